@@ -30,10 +30,12 @@
 extern "C" {
 #endif
 
-  UINT64 combohell_avx2_kernel( void *in, void *out );
+  //
+  // errors: per-run counter, incremented (lock xadd) on every mismatch
+
+  UINT64 combohell_avx2_kernel( void *in, void *out, UINT64* errors );
   
   extern void* ComboHell_StopRequestPtr;  // set this so ASM kernel can watch it
-  extern void* ComboHell_ErrorCounterPtr; // set this so ASM kernel can populate
   
   extern UINT64 ComboHell_MaxRuns;        // set to UINT64_MAX for infinite
   extern UINT64 ComboHell_TerminateOnError;
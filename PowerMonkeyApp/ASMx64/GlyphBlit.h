@@ -0,0 +1,53 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  //
+  // Draws the set bits of a 1-bit glyph (one UINT32 per row, bit n = pixel n)
+  // in 'color', 8 pixels per step. Caller makes sure YMM state is enabled.
+
+  VOID EFIAPI glyph_blit_avx2(
+    UINT32* dst,                          // Top-left pixel
+    UINTN pitch,                          // Line stride, bytes
+    const UINT32* rows,
+    UINTN nRows,
+    UINT32 color);
+
+  //
+  // Framebuffer updates from the back buffer, with non-temporal stores.
+  // bytes must be a multiple of 64, dst aligned to 16 (SSE2) or 32 (AVX2).
+
+  VOID EFIAPI fb_stream_copy_sse2(VOID* dst, const VOID* src, UINTN bytes);
+  VOID EFIAPI fb_stream_copy_avx2(VOID* dst, const VOID* src, UINTN bytes);
+
+#ifdef __cplusplus
+}
+#endif
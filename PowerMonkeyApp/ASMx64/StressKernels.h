@@ -0,0 +1,70 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  //
+  // Per-CPU context of a stress kernel (offsets are hard-coded in ASM!)
+
+  typedef struct _STRESS_CTX
+  {
+    VOID*     Scratch;                    // +0,  STRESS_SCRATCH (64B aligned)
+    UINT64*   StopRequestPtr;             // +8,  nonzero = stop (all CPUs)
+    UINT64*   ErrorCounterPtr;            // +16, incremented atomically
+    UINT64    MaxRuns;                    // +24, outer runs
+    UINT64    InnerLoops;                 // +32, between two result checks
+    UINT64    TerminateOnError;           // +40, also sets the stop request
+    UINT64    Runs;                       // +48, [OUT] completed outer runs
+  } STRESS_CTX;
+
+  //
+  // Read-only input, shared by all CPUs
+
+  typedef struct _STRESS_SCRATCH
+  {
+    UINT32    Seed[16][16];               // +0,    FP32 seeds in [1, 2)
+    UINT32    MulA[16];                   // +1024, FP32 multiplicands
+    UINT32    MulB[16];                   // +1088
+    UINT64    Int[8];                     // +1152, integer seeds
+  } STRESS_SCRATCH;
+
+  //
+  // All kernels return 0, or 0xBADDC0DE when terminated on error.
+  // Values are computed twice in separate registers and compared after 
+  // every InnerLoops iterations.
+
+  UINT64 stress_avx512_kernel( STRESS_CTX* ctx );   // AVX-512F FMA, ZMM
+  UINT64 stress_fma3_kernel( STRESS_CTX* ctx );     // AVX2/FMA3, YMM
+  UINT64 stress_sse_kernel( STRESS_CTX* ctx );      // SSE2, XMM
+  UINT64 stress_int_kernel( STRESS_CTX* ctx );      // Scalar integer/branch
+
+#ifdef __cplusplus
+}
+#endif
@@ -26,6 +26,7 @@
 
 #include "Platform.h"
 #include "CONFIGURATION.h"    // <- enable tracing if PowerMonkey hangs!
+#include "VfCurve.h"
 
 ///
 /// Please review CONFIGURATION.h for debug/global settings
@@ -91,6 +92,71 @@ UINT8 gEmergencyExit = 1;
 
 UINT8 gEnableSaferAsm = 1;
 
+///
+/// Program cores concurrently (default: 1)
+/// V/F overrides and OC ratios are programmed on all cores at the same time,
+/// which shortens boot time on many-core systems (the same goes for probing
+/// packages and cores). Set to 0 to fall back to one core after another
+///
+
+UINT8 gConcurrentProgramming = 1;
+
+///
+/// Program every logical CPU (default: 0)
+/// Registers shared by a core, module or package are normally written only
+/// once, by one CPU of that scope. Set to 1 to write them from every thread,
+/// e.g. if you plan to run with all but one core powered down
+///
+
+UINT8 gProgramEveryThread = 0;
+
+///
+/// Keep APs parked in a worker pool (default: 1)
+/// APs are started once and wait for work in a tight loop, instead of being
+/// woken up by the firmware for every dispatched call. If your firmware's MP 
+/// services misbehave with long-running AP procedures, set this to 0
+///
+
+UINT8 gUseWorkerPool = 1;
+
+///
+/// Skip writes that would not change anything (default: 1)
+/// Requested settings are compared with the probed ones and only differing
+/// OC mailbox commands, MSR and MMIO fields are written - with an unchanged
+/// profile, (warm) reboots program next to nothing. Set to 0 to always
+/// write everything
+///
+
+UINT8 gSkipUnchangedWrites = 1;
+
+///
+/// Re-probe only what has been written (default: 1)
+/// Settings printed after programming are read back from hardware. With
+/// this enabled, only the domains, VF points and registers that have been
+/// written are re-read, everything else comes from the initial probe. 
+/// Set to 0 to re-read everything
+///
+
+UINT8 gUseProbeCache = 1;
+
+///
+/// Remember the VR topology across boots (default: 1)
+/// VR addresses of voltage domains are discovered once per CPU model and 
+/// kept in a UEFI variable (PowerMonkeyVrMap), later boots skip discovery.
+/// Delete the variable, or set to 0, to discover on every boot
+///
+
+UINT8 gCacheVrTopology = 1;
+
+///
+/// Remember VF point layout across boots (default: 1)
+/// Number of VF points and their fused ratios, per package, are kept in 
+/// UEFI variables (PowerMonkeyVfTopoNN) keyed by CPU signature and microcode
+/// revision - only the known points are read on later boots
+///
+
+UINT8 gCacheVfTopology = 1;
+
 ///
 /// Disable UEFI watchdog timer
 /// Will be useful once stress testing is fully implemented 
@@ -105,6 +171,14 @@ UINT8 gDisableFirwmareWDT = 0;
 
 UINT64 gSelfTestMaxRuns = 0; /// DO NOT ENABLE YET (WIP)
 
+///
+/// SELF TEST - KERNEL
+/// NULL: every CPU runs the heaviest kernel it supports (AVX512_FMA, 
+/// FMA3_AVX2, SSE2 or INT_BRANCH - P-cores and E-cores may differ), or name
+/// of a kernel to use wherever supported (e.g. "ComboHell_AVX2")
+
+const CHAR8* gSelfTestKernel = NULL;
+
 
 /*******************************************************************************
  * Debug / Test / Diagnostics Options
@@ -118,6 +192,72 @@ UINT8 gPrintPackageConfig = 1;
 
 UINT8 gPrintVFPoints_PostProgram = 1;
 
+///
+/// Print boot profile (default: 0)
+/// Time spent in each boot phase is printed before exit, with a per-CPU 
+/// breakdown for phases that run on multiple CPUs
+/// 
+
+UINT8 gPrintBootProfile = 0;
+
+///
+/// Print the programming plan (writes that are going to be performed)
+/// 
+
+UINT8 gPrintProgrammingPlan = 1;
+
+///
+/// Print OC mailbox statistics (default: 0)
+/// Per-command counts, retries, timeouts, error completions and latency 
+/// histograms of mailbox transactions, printed before exit
+/// 
+
+UINT8 gPrintMailboxStats = 0;
+
+///
+/// Low-level I/O backend (default: 0)
+/// 0 - hardware
+/// 1 - hardware, with every MSR/MMIO access recorded into a binary trace,
+///     saved as \PowerMonkey.iotrace on the boot volume before exit
+/// 2 - simulator: MSR/MMIO writes never reach hardware, the OC mailbox
+///     is emulated - a dry run of the whole programming flow
+/// 3 - replay of \PowerMonkey.iotrace: reads answered from the trace, 
+///     writes checked against it and never reaching hardware
+///
+
+UINT8 gIoBackendMode = 0;
+
+///
+/// Program VF points from a curve (default: 0)
+/// Per-point offsets of IA cores are computed from VF_CURVE_IACORE (see 
+/// ApplyComputerOwnersPolicy) against the fused ratios of the CPU at hand, 
+/// instead of the hand-written per-point values. One curve fits every SKU.
+/// 
+
+UINT8 gUseVfCurve = 0;
+
+///
+/// Domains sharing a VR (default: 2)
+/// Linked domains (same VR address, e.g. IACORE and RING on SKL - RKL) get 
+/// a single set of voltages/IccMax, if the policy below asks for different
+/// values, this decides which one is programmed to all of them:
+/// 0 - off, program each domain as requested
+/// 1 - min (lowest voltage / IccMax)
+/// 2 - max (highest - what pcode would apply anyway)
+/// 3 - error (do not program the VR at all)
+/// 
+
+UINT8 gVrCoalescePolicy = 2;
+
+///
+/// Verify effective voltage (default: 0)
+/// Core voltage (IA32_PERF_STATUS) is sampled under load before and after
+/// programming and compared with the programmed offset. Catches "phantom 
+/// undervolts", adds ~0.5 s to the boot.
+/// 
+
+UINT8 gVerifyEffectiveVoltage = 0;
+
 
 /*******************************************************************************
  * ApplyComputerOwnersPolicy()
@@ -385,6 +525,29 @@ VOID ApplyComputerOwnersPolicy(IN PLATFORM* sys)
     pk->planes[ECORE].vfPoint[6].VOffset = 0;
 
 #endif
+
+    ///
+    /// VF curve instead of VF points (gUseVfCurve = 1): offset as a function
+    /// of the ratio, flat outside of the knots. Below: -80 mV at 35x and 
+    /// lower, tapering to -40 mV at the highest fused ratio. Points are 
+    /// computed for the ratios the CPU reports and clamped to +/- 250 mV.
+    /// Domains sharing the VR of IA cores (RING on CML/RKL) get the same
+    /// per-point values through gVrCoalescePolicy (unless it is 0).
+    /// 
+    /// VFCURVE_SPLINE fits a smooth (non-overshooting) curve through
+    /// three or more knots instead of straight lines.
+
+    if (gUseVfCurve) {
+
+      static const VFCURVE VF_CURVE_IACORE = {
+        VFCURVE_LINEAR, 2, {
+          { 35,                 -80 },          // Ratio, mV
+          { VFCURVE_RATIO_MAX,  -40 },
+        }
+      };
+
+      VfCurve_Apply(pk, IACORE, &VF_CURVE_IACORE);
+    }
  
     /////////////
     // ICC Max //
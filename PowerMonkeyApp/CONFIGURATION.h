@@ -36,3 +36,15 @@
 ///
 
 //#define ENABLE_MINILOG_TRACING
+
+///
+/// PERSISTENT TRACING
+///
+/// With ENABLE_MINILOG_TRACING, also uncomment ENABLE_MINILOG_PERSISTENT to
+/// keep the trace in reserved memory at a stable address (published in a UEFI
+/// variable). If the machine hangs, the trace left by the hung run is printed
+/// at the start of the next run (after a warm reset - cold boots and some 
+/// firmware clear the memory).
+///
+
+//#define ENABLE_MINILOG_PERSISTENT
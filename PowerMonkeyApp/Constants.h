@@ -34,10 +34,12 @@
 #define ALIGN8  __declspec(align(8))
 #define ALIGN16 __declspec(align(16))
 #define ALIGN32 __declspec(align(32))
+#define ALIGN64 __declspec(align(64))
 #else
 #define ALIGN8  __attribute((aligned(8)))
 #define ALIGN16 __attribute((aligned(16)))
 #define ALIGN32 __attribute((aligned(32)))
+#define ALIGN64 __attribute((aligned(64)))
 #endif
 #define IUNUSED(x) (void)x;
 
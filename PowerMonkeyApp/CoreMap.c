@@ -0,0 +1,244 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/MemoryAllocationLib.h>
+
+#include "CoreMap.h"
+#include "SaferAsmHdr.h"
+
+/*******************************************************************************
+ * CoreIdxMap
+ ******************************************************************************/
+
+UINTN gNumCores = 0;
+VOID** gCorePtrs = NULL;
+UINTN* gCoreApicIDs = NULL;
+
+/*******************************************************************************
+ * APIC ID hash
+ * 
+ * slot = (ApicID * Mult) >> (32 - Bits)
+ * 
+ * APIC IDs are sparse (SMT/core/module/die/package bit fields with gaps), 
+ * but there are few of them - a table 2x-16x larger than the CPU count and
+ * a handful of multipliers are enough to find a collision-free combination
+ ******************************************************************************/
+
+#define COREMAP_EMPTY         0xFFFFFFFF
+#define COREMAP_MAX_BITS      16
+#define COREMAP_MULT_TRIES    64
+
+typedef struct _COREMAP_SLOT
+{
+  UINT32  ApicID;
+  UINT32  AbsIdx;                           // COREMAP_EMPTY = unused slot
+} COREMAP_SLOT;
+
+static COREMAP_SLOT* gMapSlots = NULL;
+static UINT32 gMapBits = 0;
+static UINT32 gMapMult = 0;
+
+static inline UINT32 CoreMap_Hash(const UINT32 apicId, 
+  const UINT32 mult, const UINT32 bits)
+{
+  return (UINT32)(apicId * mult) >> (32 - bits);
+}
+
+/*******************************************************************************
+ * CoreMap_Allocate
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI CoreMap_Allocate(IN const UINTN nCpus)
+{
+  gCorePtrs = (VOID**)AllocateZeroPool(nCpus * sizeof(VOID*));
+  gCoreApicIDs = (UINTN*)AllocateZeroPool(nCpus * sizeof(UINTN));
+
+  if ((!gCorePtrs) || (!gCoreApicIDs)) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/*******************************************************************************
+ * CoreMap_TryBuild
+ ******************************************************************************/
+
+static BOOLEAN CoreMap_TryBuild(COREMAP_SLOT* slots, 
+  const UINT32 mult, const UINT32 bits)
+{
+  const UINTN nSlots = (UINTN)1 << bits;
+
+  for (UINTN sidx = 0; sidx < nSlots; sidx++) {
+    slots[sidx].AbsIdx = COREMAP_EMPTY;
+  }
+
+  for (UINTN cidx = 0; cidx < gNumCores; cidx++) {
+
+    const UINT32 apicId = (UINT32)gCoreApicIDs[cidx];
+    COREMAP_SLOT* slot = slots + CoreMap_Hash(apicId, mult, bits);
+
+    if (slot->AbsIdx != COREMAP_EMPTY) {
+      return FALSE;
+    }
+
+    slot->ApicID = apicId;
+    slot->AbsIdx = (UINT32)cidx;
+  }
+
+  return TRUE;
+}
+
+/*******************************************************************************
+ * CoreMap_Build
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI CoreMap_Build(VOID)
+{
+  UINT32 bits = 1;
+
+  if (gMapSlots) {
+    FreePool(gMapSlots);
+    gMapSlots = NULL;
+  }
+
+  //
+  // Start with table at least 2x the CPU count
+
+  while (((UINTN)1 << bits) < 2 * gNumCores) {
+    bits++;
+  }
+
+  for (; bits <= COREMAP_MAX_BITS; bits++) {
+
+    COREMAP_SLOT* slots = 
+      (COREMAP_SLOT*)AllocatePool(((UINTN)1 << bits) * sizeof(COREMAP_SLOT));
+
+    if (!slots) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    //
+    // Odd multipliers derived from the golden ratio constant
+
+    UINT32 mult = 0x9E3779B1;
+
+    for (UINT32 tries = 0; tries < COREMAP_MULT_TRIES; tries++) {
+
+      if (CoreMap_TryBuild(slots, mult, bits)) {
+        gMapSlots = slots;
+        gMapBits = bits;
+        gMapMult = mult;
+        return EFI_SUCCESS;
+      }
+
+      mult = (mult * 1664525 + 1013904223) | 1;
+    }
+
+    FreePool(slots);
+  }
+
+  //
+  // Should not happen - lookups will fall back to a linear scan
+
+  return EFI_NOT_FOUND;
+}
+
+/*******************************************************************************
+ * CoreMap_ApicToIndex
+ ******************************************************************************/
+
+UINTN EFIAPI CoreMap_ApicToIndex(IN const UINT32 ApicID)
+{
+  if (gMapSlots) {
+
+    const COREMAP_SLOT* slot = gMapSlots + 
+      CoreMap_Hash(ApicID, gMapMult, gMapBits);
+
+    if ((slot->AbsIdx != COREMAP_EMPTY) && (slot->ApicID == ApicID)) {
+      return slot->AbsIdx;
+    }
+
+    return COREMAP_INVALID;
+  }
+
+  for (UINTN cidx = 0; cidx < gNumCores; cidx++) {
+    if ((UINT32)gCoreApicIDs[cidx] == ApicID) {
+      return cidx;
+    }
+  }
+
+  return COREMAP_INVALID;
+}
+
+/*******************************************************************************
+ * CoreMap_ApicToCore
+ ******************************************************************************/
+
+CPUCORE* EFIAPI CoreMap_ApicToCore(IN const UINT32 ApicID)
+{
+  const UINTN cidx = CoreMap_ApicToIndex(ApicID);
+
+  return (cidx != COREMAP_INVALID) ? (CPUCORE*)gCorePtrs[cidx] : NULL;
+}
+
+/*******************************************************************************
+ * CoreMap_ThisCore
+ ******************************************************************************/
+
+CPUCORE* EFIAPI CoreMap_ThisCore(VOID)
+{
+  UINT32 regs[4] = { 0 };
+
+  //
+  // Not before CoreMap_Build: unfilled gCoreApicIDs entries read as APIC 
+  // ID 0, the linear scan could then pick the wrong CPU
+
+  if (!gMapSlots) {
+    return NULL;
+  }
+
+  _pm_cpuid(0, regs);
+
+  //
+  // x2APIC ID (CPUID 0Bh EDX) if the leaf is there, 8-bit initial APIC ID
+  // (CPUID 01h EBX[31:24]) otherwise
+
+  if (regs[0] >= 0x0B) {
+
+    _pm_cpuid_ex(0x0B, 0, regs);
+
+    if (regs[1]) {
+      return CoreMap_ApicToCore(regs[3]);
+    }
+  }
+
+  _pm_cpuid(0x01, regs);
+
+  return CoreMap_ApicToCore(regs[1] >> 24);
+}
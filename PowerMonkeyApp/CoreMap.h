@@ -0,0 +1,75 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#pragma once
+
+#include "Platform.h"
+
+/*******************************************************************************
+ * CoreMap
+ * 
+ * gCorePtrs / gCoreApicIDs map absolute CPU index to CPUCORE and APIC ID, 
+ * and are sized to the number of logical processors. Reverse direction 
+ * (APIC ID -> index) uses a collision-free multiplicative hash keyed by the
+ * full 32-bit (x2)APIC ID, so every lookup is a single probe
+ ******************************************************************************/
+
+#define COREMAP_INVALID       ((UINTN)-1)
+
+/*******************************************************************************
+ * CoreMap_Allocate
+ * Allocates gCorePtrs and gCoreApicIDs for nCpus logical processors
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI CoreMap_Allocate(IN const UINTN nCpus);
+
+/*******************************************************************************
+ * CoreMap_Build
+ * Builds the APIC ID hash, call after gCoreApicIDs has been filled
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI CoreMap_Build(VOID);
+
+/*******************************************************************************
+ * CoreMap_ApicToIndex
+ * Returns COREMAP_INVALID for unknown APIC IDs
+ ******************************************************************************/
+
+UINTN EFIAPI CoreMap_ApicToIndex(IN const UINT32 ApicID);
+
+/*******************************************************************************
+ * CoreMap_ApicToCore
+ ******************************************************************************/
+
+CPUCORE* EFIAPI CoreMap_ApicToCore(IN const UINT32 ApicID);
+
+/*******************************************************************************
+ * CoreMap_ThisCore
+ * CPUCORE of the calling CPU, by its (x2)APIC ID - no MP services call, so
+ * it works on APs too. NULL before the map is built
+ ******************************************************************************/
+
+CPUCORE* EFIAPI CoreMap_ThisCore(VOID);
@@ -29,6 +29,8 @@
 #include "SaferAsmHdr.h"
 #include "CpuInfo.h"
 #include "Constants.h"
+#include "LowLevel.h"
+#include "IoBackend.h"
 
 /*******************************************************************************
  * 
@@ -39,6 +41,8 @@
 #define CPUID_ECX   2
 #define CPUID_EDX   3
 
+#define MSR_IA32_BIOS_SIGN_ID     0x8B
+
 /*******************************************************************************
  * 
  ******************************************************************************/
@@ -110,4 +114,27 @@ void GetCpuInfo(CPUINFO* ci)
       }        
     }
   }
+}
+
+/*******************************************************************************
+ * GetMicrocodeRevision
+ ******************************************************************************/
+
+UINT32 GetMicrocodeRevision(VOID)
+{
+  UINT32 regs[4] = { 0 };
+
+  UINT32 err = 0;
+
+  //
+  // IA32_BIOS_SIGN_ID is only updated by CPUID(1) after being cleared.
+  // Straight to the hardware: this describes the CPU, not the OC state a 
+  // simulated or replayed backend stands in for
+
+  gIoHardware.WrMsr64(MSR_IA32_BIOS_SIGN_ID, 0);
+  _pm_cpuid(0x01, regs);
+
+  const UINT64 val = gIoHardware.RdMsr64(MSR_IA32_BIOS_SIGN_ID, &err);
+
+  return (err) ? 0 : (UINT32)(val >> 32);
 }
\ No newline at end of file
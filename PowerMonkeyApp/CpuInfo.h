@@ -51,4 +51,11 @@ typedef struct _CPUINFO
  * GetCpuInfo
  ******************************************************************************/
 
-void GetCpuInfo(CPUINFO* ci);
\ No newline at end of file
+void GetCpuInfo(CPUINFO* ci);
+
+/*******************************************************************************
+ * GetMicrocodeRevision
+ * Of the calling CPU
+ ******************************************************************************/
+
+UINT32 GetMicrocodeRevision(VOID);
\ No newline at end of file
@@ -25,9 +25,24 @@
 *******************************************************************************/
 
 #include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+
+#if defined(__clang__)
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+#include <x86intrin.h>
+#else
+#pragma intrinsic(_mm_pause)
+#endif
+
 #include "LowLevel.h"
 #include "DelayX86.h"
 #include "CpuMailboxes.h"
+#include "PerCpu.h"
 
 /*******************************************************************************
  * Layout of the CPU Overclocking mailbox can be found in academic papers:
@@ -45,6 +60,277 @@
  * in this ScatterBencher video: https://www.youtube.com/watch?v=0TGcKyXBQ6U
  ******************************************************************************/
 
+/*******************************************************************************
+ * Adaptive polling
+ *
+ * Busy-waits spin (PAUSE) against a TSC deadline of maxSpins microseconds, 
+ * instead of stalling 1 us between probes.
+ *
+ * For every command ID we keep a running estimate (EWMA) of the time needed 
+ * for the busy flag to clear, and count transactions in a row that completed
+ * and passed the verification read. Once a command has enough of those, and
+ * completes faster than the settle window, the settle stall and the 
+ * verification read are skipped. Any failure puts the command back on the 
+ * slow path, and commands that ever failed the verification keep it for good.
+ *
+ * Entries are updated without locking; concurrent updates from different 
+ * packages can lose a sample, which only delays (or repeats) the decision
+ ******************************************************************************/
+
+#define MAILBOX_CMD_SLOTS           256
+#define MAILBOX_TRUSTED_RUNS        8       // Clean runs before fast path
+#define MAILBOX_EWMA_SHIFT          3       // New sample weight: 1/8
+
+typedef struct _MAILBOX_CMD_TRACK
+{
+  UINT32  EwmaTicks;                        // Write-to-done latency estimate
+  UINT16  CleanRuns;                        // Clean transactions in a row
+  UINT8   NeedsVerify;                      // Verification caught a mismatch
+  UINT8   pad;
+} MAILBOX_CMD_TRACK;
+
+static MAILBOX_CMD_TRACK gMsrCmdTrack[MAILBOX_CMD_SLOTS] = { 0 };
+
+/*******************************************************************************
+ * TrackLatency
+ ******************************************************************************/
+
+static VOID TrackLatency(IN OUT MAILBOX_CMD_TRACK* trk, IN const UINT64 ticks)
+{
+  const UINT32 sample = (ticks > 0xFFFFFFFF) ? 0xFFFFFFFF : (UINT32)ticks;
+
+  if (!trk->EwmaTicks) {
+    trk->EwmaTicks = sample;
+  }
+  else {
+    INT64 delta = (INT64)sample - (INT64)trk->EwmaTicks;
+    trk->EwmaTicks = (UINT32)((INT64)trk->EwmaTicks + 
+      (delta / (1 << MAILBOX_EWMA_SHIFT)));
+  }
+}
+
+/*******************************************************************************
+ * IsTrusted
+ ******************************************************************************/
+
+static BOOLEAN IsTrusted(IN const MAILBOX_CMD_TRACK* trk, 
+  IN const UINT64 settleTicks)
+{
+  return (BOOLEAN)((!trk->NeedsVerify) &&
+                   (trk->CleanRuns >= MAILBOX_TRUSTED_RUNS) &&
+                   ((UINT64)trk->EwmaTicks <= settleTicks));
+}
+
+/*******************************************************************************
+ * Mailbox statistics
+ ******************************************************************************/
+
+extern UINT8 gPrintMailboxStats;
+
+static MAILBOX_CMD_STATS gMboxStatsBoot[MAILBOX_STAT_CMDS] = { 0 };
+static MAILBOX_CMD_STATS* gMboxStats = NULL;      // [numCpus][CMDS]
+static UINTN gMboxStatsCpus = 0;
+
+#define MAILBOX_STAT_SLOW_FACTOR    2       // "Slow CPU": avg > 2x overall
+
+/*******************************************************************************
+ * GetCmdStats
+ ******************************************************************************/
+
+static MAILBOX_CMD_STATS* GetCmdStats(IN const UINT32 cmd)
+{
+  if (!gPrintMailboxStats) {
+    return NULL;
+  }
+
+  const UINT32 slot = (cmd < MAILBOX_STAT_CMDS - 1) ? 
+    cmd : MAILBOX_STAT_CMDS - 1;
+
+  if (gMboxStats) {
+
+    CPUCORE* core = PerCpu_Self();
+
+    if ((core) && (core->AbsIdx < gMboxStatsCpus)) {
+      return gMboxStats + core->AbsIdx * MAILBOX_STAT_CMDS + slot;
+    }
+  }
+
+  return gMboxStatsBoot + slot;
+}
+
+/*******************************************************************************
+ * AccountLatency
+ ******************************************************************************/
+
+static VOID AccountLatency(IN OUT MAILBOX_CMD_STATS* st, IN const UINT64 ticks)
+{
+  UINT32 bucket = 0;
+
+  while ((bucket < MAILBOX_STAT_BUCKETS - 1) && ((ticks >> (bucket + 1)) != 0)) {
+    bucket++;
+  }
+
+  st->Hist[bucket]++;
+  st->TotalTicks += ticks;
+
+  if (ticks > st->MaxTicks) {
+    st->MaxTicks = ticks;
+  }
+}
+
+/*******************************************************************************
+ * CpuMailbox_InitStats
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI CpuMailbox_InitStats(IN const UINTN numCpus)
+{
+  if ((!gPrintMailboxStats) || (gMboxStats) || (!numCpus)) {
+    return EFI_SUCCESS;
+  }
+
+  const UINTN size = numCpus * MAILBOX_STAT_CMDS * sizeof(MAILBOX_CMD_STATS);
+
+  MAILBOX_CMD_STATS* stats = 
+    (MAILBOX_CMD_STATS*)AllocatePages(EFI_SIZE_TO_PAGES(size));
+
+  if (!stats) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  ZeroMem(stats, size);
+
+  gMboxStatsCpus = numCpus;
+  gMboxStats = stats;
+
+  return EFI_SUCCESS;
+}
+
+/*******************************************************************************
+ * CpuMailbox_GetStats
+ ******************************************************************************/
+
+MAILBOX_CMD_STATS* EFIAPI CpuMailbox_GetStats(IN const UINTN cpu)
+{
+  if ((!gMboxStats) || (cpu >= gMboxStatsCpus)) {
+    return NULL;
+  }
+
+  return gMboxStats + cpu * MAILBOX_STAT_CMDS;
+}
+
+/*******************************************************************************
+ * AddStats
+ ******************************************************************************/
+
+static VOID AddStats(IN OUT MAILBOX_CMD_STATS* sum, 
+  IN const MAILBOX_CMD_STATS* st)
+{
+  sum->Transactions += st->Transactions;
+  sum->Retries += st->Retries;
+  sum->Timeouts += st->Timeouts;
+  sum->Errors += st->Errors;
+  sum->TotalTicks += st->TotalTicks;
+
+  if (st->MaxTicks > sum->MaxTicks) {
+    sum->MaxTicks = st->MaxTicks;
+  }
+
+  for (UINTN bidx = 0; bidx < MAILBOX_STAT_BUCKETS; bidx++) {
+    sum->Hist[bidx] += st->Hist[bidx];
+  }
+}
+
+/*******************************************************************************
+ * AvgNanoSeconds
+ * Average busy-wait time (retries are included in the number of samples)
+ ******************************************************************************/
+
+static UINT64 AvgNanoSeconds(IN const MAILBOX_CMD_STATS* st)
+{
+  const UINT64 samples = (UINT64)st->Transactions + st->Retries;
+
+  return (samples) ? TicksToNanoSeconds(st->TotalTicks / samples) : 0;
+}
+
+/*******************************************************************************
+ * CpuMailbox_PrintStats
+ ******************************************************************************/
+
+VOID EFIAPI CpuMailbox_PrintStats(VOID)
+{
+  if (!gPrintMailboxStats) {
+    return;
+  }
+
+  AsciiPrint("\nMailbox statistics (times in ns):\n\n");
+  AsciiPrint("  Cmd        Count  Retries Timeouts   Errors"
+    "          Avg          Max\n");
+
+  for (UINT32 cmd = 0; cmd < MAILBOX_STAT_CMDS; cmd++) {
+
+    MAILBOX_CMD_STATS sum;
+    ZeroMem(&sum, sizeof(sum));
+
+    AddStats(&sum, gMboxStatsBoot + cmd);
+
+    for (UINTN cidx = 0; cidx < gMboxStatsCpus; cidx++) {
+      AddStats(&sum, gMboxStats + cidx * MAILBOX_STAT_CMDS + cmd);
+    }
+
+    if (!sum.Transactions) {
+      continue;
+    }
+
+    if (cmd < MAILBOX_STAT_CMDS - 1) {
+      AsciiPrint("  0x%02x ", cmd);
+    }
+    else {
+      AsciiPrint("  other");
+    }
+
+    const UINT64 avgNs = AvgNanoSeconds(&sum);
+
+    AsciiPrint(" %10u %8u %8u %8u %12lu %12lu\n",
+      sum.Transactions,
+      sum.Retries,
+      sum.Timeouts,
+      sum.Errors,
+      avgNs,
+      TicksToNanoSeconds(sum.MaxTicks));
+
+    //
+    // Histogram (non-empty buckets only)
+
+    for (UINT32 bidx = 0; bidx < MAILBOX_STAT_BUCKETS; bidx++) {
+      if (sum.Hist[bidx]) {
+        AsciiPrint("         %a%10lu ns: %u\n",
+          (bidx == MAILBOX_STAT_BUCKETS - 1) ? ">=" : "  ",
+          TicksToNanoSeconds(1ull << bidx),
+          sum.Hist[bidx]);
+      }
+    }
+
+    //
+    // CPUs where this command is notably slower
+
+    for (UINTN cidx = 0; cidx < gMboxStatsCpus; cidx++) {
+
+      MAILBOX_CMD_STATS* st = gMboxStats + cidx * MAILBOX_STAT_CMDS + cmd;
+      const UINT64 cpuAvgNs = AvgNanoSeconds(st);
+
+      if ((st->Transactions) && 
+          (cpuAvgNs > avgNs * MAILBOX_STAT_SLOW_FACTOR)) {
+        AsciiPrint("         slow: CPU %u, avg %lu ns, max %lu ns\n",
+          cidx,
+          cpuAvgNs,
+          TicksToNanoSeconds(st->MaxTicks));
+      }
+    }
+  }
+
+  AsciiPrint("\n");
+}
+
 /*******************************************************************************
  * CpuMailbox_MMIOBusyWait
  ******************************************************************************/
@@ -55,32 +341,31 @@ EFI_STATUS EFIAPI CpuMailbox_MMIOBusyWait(CpuMailbox* b)
   const UINT32 busyFlag = b->cfg.busyFlag;
   const UINT32 maxSpins = b->cfg.maxSpins;
 
+  const UINT64 deadline = ReadTsc() + MicroSecondsToTicks(maxSpins);
+
   MailboxBody* mb = &b->b;
 
-  UINT8 busy = 1;
   UINTN nspins = 0;
 
-  do {
+  for (;;) {
     mb->box.ifce = pm_mmio_read32(mmioAddr);
 
-    busy = (mb->box.ifce & busyFlag) ? 1 : 0;
-
-    if (busy) {
-      nspins++;
-      MicroStall(1);
+    if (!(mb->box.ifce & busyFlag)) {
+      return EFI_SUCCESS;
     }
-  } while ((busy) && (nspins < maxSpins));
 
-  //
-  // Check if the operation timed out
+    //
+    // Spin count is only a backstop in case TSC is not calibrated
 
-  if ((busy) && (nspins == maxSpins)) {
-    return EFI_ABORTED;
-  }
+    nspins++;
 
-  return EFI_SUCCESS;
-}
+    if ((nspins >= maxSpins) && (ReadTsc() >= deadline)) {
+      return EFI_ABORTED;
+    }
 
+    _mm_pause();
+  }
+}
 
 /*******************************************************************************
  * CpuMailbox_BusyWait_MSR
@@ -92,28 +377,28 @@ EFI_STATUS EFIAPI CpuMailbox_MsrBusyWait(CpuMailbox *b)
   const UINT32 busyFlag = b->cfg.busyFlag;
   const UINT32 maxSpins = b->cfg.maxSpins;
 
-  UINT8 busy = 1;
+  const UINT64 deadline = ReadTsc() + MicroSecondsToTicks(maxSpins);
+
   UINTN nspins = 0;
 
-  do {
+  for (;;) {
     b->b.u64 = pm_rdmsr64(msrIdx);
-    
-    busy = (b->b.box.ifce & busyFlag) ? 1 : 0;
 
-    if (busy) {
-      nspins++;
-      MicroStall(1);
+    if (!(b->b.box.ifce & busyFlag)) {
+      return EFI_SUCCESS;
     }
-  } while ((busy) && (nspins < maxSpins));
 
-  //
-  // Check if the operation timed out
+    //
+    // Spin count is only a backstop in case TSC is not calibrated
 
-  if ((busy) && (nspins == maxSpins)) {
-    return EFI_ABORTED;
-  }
+    nspins++;
 
-  return EFI_SUCCESS;
+    if ((nspins >= maxSpins) && (ReadTsc() >= deadline)) {
+      return EFI_ABORTED;
+    }
+
+    _mm_pause();
+  }
 }
 
 /*******************************************************************************
@@ -126,10 +411,20 @@ EFI_STATUS EFIAPI CpuMailbox_MsrReadWrite( CpuMailbox *b )
 
   const UINT32 statusBits = b->cfg.statusBits;
   const UINT32 maxRetries = b->cfg.maxRetries;
-  const UINT32 boxLatency = b->cfg.latency;
   const UINT32 busyFlag = b->cfg.busyFlag;
   const UINT32 msrIdx = b->cfg.addr;
 
+  const UINT64 settleTicks = MicroSecondsToTicks(b->cfg.latency);
+
+  //
+  // Keep the request, the box is overwritten with the response
+
+  const UINT64 request = b->b.u64;
+  const UINT32 cmd = b->b.box.ifce & b->cfg.cmdBits;
+
+  MAILBOX_CMD_TRACK* trk = gMsrCmdTrack + (cmd & (MAILBOX_CMD_SLOTS - 1));
+  MAILBOX_CMD_STATS* st = GetCmdStats(cmd);
+
   UINT32 nRetries = 0;
 
   do {
@@ -137,26 +432,51 @@ EFI_STATUS EFIAPI CpuMailbox_MsrReadWrite( CpuMailbox *b )
     MailboxBody test;
     state = EFI_SUCCESS;
 
+    b->b.u64 = request;
     b->b.box.ifce |= busyFlag;
 
+    const UINT64 start = ReadTsc();
+
     pm_wrmsr64(msrIdx, b->b.u64);
 
+    //
+    // Last read of the busy-wait holds the response
+
     if (EFI_ERROR(CpuMailbox_MsrBusyWait(b))) {
       state = EFI_INVALID_PARAMETER;
+      trk->CleanRuns = 0;
+
+      if (st) {
+        st->Timeouts++;
+      }
     }
+    else {
+      const UINT64 ticks = ReadTsc() - start;
 
-    b->b.u64 = pm_rdmsr64(msrIdx);
+      TrackLatency(trk, ticks);
 
-    MicroStall(boxLatency);
+      if (st) {
+        AccountLatency(st, ticks);
+      }
+    }
 
-    test.u64 = pm_rdmsr64(msrIdx);
+    if ((!EFI_ERROR(state)) && (!IsTrusted(trk, settleTicks))) {
 
-    //
-    // Verify if the result is correct
+      StallCpu(settleTicks);
 
-    if (b->b.box.ifce != test.box.ifce) {
-      if (b->b.box.data != test.box.data) {
+      test.u64 = pm_rdmsr64(msrIdx);
+
+      //
+      // Verify if the result is correct
+
+      if ((b->b.box.ifce != test.box.ifce) &&
+          (b->b.box.data != test.box.data)) {
         state = EFI_INVALID_PARAMETER;
+        trk->NeedsVerify = 1;
+        trk->CleanRuns = 0;
+      }
+      else if (trk->CleanRuns < MAILBOX_TRUSTED_RUNS) {
+        trk->CleanRuns++;
       }
     }
 
@@ -169,6 +489,12 @@ EFI_STATUS EFIAPI CpuMailbox_MsrReadWrite( CpuMailbox *b )
   
   b->status = b->b.box.ifce & statusBits;
 
+  if (st) {
+    st->Transactions++;
+    st->Retries += nRetries - 1;
+    st->Errors += (b->status) ? 1 : 0;
+  }
+
   return state;
 }
 
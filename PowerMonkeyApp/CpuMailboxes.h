@@ -103,3 +103,50 @@ typedef struct _CpuMailbox
  ******************************************************************************/
 
 EFI_STATUS EFIAPI CpuMailbox_ReadWrite(CpuMailbox* b);
+
+/*******************************************************************************
+ * Mailbox statistics
+ *
+ * Per-CPU, per-command counters and latency histograms of MSR mailbox 
+ * transactions. Every CPU updates only its own tables, so no locking is 
+ * needed. Commands are keyed by the command byte, commands above 0x1E share
+ * the last slot. Histogram bucket N counts busy-waits that took
+ * [2^N, 2^(N+1)) TSC ticks, the last bucket is open-ended
+ ******************************************************************************/
+
+#define MAILBOX_STAT_CMDS           32
+#define MAILBOX_STAT_BUCKETS        24
+
+typedef struct _MAILBOX_CMD_STATS
+{
+  UINT32  Transactions;
+  UINT32  Retries;
+  UINT32  Timeouts;                       // Busy flag did not clear in time
+  UINT32  Errors;                         // Non-zero completion code
+  UINT64  TotalTicks;                     // Sum of busy-wait latencies
+  UINT64  MaxTicks;
+  UINT32  Hist[MAILBOX_STAT_BUCKETS];
+} MAILBOX_CMD_STATS;
+
+/*******************************************************************************
+ * CpuMailbox_InitStats
+ * Allocates per-CPU tables, call on the BSP once cores are known. 
+ * Transactions before that are accounted to a shared early boot table
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI CpuMailbox_InitStats(IN const UINTN numCpus);
+
+/*******************************************************************************
+ * CpuMailbox_GetStats
+ * Returns stats of one CPU (MAILBOX_STAT_CMDS entries), or NULL
+ ******************************************************************************/
+
+MAILBOX_CMD_STATS* EFIAPI CpuMailbox_GetStats(IN const UINTN cpu);
+
+/*******************************************************************************
+ * CpuMailbox_PrintStats
+ * Totals and histograms per command, followed by CPUs that are notably 
+ * slower than the average
+ ******************************************************************************/
+
+VOID EFIAPI CpuMailbox_PrintStats(VOID);
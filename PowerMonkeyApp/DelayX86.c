@@ -136,6 +136,15 @@ VOID EFIAPI NanoStall (const UINT64 ns)
   StallCpu(ticks);
 }
 
+/*******************************************************************************
+ * MicroSecondsToTicks
+ ******************************************************************************/
+
+UINT64 EFIAPI MicroSecondsToTicks(const UINT64 us)
+{
+  return us * gTscFreq / 1000000u;
+}
+
 /*******************************************************************************
  * MicroStall
  * Stalls the CPU for specific number of ns (microseconds)
@@ -143,9 +152,7 @@ VOID EFIAPI NanoStall (const UINT64 ns)
 
 VOID EFIAPI MicroStall(const UINT64 us)
 {
-  UINT64 ticks = us * gTscFreq / 1000000u;
-
-  StallCpu(ticks);
+  StallCpu(MicroSecondsToTicks(us));
 }
 
 /*******************************************************************************
@@ -33,6 +33,13 @@
 
 EFI_STATUS EFIAPI InitializeTscVars(VOID);
 
+/*******************************************************************************
+ * StallCpu
+ * Stalls the CPU for specific number of TSC ticks
+ ******************************************************************************/
+
+VOID EFIAPI StallCpu(const UINT64 ticks);
+
 /*******************************************************************************
  * nsDelay
  * Stalls the CPU for specific number of ns (nanoseconds)
@@ -53,6 +60,12 @@ VOID EFIAPI MicroStall(const UINT64 us);
 
 UINT64 EFIAPI TicksToNanoSeconds(UINT64 Ticks);
 
+/*******************************************************************************
+ * MicroSecondsToTicks
+ ******************************************************************************/
+
+UINT64 EFIAPI MicroSecondsToTicks(const UINT64 us);
+
 /*******************************************************************************
  * ReadTsc
  ******************************************************************************/
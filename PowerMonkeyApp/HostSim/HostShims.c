@@ -0,0 +1,498 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+
+#include "SaferAsmHdr.h"
+#include "DelayX86.h"
+#include "Platform.h"
+#include "PerCpu.h"
+#include "IoTraceFile.h"
+#include "MiniLog.h"
+#include "HostShims.h"
+
+/*******************************************************************************
+ * Globals normally owned by CONFIGURATION.c and Platform.c
+ ******************************************************************************/
+
+UINT8 gIoBackendMode = 0;
+UINT8 gPrintMailboxStats = 1;
+
+UINTN gNumCores = 0;                  // No platform: mailbox locks are off
+BOOLEAN gPerCpuReady = FALSE;
+
+static UINT64 gHostTsc = 0;
+static const CHAR8* gHostTracePath = "PowerMonkey.iotrace";
+
+/****
+ * Time
+ ****/
+
+/*******************************************************************************
+ * HostClock_Advance / HostClock_Now
+ ******************************************************************************/
+
+VOID EFIAPI HostClock_Advance(IN const UINT64 ticks)
+{
+  gHostTsc += ticks;
+}
+
+UINT64 EFIAPI HostClock_Now(VOID)
+{
+  return gHostTsc;
+}
+
+/*******************************************************************************
+ * DelayX86 replacements
+ ******************************************************************************/
+
+UINT64 ReadTsc(VOID)
+{
+  return gHostTsc;
+}
+
+VOID EFIAPI StallCpu(const UINT64 ticks)
+{
+  gHostTsc += ticks;
+}
+
+UINT64 EFIAPI MicroSecondsToTicks(const UINT64 us)
+{
+  return us * HOST_TSC_FREQ / 1000000u;
+}
+
+UINT64 EFIAPI TicksToNanoSeconds(UINT64 Ticks)
+{
+  return (UINT64)(1000000000u * Ticks) / HOST_TSC_FREQ;
+}
+
+VOID EFIAPI MicroStall(const UINT64 us)
+{
+  StallCpu(MicroSecondsToTicks(us));
+}
+
+/****
+ * SaferAsm replacements - there is no hardware, every access faults
+ ****/
+
+UINT64 EFIAPI safer_rdmsr64(const UINT32 msr_idx, UINT32* is_err)
+{
+  *is_err = 1;
+  return 0;
+}
+
+UINT32 EFIAPI safer_wrmsr64(const UINT32 msr_idx, const UINT64 value)
+{
+  return 1;
+}
+
+UINT32 EFIAPI safer_mmio_read32(const UINT32 addr, UINT32* is_err)
+{
+  *is_err = 1;
+  return 0;
+}
+
+UINT32 EFIAPI safer_mmio_or32(const UINT32 addr, const UINT32 value)
+{
+  return 1;
+}
+
+UINT32 EFIAPI safer_mmio_write32(const UINT32 addr, const UINT32 value)
+{
+  return 1;
+}
+
+VOID EFIAPI stop_interrupts_on_this_cpu(VOID)
+{
+}
+
+VOID EFIAPI resume_interrupts_on_this_cpu(VOID)
+{
+}
+
+UINT32 EFIAPI get_pciex_base_addr(VOID)
+{
+  return 0xE0000001;                  // PCIEXBAR at 0xE0000000, enabled
+}
+
+UINT64 EFIAPI hlp_atomic_increment_u64(UINT64* val)
+{
+  return __atomic_add_fetch(val, 1, __ATOMIC_SEQ_CST);
+}
+
+UINT32 EFIAPI hlp_atomic_increment_u32(UINT32* val)
+{
+  return __atomic_add_fetch(val, 1, __ATOMIC_SEQ_CST);
+}
+
+UINT32 EFIAPI hlp_atomic_cmpxchg_u32(UINT32* val, UINT32 cmp, UINT32 xchg)
+{
+  __atomic_compare_exchange_n(val, &cmp, xchg, 0, 
+    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+
+  return cmp;
+}
+
+/****
+ * Platform - one thread, bound to a CPUCORE only through HostCpu_Set
+ ****/
+
+static CPUCORE gHostCore;
+static BOOLEAN gHostCoreBound = FALSE;
+
+VOID EFIAPI HostCpu_Set(IN const UINTN absIdx)
+{
+  gHostCoreBound = (BOOLEAN)(absIdx != HOST_CPU_NONE);
+  gHostCore.AbsIdx = (gHostCoreBound) ? absIdx : 0;
+}
+
+CPUCORE* EFIAPI PerCpu_Self(VOID)
+{
+  return (gHostCoreBound) ? &gHostCore : NULL;
+}
+
+PERCPU_SCRATCH* EFIAPI PerCpu_Scratch(VOID)
+{
+  return NULL;
+}
+
+VOID* GetCpuDataBlock()
+{
+  return NULL;
+}
+
+/****
+ * MiniLog (MiniLog.c) - no screen to render the trace rings on
+ ****/
+
+#ifdef ENABLE_MINILOG_TRACING
+
+void MiniTrace(
+  const UINT8  operId,
+  const UINT8  dangerous,
+  const UINT32 param1,
+  const UINT64 param2)
+{
+}
+
+void MiniTraceEx(IN CONST CHAR8* format, ...)
+{
+}
+
+void DrainTrace()
+{
+}
+
+void DrainTraceNow()
+{
+}
+
+#endif
+
+/****
+ * Trace file (IoTraceFile.c) - a plain file on the host
+ ****/
+
+/*******************************************************************************
+ * HostTrace_SetPath
+ ******************************************************************************/
+
+VOID EFIAPI HostTrace_SetPath(IN const CHAR8* path)
+{
+  gHostTracePath = path;
+}
+
+/*******************************************************************************
+ * IoTrace_Save
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI IoTrace_Save(
+  IN const IO_TRACE_HEADER* trace,
+  IN const UINTN size)
+{
+  if ((!trace) || (size < sizeof(IO_TRACE_HEADER))) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  FILE* file = fopen(gHostTracePath, "wb");
+
+  if (!file) {
+    return EFI_NOT_FOUND;
+  }
+
+  const UINTN written = fwrite(trace, 1, size, file);
+
+  fclose(file);
+
+  return (written == size) ? EFI_SUCCESS : EFI_DEVICE_ERROR;
+}
+
+/*******************************************************************************
+ * IoTrace_Load
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI IoTrace_Load(OUT IO_TRACE_HEADER** trace)
+{
+  IO_TRACE_HEADER hdr;
+
+  *trace = NULL;
+
+  FILE* file = fopen(gHostTracePath, "rb");
+
+  if (!file) {
+    return EFI_NOT_FOUND;
+  }
+
+  if ((fread(&hdr, 1, sizeof(hdr), file) != sizeof(hdr)) ||
+      (hdr.Magic != IO_TRACE_MAGIC) ||
+      (hdr.Version != IO_TRACE_VERSION) ||
+      (hdr.RecordSize != sizeof(IO_TRACE_RECORD)) ||
+      (hdr.Count > hdr.Capacity)) {
+    fclose(file);
+    return EFI_LOAD_ERROR;
+  }
+
+  const UINTN recBytes = (UINTN)hdr.Count * sizeof(IO_TRACE_RECORD);
+
+  IO_TRACE_HEADER* buf = 
+    (IO_TRACE_HEADER*)AllocatePool(sizeof(IO_TRACE_HEADER) + recBytes);
+
+  if (!buf) {
+    fclose(file);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  CopyMem(buf, &hdr, sizeof(hdr));
+
+  const UINTN got = fread(IO_TRACE_RECORDS(buf), 1, recBytes, file);
+
+  fclose(file);
+
+  if (got != recBytes) {
+    FreePool(buf);
+    return EFI_LOAD_ERROR;
+  }
+
+  *trace = buf;
+
+  return EFI_SUCCESS;
+}
+
+/****
+ * EDK2 libraries
+ ****/
+
+VOID* EFIAPI CopyMem(OUT VOID* dst, IN CONST VOID* src, IN UINTN len)
+{
+  return memmove(dst, src, len);
+}
+
+VOID* EFIAPI SetMem(OUT VOID* dst, IN UINTN len, IN UINT8 value)
+{
+  return memset(dst, value, len);
+}
+
+VOID* EFIAPI ZeroMem(OUT VOID* dst, IN UINTN len)
+{
+  return memset(dst, 0, len);
+}
+
+INTN EFIAPI CompareMem(IN CONST VOID* a, IN CONST VOID* b, IN UINTN len)
+{
+  return memcmp(a, b, len);
+}
+
+VOID* EFIAPI AllocatePool(IN UINTN size)
+{
+  return malloc(size);
+}
+
+VOID* EFIAPI AllocateZeroPool(IN UINTN size)
+{
+  return calloc(1, size);
+}
+
+VOID EFIAPI FreePool(IN VOID* buf)
+{
+  free(buf);
+}
+
+VOID* EFIAPI AllocatePages(IN UINTN pages)
+{
+  return aligned_alloc(EFI_PAGE_SIZE, EFI_PAGES_TO_SIZE(pages));
+}
+
+VOID EFIAPI FreePages(IN VOID* buf, IN UINTN pages)
+{
+  free(buf);
+}
+
+EFI_STATUS EFIAPI AsciiStrCpyS(
+  OUT CHAR8* dst, 
+  IN UINTN dstMax, 
+  IN CONST CHAR8* src)
+{
+  if ((!dst) || (!src) || (strlen(src) >= dstMax)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  strcpy(dst, src);
+
+  return EFI_SUCCESS;
+}
+
+UINTN EFIAPI AsciiStrLen(IN CONST CHAR8* str)
+{
+  return strlen(str);
+}
+
+/*******************************************************************************
+ * HostVPrint
+ * 
+ * EDK2 PrintLib format on top of printf: %a is an ASCII string, %s a CHAR16
+ * one, %r an EFI_STATUS and the l flag means 64 bits. Anything else is 
+ * passed through as a 32-bit value.
+ ******************************************************************************/
+
+static UINTN HostVPrint(IN CONST CHAR8* format, IN va_list args)
+{
+  UINTN n = 0;
+
+  while (*format) {
+
+    if (*format != '%') {
+      putchar(*format++);
+      n++;
+      continue;
+    }
+
+    //
+    // Copy the spec (flags, width), note the l flag
+
+    CHAR8 spec[32];
+    UINTN len = 0;
+    BOOLEAN wide = FALSE;
+
+    spec[len++] = *format++;
+
+    while ((*format) && (strchr("-+ #0123456789.l", *format)) && 
+           (len < sizeof(spec) - 4)) {
+      if (*format == 'l') {
+        wide = TRUE;
+      }
+      else {
+        spec[len++] = *format;
+      }
+      format++;
+    }
+
+    const CHAR8 conv = *format;
+
+    if (conv) {
+      format++;
+    }
+
+    switch (conv)
+    {
+      case 'a':
+      {
+        spec[len++] = 's';
+        spec[len] = 0;
+        n += printf(spec, va_arg(args, const CHAR8*));
+      }
+      break;
+
+      case 's':
+      {
+        const CHAR16* str = va_arg(args, const CHAR16*);
+
+        while ((str) && (*str)) {
+          putchar((CHAR8)*str++);
+          n++;
+        }
+      }
+      break;
+
+      case 'r':
+      {
+        n += printf("status 0x%llx", (UINT64)va_arg(args, EFI_STATUS));
+      }
+      break;
+
+      case 'c':
+      case 'd':
+      case 'i':
+      case 'u':
+      case 'x':
+      case 'X':
+      {
+        if (wide) {
+          spec[len++] = 'l';
+          spec[len++] = 'l';
+        }
+
+        spec[len++] = conv;
+        spec[len] = 0;
+
+        n += (wide) ? 
+          printf(spec, va_arg(args, UINT64)) : 
+          printf(spec, va_arg(args, UINT32));
+      }
+      break;
+
+      case '%':
+      {
+        putchar('%');
+        n++;
+      }
+      break;
+
+      default:
+      break;
+    }
+  }
+
+  return n;
+}
+
+UINTN EFIAPI AsciiPrint(IN CONST CHAR8* format, ...)
+{
+  va_list args;
+
+  va_start(args, format);
+  UINTN n = HostVPrint(format, args);
+  va_end(args);
+
+  return n;
+}
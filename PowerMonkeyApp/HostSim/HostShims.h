@@ -0,0 +1,69 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#pragma once
+
+/*******************************************************************************
+ * HostShims - what the firmware gets from EDK2, the ASM helpers and the 
+ * platform discovery, reduced to a single simulated CPU in userspace
+ * 
+ * Time is virtual: ReadTsc only moves when HostClock_Advance is called (and
+ * by StallCpu), so a run is exactly repeatable - recording and replaying the
+ * same flow makes the same timing decisions (polling deadlines, mailbox fast
+ * path), whatever the host machine is doing.
+ ******************************************************************************/
+
+#define HOST_TSC_FREQ                 1000000000ull     // 1 GHz, 1 ns ticks
+
+/*******************************************************************************
+ * HostClock_Advance
+ ******************************************************************************/
+
+VOID EFIAPI HostClock_Advance(IN const UINT64 ticks);
+
+/*******************************************************************************
+ * HostClock_Now
+ ******************************************************************************/
+
+UINT64 EFIAPI HostClock_Now(VOID);
+
+/*******************************************************************************
+ * HostTrace_SetPath
+ * File behind IoTrace_Save / IoTrace_Load (default: PowerMonkey.iotrace in 
+ * the current directory)
+ ******************************************************************************/
+
+VOID EFIAPI HostTrace_SetPath(IN const CHAR8* path);
+
+/*******************************************************************************
+ * HostCpu_Set
+ * CPU that PerCpu_Self reports from now on (HOST_CPU_NONE: not bound, as
+ * before per-CPU data is set up) - lets one thread act as several CPUs
+ ******************************************************************************/
+
+#define HOST_CPU_NONE                 ((UINTN)-1)
+
+VOID EFIAPI HostCpu_Set(IN const UINTN absIdx);
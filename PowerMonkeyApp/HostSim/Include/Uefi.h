@@ -0,0 +1,108 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#pragma once
+
+/*******************************************************************************
+ * Host (Linux userspace) stand-in for the EDK2 base headers
+ * 
+ * Just enough of the UEFI types for the I/O backend, simulator and mailbox
+ * sources to build unchanged with the host compiler. EFIAPI is empty: the
+ * whole program is built with the host calling convention.
+ ******************************************************************************/
+
+#include <stddef.h>
+#include <stdarg.h>
+
+typedef unsigned long long    UINT64;
+typedef long long             INT64;
+typedef unsigned int          UINT32;
+typedef int                   INT32;
+typedef unsigned short        UINT16;
+typedef short                 INT16;
+typedef unsigned char         UINT8;
+typedef signed char           INT8;
+typedef char                  CHAR8;
+typedef unsigned short        CHAR16;
+typedef UINT64                UINTN;
+typedef INT64                 INTN;
+typedef unsigned char         BOOLEAN;
+typedef void                  VOID;
+
+typedef UINTN                 EFI_STATUS;
+typedef VOID*                 EFI_HANDLE;
+typedef VOID*                 EFI_EVENT;
+typedef UINT64                EFI_PHYSICAL_ADDRESS;
+
+typedef struct _EFI_SYSTEM_TABLE  EFI_SYSTEM_TABLE;   // Opaque here
+
+typedef struct {
+  UINT32  Data1;
+  UINT16  Data2;
+  UINT16  Data3;
+  UINT8   Data4[8];
+} EFI_GUID;
+
+#define IN
+#define OUT
+#define OPTIONAL
+#define CONST                     const
+#define STATIC                    static
+#define EFIAPI
+
+#define TRUE                      ((BOOLEAN)(1 == 1))
+#define FALSE                     ((BOOLEAN)(0 == 1))
+
+#define VA_LIST                   va_list
+#define VA_START                  va_start
+#define VA_END                    va_end
+#define VA_ARG                    va_arg
+
+#define OFFSET_OF(T, F)           offsetof(T, F)
+#define STATIC_ASSERT             _Static_assert
+#define ARRAY_SIZE(a)             (sizeof(a) / sizeof((a)[0]))
+#define MAX(a, b)                 (((a) > (b)) ? (a) : (b))
+#define MIN(a, b)                 (((a) < (b)) ? (a) : (b))
+
+#define ENCODE_ERROR(x)           ((EFI_STATUS)(0x8000000000000000ULL | (x)))
+#define EFI_ERROR(s)              (((INTN)(EFI_STATUS)(s)) < 0)
+
+#define EFI_SUCCESS               0
+#define EFI_LOAD_ERROR            ENCODE_ERROR(1)
+#define EFI_INVALID_PARAMETER     ENCODE_ERROR(2)
+#define EFI_UNSUPPORTED           ENCODE_ERROR(3)
+#define EFI_BUFFER_TOO_SMALL      ENCODE_ERROR(5)
+#define EFI_NOT_READY             ENCODE_ERROR(6)
+#define EFI_DEVICE_ERROR          ENCODE_ERROR(7)
+#define EFI_OUT_OF_RESOURCES      ENCODE_ERROR(9)
+#define EFI_NOT_FOUND             ENCODE_ERROR(14)
+#define EFI_TIMEOUT               ENCODE_ERROR(18)
+#define EFI_NOT_STARTED           ENCODE_ERROR(19)
+#define EFI_ABORTED               ENCODE_ERROR(21)
+
+#define EFI_PAGE_SIZE             0x1000
+#define EFI_SIZE_TO_PAGES(s)      (((s) >> 12) + (((s) & 0xfff) ? 1 : 0))
+#define EFI_PAGES_TO_SIZE(p)      ((p) << 12)
@@ -0,0 +1,496 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "IoBackend.h"
+#include "IoSim.h"
+#include "LowLevel.h"
+#include "OcMailbox.h"
+#include "VFTuning.h"
+#include "HostShims.h"
+
+/*******************************************************************************
+ * IoSimTest - mailbox drivers against the simulator, recorded and replayed
+ * 
+ *   IoSimTest record <trace>   runs the scenario on the simulator with the
+ *                              recorder on, saves <trace> (IoBackend_Finish)
+ *                              and the outcome to <trace>.result
+ * 
+ *   IoSimTest replay <trace>   loads <trace> the way the firmware does
+ *                              (gIoBackendMode = 3), runs the same scenario
+ *                              and expects no divergence and the same outcome
+ * 
+ * The scenario programs V/F offsets of every domain through the OC mailbox, 
+ * makes one MSR read fault, has two CPUs read their own values of one MSR
+ * (in the opposite order on replay) and makes one command hang. The 
+ * simulator fails, garbles and delays commands along the way, so the retry,
+ * verification and timeout paths all run.
+ ******************************************************************************/
+
+#define TEST_TRACE_RECORDS            0x40000
+#define TEST_TICKS_PER_ACCESS         500       // 0.5 us per MSR/MMIO access
+#define TEST_ROUNDS                   24
+#define TEST_DOMAINS                  4
+
+#define TEST_MCHBAR                   0xFED10000
+#define TEST_FAULT_MSR                0x1A2     // Faults on the test machine
+#define TEST_PLAIN_MSR                0x1A0
+
+#define TEST_CPUS                     2
+#define TEST_CPU_READS                16        // > replay resync window
+#define TEST_CPU_VALUE(cpu)           (0xC0DE0000ull + (cpu))
+
+typedef struct _TEST_RESULT {
+  UINT32  Transactions;
+  UINT32  Failed;                     // Completion code other than 0
+  UINT32  Errors;                     // Driver error (verify, timeout)
+  UINT32  Mismatches;                 // Clean write, clean read, other value
+  UINT32  FaultedReads;
+  UINT32  Digest;                     // FNV-1a of every value read
+} TEST_RESULT;
+
+extern UINT8 gIoBackendMode;
+
+static IOSIM_CONFIG gTestSim;
+
+/****
+ * Test machine - seeds the simulator's registers
+ ****/
+
+static UINT64 EFIAPI MachineRdMsr64(const UINT32 msr_idx, UINT32* is_err)
+{
+  *is_err = (msr_idx == TEST_FAULT_MSR) ? 1 : 0;
+  return (*is_err) ? 0 : 0x0000100000000000ull | msr_idx;
+}
+
+static UINT32 EFIAPI MachineWrMsr64(const UINT32 msr_idx, const UINT64 value)
+{
+  return 0;
+}
+
+static UINT32 EFIAPI MachineMmioRead32(const UINT32 addr, UINT32* is_err)
+{
+  *is_err = 0;
+  return 0;
+}
+
+static UINT32 EFIAPI MachineMmioWrite32(const UINT32 addr, const UINT32 value)
+{
+  return 0;
+}
+
+static const IO_BACKEND gTestMachine = {
+  "test machine",
+  MachineRdMsr64,
+  MachineWrMsr64,
+  MachineMmioRead32,
+  MachineMmioWrite32,
+  MachineMmioWrite32
+};
+
+/****
+ * Clock - every access takes the same (virtual) time, recorded or replayed
+ ****/
+
+static const IO_BACKEND* gTimedInner = NULL;
+
+static UINT64 EFIAPI TimedRdMsr64(const UINT32 msr_idx, UINT32* is_err)
+{
+  HostClock_Advance(TEST_TICKS_PER_ACCESS);
+  return gTimedInner->RdMsr64(msr_idx, is_err);
+}
+
+static UINT32 EFIAPI TimedWrMsr64(const UINT32 msr_idx, const UINT64 value)
+{
+  HostClock_Advance(TEST_TICKS_PER_ACCESS);
+  return gTimedInner->WrMsr64(msr_idx, value);
+}
+
+static UINT32 EFIAPI TimedMmioRead32(const UINT32 addr, UINT32* is_err)
+{
+  HostClock_Advance(TEST_TICKS_PER_ACCESS);
+  return gTimedInner->MmioRead32(addr, is_err);
+}
+
+static UINT32 EFIAPI TimedMmioOr32(const UINT32 addr, const UINT32 value)
+{
+  HostClock_Advance(TEST_TICKS_PER_ACCESS);
+  return gTimedInner->MmioOr32(addr, value);
+}
+
+static UINT32 EFIAPI TimedMmioWrite32(const UINT32 addr, const UINT32 value)
+{
+  HostClock_Advance(TEST_TICKS_PER_ACCESS);
+  return gTimedInner->MmioWrite32(addr, value);
+}
+
+static const IO_BACKEND gTimed = {
+  "timed",
+  TimedRdMsr64,
+  TimedWrMsr64,
+  TimedMmioRead32,
+  TimedMmioOr32,
+  TimedMmioWrite32
+};
+
+/*******************************************************************************
+ * Digest
+ ******************************************************************************/
+
+static VOID Digest(IN OUT TEST_RESULT* res, IN const UINT64 value)
+{
+  UINT32 h = (res->Digest) ? res->Digest : 0x811C9DC5;
+
+  for (UINT32 i = 0; i < 8; i++) {
+    h ^= (UINT8)(value >> (i * 8));
+    h *= 0x01000193;
+  }
+
+  res->Digest = h;
+}
+
+/*******************************************************************************
+ * Account - returns TRUE if the transaction went through cleanly
+ ******************************************************************************/
+
+static BOOLEAN Account( IN OUT TEST_RESULT* res, 
+                        IN const EFI_STATUS status, 
+                        IN const CpuMailbox* b )
+{
+  res->Transactions++;
+
+  if (EFI_ERROR(status)) {
+    res->Errors++;
+  }
+  else if (b->status) {
+    res->Failed++;
+  }
+
+  Digest(res, ((UINT64)b->status << 32) | b->b.box.data);
+
+  return (BOOLEAN)((!EFI_ERROR(status)) && (!b->status));
+}
+
+/*******************************************************************************
+ * Scenario
+ * Identical accesses whether recording or replaying - only the simulator 
+ * setup (invisible to a replay) depends on record
+ ******************************************************************************/
+
+static VOID Scenario(IN const BOOLEAN record, OUT TEST_RESULT* res)
+{
+  CpuMailbox oc;
+  UINT32 err = 0;
+
+  SetMem(res, sizeof(TEST_RESULT), 0);
+
+  //
+  // MCHBAR is found through PCIEXBAR, as on hardware
+
+  InitializeMMIO();
+
+  OcMailbox_InitializeAsMSR(&oc);
+
+  for (UINT32 round = 0; round < TEST_ROUNDS; round++) {
+    for (UINT32 domain = 0; domain < TEST_DOMAINS; domain++) {
+
+      const UINT32 data = ((0x7E0 - round * 4) << 21) | (domain << 8);
+
+      EFI_STATUS status = OcMailbox_ReadWrite(
+        OcMailbox_BuildInterface(OC_CMD_WRITE_VF, (UINT8)domain, 0), 
+        data, 
+        &oc);
+
+      const BOOLEAN written = Account(res, status, &oc);
+
+      status = OcMailbox_ReadWrite(
+        OcMailbox_BuildInterface(OC_CMD_READ_VF, (UINT8)domain, 0), 
+        0, 
+        &oc);
+
+      if ((Account(res, status, &oc)) && (written) && 
+          (oc.b.box.data != data)) {
+        res->Mismatches++;
+      }
+    }
+  }
+
+  //
+  // Plain and faulting reads (the latter bypasses pm_rdmsr64, which would 
+  // halt on it)
+
+  Digest(res, pm_rdmsr64(TEST_PLAIN_MSR));
+
+  gIo->RdMsr64(TEST_FAULT_MSR, &err);
+
+  if (err) {
+    res->FaultedReads++;
+  }
+
+  //
+  // Each CPU reads its own value of the same MSR, as APs polling their
+  // package's mailbox do. Replay runs the CPUs in the opposite order, every
+  // CPU must still be answered from its own records
+
+  for (UINT32 n = 0; n < TEST_CPUS; n++) {
+
+    const UINT32 cpu = (record) ? n : TEST_CPUS - 1 - n;
+
+    if (record) {
+      IoSim_SetMsr(TEST_PLAIN_MSR, TEST_CPU_VALUE(cpu));
+    }
+
+    HostCpu_Set(cpu);
+
+    for (UINT32 i = 0; i < TEST_CPU_READS; i++) {
+      if (pm_rdmsr64(TEST_PLAIN_MSR) != TEST_CPU_VALUE(cpu)) {
+        res->Mismatches++;
+      }
+    }
+
+    HostCpu_Set(HOST_CPU_NONE);
+  }
+
+  //
+  // Last command never completes: the driver must time out and retry
+
+  if (record) {
+    gTestSim.StuckEvery = 1;
+    IoSim_Start(&gTestSim);
+  }
+
+  Account(res, OcMailbox_ReadWrite(
+    OcMailbox_BuildInterface(OC_CMD_WRITE_VF, 0, 0), 0, &oc), &oc);
+}
+
+/*******************************************************************************
+ * PrintResult
+ ******************************************************************************/
+
+static VOID PrintResult(IN const CHAR8* what, IN const TEST_RESULT* res)
+{
+  AsciiPrint("%a: %u transactions, %u failed, %u errors, %u mismatches, "
+    "%u faulted reads, digest 0x%08x\n",
+    what,
+    res->Transactions,
+    res->Failed,
+    res->Errors,
+    res->Mismatches,
+    res->FaultedReads,
+    res->Digest);
+}
+
+/*******************************************************************************
+ * CheckResult
+ * What the simulator is set up to produce, recorded or replayed
+ ******************************************************************************/
+
+static BOOLEAN CheckResult(IN const TEST_RESULT* res)
+{
+  BOOLEAN ok = TRUE;
+
+  if (res->Mismatches) {
+    AsciiPrint("FAIL: %u values read back differently\n", res->Mismatches);
+    ok = FALSE;
+  }
+
+  if (!res->Failed) {
+    AsciiPrint("FAIL: injected command failures were not reported\n");
+    ok = FALSE;
+  }
+
+  if (res->Errors != 1) {
+    AsciiPrint("FAIL: %u driver errors, expected 1 (timeout)\n", 
+      res->Errors);
+    ok = FALSE;
+  }
+
+  if (res->FaultedReads != 1) {
+    AsciiPrint("FAIL: faulting MSR read was not reported\n");
+    ok = FALSE;
+  }
+
+  return ok;
+}
+
+/*******************************************************************************
+ * ResultPath
+ ******************************************************************************/
+
+static const CHAR8* ResultPath(IN const CHAR8* trace)
+{
+  static CHAR8 path[4096];
+
+  snprintf(path, sizeof(path), "%s.result", trace);
+
+  return path;
+}
+
+/*******************************************************************************
+ * Record
+ ******************************************************************************/
+
+static int Record(IN const CHAR8* trace)
+{
+  TEST_RESULT res;
+
+  IoSim_DefaultConfig(&gTestSim);
+
+  gTestSim.LatencyPolls = 3;
+  gTestSim.JitterPolls = 4;
+  gTestSim.Seed = 0x5EED;
+  gTestSim.FailEvery = 7;
+  gTestSim.FlipEvery = 5;
+  gTestSim.Mchbar = TEST_MCHBAR;
+  gTestSim.Backing = &gTestMachine;
+
+  const IO_BACKEND* rec = 
+    IoRecorder_Start(IoSim_Start(&gTestSim), TEST_TRACE_RECORDS);
+
+  if (!rec) {
+    AsciiPrint("FAIL: unable to start the recorder\n");
+    return 1;
+  }
+
+  gTimedInner = rec;
+  IoBackend_Set(&gTimed);
+
+  Scenario(TRUE, &res);
+
+  //
+  // Saves the trace, as the firmware does on exit
+
+  IoBackend_Set(rec);
+  CpuMailbox_PrintStats();
+  IoBackend_Finish();
+
+  PrintResult("recorded", &res);
+
+  FILE* file = fopen(ResultPath(trace), "wb");
+
+  if ((!file) || (fwrite(&res, sizeof(res), 1, file) != 1)) {
+    AsciiPrint("FAIL: unable to write %a\n", ResultPath(trace));
+    return 1;
+  }
+
+  fclose(file);
+
+  return (CheckResult(&res)) ? 0 : 1;
+}
+
+/*******************************************************************************
+ * Replay
+ ******************************************************************************/
+
+static int Replay(IN const CHAR8* trace)
+{
+  TEST_RESULT expected;
+  TEST_RESULT res;
+  UINT32 first = 0;
+
+  FILE* file = fopen(ResultPath(trace), "rb");
+
+  if ((!file) || (fread(&expected, sizeof(expected), 1, file) != 1)) {
+    AsciiPrint("FAIL: unable to read %a\n", ResultPath(trace));
+    return 1;
+  }
+
+  fclose(file);
+
+  //
+  // Same path as gIoBackendMode = 3 in the firmware
+
+  gIoBackendMode = IO_BACKEND_REPLAY;
+  IoBackend_Init();
+
+  const IO_BACKEND* replay = gIo;
+
+  if (replay == &gIoHardware) {
+    AsciiPrint("FAIL: trace not loaded\n");
+    return 1;
+  }
+
+  gTimedInner = replay;
+  IoBackend_Set(&gTimed);
+
+  Scenario(FALSE, &res);
+
+  IoBackend_Set(replay);
+
+  const UINT32 divergences = IoReplay_Divergences(&first);
+
+  IoBackend_Finish();
+
+  PrintResult("replayed", &res);
+
+  BOOLEAN ok = CheckResult(&res);
+
+  if (divergences) {
+    AsciiPrint("FAIL: %u divergences, first at record %u\n", 
+      divergences, 
+      first);
+    ok = FALSE;
+  }
+
+  if (CompareMem(&res, &expected, sizeof(res))) {
+    PrintResult("FAIL: expected", &expected);
+    ok = FALSE;
+  }
+
+  return (ok) ? 0 : 1;
+}
+
+/*******************************************************************************
+ * main
+ ******************************************************************************/
+
+int main(int argc, char** argv)
+{
+  if (argc != 3) {
+    AsciiPrint("usage: %a record|replay <trace>\n", argv[0]);
+    return 2;
+  }
+
+  HostTrace_SetPath(argv[2]);
+
+  if (!strcmp(argv[1], "record")) {
+    return Record(argv[2]);
+  }
+
+  if (!strcmp(argv[1], "replay")) {
+    return Replay(argv[2]);
+  }
+
+  AsciiPrint("usage: %a record|replay <trace>\n", argv[0]);
+
+  return 2;
+}
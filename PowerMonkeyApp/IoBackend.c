@@ -0,0 +1,565 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+
+#include "IoBackend.h"
+#include "IoSim.h"
+#include "IoTraceFile.h"
+#include "SaferAsmHdr.h"
+#include "LowLevel.h"
+#include "MiniLog.h"
+#include "PerCpu.h"
+#include "DelayX86.h"
+
+/*******************************************************************************
+ * Globals
+ ******************************************************************************/
+
+extern UINT8 gIoBackendMode;
+
+#define IO_TRACE_DEFAULT_RECORDS          65536     // 1.5 MB
+#define IO_REPLAY_RESYNC_WINDOW           8
+
+const IO_BACKEND gIoHardware = {
+  "hardware",
+  safer_rdmsr64,
+  safer_wrmsr64,
+  safer_mmio_read32,
+  safer_mmio_or32,
+  safer_mmio_write32
+};
+
+const IO_BACKEND* gIo = &gIoHardware;
+
+//
+// Recorder
+
+static const IO_BACKEND* gRecInner = &gIoHardware;
+static IO_TRACE_HEADER* gTrace = NULL;
+static UINTN gTracePages = 0;
+static BOOLEAN gRecording = FALSE;
+
+//
+// Replay
+
+static const IO_TRACE_HEADER* gReplay = NULL;
+static IO_TRACE_HEADER* gReplayLoaded = NULL;   // Owned, from the trace file
+static volatile UINT32 gReplayLock = 0;
+static UINT32* gReplayPos = NULL;               // Cursor per recorded CPU
+static UINT32 gReplayCpus = 0;                  // + 1 slot for unknown CPU
+static UINT32 gReplayConsumed = 0;
+static UINT32 gReplayDivergences = 0;
+static UINT32 gReplayFirstDivergence = 0;
+
+/*******************************************************************************
+ * IoBackend_Set
+ ******************************************************************************/
+
+const IO_BACKEND* EFIAPI IoBackend_Set(IN const IO_BACKEND* backend)
+{
+  const IO_BACKEND* prev = gIo;
+
+  gIo = (backend) ? backend : &gIoHardware;
+
+  return prev;
+}
+
+/****
+ * Recorder
+ ****/
+
+/*******************************************************************************
+ * TraceCpu
+ ******************************************************************************/
+
+static UINT16 TraceCpu(VOID)
+{
+  CPUCORE* core = PerCpu_Self();
+
+  return (core) ? (UINT16)core->AbsIdx : IO_TRACE_CPU_UNKNOWN;
+}
+
+/*******************************************************************************
+ * RecAppend
+ ******************************************************************************/
+
+static VOID RecAppend( IN const UINT8 op, 
+                       IN const UINT32 addr, 
+                       IN const UINT64 value,
+                       IN const UINT32 err )
+{
+  IO_TRACE_HEADER* hdr = gTrace;
+  UINT32 idx;
+
+  //
+  // Claim a slot - APs record concurrently
+
+  do {
+    idx = hdr->Count;
+  } while (hlp_atomic_cmpxchg_u32(&hdr->Count, idx, idx + 1) != idx);
+
+  if (idx >= hdr->Capacity) {
+    hlp_atomic_increment_u32(&hdr->Dropped);
+    return;
+  }
+
+  IO_TRACE_RECORD* rec = IO_TRACE_RECORDS(hdr) + idx;
+
+  rec->Tsc = ReadTsc() - hdr->StartTsc;
+  rec->Value = value;
+  rec->Addr = addr;
+  rec->Cpu = TraceCpu();
+  rec->Op = op;
+  rec->Flags = (err) ? IO_TRACE_FLAG_ERR : 0;
+}
+
+static UINT64 EFIAPI RecRdMsr64(const UINT32 msr_idx, UINT32* is_err)
+{
+  UINT64 val = gRecInner->RdMsr64(msr_idx, is_err);
+  RecAppend(MINILOG_OPID_RDMSR64, msr_idx, val, *is_err);
+  return val;
+}
+
+static UINT32 EFIAPI RecWrMsr64(const UINT32 msr_idx, const UINT64 value)
+{
+  UINT32 err = gRecInner->WrMsr64(msr_idx, value);
+  RecAppend(MINILOG_OPID_WRMSR64, msr_idx, value, err);
+  return err;
+}
+
+static UINT32 EFIAPI RecMmioRead32(const UINT32 addr, UINT32* is_err)
+{
+  UINT32 val = gRecInner->MmioRead32(addr, is_err);
+  RecAppend(MINILOG_OPID_MMIO_READ32, addr, val, *is_err);
+  return val;
+}
+
+static UINT32 EFIAPI RecMmioOr32(const UINT32 addr, const UINT32 value)
+{
+  UINT32 err = gRecInner->MmioOr32(addr, value);
+  RecAppend(MINILOG_OPID_MMIO_OR32, addr, value, err);
+  return err;
+}
+
+static UINT32 EFIAPI RecMmioWrite32(const UINT32 addr, const UINT32 value)
+{
+  UINT32 err = gRecInner->MmioWrite32(addr, value);
+  RecAppend(MINILOG_OPID_MMIO_WRITE32, addr, value, err);
+  return err;
+}
+
+static const IO_BACKEND gIoRecorder = {
+  "recorder",
+  RecRdMsr64,
+  RecWrMsr64,
+  RecMmioRead32,
+  RecMmioOr32,
+  RecMmioWrite32
+};
+
+/*******************************************************************************
+ * IoRecorder_Start
+ ******************************************************************************/
+
+const IO_BACKEND* EFIAPI IoRecorder_Start(
+  IN const IO_BACKEND* inner OPTIONAL,
+  IN const UINT32 maxRecords)
+{
+  if ((gRecording) || (!maxRecords)) {
+    return NULL;
+  }
+
+  if (gTrace) {
+    FreePages(gTrace, gTracePages);
+    gTrace = NULL;
+  }
+
+  gTracePages = EFI_SIZE_TO_PAGES(
+    sizeof(IO_TRACE_HEADER) + (UINTN)maxRecords * sizeof(IO_TRACE_RECORD));
+
+  gTrace = (IO_TRACE_HEADER*)AllocatePages(gTracePages);
+
+  if (!gTrace) {
+    return NULL;
+  }
+
+  SetMem(gTrace, sizeof(IO_TRACE_HEADER), 0);
+
+  gTrace->Magic = IO_TRACE_MAGIC;
+  gTrace->Version = IO_TRACE_VERSION;
+  gTrace->RecordSize = (UINT16)sizeof(IO_TRACE_RECORD);
+  gTrace->Capacity = maxRecords;
+  gTrace->StartTsc = ReadTsc();
+
+  gRecInner = (inner) ? inner : &gIoHardware;
+  gRecording = TRUE;
+
+  return &gIoRecorder;
+}
+
+/*******************************************************************************
+ * IoRecorder_Stop
+ ******************************************************************************/
+
+IO_TRACE_HEADER* EFIAPI IoRecorder_Stop(OUT UINTN* sizeBytes OPTIONAL)
+{
+  if (!gTrace) {
+    return NULL;
+  }
+
+  if (gIo == &gIoRecorder) {
+    gIo = gRecInner;
+  }
+
+  gRecording = FALSE;
+
+  if (gTrace->Count > gTrace->Capacity) {
+    gTrace->Count = gTrace->Capacity;
+  }
+
+  gTrace->TscTicksPerMs = MicroSecondsToTicks(1000);
+
+  if (sizeBytes) {
+    *sizeBytes = sizeof(IO_TRACE_HEADER) + 
+      (UINTN)gTrace->Count * sizeof(IO_TRACE_RECORD);
+  }
+
+  return gTrace;
+}
+
+/****
+ * Replay
+ ****/
+
+/*******************************************************************************
+ * ReplayNext
+ * Returns the record matching the access, NULL (and counts) on divergence.
+ * 
+ * Every CPU walks only its own records (rec->Cpu), so APs polling the same 
+ * mailbox concurrently get their own responses whatever the interleaving
+ ******************************************************************************/
+
+static const IO_TRACE_RECORD* ReplayNext( IN const UINT8 op, 
+                                          IN const UINT32 addr )
+{
+  const IO_TRACE_RECORD* recs = IO_TRACE_RECORDS(gReplay);
+  const IO_TRACE_RECORD* match = NULL;
+  const UINT16 cpu = TraceCpu();
+  UINT32 ahead = 0;
+
+  UINT32* cursor = gReplayPos + ((cpu < gReplayCpus) ? cpu : gReplayCpus);
+
+  pm_spin_lock(&gReplayLock);
+
+  //
+  // Tolerate a few accesses that the replayed run no longer makes 
+  // (e.g. skipped writes) by looking a bit ahead
+
+  UINT32 pos = *cursor;
+
+  for (; pos < gReplay->Count; pos++) {
+
+    if (recs[pos].Cpu != cpu) {
+      continue;
+    }
+
+    if ((recs[pos].Op == op) && (recs[pos].Addr == addr)) {
+      match = &recs[pos];
+      break;
+    }
+
+    if (++ahead >= IO_REPLAY_RESYNC_WINDOW) {
+      break;
+    }
+  }
+
+  if ((!match) || (ahead)) {
+
+    if (!gReplayDivergences) {
+      gReplayFirstDivergence = *cursor;
+    }
+
+    gReplayDivergences++;
+  }
+
+  if (match) {
+    *cursor = pos + 1;
+    gReplayConsumed += ahead + 1;
+  }
+
+  pm_spin_unlock(&gReplayLock);
+
+  return match;
+}
+
+/*******************************************************************************
+ * ReplayWrite
+ ******************************************************************************/
+
+static UINT32 ReplayWrite( IN const UINT8 op, 
+                           IN const UINT32 addr, 
+                           IN const UINT64 value )
+{
+  const IO_TRACE_RECORD* rec = ReplayNext(op, addr);
+
+  if (!rec) {
+    return 0;
+  }
+
+  if (rec->Value != value) {
+
+    pm_spin_lock(&gReplayLock);
+
+    if (!gReplayDivergences) {
+      gReplayFirstDivergence = (UINT32)(rec - IO_TRACE_RECORDS(gReplay));
+    }
+
+    gReplayDivergences++;
+
+    pm_spin_unlock(&gReplayLock);
+  }
+
+  return (rec->Flags & IO_TRACE_FLAG_ERR) ? 1 : 0;
+}
+
+static UINT64 EFIAPI ReplayRdMsr64(const UINT32 msr_idx, UINT32* is_err)
+{
+  const IO_TRACE_RECORD* rec = ReplayNext(MINILOG_OPID_RDMSR64, msr_idx);
+  
+  *is_err = ((rec) && (rec->Flags & IO_TRACE_FLAG_ERR)) ? 1 : 0;
+
+  return (rec) ? rec->Value : 0;
+}
+
+static UINT32 EFIAPI ReplayWrMsr64(const UINT32 msr_idx, const UINT64 value)
+{
+  return ReplayWrite(MINILOG_OPID_WRMSR64, msr_idx, value);
+}
+
+static UINT32 EFIAPI ReplayMmioRead32(const UINT32 addr, UINT32* is_err)
+{
+  const IO_TRACE_RECORD* rec = ReplayNext(MINILOG_OPID_MMIO_READ32, addr);
+  
+  *is_err = ((rec) && (rec->Flags & IO_TRACE_FLAG_ERR)) ? 1 : 0;
+
+  return (rec) ? (UINT32)rec->Value : 0;
+}
+
+static UINT32 EFIAPI ReplayMmioOr32(const UINT32 addr, const UINT32 value)
+{
+  return ReplayWrite(MINILOG_OPID_MMIO_OR32, addr, value);
+}
+
+static UINT32 EFIAPI ReplayMmioWrite32(const UINT32 addr, const UINT32 value)
+{
+  return ReplayWrite(MINILOG_OPID_MMIO_WRITE32, addr, value);
+}
+
+static const IO_BACKEND gIoReplay = {
+  "replay",
+  ReplayRdMsr64,
+  ReplayWrMsr64,
+  ReplayMmioRead32,
+  ReplayMmioOr32,
+  ReplayMmioWrite32
+};
+
+/*******************************************************************************
+ * IoReplay_Start
+ ******************************************************************************/
+
+const IO_BACKEND* EFIAPI IoReplay_Start(IN const IO_TRACE_HEADER* trace)
+{
+  if ((!trace) || (trace->Magic != IO_TRACE_MAGIC) || 
+      (trace->Version != IO_TRACE_VERSION) ||
+      (trace->RecordSize != sizeof(IO_TRACE_RECORD))) {
+    return NULL;
+  }
+
+  //
+  // One cursor per CPU seen in the trace, the last one for accesses made 
+  // before per-CPU data was set up
+
+  UINT32 nCpus = 0;
+
+  for (UINT32 i = 0; i < trace->Count; i++) {
+
+    const UINT16 cpu = IO_TRACE_RECORDS(trace)[i].Cpu;
+
+    if ((cpu != IO_TRACE_CPU_UNKNOWN) && (cpu >= nCpus)) {
+      nCpus = cpu + 1;
+    }
+  }
+
+  if (gReplayPos) {
+    FreePool(gReplayPos);
+  }
+
+  gReplayPos = (UINT32*)AllocateZeroPool((nCpus + 1) * sizeof(UINT32));
+
+  if (!gReplayPos) {
+    return NULL;
+  }
+
+  gReplay = trace;
+  gReplayCpus = nCpus;
+  gReplayConsumed = 0;
+  gReplayDivergences = 0;
+  gReplayFirstDivergence = 0;
+
+  return &gIoReplay;
+}
+
+/*******************************************************************************
+ * IoReplay_Divergences
+ ******************************************************************************/
+
+UINT32 EFIAPI IoReplay_Divergences(OUT UINT32* firstAt OPTIONAL)
+{
+  if (firstAt) {
+    *firstAt = gReplayFirstDivergence;
+  }
+
+  return gReplayDivergences;
+}
+
+/****
+ * Selection
+ ****/
+
+/*******************************************************************************
+ * IoBackend_Init
+ ******************************************************************************/
+
+VOID EFIAPI IoBackend_Init(VOID)
+{
+  const IO_BACKEND* backend = NULL;
+
+  switch (gIoBackendMode)
+  {
+    case IO_BACKEND_RECORD:
+    {
+      backend = IoRecorder_Start(NULL, IO_TRACE_DEFAULT_RECORDS);
+      
+      if (!backend) {
+        AsciiPrint("[WARNING] Unable to allocate I/O trace, not recording\n");
+      }
+    }
+    break;
+
+    case IO_BACKEND_SIMULATE:
+    {
+      backend = IoSim_Start(NULL);
+    }
+    break;
+
+    case IO_BACKEND_REPLAY:
+    {
+      EFI_STATUS status = IoTrace_Load(&gReplayLoaded);
+
+      if (!EFI_ERROR(status)) {
+        backend = IoReplay_Start(gReplayLoaded);
+      }
+
+      if ((!backend) && (gReplayLoaded)) {
+        FreePool(gReplayLoaded);
+        gReplayLoaded = NULL;
+      }
+
+      if (!backend) {
+        AsciiPrint("[WARNING] No usable I/O trace to replay (%r), "
+          "running on hardware\n", status);
+      }
+    }
+    break;
+
+    default:
+    break;
+  }
+
+  IoBackend_Set(backend);
+}
+
+/*******************************************************************************
+ * IoBackend_Finish
+ ******************************************************************************/
+
+VOID EFIAPI IoBackend_Finish(VOID)
+{
+  if (gIo == &gIoRecorder) {
+
+    UINTN size = 0;
+    IO_TRACE_HEADER* hdr = IoRecorder_Stop(&size);
+
+    EFI_STATUS status = IoTrace_Save(hdr, size);
+
+    AsciiPrint("I/O trace: %u records (%u dropped), %u bytes at 0x%016lx\n",
+      hdr->Count,
+      hdr->Dropped,
+      (UINT32)size,
+      (UINT64)(UINTN)hdr);
+
+    if (EFI_ERROR(status)) {
+      AsciiPrint("[WARNING] Unable to save the I/O trace: %r\n", status);
+    }
+    else {
+      AsciiPrint("I/O trace saved to %s\n", IO_TRACE_FILE_NAME);
+    }
+  }
+  else if (gIo == &gIoReplay) {
+
+    UINT32 first = 0;
+    UINT32 n = IoReplay_Divergences(&first);
+
+    AsciiPrint("I/O replay: %u of %u records consumed, %u divergences",
+      gReplayConsumed,
+      gReplay->Count,
+      n);
+
+    if (n) {
+      AsciiPrint(" (first at record %u)", first);
+    }
+
+    AsciiPrint("\n");
+
+    if (gReplayLoaded) {
+      FreePool(gReplayLoaded);
+      gReplayLoaded = NULL;
+    }
+
+    FreePool(gReplayPos);
+    gReplayPos = NULL;
+  }
+  else if (gIo != &gIoHardware) {
+    IoSim_PrintStats();
+  }
+
+  IoBackend_Set(NULL);
+}
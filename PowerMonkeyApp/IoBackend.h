@@ -0,0 +1,152 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#pragma once
+
+/*******************************************************************************
+ * Low-level I/O backends
+ * 
+ * pm_rdmsr64, pm_wrmsr64 and pm_mmio_* (LowLevel.c) keep their tracing and
+ * fault handling, but the access itself goes through gIo:
+ * 
+ *   hardware   - safer_* ASM routines (default)
+ *   recorder   - hardware + every access appended to a binary trace
+ *   replay     - accesses answered from a previously recorded trace
+ *   simulator  - OC mailbox model and register file (IoSim.c)
+ * 
+ * GS base and CPUID do not go through the backend
+ ******************************************************************************/
+
+typedef struct _IO_BACKEND {
+  const CHAR8*  Name;
+  UINT64 (EFIAPI *RdMsr64)(const UINT32 msr_idx, UINT32* is_err);
+  UINT32 (EFIAPI *WrMsr64)(const UINT32 msr_idx, const UINT64 value);
+  UINT32 (EFIAPI *MmioRead32)(const UINT32 addr, UINT32* is_err);
+  UINT32 (EFIAPI *MmioOr32)(const UINT32 addr, const UINT32 value);
+  UINT32 (EFIAPI *MmioWrite32)(const UINT32 addr, const UINT32 value);
+} IO_BACKEND;
+
+extern const IO_BACKEND* gIo;
+extern const IO_BACKEND gIoHardware;
+
+enum IoBackendMode
+{
+  IO_BACKEND_HARDWARE = 0x00,
+  IO_BACKEND_RECORD =   0x01,
+  IO_BACKEND_SIMULATE = 0x02,
+  IO_BACKEND_REPLAY =   0x03,
+};
+
+/*******************************************************************************
+ * Binary trace - header followed by IO_TRACE_RECORDs, op IDs are MINILOG_OPID_*
+ ******************************************************************************/
+
+#define IO_TRACE_MAGIC            0x4F494D50        // "PMIO"
+#define IO_TRACE_VERSION          1
+
+#define IO_TRACE_CPU_UNKNOWN      0xFFFF
+
+#define IO_TRACE_FLAG_ERR         0x01              // Access faulted
+
+typedef struct _IO_TRACE_RECORD {
+  UINT64  Tsc;                    // Relative to IO_TRACE_HEADER.StartTsc
+  UINT64  Value;                  // Value read / written
+  UINT32  Addr;                   // MSR index or MMIO address
+  UINT16  Cpu;                    // AbsIdx
+  UINT8   Op;
+  UINT8   Flags;
+} IO_TRACE_RECORD;
+
+typedef struct _IO_TRACE_HEADER {
+  UINT32  Magic;
+  UINT16  Version;
+  UINT16  RecordSize;
+  UINT32  Capacity;               // Records
+  UINT32  Count;                  // Records claimed (may exceed Capacity)
+  UINT64  StartTsc;
+  UINT64  TscTicksPerMs;          // Filled in by IoRecorder_Stop
+  UINT32  Dropped;
+  UINT32  Reserved;
+} IO_TRACE_HEADER;
+
+#define IO_TRACE_RECORDS(hdr) ((IO_TRACE_RECORD*)((hdr) + 1))
+
+/*******************************************************************************
+ * IoBackend_Init
+ * Selects the backend according to gIoBackendMode, call first thing in main
+ ******************************************************************************/
+
+VOID EFIAPI IoBackend_Init(VOID);
+
+/*******************************************************************************
+ * IoBackend_Finish
+ * Stops recording (saving the trace, see IoTraceFile.h) and prints a summary
+ * of the active backend
+ ******************************************************************************/
+
+VOID EFIAPI IoBackend_Finish(VOID);
+
+/*******************************************************************************
+ * IoBackend_Set
+ * Returns the previous backend
+ ******************************************************************************/
+
+const IO_BACKEND* EFIAPI IoBackend_Set(IN const IO_BACKEND* backend);
+
+/*******************************************************************************
+ * IoRecorder_Start
+ * Records every access forwarded to inner (NULL = hardware) into a trace of
+ * up to maxRecords, allocated here. Returns the recording backend
+ ******************************************************************************/
+
+const IO_BACKEND* EFIAPI IoRecorder_Start(
+  IN const IO_BACKEND* inner OPTIONAL,
+  IN const UINT32 maxRecords);
+
+/*******************************************************************************
+ * IoRecorder_Stop
+ * Finalizes the header. The trace stays valid until IoRecorder_Start
+ ******************************************************************************/
+
+IO_TRACE_HEADER* EFIAPI IoRecorder_Stop(OUT UINTN* sizeBytes OPTIONAL);
+
+/*******************************************************************************
+ * IoReplay_Start
+ * 
+ * Replays a trace: reads return the recorded values, writes are checked
+ * against the recorded ones. Accesses must come in the recorded order, so
+ * traces of concurrent (multi-CPU) programming only replay reliably when
+ * the replayed run is serialized the same way
+ ******************************************************************************/
+
+const IO_BACKEND* EFIAPI IoReplay_Start(IN const IO_TRACE_HEADER* trace);
+
+/*******************************************************************************
+ * IoReplay_Divergences
+ * Number of accesses that did not match the trace, first one in firstAt
+ ******************************************************************************/
+
+UINT32 EFIAPI IoReplay_Divergences(OUT UINT32* firstAt OPTIONAL);
@@ -0,0 +1,524 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "IoSim.h"
+#include "OcMailbox.h"
+#include "VFTuning.h"
+#include "LowLevel.h"
+
+/*******************************************************************************
+ * Model
+ ******************************************************************************/
+
+#define IOSIM_MAX_REGS                    1024
+
+#define IOSIM_SPACE_MSR                   0x00
+#define IOSIM_SPACE_MMIO                  0x01
+#define IOSIM_SPACE_MBOX                  0x02    // Mailbox-held values
+
+#define IOSIM_BUSY                        0x80000000
+#define IOSIM_CMD_MASK                    0x000000ff
+#define IOSIM_MCHBAR_REG                  0x48
+#define IOSIM_PCIE_OFFSET_MASK            0x03ffffff
+
+typedef struct _IOSIM_REG {
+  UINT32  Addr;
+  UINT32  Space;
+  UINT64  Value;
+} IOSIM_REG;
+
+typedef struct _IOSIM_MAILBOX {
+  UINT32  Ifce;
+  UINT32  Data;
+  UINT32  Remaining;
+  UINT8   Busy;
+  UINT8   Stuck;
+  UINT8   Flip;
+  UINT8   pad;
+} IOSIM_MAILBOX;
+
+static IOSIM_CONFIG gSimCfg;
+static IOSIM_STATS gSimStats;
+static IOSIM_REG gSimRegs[IOSIM_MAX_REGS];
+static UINT32 gSimNumRegs = 0;
+static IOSIM_MAILBOX gSimMbox;
+static UINT32 gSimRng = 1;
+static volatile UINT32 gSimLock = 0;
+
+/*******************************************************************************
+ * IoSim_DefaultConfig
+ ******************************************************************************/
+
+VOID EFIAPI IoSim_DefaultConfig(OUT IOSIM_CONFIG* cfg)
+{
+  SetMem(cfg, sizeof(IOSIM_CONFIG), 0);
+
+  cfg->LatencyPolls = 3;
+  cfg->Seed = 1;
+  cfg->FailCode = 0x07;                 // Read/write failed
+  cfg->Backing = &gIoHardware;
+}
+
+/*******************************************************************************
+ * SimRandom (xorshift32, deterministic for a given seed)
+ ******************************************************************************/
+
+static UINT32 SimRandom(VOID)
+{
+  UINT32 x = gSimRng;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+
+  gSimRng = x;
+
+  return x;
+}
+
+/*******************************************************************************
+ * SimFindReg
+ ******************************************************************************/
+
+static IOSIM_REG* SimFindReg( IN const UINT32 space, 
+                              IN const UINT32 addr, 
+                              IN const BOOLEAN create )
+{
+  for (UINT32 i = 0; i < gSimNumRegs; i++) {
+    if ((gSimRegs[i].Addr == addr) && (gSimRegs[i].Space == space)) {
+      return &gSimRegs[i];
+    }
+  }
+
+  if ((!create) || (gSimNumRegs >= IOSIM_MAX_REGS)) {
+    return NULL;
+  }
+
+  IOSIM_REG* reg = &gSimRegs[gSimNumRegs++];
+
+  reg->Addr = addr;
+  reg->Space = space;
+  reg->Value = 0;
+
+  return reg;
+}
+
+/*******************************************************************************
+ * SimReadReg
+ * Unset registers are seeded from the backing backend on first read
+ ******************************************************************************/
+
+static UINT64 SimReadReg( IN const UINT32 space, 
+                          IN const UINT32 addr, 
+                          OUT UINT32* is_err )
+{
+  IOSIM_REG* reg = SimFindReg(space, addr, FALSE);
+
+  *is_err = 0;
+
+  if (reg) {
+    return reg->Value;
+  }
+
+  UINT64 val = 0;
+
+  const BOOLEAN isMchbarReg = (BOOLEAN)((space == IOSIM_SPACE_MMIO) && 
+    ((addr & IOSIM_PCIE_OFFSET_MASK) == IOSIM_MCHBAR_REG));
+
+  if ((isMchbarReg) && (gSimCfg.Mchbar)) {
+    val = gSimCfg.Mchbar | 1;
+  }
+  else if (gSimCfg.Backing) {
+    val = (space == IOSIM_SPACE_MSR) ?
+      gSimCfg.Backing->RdMsr64(addr, is_err) :
+      gSimCfg.Backing->MmioRead32(addr, is_err);
+  }
+
+  if (*is_err) {
+    return val;
+  }
+
+  reg = SimFindReg(space, addr, TRUE);
+
+  if (reg) {
+    reg->Value = val;
+  }
+
+  return val;
+}
+
+/*******************************************************************************
+ * SimWriteReg
+ ******************************************************************************/
+
+static VOID SimWriteReg( IN const UINT32 space, 
+                         IN const UINT32 addr, 
+                         IN const UINT64 value )
+{
+  IOSIM_REG* reg = SimFindReg(space, addr, TRUE);
+
+  if (reg) {
+    reg->Value = value;
+  }
+}
+
+/****
+ * Mailboxes
+ ****/
+
+/*******************************************************************************
+ * SimMailboxExecute
+ * Returns the completion code, response goes to mb->Data
+ ******************************************************************************/
+
+static UINT32 SimMailboxExecute(IN OUT IOSIM_MAILBOX* mb)
+{
+  const UINT32 cmd = mb->Ifce & IOSIM_CMD_MASK;
+
+  //
+  // Values are keyed by the read command ID and both parameters
+
+  const UINT32 key = mb->Ifce & 0x00ffff00;
+
+  if ((gSimCfg.FailEvery) && ((gSimStats.Commands % gSimCfg.FailEvery) == 0)) {
+    gSimStats.Failed++;
+    mb->Data = 0;
+    return gSimCfg.FailCode;
+  }
+
+  if (cmd == OC_CMD_GET_VR_TOPOLOGY) {
+    mb->Data = gSimCfg.VrTopology;
+  }
+  else if (cmd & 1) {
+    SimWriteReg(IOSIM_SPACE_MBOX, key | (cmd - 1), mb->Data);
+  }
+  else {
+    IOSIM_REG* reg = SimFindReg(IOSIM_SPACE_MBOX, key | cmd, FALSE);
+    mb->Data = (reg) ? (UINT32)reg->Value : 0;
+  }
+
+  return 0;
+}
+
+/*******************************************************************************
+ * SimMailboxWrite
+ * Writing the interface with busy set starts a command, ignored while busy
+ ******************************************************************************/
+
+static VOID SimMailboxWrite(IN const UINT32 ifce, IN const UINT32 data)
+{
+  IOSIM_MAILBOX* mb = &gSimMbox;
+
+  if (mb->Busy) {
+    return;
+  }
+
+  mb->Ifce = ifce;
+  mb->Data = data;
+
+  if (!(ifce & IOSIM_BUSY)) {
+    return;
+  }
+
+  gSimStats.Commands++;
+
+  mb->Busy = 1;
+  mb->Remaining = gSimCfg.LatencyPolls;
+
+  if (gSimCfg.JitterPolls) {
+    mb->Remaining += SimRandom() % (gSimCfg.JitterPolls + 1);
+  }
+
+  mb->Stuck = (UINT8)((gSimCfg.StuckEvery) && 
+    ((gSimStats.Commands % gSimCfg.StuckEvery) == 0));
+
+  mb->Flip = (UINT8)((gSimCfg.FlipEvery) && 
+    ((gSimStats.Commands % gSimCfg.FlipEvery) == 0));
+
+  if (mb->Stuck) {
+    gSimStats.Stuck++;
+  }
+}
+
+/*******************************************************************************
+ * SimMailboxRead
+ * Each read of a busy interface counts as one poll
+ ******************************************************************************/
+
+static VOID SimMailboxRead(OUT UINT32* ifce, OUT UINT32* data)
+{
+  IOSIM_MAILBOX* mb = &gSimMbox;
+  BOOLEAN flip = FALSE;
+
+  if (mb->Busy) {
+
+    gSimStats.BusyPolls++;
+
+    if ((!mb->Stuck) && (mb->Remaining)) {
+      mb->Remaining--;
+    }
+
+    if ((!mb->Stuck) && (!mb->Remaining)) {
+
+      const UINT32 code = SimMailboxExecute(mb);
+
+      mb->Ifce = (mb->Ifce & ~(IOSIM_BUSY | IOSIM_CMD_MASK)) | code;
+      mb->Busy = 0;
+
+      //
+      // Completion read returns garbage once - verification must catch it
+
+      if (mb->Flip) {
+        mb->Flip = 0;
+        flip = TRUE;
+        gSimStats.Flipped++;
+      }
+    }
+  }
+
+  *ifce = mb->Ifce ^ ((flip) ? 0x00000100 : 0);
+  *data = mb->Data ^ ((flip) ? 0x00000001 : 0);
+}
+
+/****
+ * Backend
+ ****/
+
+static UINT64 EFIAPI SimRdMsr64(const UINT32 msr_idx, UINT32* is_err)
+{
+  UINT64 val = 0;
+
+  pm_spin_lock(&gSimLock);
+
+  gSimStats.MsrReads++;
+
+  if (msr_idx == MSR_OC_MAILBOX) {
+
+    UINT32 ifce = 0;
+    UINT32 data = 0;
+
+    SimMailboxRead(&ifce, &data);
+
+    *is_err = 0;
+    val = ((UINT64)ifce << 32) | data;
+  }
+  else {
+    val = SimReadReg(IOSIM_SPACE_MSR, msr_idx, is_err);
+  }
+
+  pm_spin_unlock(&gSimLock);
+
+  return val;
+}
+
+static UINT32 EFIAPI SimWrMsr64(const UINT32 msr_idx, const UINT64 value)
+{
+  pm_spin_lock(&gSimLock);
+
+  gSimStats.MsrWrites++;
+
+  if (msr_idx == MSR_OC_MAILBOX) {
+    SimMailboxWrite((UINT32)(value >> 32), (UINT32)value);
+  }
+  else {
+    SimWriteReg(IOSIM_SPACE_MSR, msr_idx, value);
+  }
+
+  pm_spin_unlock(&gSimLock);
+
+  return 0;
+}
+
+static UINT32 EFIAPI SimMmioRead32(const UINT32 addr, UINT32* is_err)
+{
+  UINT32 val = 0;
+
+  pm_spin_lock(&gSimLock);
+
+  gSimStats.MmioReads++;
+
+  val = (UINT32)SimReadReg(IOSIM_SPACE_MMIO, addr, is_err);
+
+  pm_spin_unlock(&gSimLock);
+
+  return val;
+}
+
+static UINT32 EFIAPI SimMmioWrite32(const UINT32 addr, const UINT32 value)
+{
+  pm_spin_lock(&gSimLock);
+
+  gSimStats.MmioWrites++;
+
+  SimWriteReg(IOSIM_SPACE_MMIO, addr, value);
+
+  pm_spin_unlock(&gSimLock);
+
+  return 0;
+}
+
+static UINT32 EFIAPI SimMmioOr32(const UINT32 addr, const UINT32 value)
+{
+  UINT32 err = 0;
+  UINT32 val = SimMmioRead32(addr, &err);
+
+  if (!err) {
+    err = SimMmioWrite32(addr, val | value);
+  }
+
+  return err;
+}
+
+static const IO_BACKEND gIoSim = {
+  "simulator",
+  SimRdMsr64,
+  SimWrMsr64,
+  SimMmioRead32,
+  SimMmioOr32,
+  SimMmioWrite32
+};
+
+/*******************************************************************************
+ * IoSim_Start
+ ******************************************************************************/
+
+const IO_BACKEND* EFIAPI IoSim_Start(IN const IOSIM_CONFIG* cfg OPTIONAL)
+{
+  pm_spin_lock(&gSimLock);
+
+  if (cfg) {
+    CopyMem(&gSimCfg, cfg, sizeof(IOSIM_CONFIG));
+  }
+  else {
+    IoSim_DefaultConfig(&gSimCfg);
+  }
+
+  SetMem(&gSimStats, sizeof(IOSIM_STATS), 0);
+  SetMem(&gSimMbox, sizeof(gSimMbox), 0);
+
+  gSimNumRegs = 0;
+  gSimRng = (gSimCfg.Seed) ? gSimCfg.Seed : 1;
+
+  pm_spin_unlock(&gSimLock);
+
+  return &gIoSim;
+}
+
+/*******************************************************************************
+ * IoSim_SetMsr
+ ******************************************************************************/
+
+BOOLEAN EFIAPI IoSim_SetMsr(IN const UINT32 msr_idx, IN const UINT64 value)
+{
+  pm_spin_lock(&gSimLock);
+
+  IOSIM_REG* reg = SimFindReg(IOSIM_SPACE_MSR, msr_idx, TRUE);
+
+  if (reg) {
+    reg->Value = value;
+  }
+
+  pm_spin_unlock(&gSimLock);
+
+  return (BOOLEAN)(reg != NULL);
+}
+
+/*******************************************************************************
+ * IoSim_SetMmio
+ ******************************************************************************/
+
+BOOLEAN EFIAPI IoSim_SetMmio(IN const UINT32 addr, IN const UINT32 value)
+{
+  pm_spin_lock(&gSimLock);
+
+  IOSIM_REG* reg = SimFindReg(IOSIM_SPACE_MMIO, addr, TRUE);
+
+  if (reg) {
+    reg->Value = value;
+  }
+
+  pm_spin_unlock(&gSimLock);
+
+  return (BOOLEAN)(reg != NULL);
+}
+
+/*******************************************************************************
+ * IoSim_GetMsr
+ ******************************************************************************/
+
+UINT64 EFIAPI IoSim_GetMsr(IN const UINT32 msr_idx)
+{
+  pm_spin_lock(&gSimLock);
+
+  IOSIM_REG* reg = SimFindReg(IOSIM_SPACE_MSR, msr_idx, FALSE);
+  UINT64 val = (reg) ? reg->Value : 0;
+
+  pm_spin_unlock(&gSimLock);
+
+  return val;
+}
+
+/*******************************************************************************
+ * IoSim_GetStats
+ ******************************************************************************/
+
+VOID EFIAPI IoSim_GetStats(OUT IOSIM_STATS* stats)
+{
+  pm_spin_lock(&gSimLock);
+  CopyMem(stats, &gSimStats, sizeof(IOSIM_STATS));
+  pm_spin_unlock(&gSimLock);
+}
+
+/*******************************************************************************
+ * IoSim_PrintStats
+ ******************************************************************************/
+
+VOID EFIAPI IoSim_PrintStats(VOID)
+{
+  IOSIM_STATS st;
+
+  IoSim_GetStats(&st);
+
+  AsciiPrint("I/O simulator: %u mailbox commands (%u failed, %u stuck, "
+    "%u garbled), %lu busy polls\n",
+    st.Commands,
+    st.Failed,
+    st.Stuck,
+    st.Flipped,
+    st.BusyPolls);
+
+  AsciiPrint("  MSR %lu reads / %lu writes, MMIO %lu reads / %lu writes, "
+    "%u registers touched\n",
+    st.MsrReads,
+    st.MsrWrites,
+    st.MmioReads,
+    st.MmioWrites,
+    gSimNumRegs);
+}
@@ -0,0 +1,99 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#pragma once
+
+#include "IoBackend.h"
+
+/*******************************************************************************
+ * I/O simulator
+ * 
+ * Deterministic model of one package: a register file for MSRs and MMIO, 
+ * and the OC mailbox (MSR 0x150) state machine.
+ * 
+ * A mailbox command completes after LatencyPolls (+ pseudo-random jitter) 
+ * reads of the busy interface. Write commands (odd IDs) store their data, 
+ * read commands (write ID - 1) return it - so a V/F or IccMax write reads 
+ * back as written, as on hardware. Failures are injected by command count.
+ * 
+ * Nothing here touches hardware except through cfg.Backing, which seeds
+ * registers that have not been set on their first read. Leave it NULL for
+ * a fully synthetic machine, seeded with IoSim_SetMsr / IoSim_SetMmio
+ ******************************************************************************/
+
+typedef struct _IOSIM_CONFIG {
+  UINT32  LatencyPolls;           // Busy reads before a command completes
+  UINT32  JitterPolls;            // + 0..JitterPolls, from Seed
+  UINT32  Seed;
+  UINT32  FailEvery;              // Nth command completes with FailCode
+  UINT32  StuckEvery;             // Nth command never clears busy
+  UINT32  FlipEvery;              // Nth completion reads back once garbled
+  UINT8   FailCode;
+  UINT8   pad[3];
+  UINT32  VrTopology;             // OC_CMD_GET_VR_TOPOLOGY response
+  UINT32  Mchbar;                 // Host bridge MCHBAR (0: from Backing)
+  const IO_BACKEND* Backing;      // Seeds unset registers (NULL: zero)
+} IOSIM_CONFIG;
+
+typedef struct _IOSIM_STATS {
+  UINT32  Commands;
+  UINT32  Failed;
+  UINT32  Stuck;
+  UINT32  Flipped;
+  UINT64  BusyPolls;
+  UINT64  MsrReads;
+  UINT64  MsrWrites;
+  UINT64  MmioReads;
+  UINT64  MmioWrites;
+} IOSIM_STATS;
+
+/*******************************************************************************
+ * IoSim_DefaultConfig
+ ******************************************************************************/
+
+VOID EFIAPI IoSim_DefaultConfig(OUT IOSIM_CONFIG* cfg);
+
+/*******************************************************************************
+ * IoSim_Start
+ * Resets the model (NULL = default config), returns the simulator backend
+ ******************************************************************************/
+
+const IO_BACKEND* EFIAPI IoSim_Start(IN const IOSIM_CONFIG* cfg OPTIONAL);
+
+/*******************************************************************************
+ * IoSim_SetMsr / IoSim_SetMmio / IoSim_GetMsr
+ ******************************************************************************/
+
+BOOLEAN EFIAPI IoSim_SetMsr(IN const UINT32 msr_idx, IN const UINT64 value);
+BOOLEAN EFIAPI IoSim_SetMmio(IN const UINT32 addr, IN const UINT32 value);
+UINT64 EFIAPI IoSim_GetMsr(IN const UINT32 msr_idx);
+
+/*******************************************************************************
+ * IoSim_GetStats / IoSim_PrintStats
+ ******************************************************************************/
+
+VOID EFIAPI IoSim_GetStats(OUT IOSIM_STATS* stats);
+VOID EFIAPI IoSim_PrintStats(VOID);
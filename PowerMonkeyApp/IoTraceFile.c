@@ -0,0 +1,194 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Protocol/LoadedImage.h>
+#include <Protocol/SimpleFileSystem.h>
+
+#include "IoTraceFile.h"
+
+/*******************************************************************************
+ * Globals
+ ******************************************************************************/
+
+extern EFI_BOOT_SERVICES* gBS;
+extern EFI_HANDLE gImageHandle;
+
+/*******************************************************************************
+ * OpenTraceFile
+ ******************************************************************************/
+
+static EFI_STATUS OpenTraceFile( IN const UINT64 mode, 
+                                 OUT EFI_FILE_PROTOCOL** file )
+{
+  EFI_LOADED_IMAGE_PROTOCOL* image = NULL;
+  EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* fs = NULL;
+  EFI_FILE_PROTOCOL* root = NULL;
+
+  EFI_STATUS status = gBS->HandleProtocol(gImageHandle, 
+    &gEfiLoadedImageProtocolGuid, (VOID**)&image);
+
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+
+  status = gBS->HandleProtocol(image->DeviceHandle, 
+    &gEfiSimpleFileSystemProtocolGuid, (VOID**)&fs);
+
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+
+  status = fs->OpenVolume(fs, &root);
+
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+
+  status = root->Open(root, file, IO_TRACE_FILE_NAME, mode, 0);
+
+  root->Close(root);
+
+  return status;
+}
+
+/*******************************************************************************
+ * IoTrace_Save
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI IoTrace_Save(
+  IN const IO_TRACE_HEADER* trace,
+  IN const UINTN size)
+{
+  EFI_FILE_PROTOCOL* file = NULL;
+
+  if ((!trace) || (size < sizeof(IO_TRACE_HEADER))) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // Delete first - a shorter trace must not keep the tail of a longer one
+
+  EFI_STATUS status = OpenTraceFile(
+    EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, &file);
+
+  if (!EFI_ERROR(status)) {
+    file->Delete(file);
+  }
+
+  status = OpenTraceFile(
+    EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE, &file);
+
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+
+  UINTN written = size;
+
+  status = file->Write(file, &written, (VOID*)trace);
+
+  if ((!EFI_ERROR(status)) && (written != size)) {
+    status = EFI_VOLUME_FULL;
+  }
+
+  file->Close(file);
+
+  return status;
+}
+
+/*******************************************************************************
+ * IoTrace_Load
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI IoTrace_Load(OUT IO_TRACE_HEADER** trace)
+{
+  EFI_FILE_PROTOCOL* file = NULL;
+  IO_TRACE_HEADER hdr;
+
+  *trace = NULL;
+
+  EFI_STATUS status = OpenTraceFile(EFI_FILE_MODE_READ, &file);
+
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+
+  UINTN got = sizeof(hdr);
+
+  status = file->Read(file, &got, &hdr);
+
+  if ((!EFI_ERROR(status)) && 
+      ((got != sizeof(hdr)) ||
+       (hdr.Magic != IO_TRACE_MAGIC) ||
+       (hdr.Version != IO_TRACE_VERSION) ||
+       (hdr.RecordSize != sizeof(IO_TRACE_RECORD)) ||
+       (hdr.Count > hdr.Capacity))) {
+    status = EFI_LOAD_ERROR;
+  }
+
+  if (EFI_ERROR(status)) {
+    file->Close(file);
+    return status;
+  }
+
+  //
+  // Only the records written are saved, whatever the capacity was
+
+  const UINTN recBytes = (UINTN)hdr.Count * sizeof(IO_TRACE_RECORD);
+
+  IO_TRACE_HEADER* buf = 
+    (IO_TRACE_HEADER*)AllocatePool(sizeof(IO_TRACE_HEADER) + recBytes);
+
+  if (!buf) {
+    file->Close(file);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  CopyMem(buf, &hdr, sizeof(hdr));
+
+  got = recBytes;
+
+  status = (recBytes) ? 
+    file->Read(file, &got, IO_TRACE_RECORDS(buf)) : EFI_SUCCESS;
+
+  file->Close(file);
+
+  if ((!EFI_ERROR(status)) && (got != recBytes)) {
+    status = EFI_LOAD_ERROR;
+  }
+
+  if (EFI_ERROR(status)) {
+    FreePool(buf);
+    return status;
+  }
+
+  *trace = buf;
+
+  return EFI_SUCCESS;
+}
@@ -0,0 +1,57 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#pragma once
+
+#include "IoBackend.h"
+
+/*******************************************************************************
+ * I/O trace file
+ * 
+ * A recorded trace is saved in the root of the volume PowerMonkey was 
+ * started from, to be replayed on the next boot (gIoBackendMode = 3) or 
+ * by the host simulator build (HostSim/).
+ * 
+ * Uses boot services: BSP only
+ ******************************************************************************/
+
+#define IO_TRACE_FILE_NAME        L"\\PowerMonkey.iotrace"
+
+/*******************************************************************************
+ * IoTrace_Save
+ * Replaces the trace file with size bytes of trace (header + records)
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI IoTrace_Save(
+  IN const IO_TRACE_HEADER* trace, 
+  IN const UINTN size);
+
+/*******************************************************************************
+ * IoTrace_Load
+ * Reads and validates the trace file, *trace is allocated here (FreePool)
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI IoTrace_Load(OUT IO_TRACE_HEADER** trace);
@@ -34,7 +34,9 @@
 
 #include "SaferAsmHdr.h"
 #include "LowLevel.h"
+#include "IoBackend.h"
 #include "MiniLog.h"
+#include "PerCpu.h"
 
 /*******************************************************************************
  * Compiler Overrides
@@ -101,6 +103,7 @@ VOID EFIAPI HandleProbingFault(MINISTAT *pst)
     /////////////////////////////////////////////////////////////
     
     MiniTraceEx("PowerMonkey has encountered a fatal error during operation.\n");    
+    DrainTraceNow();
   }
 
   //
@@ -134,6 +137,32 @@ VOID EFIAPI SetCpuGSBase(const void* addr)
 }
 
 
+/*******************************************************************************
+ * pm_spin_lock
+ ******************************************************************************/
+
+VOID EFIAPI pm_spin_lock(volatile UINT32* lock)
+{
+  while (hlp_atomic_cmpxchg_u32((UINT32*)lock, 0, 1) != 0) {
+
+    //
+    // Spin on a plain read to avoid hammering the line with locked ops
+
+    while (*lock) {
+      _mm_pause();
+    }
+  }
+}
+
+/*******************************************************************************
+ * pm_spin_unlock
+ ******************************************************************************/
+
+VOID EFIAPI pm_spin_unlock(volatile UINT32* lock)
+{
+  hlp_atomic_cmpxchg_u32((UINT32*)lock, 1, 0);
+}
+
 /*******************************************************************************
  * GetPCIeBaseAddress
  ******************************************************************************/
@@ -163,12 +192,19 @@ VOID EFIAPI InitializeMMIO(VOID)
 
 /*******************************************************************************
  * Below routines are wrappers for ASM + Error Handling
+ * (the access itself goes through the selected I/O backend, see IoBackend.h)
  ******************************************************************************/
 
 UINT64 EFIAPI pm_rdmsr64(const UINT32 msr_idx)
 { 
   UINT32 err = 0;
-  UINT64 val = safer_rdmsr64(msr_idx, &err);
+  UINT64 val = gIo->RdMsr64(msr_idx, &err);
+
+  PERCPU_SCRATCH* scratch = PerCpu_Scratch();
+
+  if (scratch) {
+    scratch->MsrReads++;
+  }
 
   MiniTrace(MINILOG_OPID_RDMSR64, 1, (UINT32)msr_idx, (err)?0xBAAD : val);
 
@@ -196,7 +232,13 @@ UINT32 EFIAPI pm_wrmsr64(const UINT32 msr_idx, const UINT64 value)
 {
   MiniTrace(MINILOG_OPID_WRMSR64, 1, (UINT32)msr_idx, value);
 
-  UINT32 err = safer_wrmsr64(msr_idx, value);
+  UINT32 err = gIo->WrMsr64(msr_idx, value);
+
+  PERCPU_SCRATCH* scratch = PerCpu_Scratch();
+
+  if (scratch) {
+    scratch->MsrWrites++;
+  }
 
   if (err) {
 
@@ -221,9 +263,9 @@ UINT32 EFIAPI pm_wrmsr64(const UINT32 msr_idx, const UINT64 value)
 UINT32 EFIAPI pm_mmio_read32(const UINT32 addr)
 {  
   UINT32 err = 0;
-  UINT32 val = safer_mmio_read32(addr, &err);
+  UINT32 val = gIo->MmioRead32(addr, &err);
 
-  MiniTrace(MINILOG_OPID_MMIO_READ32, 0, (UINT64)((err) ? 0xBAAD : (UINT64)val) | (UINT64)addr<<32, 0);
+  MiniTrace(MINILOG_OPID_MMIO_READ32, 0, addr, (err) ? 0xBAAD : (UINT64)val);
 
   if (err) {
 
@@ -247,9 +289,9 @@ UINT32 EFIAPI pm_mmio_read32(const UINT32 addr)
 
 UINT32 EFIAPI pm_mmio_or32(const UINT32 addr, const UINT32 value)
 {
-  MiniTrace(MINILOG_OPID_MMIO_OR32, 0, (UINT64)value | (UINT64)addr<<32, 1);
+  MiniTrace(MINILOG_OPID_MMIO_OR32, 1, addr, (UINT64)value);
 
-  UINT32 err = safer_mmio_or32(addr, value);
+  UINT32 err = gIo->MmioOr32(addr, value);
 
   if (err) {
 
@@ -273,9 +315,9 @@ UINT32 EFIAPI pm_mmio_or32(const UINT32 addr, const UINT32 value)
 
 UINT32 EFIAPI pm_mmio_write32(const UINT32 addr, const UINT32 value)
 {
-  MiniTrace(MINILOG_OPID_MMIO_WRITE32, 0, (UINT64)value | (UINT64)addr << 32, 1);
+  MiniTrace(MINILOG_OPID_MMIO_WRITE32, 1, addr, (UINT64)value);
 
-  UINT32 err = safer_mmio_write32(addr, value);
+  UINT32 err = gIo->MmioWrite32(addr, value);
 
   if (err) {
 
@@ -47,6 +47,14 @@ VOID* EFIAPI GetCpuGSBase();
 
 VOID EFIAPI SetCpuGSBase(const void* addr);
 
+/*******************************************************************************
+ * pm_spin_lock / pm_spin_unlock
+ * Minimal spin lock (0 = free) usable from any CPU, BSP or AP
+ ******************************************************************************/
+
+VOID EFIAPI pm_spin_lock(volatile UINT32* lock);
+VOID EFIAPI pm_spin_unlock(volatile UINT32* lock);
+
 /*******************************************************************************
  * InitializeMMIO
  ******************************************************************************/
@@ -34,6 +34,8 @@
 #include <Library/BaseLib.h>
 #include <Library/PrintLib.h>
 #include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/BaseMemoryLib.h>
 #include <Protocol/MpService.h>
 #include <Library/SynchronizationLib.h>
 
@@ -42,10 +44,15 @@
 #endif
 
 #include "CONFIGURATION.h"
+#include "Constants.h"
 #include "MiniLog.h"
 #include "Platform.h"
 #include "LowLevel.h"
 #include "DelayX86.h"
+#include "PerCpu.h"
+#include "SaferAsmHdr.h"
+#include "NvCache.h"
+#include "ASMx64/GlyphBlit.h"
 
 extern PLATFORM* gPlatform;
 
@@ -57,6 +64,10 @@ extern PLATFORM* gPlatform;
 #include <x86intrin.h>
 #else
 #pragma intrinsic(__rdtsc)
+#ifdef ENABLE_MINILOG_PERSISTENT
+#pragma intrinsic(_mm_clflush)
+#pragma intrinsic(_mm_sfence)
+#endif
 #endif
 
 
@@ -139,12 +150,200 @@ BOOLEAN haveConsole = 0;
 
 /* font to be used */
 ssfn_font_t* font = (ssfn_font_t *) & _bmp_font[0];
-unsigned char* lfb;
+unsigned char* lfb;                 /* draw target - the back buffer if any */
+unsigned char* gFrontBuffer = NULL; /* GOP framebuffer */
+UINTN gBackBufferPages = 0;
 
 EFI_GUID gopGuid = EFI_GRAPHICS_OUTPUT_PROTOCOL_GUID;
 EFI_GRAPHICS_OUTPUT_PROTOCOL* gop = NULL;
 
 
+/*******************************************************************************
+ * Glyph atlas
+ * 
+ * Printable ASCII pre-rasterized into 1-bit rows at InitMiniConsole, so that
+ * drawing a character does not need to walk the font's character table and 
+ * decode fragments every time. Anything else goes through the font.
+ ******************************************************************************/
+
+#define GLYPH_FIRST                                             0x20
+#define GLYPH_LAST                                              0x7E
+#define GLYPH_MAX_ROWS                                          32
+#define GLYPH_MAX_WIDTH                                         32
+
+#define CR4_OSXSAVE                                             bit18u32
+#define XCR0_SSE_AVX                                            0x06
+
+typedef struct _MiniGlyph {
+  UINT32  rows[GLYPH_MAX_ROWS];       // Bit n = pixel n
+  UINT8   nRows;
+  UINT8   advX;
+  UINT8   advY;
+  UINT8   valid;                      // Character exists in the font
+} MiniGlyph;
+
+MiniGlyph gGlyphs[GLYPH_LAST - GLYPH_FIRST + 1];
+BOOLEAN gHaveGlyphAtlas = FALSE;
+BOOLEAN gGlyphAvx2 = FALSE;
+
+/*******************************************************************************
+ * FindGlyph
+ * Code based on POSIX-UEFI, Copyright (C) 2021 bzt* 
+ ******************************************************************************/
+
+static unsigned char* FindGlyph(unsigned int c)
+{
+  unsigned char* ptr;
+  int i, j;
+
+  for (ptr = (unsigned char*)font + font->characters_offs, i = 0; i < 0x110000; i++) {
+    if (ptr[0] == 0xFF) { i += 65535; ptr++; }
+    else if ((ptr[0] & 0xC0) == 0xC0) { j = (((ptr[0] & 0x3F) << 8) | ptr[1]); i += j; ptr += 2; }
+    else if ((ptr[0] & 0xC0) == 0x80) { j = (ptr[0] & 0x3F); i += j; ptr++; }
+    else { if ((unsigned int)i == c) { return ptr; } ptr += 6 + ptr[1] * (ptr[0] & 0x40 ? 6 : 5); }
+  }
+
+  return NULL;
+}
+
+/*******************************************************************************
+ * DrawGlyph
+ * Decodes the fragments straight into the framebuffer (o = top-left pixel)
+ ******************************************************************************/
+
+static VOID DrawGlyph(unsigned char* chr, UINT64 o, UINT32 color)
+{
+  unsigned char* ptr, * frg;
+  UINT64 p;
+  int i, j, k, l, m, n;
+
+  ptr = chr + 6;
+  for (i = n = 0; i < chr[1]; i++, ptr += chr[0] & 0x40 ? 6 : 5) {
+    if (ptr[0] == 255 && ptr[1] == 255) continue;
+    frg = (unsigned char*)font + (chr[0] & 0x40 ? ((ptr[5] << 24) | (ptr[4] << 16) | (ptr[3] << 8) | ptr[2]) :
+      ((ptr[4] << 16) | (ptr[3] << 8) | ptr[2]));
+    if ((frg[0] & 0xE0) != 0x80) continue;
+    o += (int)(ptr[1] - n) * fbPitch; n = ptr[1];
+    k = ((frg[0] & 0x1F) + 1) << 3; j = frg[1] + 1; frg += 2;
+    for (m = 1; j; j--, n++, o += fbPitch)
+      for (p = o, l = 0; l < k; l++, p += 4, m <<= 1) {
+        if (m > 0x80) { frg++; m = 1; }
+        if (*frg & m) *((unsigned int*)p) = color;
+      }
+  }
+}
+
+/*******************************************************************************
+ * RasterizeGlyph
+ * Same decoding as DrawGlyph, into 1-bit rows. FALSE if it does not fit.
+ ******************************************************************************/
+
+static BOOLEAN RasterizeGlyph(unsigned char* chr, MiniGlyph* g)
+{
+  unsigned char* ptr, * frg;
+  int i, j, k, l, m, n;
+
+  SetMem(g, sizeof(MiniGlyph), 0);
+
+  ptr = chr + 6;
+  for (i = n = 0; i < chr[1]; i++, ptr += chr[0] & 0x40 ? 6 : 5) {
+    if (ptr[0] == 255 && ptr[1] == 255) continue;
+    frg = (unsigned char*)font + (chr[0] & 0x40 ? ((ptr[5] << 24) | (ptr[4] << 16) | (ptr[3] << 8) | ptr[2]) :
+      ((ptr[4] << 16) | (ptr[3] << 8) | ptr[2]));
+    if ((frg[0] & 0xE0) != 0x80) continue;
+    n = ptr[1];
+    k = ((frg[0] & 0x1F) + 1) << 3; j = frg[1] + 1; frg += 2;
+    for (m = 1; j; j--, n++)
+      for (l = 0; l < k; l++, m <<= 1) {
+        if (m > 0x80) { frg++; m = 1; }
+        if (!(*frg & m)) continue;
+        if ((n >= GLYPH_MAX_ROWS) || (l >= GLYPH_MAX_WIDTH)) return FALSE;
+        g->rows[n] |= 1u << l;
+        g->nRows = (UINT8)((n + 1 > g->nRows) ? n + 1 : g->nRows);
+      }
+  }
+
+  g->advX = (UINT8)(chr[4] + 1);
+  g->advY = chr[5];
+  g->valid = 1;
+
+  return TRUE;
+}
+
+/*******************************************************************************
+ * InitGlyphAtlas
+ ******************************************************************************/
+
+static VOID InitGlyphAtlas()
+{
+  UINT32 regs[4] = { 0 };
+
+  for (unsigned int c = GLYPH_FIRST; c <= GLYPH_LAST; c++) {
+    
+    MiniGlyph* g = &gGlyphs[c - GLYPH_FIRST];
+    unsigned char* chr = FindGlyph(c);
+
+    if (!chr) {
+      SetMem(g, sizeof(MiniGlyph), 0);
+    }
+    else if (!RasterizeGlyph(chr, g)) {
+      return;
+    }
+  }
+
+  //
+  // AVX2 expansion - if supported (whether YMM state is enabled is checked 
+  // at draw time, on the CPU that draws)
+
+  _pm_cpuid(0x00, regs);
+
+  const UINT32 maxLeaf = regs[0];
+
+  _pm_cpuid(0x01, regs);
+
+  if ((regs[2] & bit28u32) && (maxLeaf >= 0x07)) {
+    _pm_cpuid_ex(0x07, 0, regs);
+    gGlyphAvx2 = (BOOLEAN)((regs[1] & bit5u32) != 0);
+  }
+
+  gHaveGlyphAtlas = TRUE;
+}
+
+/*******************************************************************************
+ * YmmUsable
+ * AVX2 is supported and YMM state is enabled on this CPU
+ ******************************************************************************/
+
+static BOOLEAN YmmUsable()
+{
+  return (BOOLEAN)((gGlyphAvx2) && 
+    (hlp_read_cr4() & CR4_OSXSAVE) &&
+    ((hlp_xgetbv(0) & XCR0_SSE_AVX) == XCR0_SSE_AVX));
+}
+
+/*******************************************************************************
+ * BlitGlyph
+ ******************************************************************************/
+
+static VOID BlitGlyph(const MiniGlyph* g, UINT64 o, UINT32 color, BOOLEAN avx2)
+{
+  if (avx2) {
+    glyph_blit_avx2((UINT32*)o, fbPitch, g->rows, g->nRows, color);
+    return;
+  }
+
+  for (UINTN row = 0; row < g->nRows; row++, o += fbPitch) {
+    
+    UINT32 bits = g->rows[row];
+    UINT32* px = (UINT32*)o;
+
+    while (bits) {
+      px[LowBitSet32(bits)] = color;
+      bits &= bits - 1;
+    }
+  }
+}
+
 /*******************************************************************************
  * OutputRawString
  * Code based on POSIX-UEFI, Copyright (C) 2021 bzt* 
@@ -152,40 +351,35 @@ EFI_GRAPHICS_OUTPUT_PROTOCOL* gop = NULL;
 
 VOID OutputRawString(UINT32 x, UINT32 y, CHAR8* s, UINT32 color)
 {
-  unsigned char* ptr, * chr, * frg;
+  unsigned char* chr;
   unsigned int c;
-  UINT64 o, p;
-  int i, j, k, l, m, n;
+
+  const BOOLEAN avx2 = YmmUsable();
+
   while (*s) {
     c = *s; s += 1;
     if (c == '\r') { x = 0; continue; }
     else
       if (c == '\n') { x = 0; y += font->fbHeight; continue; }
-    for (ptr = (unsigned char*)font + font->characters_offs, chr = 0, i = 0; i < 0x110000; i++) {
-      if (ptr[0] == 0xFF) { i += 65535; ptr++; }
-      else if ((ptr[0] & 0xC0) == 0xC0) { j = (((ptr[0] & 0x3F) << 8) | ptr[1]); i += j; ptr += 2; }
-      else if ((ptr[0] & 0xC0) == 0x80) { j = (ptr[0] & 0x3F); i += j; ptr++; }
-      else { if ((unsigned int)i == c) { chr = ptr; break; } ptr += 6 + ptr[1] * (ptr[0] & 0x40 ? 6 : 5); }
+    
+    UINT64 o = (UINT64)lfb + y * fbPitch + x * 4;
+
+    if ((gHaveGlyphAtlas) && (c >= GLYPH_FIRST) && (c <= GLYPH_LAST)) {
+      
+      const MiniGlyph* g = &gGlyphs[c - GLYPH_FIRST];
+
+      if (!g->valid) continue;
+      
+      BlitGlyph(g, o, color, avx2);
+      x += g->advX; y += g->advY;
+      continue;
     }
+
+    chr = FindGlyph(c);
     if (!chr) continue;
-    ptr = chr + 6; o = (UINT64)lfb + y * fbPitch + x * 4;
-    for (i = n = 0; i < chr[1]; i++, ptr += chr[0] & 0x40 ? 6 : 5) {
-      if (ptr[0] == 255 && ptr[1] == 255) continue;
-      frg = (unsigned char*)font + (chr[0] & 0x40 ? ((ptr[5] << 24) | (ptr[4] << 16) | (ptr[3] << 8) | ptr[2]) :
-        ((ptr[4] << 16) | (ptr[3] << 8) | ptr[2]));
-      if ((frg[0] & 0xE0) != 0x80) continue;
-      o += (int)(ptr[1] - n) * fbPitch; n = ptr[1];
-      k = ((frg[0] & 0x1F) + 1) << 3; j = frg[1] + 1; frg += 2;
-      for (m = 1; j; j--, n++, o += fbPitch)
-        for (p = o, l = 0; l < k; l++, p += 4, m <<= 1) {
-          if (m > 0x80) { frg++; m = 1; }
-          if (*frg & m) *((unsigned int*)p) = color;
-        }
-    }
+    DrawGlyph(chr, o, color);
     x += chr[4] + 1; y += chr[5];
   }
-
-
 }
 
 /*******************************************************************************
@@ -207,10 +401,26 @@ VOID InitMiniConsole()
     }
 
     /* set up destination buffer */
-    lfb = (unsigned char*)gop->Mode->FrameBufferBase;
+    gFrontBuffer = (unsigned char*)gop->Mode->FrameBufferBase;
     fbWidth = gop->Mode->Info->HorizontalResolution;
     fbHeight = gop->Mode->Info->VerticalResolution;
     fbPitch = sizeof(unsigned int) * gop->Mode->Info->PixelsPerScanLine;
+
+    //
+    // Everything is drawn into a back buffer in normal (write-back) memory 
+    // and only changed rows get copied to the framebuffer, see 
+    // Compositor_Flush. Without one, draw straight into the framebuffer.
+
+    gBackBufferPages = EFI_SIZE_TO_PAGES((UINTN)fbPitch * fbHeight);
+    lfb = (unsigned char*)AllocatePages(gBackBufferPages);
+
+    if (lfb) {
+      ZeroMem(lfb, (UINTN)fbPitch * fbHeight);
+    }
+    else {
+      lfb = gFrontBuffer;
+      gBackBufferPages = 0;
+    }
   }
   else {
     fbHeight = fbWidth = fbPitch = 0;
@@ -218,84 +428,593 @@ VOID InitMiniConsole()
 
   haveConsole = ((fbHeight != 0) && (fbWidth != 0));
 
+  if (haveConsole) {
+    InitGlyphAtlas();
+  }
+
 }
 
 /*******************************************************************************
- * InitTrace
+ * Compositor
+ * 
+ * Dirty tracking is per text row ("band", font height) of the whole screen.
+ * Flushing happens from the trace consumer, so at most once per 
+ * MINILOG_DRAIN_INTERVAL_US.
  ******************************************************************************/
 
-void InitTrace()
+#define MAX_BANDS                                               512
+
+UINT8 gDirtyBands[MAX_BANDS] = { 0 };
+BOOLEAN gAnyDirty = FALSE;
+
+/*******************************************************************************
+ * Compositor_MarkDirty
+ ******************************************************************************/
+
+static VOID Compositor_MarkDirty(IN const UINTN y, IN const UINTN height)
 {
-  InitMiniConsole();
+  const UINTN first = y / font->fbHeight;
+  const UINTN last = (y + height - 1) / font->fbHeight;
+
+  for (UINTN band = first; (band <= last) && (band < MAX_BANDS); band++) {
+    gDirtyBands[band] = 1;
+  }
+
+  gAnyDirty = TRUE;
 }
 
+/*******************************************************************************
+ * CopyToFront
+ * Rows [y, y + height) of the back buffer, preferably with streaming stores
+ ******************************************************************************/
+
+static VOID CopyToFront(IN const UINTN y, IN const UINTN height)
+{
+  const UINTN offset = y * fbPitch;
+  const UINTN bytes = height * fbPitch;
+  const UINTN dst = (UINTN)gFrontBuffer + offset;
+
+  if ((bytes & 63) || (dst & 15)) {
+    
+    gop->Blt(gop, (EFI_GRAPHICS_OUTPUT_BLT_PIXEL*)lfb, EfiBltBufferToVideo,
+      0, y, 0, y, fbWidth, height, fbPitch);
+  }
+  else if ((!(dst & 31)) && (YmmUsable())) {
+    fb_stream_copy_avx2((VOID*)dst, lfb + offset, bytes);
+  }
+  else {
+    fb_stream_copy_sse2((VOID*)dst, lfb + offset, bytes);
+  }
+}
 
 /*******************************************************************************
- *
+ * Compositor_Flush
+ * Copies runs of dirty bands (clipped to the screen) to the framebuffer
  ******************************************************************************/
 
-void MiniTrace(
-               const UINT8  operId,
-               const UINT8  dangerous,
-               const UINT32 param1,
-               const UINT64 param2
-                )
+static VOID Compositor_Flush()
+{
+  if ((!gAnyDirty) || (lfb == gFrontBuffer)) {
+    gAnyDirty = FALSE;
+    return;
+  }
+
+  const UINTN nBands = (fbHeight + font->fbHeight - 1) / font->fbHeight;
+
+  for (UINTN band = 0; (band < nBands) && (band < MAX_BANDS); band++) {
+    
+    if (!gDirtyBands[band]) {
+      continue;
+    }
+
+    UINTN end = band;
+
+    while ((end < nBands) && (end < MAX_BANDS) && (gDirtyBands[end])) {
+      gDirtyBands[end++] = 0;
+    }
+
+    const UINTN y = band * font->fbHeight;
+    const UINTN yEnd = end * font->fbHeight;
+
+    CopyToFront(y, ((yEnd < fbHeight) ? yEnd : fbHeight) - y);
+
+    band = end;
+  }
+
+  gAnyDirty = FALSE;
+}
+
+/*******************************************************************************
+ * Panes
+ * 
+ * Every CPU gets a pane of scrolling lines. Panes are stacked in as many 
+ * columns (up to MINILOG_PANE_MAX_COLS) as needed to give each at least 
+ * MINILOG_PANE_MIN_LINES - and at least one line if the screen is really 
+ * short of space. CPUs that still do not fit get no pane.
+ ******************************************************************************/
+
+typedef struct _MiniLogPane {
+  UINT32  x;                          // Pixels
+  UINT32  y;
+  UINT32  width;
+  UINT32  lines;                      // 0 = no pane
+  UINT32  used;                       // Lines filled so far
+  UINT32  maxChars;
+} MiniLogPane;
+
+MiniLogPane* gPanes = NULL;
+
+/*******************************************************************************
+ * Panes_Layout
+ ******************************************************************************/
+
+static VOID Panes_Layout(IN const UINTN nCpus)
 {
-  ///
-  /// Idiot's thread safety with no locks:
-  /// each core gets a designated "stripe" of the video frame buffer
-  /// I will make something better one day when I have more time...
-  ///
+  if ((!haveConsole) || (!nCpus)) {
+    return;
+  }
+
+  gPanes = (MiniLogPane*)AllocateZeroPool(nCpus * sizeof(MiniLogPane));
+
+  if (!gPanes) {
+    return;
+  }
+
+  //
+  // Line 0 is kept free, like before
+
+  const UINTN lineH = font->fbHeight;
+  const UINTN rowsAvail = (fbHeight / lineH) ? (fbHeight / lineH) - 1 : 0;
+  const UINTN cellW = (gHaveGlyphAtlas) ? 
+    gGlyphs['M' - GLYPH_FIRST].advX : font->fbWidth;
+
+  UINTN cols = 1;
+
+  while ((cols < MINILOG_PANE_MAX_COLS) &&
+         (((nCpus + cols - 1) / cols) * MINILOG_PANE_MIN_LINES > rowsAvail)) {
+    cols++;
+  }
+
+  const UINTN perCol = (nCpus + cols - 1) / cols;
   
-  if (haveConsole) {
+  UINTN paneLines = rowsAvail / perCol;
+
+  paneLines = (paneLines > MINILOG_PANE_MAX_LINES) ? 
+    MINILOG_PANE_MAX_LINES : paneLines;
+  paneLines = (paneLines) ? paneLines : 1;
+
+  const UINTN paneW = fbWidth / cols;
+
+  for (UINTN cidx = 0; cidx < nCpus; cidx++) {
     
+    MiniLogPane* pane = &gPanes[cidx];
+    const UINTN row = (cidx % perCol) * paneLines;
+
+    if (row + paneLines > rowsAvail) {
+      continue;
+    }
+
+    pane->x = (UINT32)((cidx / perCol) * paneW);
+    pane->y = (UINT32)((1 + row) * lineH);
+    pane->width = (UINT32)paneW;
+    pane->lines = (UINT32)paneLines;
+    pane->maxChars = (UINT32)((cellW) ? (paneW - 1) / cellW : 0);
+  }
+}
+
+/*******************************************************************************
+ * Pane_Append
+ * Adds a line at the bottom of the pane, scrolling it if full
+ ******************************************************************************/
+
+static VOID Pane_Append(IN MiniLogPane* pane, 
+  IN CONST CHAR8* text, 
+  IN const UINT32 color)
+{
+  const UINTN lineH = font->fbHeight;
+  const UINTN rowBytes = pane->width * 4;
+  UINT8* base = lfb + (UINTN)pane->y * fbPitch + (UINTN)pane->x * 4;
+
+  if (!pane->lines) {
+    return;
+  }
+
+  if (pane->used == pane->lines) {
+
     //
-    // Timestamp
+    // Scroll up by one line (back buffer - cheap)
+
+    for (UINTN row = lineH; row < pane->lines * lineH; row++) {
+      CopyMem(base + (row - lineH) * fbPitch, base + row * fbPitch, rowBytes);
+    }
+
+    Compositor_MarkDirty(pane->y, pane->lines * lineH);
+  }
+  else {
+    pane->used++;
+    Compositor_MarkDirty(pane->y + (pane->used - 1) * lineH, lineH);
+  }
 
-    UINT64 tsns = TicksToNanoSeconds(ReadTsc());
+  const UINTN lineY = pane->y + (pane->used - 1) * lineH;
+  UINT8* line = lfb + lineY * fbPitch + (UINTN)pane->x * 4;
+
+  for (UINTN row = 0; row < lineH; row++) {
+    ZeroMem(line + row * fbPitch, rowBytes);
+  }
+
+  //
+  // Clip to the pane
+
+  CHAR8 clipped[160] = { 0 };
+  
+  AsciiStrnCpyS(clipped, sizeof(clipped), text, 
+    (pane->maxChars < sizeof(clipped) - 1) ? 
+    pane->maxChars : sizeof(clipped) - 1);
+
+  OutputRawString(pane->x, (UINT32)lineY, clipped, color);
+}
+
+/*******************************************************************************
+ * Trace rings
+ ******************************************************************************/
+
+MiniLogArea* gTraceArea = NULL;
+UINTN gTraceAreaPages = 0;
+MiniLogRing* gTraceRings = NULL;
+MiniLogMsgRing* gMsgRings = NULL;
+UINTN gTraceRingCnt = 0;
+
+volatile UINT32 gTraceDrainBusy = 0;
+UINT64 gTraceLastDrain = 0;
+
+/*******************************************************************************
+ * Format registry (MiniLogArea.fmtKeys/fmtText)
+ * 
+ * Open-addressed table of format string pointers, the slot index is what
+ * gets stored in the records. Each slot packs the pointer (bits 55:0) and 
+ * the number of arguments the format consumes (bits 62:56), so it can be 
+ * published with a single store and never seen half-written. A slot is 
+ * claimed (cmpxchg) with FMT_PENDING set, the key is published only once
+ * its text is in place.
+ ******************************************************************************/
+
+#define FMT_PTR_MASK                                    0x00FFFFFFFFFFFFFFULL
+#define FMT_NARGS_SHIFT                                 56
+#define FMT_PENDING                                     0x8000000000000000ULL
+
+/*******************************************************************************
+ * PersistLines
+ * 
+ * Persistent mode: writes the cache lines of a just-written range back to 
+ * memory, so that a hang followed by a reset that skips the cache flush 
+ * still leaves the record there. CLFLUSH rather than CLWB - the latter is
+ * missing on the older client parts
+ ******************************************************************************/
+
+#ifdef ENABLE_MINILOG_PERSISTENT
+
+static VOID PersistLines(IN CONST VOID* ptr, IN const UINTN size)
+{
+  const UINTN end = (UINTN)ptr + size;
+
+  for (UINTN line = (UINTN)ptr & ~((UINTN)CACHE_LINE_SIZE - 1); 
+    line < end; line += CACHE_LINE_SIZE) {
+    _mm_clflush((CONST VOID*)line);
+  }
+
+  _mm_sfence();
+}
+
+#else
+#define PersistLines(ptr, size)
+#endif
+
+/*******************************************************************************
+ * CountFmtArgs
+ ******************************************************************************/
+
+static UINT8 CountFmtArgs(IN CONST CHAR8* format)
+{
+  UINT8 nArgs = 0;
+
+  for (CONST CHAR8* ch = format; *ch; ch++) {
+    
+    if (*ch != '%') {
+      continue;
+    }
+
+    ch++;
+
+    if (*ch == '%') {
+      continue;
+    }
 
     //
-    // Get absolute core idx and use it to find the Y position for the trace
+    // Flags and width, '*' takes an argument of its own
+
+    while ((*ch == '-') || (*ch == '+') || (*ch == ' ') || (*ch == ',') ||
+           (*ch == '*') || (*ch == '.') || (*ch == 'l') || (*ch == 'L') ||
+           ((*ch >= '0') && (*ch <= '9'))) {
+      if (*ch == '*') {
+        nArgs++;
+      }
+      ch++;
+    }
+
+    nArgs++;
+
+    if (!*ch) {
+      break;
+    }
+  }
 
-    VOID* gsbase = GetCpuGSBase();
+  return (nArgs > MINILOG_FMT_MAX_ARGS) ? MINILOG_FMT_MAX_ARGS : nArgs;
+}
 
-    CPUCORE* core = gsbase;
+/*******************************************************************************
+ * CopyFmtText
+ * The copy is decoded by the next boot, where string arguments point to 
+ * nowhere - they are printed as pointers (%p) instead
+ ******************************************************************************/
 
-    UINT8 pkgIdx = core->PkgIdx;
-    UINT8 coreIdx = core->LocalIdx;
+static VOID CopyFmtText(OUT CHAR8* dst, IN CONST CHAR8* format)
+{
+  BOOLEAN inSpec = FALSE;
+  UINTN len = 0;
 
-    {
-      CHAR8 outBuf[80] = { 0 };
+  for (CONST CHAR8* ch = format; 
+    (*ch) && (len < MINILOG_FMT_TEXT_LEN - 1); ch++, len++) {
 
-      AsciiSPrint(outBuf, 80, "[PKG%u][CORE%u][%u] - %a : 0x%x : 0x%lx",
-        pkgIdx,
-        coreIdx,
-        tsns,
-        GetOperIdString(operId),
-        param1,
-        param2);
+    CHAR8 out = *ch;
 
-      UINTN offsetY = 1;
-      UINTN lineOffset = (offsetY + (2 * core->AbsIdx + 1)) * font->fbHeight;
-      UINTN lineStride = gop->Mode->Info->PixelsPerScanLine * 4;
-      UINTN startPix = lineOffset * lineStride;
+    if (!inSpec) {
+      inSpec = (BOOLEAN)(out == '%');
+    }
+    else if ((out == 'a') || (out == 's') || (out == 'S')) {
+      out = 'p';
+      inSpec = FALSE;
+    }
+    else if ((out != 'l') && (out != 'L') && (out != '-') && (out != '.') &&
+             (out != ',') && (out != '*') && ((out < '0') || (out > '9'))) {
+      inSpec = FALSE;
+    }
 
-      //
-      // Delete line first
+    dst[len] = out;
+  }
 
-      memset(lfb + startPix, 0, lineStride*font->fbHeight);
+  dst[len] = 0;
+}
 
-      //
-      // Render on screen 
+/*******************************************************************************
+ * LookupFmt
+ * Returns the registry slot of the format (registering it on first use)
+ ******************************************************************************/
 
-      OutputRawString(0, (UINT32)lineOffset, outBuf, 0x00FFFFFF);
+static UINT16 LookupFmt(IN CONST CHAR8* format, OUT UINT8* nArgs)
+{
+  const UINT64 key = (UINT64)(UINTN)format & FMT_PTR_MASK;
+  const UINTN hash = (UINTN)((key >> 3) ^ (key >> 11));
+
+  for (UINTN probe = 0; probe < MINILOG_FMT_SLOTS; probe++) {
+    
+    const UINTN slot = (hash + probe) & (MINILOG_FMT_SLOTS - 1);
+    
+    UINT64 entry = gTraceArea->fmtKeys[slot];
+
+    if (!entry) {
+
+      entry = InterlockedCompareExchange64(&gTraceArea->fmtKeys[slot], 
+        0, key | FMT_PENDING);
+      
+      if (!entry) {
+
+        //
+        // Text first - a dump must never find a key without its text
+
+        CopyFmtText(gTraceArea->fmtText[slot], format);
+        PersistLines(gTraceArea->fmtText[slot], MINILOG_FMT_TEXT_LEN);
+        MemoryFence();
+
+        entry = key | ((UINT64)CountFmtArgs(format) << FMT_NARGS_SHIFT);
+
+        gTraceArea->fmtKeys[slot] = entry;
+        PersistLines(&gTraceArea->fmtKeys[slot], sizeof(UINT64));
+      }
     }
+
+    //
+    // Same format being registered by another CPU
+
+    while (entry == (key | FMT_PENDING)) {
+      CpuPause();
+      entry = gTraceArea->fmtKeys[slot];
+    }
+
+    if ((entry & FMT_PTR_MASK) == key) {
+      *nArgs = (UINT8)(entry >> FMT_NARGS_SHIFT);
+      return (UINT16)slot;
+    }
+  }
+
+  return MINILOG_FMT_INVALID;
+}
+
+/*******************************************************************************
+ * AreaSize
+ ******************************************************************************/
+
+static UINTN AreaSize(IN const UINTN nCpus)
+{
+  return sizeof(MiniLogArea) + 
+    nCpus * (sizeof(MiniLogRing) + sizeof(MiniLogMsgRing));
+}
+
+/*******************************************************************************
+ * AreaChecksum
+ ******************************************************************************/
+
+static UINT32 AreaChecksum(IN const MiniLogAreaHdr* hdr)
+{
+  return NvCache_Checksum(hdr, OFFSET_OF(MiniLogAreaHdr, checksum));
+}
+
+/*******************************************************************************
+ * AreaRings / AreaMsgRings
+ ******************************************************************************/
+
+static MiniLogRing* AreaRings(IN MiniLogArea* area)
+{
+  return (MiniLogRing*)(area + 1);
+}
+
+static MiniLogMsgRing* AreaMsgRings(IN MiniLogArea* area)
+{
+  return (MiniLogMsgRing*)(AreaRings(area) + area->hdr.nCpus);
+}
+
+/*******************************************************************************
+ * AllocateArea
+ * 
+ * Persistent mode: reserved memory, preferably at the address published
+ * by the previous run so that it stays stable and does not wear the NVRAM
+ ******************************************************************************/
+
+static MiniLogArea* AllocateArea(IN const UINTN pages)
+{
+#ifdef ENABLE_MINILOG_PERSISTENT
+
+  MiniLogPersistVar var = { 0 };
+  EFI_PHYSICAL_ADDRESS addr = 0;
+  EFI_STATUS status = EFI_NOT_FOUND;
+
+  if (!EFI_ERROR(NvCache_Load(MINILOG_PERSIST_VAR_NAME, MINILOG_AREA_VERSION,
+    MINILOG_AREA_MAGIC, &var, sizeof(var)))) {
+
+    addr = (EFI_PHYSICAL_ADDRESS)var.address;
+
+    status = gBS->AllocatePages(AllocateAddress, EfiReservedMemoryType, 
+      pages, &addr);
+  }
+
+  if (EFI_ERROR(status)) {
+    status = gBS->AllocatePages(AllocateAnyPages, EfiReservedMemoryType, 
+      pages, &addr);
+  }
+
+  if (EFI_ERROR(status)) {
+    return NULL;
+  }
+
+  var.address = (UINT64)addr;
+  var.pages = (UINT64)pages;
+
+  NvCache_Store(MINILOG_PERSIST_VAR_NAME, MINILOG_AREA_VERSION, 
+    MINILOG_AREA_MAGIC, &var, sizeof(var));
+
+  return (MiniLogArea*)(UINTN)addr;
+
+#else
+
+  return (MiniLogArea*)AllocatePages(pages);
+
+#endif
+}
+
+/*******************************************************************************
+ * InitTraceRings
+ ******************************************************************************/
+
+void InitTraceRings(const UINTN nCpus)
+{
+  if (nCpus > MINILOG_AREA_MAX_CPUS) {
+    return;
+  }
+
+  const UINTN size = AreaSize(nCpus);
+  const UINTN pages = EFI_SIZE_TO_PAGES(size);
+
+  //
+  // The area that held the previous run's trace gets reused if large enough
+
+  if ((gTraceArea) && (gTraceAreaPages < pages)) {
+    gBS->FreePages((EFI_PHYSICAL_ADDRESS)(UINTN)gTraceArea, gTraceAreaPages);
+    gTraceArea = NULL;
   }
+
+  if (!gTraceArea) {
+    gTraceArea = AllocateArea(pages);
+    gTraceAreaPages = pages;
+  }
+
+  if (!gTraceArea) {
+    return;
+  }
+
+  SetMem(gTraceArea, size, 0);
+
+  gTraceArea->hdr.magic = MINILOG_AREA_MAGIC;
+  gTraceArea->hdr.version = MINILOG_AREA_VERSION;
+  gTraceArea->hdr.nCpus = (UINT32)nCpus;
+  gTraceArea->hdr.size = (UINT64)size;
+  gTraceArea->hdr.bootTsc = ReadTsc();
+  gTraceArea->hdr.checksum = AreaChecksum(&gTraceArea->hdr);
+  gTraceArea->hdr.state = MINILOG_AREA_ACTIVE;
+
+  gTraceRings = AreaRings(gTraceArea);
+  gMsgRings = AreaMsgRings(gTraceArea);
+  gTraceRingCnt = nCpus;
+
+  Panes_Layout(nCpus);
 }
 
+/*******************************************************************************
+ * MiniTrace
+ * 
+ * Hot path - called from every pm_* access, does not format or render
+ ******************************************************************************/
+
+void MiniTrace(
+               const UINT8  operId,
+               const UINT8  dangerous,
+               const UINT32 param1,
+               const UINT64 param2
+                )
+{
+  CPUCORE* core = PerCpu_Self();
+
+  if ((!core) || (core->AbsIdx >= gTraceRingCnt)) {
+    return;
+  }
+
+  MiniLogRing* ring = gTraceRings + core->AbsIdx;
+
+  const UINT64 head = ring->hdr.head;
+
+  MiniLogRecord* rec = &ring->rec[head & (MINILOG_RING_ENTRIES - 1)];
+
+  rec->entry.operId = operId;
+  rec->entry.pkgIdx = core->PkgIdx;
+  rec->entry.coreIdx = (UINT8)core->LocalIdx;
+  rec->entry.dangerous = dangerous;
+  rec->entry.param1 = param1;
+  rec->entry.param2 = param2;
+  rec->tsc = __rdtsc();
+
+  PersistLines(rec, sizeof(MiniLogRecord));
+
+  //
+  // Publish (x86 does not reorder stores, volatile keeps the compiler
+  // from doing so)
+
+  ring->hdr.head = head + 1;
+
+  PersistLines(&ring->hdr.head, sizeof(UINT64));
+}
 
 /*******************************************************************************
-  MiniTraceEx
+ * MiniTraceEx
+ * 
+ * Deferred formatting - stores the format id and raw arguments only
  ******************************************************************************/
 
 void MiniTraceEx(
@@ -304,51 +1023,407 @@ void MiniTraceEx(
 )
 {
   VA_LIST mark;
-  UINTN   nprinted;
+  UINT8 nArgs = 0;
 
-  if (haveConsole) {
+  CPUCORE* core = PerCpu_Self();
 
-    //
-    // Timestamp
+  if ((!core) || (core->AbsIdx >= gTraceRingCnt)) {
+    return;
+  }
 
-    UINT64 tsns = TicksToNanoSeconds(ReadTsc());
+  MiniLogMsgRing* ring = gMsgRings + core->AbsIdx;
 
-    CHAR8 buf[160] = { 0 };
-    CHAR8 tbuf[160] = { 0 };
-    UINTN BufferSize = 160;
+  const UINT16 fmtId = LookupFmt(format, &nArgs);
 
-    VA_START(mark, format);
-    nprinted = AsciiVSPrint(tbuf, BufferSize, format, mark);
-    VA_END(mark);
+  if (fmtId == MINILOG_FMT_INVALID) {
+    ring->hdr.dropped++;
+    return;
+  }
 
+  const UINT64 head = ring->hdr.head;
 
-    //
-    // Get absolute core idx and use it to find the Y position for the trace
+  MiniLogMsgRecord* rec = &ring->rec[head & (MINILOG_RING_ENTRIES - 1)];
+
+  rec->fmtId = fmtId;
+  rec->nArgs = nArgs;
+  rec->pkgIdx = core->PkgIdx;
+  rec->coreIdx = core->LocalIdx;
+  rec->tsc = __rdtsc();
+
+  //
+  // Every variadic argument occupies a 64-bit slot on x64, which is also
+  // the layout AsciiBSPrint expects from a BASE_LIST
+
+  VA_START(mark, format);
+
+  for (UINT8 aidx = 0; aidx < nArgs; aidx++) {
+    rec->args[aidx] = VA_ARG(mark, UINT64);
+  }
+
+  VA_END(mark);
+
+  PersistLines(rec, sizeof(MiniLogMsgRecord));
+
+  ring->hdr.head = head + 1;
+
+  PersistLines(&ring->hdr.head, sizeof(UINT64));
+}
+
+/*******************************************************************************
+ * FormatRecord
+ ******************************************************************************/
+
+static VOID FormatRecord(OUT CHAR8* buf, 
+  IN const UINTN size, 
+  IN const MiniLogRecord* rec)
+{
+  AsciiSPrint(buf, size, "[PKG%u][CORE%u][%lu] - %a : 0x%x : 0x%lx",
+    rec->entry.pkgIdx,
+    rec->entry.coreIdx,
+    TicksToNanoSeconds(rec->tsc),
+    GetOperIdString(rec->entry.operId),
+    rec->entry.param1,
+    rec->entry.param2);
+}
+
+/*******************************************************************************
+ * LiveFmt
+ * Format of a record from this run
+ ******************************************************************************/
+
+static CONST CHAR8* LiveFmt(IN const MiniLogMsgRecord* rec)
+{
+  return (CONST CHAR8*)(UINTN)(gTraceArea->fmtKeys[rec->fmtId] & FMT_PTR_MASK);
+}
+
+/*******************************************************************************
+ * FormatMsgRecord
+ ******************************************************************************/
+
+static VOID FormatMsgRecord(OUT CHAR8* buf, 
+  IN const UINTN size, 
+  IN CONST CHAR8* format,
+  IN const MiniLogMsgRecord* rec)
+{
+  CHAR8 tbuf[160] = { 0 };
+
+  AsciiBSPrint(tbuf, sizeof(tbuf), format, (BASE_LIST)rec->args);
+
+  AsciiSPrint(buf, size, "[PKG%u][CORE%u][%lu] %a",
+    rec->pkgIdx,
+    rec->coreIdx,
+    TicksToNanoSeconds(rec->tsc),
+    tbuf);
+}
+
+/*******************************************************************************
+ * ConsumeRing
+ * Copies up to maxOut of the newest unconsumed records to 'out' (oldest 
+ * first) and returns how many of them are intact - records the producer has
+ * lapped during the copy are discarded
+ ******************************************************************************/
+
+static UINTN ConsumeRing(IN OUT MiniLogRingHdr* hdr, 
+  IN const VOID* recs, 
+  IN const UINTN recSize, 
+  OUT VOID* out,
+  IN const UINTN maxOut)
+{
+  UINT64 head = hdr->head;
+
+  if (head - hdr->tail > MINILOG_RING_ENTRIES) {
+    hdr->dropped += head - hdr->tail - MINILOG_RING_ENTRIES;
+    hdr->tail = head - MINILOG_RING_ENTRIES;
+  }
+
+  const UINT64 avail = head - hdr->tail;
+  UINT64 first = head - ((avail < maxOut) ? avail : maxOut);
+
+  for (UINT64 ridx = first; ridx < head; ridx++) {
+    CopyMem((UINT8*)out + (UINTN)(ridx - first) * recSize, 
+      (const UINT8*)recs + 
+      (UINTN)(ridx & (MINILOG_RING_ENTRIES - 1)) * recSize, recSize);
+  }
+
+  hdr->tail = head;
+
+  const UINT64 after = hdr->head;
+  UINT64 intact = first;
+
+  //
+  // The producer may be writing record 'after' (same slot as 'after - N')
+
+  if (after - first >= MINILOG_RING_ENTRIES) {
+    intact = after - MINILOG_RING_ENTRIES + 1;
+  }
+
+  if (intact >= head) {
+    return 0;
+  }
+
+  if (intact > first) {
+    CopyMem(out, (UINT8*)out + (UINTN)(intact - first) * recSize, 
+      (UINTN)(head - intact) * recSize);
+  }
+
+  return (UINTN)(head - intact);
+}
 
-    VOID* gsbase = GetCpuGSBase();
+/*******************************************************************************
+ * DrainTraceInternal
+ ******************************************************************************/
 
-    CPUCORE* core = gsbase;
+static void DrainTraceInternal(const BOOLEAN force)
+{
+  if ((!gTraceRingCnt) || (!haveConsole)) {
+    return;
+  }
 
-    UINT8 pkgIdx = core->PkgIdx;
-    UINT8 coreIdx = core->LocalIdx;
+  const UINT64 now = ReadTsc();
 
-    AsciiSPrint(buf, 160, "[PKG%u][CORE%u][%u] %a", pkgIdx, coreIdx, tsns, tbuf);
+  if ((!force) && 
+      (now - gTraceLastDrain < MicroSecondsToTicks(MINILOG_DRAIN_INTERVAL_US))) {
+    return;
+  }
 
-    UINTN offsetY = 1;
-    UINTN lineOffset = (offsetY + 2*core->AbsIdx) * font->fbHeight;
-    UINTN lineStride = gop->Mode->Info->PixelsPerScanLine * 4;
-    UINTN startPix = lineOffset * lineStride;
+  //
+  // Single consumer
+
+  if (hlp_atomic_cmpxchg_u32((UINT32*)&gTraceDrainBusy, 0, 1) != 0) {
+    return;
+  }
+
+  gTraceLastDrain = now;
+
+  for (UINTN cidx = 0; (cidx < gTraceRingCnt) && (gPanes); cidx++) {
+    
+    MiniLogPane* pane = &gPanes[cidx];
+    MiniLogRecord ops[MINILOG_PANE_MAX_LINES];
+    MiniLogMsgRecord msgs[MINILOG_PANE_MAX_LINES];
 
     //
-    // Delete line first
+    // Only what fits into the pane is of interest
+
+    const UINTN nMsgs = ConsumeRing(&gMsgRings[cidx].hdr, gMsgRings[cidx].rec,
+      sizeof(MiniLogMsgRecord), msgs, pane->lines);
+    const UINTN nOps = ConsumeRing(&gTraceRings[cidx].hdr, gTraceRings[cidx].rec,
+      sizeof(MiniLogRecord), ops, pane->lines);
 
-    memset(lfb + startPix, 0, lineStride * font->fbHeight);
+    UINTN skip = (nMsgs + nOps > pane->lines) ? 
+      nMsgs + nOps - pane->lines : 0;
+    UINTN midx = 0;
+    UINTN oidx = 0;
 
     //
-    // Render on screen 
+    // Messages and operations merged in TSC order
+
+    while ((midx < nMsgs) || (oidx < nOps)) {
+
+      CHAR8 outBuf[160] = { 0 };
+      const BOOLEAN isMsg = (BOOLEAN)((midx < nMsgs) && 
+        ((oidx >= nOps) || (msgs[midx].tsc <= ops[oidx].tsc)));
+
+      if (skip) {
+        midx += (isMsg) ? 1 : 0;
+        oidx += (isMsg) ? 0 : 1;
+        skip--;
+        continue;
+      }
+
+      if (isMsg) {
+        FormatMsgRecord(outBuf, sizeof(outBuf), LiveFmt(&msgs[midx]), 
+          &msgs[midx]);
+        Pane_Append(pane, outBuf, 0x00FFFF80);
+        midx++;
+      }
+      else {
+        FormatRecord(outBuf, sizeof(outBuf), &ops[oidx]);
+        Pane_Append(pane, outBuf, 0x00FFFFFF);
+        oidx++;
+      }
+    }
+  }
+
+  Compositor_Flush();
+
+  gTraceDrainBusy = 0;
+}
+
+/*******************************************************************************
+ * DrainTrace
+ ******************************************************************************/
+
+void DrainTrace()
+{
+  DrainTraceInternal(FALSE);
+}
+
+/*******************************************************************************
+ * DrainTraceNow
+ ******************************************************************************/
+
+void DrainTraceNow()
+{
+  DrainTraceInternal(TRUE);
+}
+
+/*******************************************************************************
+ * PrintTail
+ * 
+ * Prints the last 'tail' operations and messages of a CPU, merged in TSC 
+ * order. For a previous run's area (prevRun), messages are formatted from 
+ * the copied format text, and only if their format slot looks sane.
+ ******************************************************************************/
+
+static VOID PrintTail(IN MiniLogArea* area, 
+  IN const UINTN cidx, 
+  IN const UINT64 tail,
+  IN const BOOLEAN prevRun)
+{
+  const MiniLogRing* ring = AreaRings(area) + cidx;
+  const MiniLogMsgRing* msgRing = AreaMsgRings(area) + cidx;
+  const UINT64 head = ring->hdr.head;
+  const UINT64 msgHead = msgRing->hdr.head;
+
+  if ((!head) && (!msgHead)) {
+    return;
+  }
+
+  AsciiPrint("[TRACE] CPU %u: %lu records, %lu messages, %lu not rendered\n",
+    cidx, head, msgHead, ring->hdr.dropped + msgRing->hdr.dropped);
+
+  UINT64 ridx = (head > tail) ? head - tail : 0;
+  UINT64 midx = (msgHead > tail) ? msgHead - tail : 0;
+
+  while ((ridx < head) || (midx < msgHead)) {
+    
+    CHAR8 outBuf[160] = { 0 };
+
+    const MiniLogRecord* rec = 
+      &ring->rec[ridx & (MINILOG_RING_ENTRIES - 1)];
+    const MiniLogMsgRecord* msg = 
+      &msgRing->rec[midx & (MINILOG_RING_ENTRIES - 1)];
+
+    if ((midx < msgHead) && ((ridx >= head) || (msg->tsc <= rec->tsc))) {
+      
+      midx++;
+
+      if (!prevRun) {
+        FormatMsgRecord(outBuf, sizeof(outBuf), LiveFmt(msg), msg);
+      }
+      else if ((msg->fmtId < MINILOG_FMT_SLOTS) && 
+               (msg->nArgs <= MINILOG_FMT_MAX_ARGS) &&
+               (area->fmtKeys[msg->fmtId]) &&
+               (!(area->fmtKeys[msg->fmtId] & FMT_PENDING))) {
+        
+        CHAR8* text = area->fmtText[msg->fmtId];
+        
+        text[MINILOG_FMT_TEXT_LEN - 1] = 0;
+        FormatMsgRecord(outBuf, sizeof(outBuf), text, msg);
+      }
+      else {
+        AsciiSPrint(outBuf, sizeof(outBuf), "(damaged message)");
+      }
+    }
+    else {
+      ridx++;
+      FormatRecord(outBuf, sizeof(outBuf), rec);
+    }
+
+    AsciiPrint("  %a\n", outBuf);
+  }
+}
+
+/*******************************************************************************
+ * FlushTrace
+ ******************************************************************************/
+
+void FlushTrace()
+{
+  if (!gTraceRingCnt) {
+    return;
+  }
+
+  DrainTraceNow();
+
+  for (UINTN cidx = 0; cidx < gTraceRingCnt; cidx++) {
+    PrintTail(gTraceArea, cidx, MINILOG_FLUSH_TAIL, FALSE);
+  }
+
+  //
+  // Seen - do not dump again on the next run
+
+  gTraceArea->hdr.state = MINILOG_AREA_CONSUMED;
+}
+
+/*******************************************************************************
+ * RecoverPersistentTrace
+ * 
+ * Looks for the area published by the previous run. If it is still intact
+ * and was never flushed (i.e. the run hung), its tail is printed. The area 
+ * is kept and reused by InitTraceRings.
+ ******************************************************************************/
+
+#ifdef ENABLE_MINILOG_PERSISTENT
+
+static VOID RecoverPersistentTrace()
+{
+  MiniLogPersistVar var = { 0 };
+
+  if (EFI_ERROR(NvCache_Load(MINILOG_PERSIST_VAR_NAME, MINILOG_AREA_VERSION,
+    MINILOG_AREA_MAGIC, &var, sizeof(var)))) {
+    return;
+  }
+
+  EFI_PHYSICAL_ADDRESS addr = (EFI_PHYSICAL_ADDRESS)var.address;
+  const UINTN pages = (UINTN)var.pages;
+
+  if (EFI_ERROR(gBS->AllocatePages(AllocateAddress, EfiReservedMemoryType, 
+    pages, &addr))) {
+    AsciiPrint("[TRACE] Trace area of the previous run (0x%lx) is in use, "
+      "not recovered\n", var.address);
+    return;
+  }
+
+  gTraceArea = (MiniLogArea*)(UINTN)addr;
+  gTraceAreaPages = pages;
+
+  const MiniLogAreaHdr* hdr = &gTraceArea->hdr;
+
+  if ((hdr->magic != MINILOG_AREA_MAGIC) || 
+      (hdr->version != MINILOG_AREA_VERSION) ||
+      (hdr->checksum != AreaChecksum(hdr)) ||
+      (hdr->nCpus > MINILOG_AREA_MAX_CPUS) ||
+      (hdr->size != AreaSize(hdr->nCpus)) ||
+      (hdr->size > EFI_PAGES_TO_SIZE(pages)) ||
+      (hdr->state != MINILOG_AREA_ACTIVE)) {
+    return;
+  }
+
+  AsciiPrint("[TRACE] Previous run did not finish, its trace follows:\n");
 
-    OutputRawString(0, (UINT32)lineOffset, buf, 0x00FFFF80);    
+  for (UINTN cidx = 0; cidx < hdr->nCpus; cidx++) {
+    PrintTail(gTraceArea, cidx, MINILOG_PERSIST_DUMP_TAIL, TRUE);
   }
+
+  gTraceArea->hdr.state = MINILOG_AREA_CONSUMED;
+
+  AsciiPrint("[TRACE] End of the previous run's trace\n");
+}
+
+#endif
+
+/*******************************************************************************
+ * InitTrace
+ ******************************************************************************/
+
+void InitTrace()
+{
+  InitMiniConsole();
+
+#ifdef ENABLE_MINILOG_PERSISTENT
+  RecoverPersistentTrace();
+#endif
 }
 
 
@@ -49,6 +49,113 @@ typedef struct _MiniLogEntry {
   UINT64  param2;
 } MiniLogEntry;
 
+/*******************************************************************************
+ * MiniLogRing - per-CPU trace ring
+ * 
+ * Single producer (the owning CPU) fills a record with plain stores and
+ * publishes it by advancing head - it never waits, and overwrites the oldest 
+ * records if the consumer falls behind. The consumer (BSP, see DrainTrace) 
+ * decodes and renders, and tells overwritten or torn records by re-reading 
+ * head after the copy.
+ ******************************************************************************/
+
+#define MINILOG_RING_ENTRIES                                    256
+#define MINILOG_DRAIN_INTERVAL_US                               10000
+#define MINILOG_FLUSH_TAIL                                      8
+
+//
+// Screen layout: one pane of scrolling lines per CPU
+
+#define MINILOG_PANE_MIN_LINES                                  3
+#define MINILOG_PANE_MAX_LINES                                  16
+#define MINILOG_PANE_MAX_COLS                                   8
+
+typedef struct _MiniLogRingHdr {
+  volatile UINT64 head;               // Records written (producer only)
+  UINT64          tail;               // Records consumed (consumer only)
+  UINT64          dropped;            // Overwritten before consumed
+  UINT8           pad[40];            // Header in its own cache line
+} MiniLogRingHdr;
+
+typedef struct _MiniLogRecord {
+  MiniLogEntry  entry;
+  UINT64        tsc;
+  UINT64        reserved;
+} MiniLogRecord;
+
+typedef struct _MiniLogRing {
+  MiniLogRingHdr  hdr;
+  MiniLogRecord   rec[MINILOG_RING_ENTRIES];
+} MiniLogRing;
+
+/*******************************************************************************
+ * MiniLogMsgRecord - deferred-format MiniTraceEx message, one cache line
+ * 
+ * Only the format id (see the format registry in MiniLog.c), the TSC and the
+ * raw 64-bit arguments are stored by the caller - formatting happens on the
+ * consumer. Arguments must stay valid until then, so %a/%s arguments must 
+ * point to static strings.
+ ******************************************************************************/
+
+#define MINILOG_FMT_MAX_ARGS                                    6
+#define MINILOG_FMT_SLOTS                                       256
+#define MINILOG_FMT_INVALID                                     0xFFFF
+
+typedef struct _MiniLogMsgRecord {
+  UINT16  fmtId;
+  UINT8   nArgs;
+  UINT8   pkgIdx;
+  UINT32  coreIdx;
+  UINT64  tsc;
+  UINT64  args[MINILOG_FMT_MAX_ARGS];
+} MiniLogMsgRecord;
+
+typedef struct _MiniLogMsgRing {
+  MiniLogRingHdr    hdr;
+  MiniLogMsgRecord  rec[MINILOG_RING_ENTRIES];
+} MiniLogMsgRing;
+
+/*******************************************************************************
+ * MiniLogArea - everything the trace needs, in one allocation
+ * 
+ * Self-contained so that it can be decoded by the next boot (persistent 
+ * mode): format strings are copied into the area on registration. Followed
+ * by nCpus MiniLogRing-s and then nCpus MiniLogMsgRing-s.
+ ******************************************************************************/
+
+#define MINILOG_AREA_MAGIC                              0x31454341525450ULL
+#define MINILOG_AREA_VERSION                                    1
+#define MINILOG_AREA_MAX_CPUS                                   1024
+#define MINILOG_FMT_TEXT_LEN                                    128
+
+#define MINILOG_AREA_ACTIVE                                     0
+#define MINILOG_AREA_CONSUMED                                   1
+
+#define MINILOG_PERSIST_VAR_NAME                        L"PmTraceArea"
+#define MINILOG_PERSIST_DUMP_TAIL                               32
+
+typedef struct _MiniLogAreaHdr {
+  UINT64          magic;
+  UINT32          version;
+  UINT32          nCpus;
+  UINT64          size;               // Of the whole area, bytes
+  UINT64          bootTsc;            // Tells one run from another
+  UINT32          checksum;           // Of the fields above
+  volatile UINT32 state;              // MINILOG_AREA_*
+  UINT8           pad[24];
+} MiniLogAreaHdr;
+
+typedef struct _MiniLogArea {
+  MiniLogAreaHdr  hdr;
+  volatile UINT64 fmtKeys[MINILOG_FMT_SLOTS];
+  CHAR8           fmtText[MINILOG_FMT_SLOTS][MINILOG_FMT_TEXT_LEN];
+} MiniLogArea;
+
+typedef struct _MiniLogPersistVar {
+  UINT64  address;
+  UINT64  pages;
+} MiniLogPersistVar;
+
 /*******************************************************************************
  * Operation IDs
  ******************************************************************************/
@@ -74,6 +181,27 @@ typedef struct _MiniLogEntry {
 
 void InitTrace();
 
+//
+// Rings, one per CPU (call once CPUs are known)
+
+void InitTraceRings(const UINTN nCpus);
+
+//
+// Consumer: renders the latest record of every CPU, rate-limited - cheap 
+// enough to be called from BSP wait loops
+
+void DrainTrace();
+
+//
+// Same, without the rate limit (fault paths)
+
+void DrainTraceNow();
+
+//
+// End of run: drains everything and prints the last records of every CPU
+
+void FlushTrace();
+
 void MiniTrace(
   const UINT8  operId,  
   const UINT8  dangerous,
@@ -81,6 +209,10 @@ void MiniTrace(
   const UINT64 param2
 );
 
+//
+// Deferred formatting: format must be a string literal, at most 
+// MINILOG_FMT_MAX_ARGS integer (or static string) arguments
+
 void MiniTraceEx(
   IN  CONST CHAR8* format,
   ...
@@ -90,6 +222,10 @@ void MiniTraceEx(
 
 #define InitTrace()
 #define MiniTrace(a, b, c, d)
+#define InitTraceRings(a)
+#define DrainTrace()
+#define DrainTraceNow()
+#define FlushTrace()
 
 static void UNUSED MiniTraceEx(
   IN  CONST CHAR8* format,
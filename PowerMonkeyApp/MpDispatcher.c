@@ -37,7 +37,13 @@
 // PowerMonkey
 
 #include "MpDispatcher.h"
+#include "WorkerPool.h"
 #include "LowLevel.h"
+#include "PerCpu.h"
+#include "Topology.h"
+#include "Profile.h"
+#include "MiniLog.h"
+#include "DelayX86.h"
 
 //
 // Initialized at startup
@@ -69,6 +75,12 @@ typedef struct _IgniteContext
   UINTN CpuNumber;
   VOID* userParam;  
   EFI_AP_PROCEDURE userProc;
+
+  //
+  // Selective dispatch (RunOnSelectedCores)
+
+  CORE_PROCEDURE coreProc;
+  CORE_RESULT* results;
 } IgniteContext;
 
 VOID EFIAPI ProcessorIgnite(VOID* params)
@@ -80,12 +92,29 @@ VOID EFIAPI ProcessorIgnite(VOID* params)
     
   IgniteContext* pic = (IgniteContext*)params;
 
-  VOID* coreStructAddr = GetCpuDataBlock();
+  //
+  // GS base may not be set up yet on this CPU, so use the slow path
+
+  VOID* coreStructAddr = PerCpu_Lookup();
+
+  //
+  // Selective dispatch: CPUs not picked by the caller have nothing to do
+
+  CORE_RESULT* res = NULL;
+
+  if (pic->results) {
+
+    res = &pic->results[((CPUCORE*)coreStructAddr)->AbsIdx];
+
+    if ((!res->Selected) || (res->Completed)) {
+      return;
+    }
+  }
 
   //
   // Set the GS register to point to coreStructAddr
 
-  SetCpuGSBase(coreStructAddr);
+  PerCpu_Bind((CPUCORE*)coreStructAddr);
 
   ///
   /// Populate CPU core-specific info
@@ -93,18 +122,38 @@ VOID EFIAPI ProcessorIgnite(VOID* params)
   
   CPUCORE* core = (CPUCORE*)coreStructAddr;
   
+  PROFILE_BEGIN(tProbe);
+
   GetCpuInfo(&core->CpuInfo);
   core->IsECore = core->CpuInfo.ECore;
 
+  Topology_ProbeThisCpu(core);
+
+  PROFILE_END(tProbe, "Core: CPU info probe");
+
   //
   // Debug
   {
     UINTN processorNumber = 0;
     gMpServices->WhoAmI(gMpServices, &processorNumber);
-    core->ValidateIdx = (UINT32)processorNumber;
+    core->Hot->ValidateIdx = (UINT32)processorNumber;
   }  
   
-  if (pic->userProc) {
+  if (res) {
+
+    ///
+    /// Execute user's call and report back (if supplied)
+    ///
+
+    res->Status = (pic->coreProc) ? 
+      pic->coreProc(res, pic->userParam) : 
+      EFI_SUCCESS;
+
+    core->Hot->LastStatus = res->Status;
+
+    res->Completed = 1;
+  }
+  else if (pic->userProc) {
 
     ///
     /// Execute user's call (if supplied)
@@ -115,6 +164,80 @@ VOID EFIAPI ProcessorIgnite(VOID* params)
 }
 
 
+/*******************************************************************************
+ * WaitForApsDraining
+ ******************************************************************************/
+
+static VOID EFIAPI WaitForApsDraining(IN EFI_EVENT apEvent)
+{
+  //
+  // BSP is idle here anyway - use it to render what the APs traced
+  // (WaitForEvent would leave the trace rings undrained until APs return)
+
+  while (gBS->CheckEvent(apEvent) == EFI_NOT_READY) {
+    DrainTrace();
+    MicroStall(1);
+  }
+
+  DrainTrace();
+}
+
+/*******************************************************************************
+ * StartupThisApDraining
+ ******************************************************************************/
+
+static EFI_STATUS EFIAPI StartupThisApDraining(
+  IN const UINTN CpuNumber,
+  IN IgniteContext* ctx)
+{
+  EFI_STATUS status = EFI_SUCCESS;
+  EFI_EVENT apEvent = NULL;
+  BOOLEAN finished = FALSE;
+
+  //
+  // Non-blocking mode, so the BSP can keep draining the trace rings. 
+  // Fall back to a blocking call if there is no event to wait on
+
+  if (EFI_ERROR(gBS->CreateEvent(0, TPL_NOTIFY, NULL, NULL, &apEvent))) {
+
+    return gMpServices->StartupThisAP(
+      gMpServices,
+      ProcessorIgnite,
+      CpuNumber,
+      NULL,
+      1000000,
+      ctx,
+      NULL
+    );
+  }
+
+  status = gMpServices->StartupThisAP(
+    gMpServices,
+    ProcessorIgnite,
+    CpuNumber,
+    apEvent,
+    1000000,
+    ctx,
+    &finished
+  );
+
+  if (!EFI_ERROR(status)) {
+
+    WaitForApsDraining(apEvent);
+
+    //
+    // Event is signaled on timeout too - report it like the blocking call
+
+    if (!finished) {
+      status = EFI_TIMEOUT;
+    }
+  }
+
+  gBS->CloseEvent(apEvent);
+
+  return status;
+}
+
 /*******************************************************************************
  * TBD / TODO: Needs Rewrite
  ******************************************************************************/
@@ -127,6 +250,24 @@ EFI_STATUS EFIAPI RunOnPackageOrCore(
 {
   EFI_STATUS status = EFI_SUCCESS;
 
+  //
+  // Parked APs: one store to the command slot, then wait for completion
+
+  if ((WorkerPool_IsActive()) && (CpuNumber != Platform->BootProcessor)) {
+
+    status = WorkerPool_Post(CpuNumber, proc, NULL, param, NULL);
+
+    if (EFI_ERROR(status)) {
+      Print(L"[ERROR] Unable to execute on CPU %u,"
+        "status code: 0x%x\n", CpuNumber, status);
+    }
+    else {
+      status = WorkerPool_Wait(CpuNumber, WP_JOB_TIMEOUT_US);
+    }
+
+    return status;
+  }
+
   if (gMpServices) {
     if (CpuNumber != Platform->BootProcessor) {
 
@@ -136,15 +277,7 @@ EFI_STATUS EFIAPI RunOnPackageOrCore(
       ctx.userProc = proc;
       ctx.CpuNumber = CpuNumber;
 
-      status = gMpServices->StartupThisAP(
-        gMpServices,
-        ProcessorIgnite,
-        CpuNumber,
-        NULL,
-        1000000,
-        &ctx,
-        NULL
-      );
+      status = StartupThisApDraining(CpuNumber, &ctx);
 
       if (EFI_ERROR(status)) {
         Print(L"[ERROR] Unable to execute on CPU %u,"
@@ -187,7 +320,29 @@ EFI_STATUS EFIAPI RunOnAllProcessors(
 {
   EFI_STATUS status = EFI_SUCCESS;
   EFI_EVENT mpEvent = NULL;
-  UINTN eventIdx = 0;
+
+  ///
+  /// Parked APs (worker pool)
+  ///
+
+  if (WorkerPool_IsActive()) {
+
+    //
+    // No limit, as with StartupAllAPs below (stress runs take as long as 
+    // they take)
+
+    status = WorkerPool_PostAll(proc, param);
+
+    if (!runConcurrent) {
+      WorkerPool_WaitAll(0);
+    }
+
+    proc(param);
+
+    EFI_STATUS waitStatus = WorkerPool_WaitAll(0);
+
+    return (EFI_ERROR(status)) ? status : waitStatus;
+  }
 
   ///
   /// Start other processors with our workload 
@@ -195,11 +350,15 @@ EFI_STATUS EFIAPI RunOnAllProcessors(
 
   if (gMpServices) {
 
+    //
+    // NOTE: CheckEvent() refuses EVT_NOTIFY_SIGNAL events, 
+    // so this has to be a plain (type 0) event
+
     if (runConcurrent) {
       status = gBS->CreateEvent(
-        EVT_NOTIFY_SIGNAL,
+        0,
         TPL_NOTIFY,
-        EfiEventEmptyFunction,
+        NULL,
         NULL,
         &mpEvent);
     }
@@ -220,7 +379,7 @@ EFI_STATUS EFIAPI RunOnAllProcessors(
         gMpServices,
         ProcessorIgnite,
         FALSE,
-        (runConcurrent) ? &mpEvent : NULL,
+        (runConcurrent) ? mpEvent : NULL,
         0,
         &ctx,
         NULL
@@ -250,10 +409,146 @@ EFI_STATUS EFIAPI RunOnAllProcessors(
     // Wait for APs to finish
 
     if (runConcurrent) {
-      gBS->WaitForEvent(1, &mpEvent, &eventIdx);
+      WaitForApsDraining(mpEvent);
       gBS->CloseEvent(mpEvent);
     }    
   }
 
   return status;
-}
\ No newline at end of file
+}
+
+/*******************************************************************************
+ * RunOnSelectedCores
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI RunOnSelectedCores(
+  const IN PLATFORM* Platform,
+  const IN CORE_PROCEDURE proc,
+  const BOOLEAN runConcurrent,                  // false = serial execution
+  IN VOID* param OPTIONAL,
+  IN OUT CORE_RESULT* results)
+{
+  EFI_STATUS status = EFI_SUCCESS;
+  EFI_EVENT mpEvent = NULL;
+  BOOLEAN apsStarted = FALSE;
+
+  IgniteContext ctx = { 0 };
+
+  ctx.CpuNumber = 0xFFFFFFFF;
+  ctx.userParam = param;
+  ctx.coreProc = proc;
+  ctx.results = results;
+
+  for (UINTN cidx = 0; cidx < Platform->LogicalProcessors; cidx++) {
+    results[cidx].Status = EFI_NOT_STARTED;
+    results[cidx].MailboxStatus = 0;
+    results[cidx].Completed = 0;
+  }
+
+  ///
+  /// Parked APs (worker pool): post to every selected AP first, collect later
+  ///
+
+  if (WorkerPool_IsActive()) {
+
+    for (UINTN cidx = 0; cidx < Platform->LogicalProcessors; cidx++) {
+
+      if ((!results[cidx].Selected) || (cidx == Platform->BootProcessor)) {
+        continue;
+      }
+
+      EFI_STATUS apStatus = WorkerPool_Post(cidx, NULL, proc, param, 
+        results + cidx);
+
+      if (EFI_ERROR(apStatus)) {
+        results[cidx].Status = apStatus;
+        status = apStatus;
+      }
+      else if (!runConcurrent) {
+        apStatus = WorkerPool_Wait(cidx, WP_JOB_TIMEOUT_US);
+        status = (EFI_ERROR(apStatus)) ? apStatus : status;
+      }
+    }
+
+    ProcessorIgnite(&ctx);
+
+    //
+    // Timed-out CPUs get EFI_TIMEOUT in their results
+
+    EFI_STATUS waitStatus = WorkerPool_WaitAll(WP_JOB_TIMEOUT_US);
+
+    return (EFI_ERROR(status)) ? status : waitStatus;
+  }
+
+  ///
+  /// Concurrent: fan out to all APs at once, non-selected ones return 
+  /// immediately from the Ignite call
+  ///
+
+  if ((gMpServices) && (runConcurrent) && (Platform->LogicalProcessors > 1)) {
+
+    status = gBS->CreateEvent(0, TPL_NOTIFY, NULL, NULL, &mpEvent);
+
+    if (!EFI_ERROR(status)) {
+
+      status = gMpServices->StartupAllAPs(
+        gMpServices,
+        ProcessorIgnite,
+        FALSE,
+        mpEvent,
+        0,
+        &ctx,
+        NULL
+      );
+
+      if (EFI_ERROR(status)) {
+        Print(L"[ERROR] Unable to execute on AP CPUs, code: 0x%x\n", status);
+        gBS->CloseEvent(mpEvent);
+        mpEvent = NULL;
+      }
+      else {
+        apsStarted = TRUE;
+      }
+    }
+    else {
+      Print(L"[ERROR] Unable to create EFI_EVENT, code: 0x%x\n", status);
+    }
+  }
+
+  ///
+  /// BSP does its own share while APs are busy
+  ///
+
+  ProcessorIgnite(&ctx);
+
+  if (apsStarted) {
+    WaitForApsDraining(mpEvent);
+    gBS->CloseEvent(mpEvent);
+  }
+
+  ///
+  /// Serial mode (or fan-out failed): visit remaining CPUs one by one
+  ///
+
+  status = EFI_SUCCESS;
+
+  for (UINTN cidx = 0; cidx < Platform->LogicalProcessors; cidx++) {
+
+    if ((!results[cidx].Selected) || (results[cidx].Completed)) {
+      continue;
+    }
+
+    if (!gMpServices) {
+      break;
+    }
+
+    EFI_STATUS apStatus = StartupThisApDraining(cidx, &ctx);
+
+    if (EFI_ERROR(apStatus)) {
+      results[cidx].Status = apStatus;
+      status = apStatus;
+    }
+  }
+
+  return status;
+}
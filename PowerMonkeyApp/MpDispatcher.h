@@ -40,3 +40,44 @@ EFI_STATUS EFIAPI RunOnAllProcessors(
   const BOOLEAN runConcurrent,                  // false = serial execution
   IN VOID *param OPTIONAL
 );
+
+/*******************************************************************************
+ * CORE_RESULT - outcome of a dispatched call on a single logical CPU
+ ******************************************************************************/
+
+typedef struct _CORE_RESULT
+{
+  EFI_STATUS  Status;                           // [OUT] Returned by the call
+  UINT32      MailboxStatus;                    // [OUT] Last non-zero mailbox
+                                                //       completion code
+  UINT8       Selected;                         // [IN]  Run on this CPU
+  UINT8       Completed;                        // [OUT] Call has returned
+  UINT8       pad[2];
+} CORE_RESULT;
+
+/*******************************************************************************
+ * CORE_PROCEDURE - procedure that reports its result back to the dispatcher
+ ******************************************************************************/
+
+typedef EFI_STATUS (EFIAPI *CORE_PROCEDURE)(
+  IN OUT CORE_RESULT *result,
+  IN VOID *param OPTIONAL
+);
+
+/*******************************************************************************
+ * RunOnSelectedCores
+ *
+ * Runs proc on every CPU whose results[AbsIdx].Selected is set. In concurrent
+ * mode all APs are started at once (non-blocking StartupAllAPs) while the BSP
+ * does its own share, in serial mode CPUs are visited one by one. Per-CPU
+ * status is collected in results[], which must hold LogicalProcessors entries
+ * (EFI_TIMEOUT for CPUs that did not finish within WP_JOB_TIMEOUT_US)
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI RunOnSelectedCores(
+  const IN PLATFORM *Platform,
+  const IN CORE_PROCEDURE proc,
+  const BOOLEAN runConcurrent,                  // false = serial execution
+  IN VOID *param OPTIONAL,
+  IN OUT CORE_RESULT *results
+);
@@ -0,0 +1,215 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiRuntimeServicesTableLib.h>
+
+#include "NvCache.h"
+
+/*******************************************************************************
+ * Globals
+ ******************************************************************************/
+
+extern EFI_RUNTIME_SERVICES* gRT;
+
+//
+// {5129AFF6-6F84-48EF-B187-481DDC11F52D}
+
+static EFI_GUID gPowerMonkeyVarGuid = 
+  { 0x5129aff6, 0x6f84, 0x48ef, { 0xb1, 0x87, 0x48, 0x1d, 0xdc, 0x11, 0xf5, 0x2d } };
+
+#define NVCACHE_MAGIC               0x43564E50          // "PNVC"
+#define NVCACHE_MAX_SIZE            4096
+
+#define NVCACHE_ATTRIBUTES          (EFI_VARIABLE_NON_VOLATILE | \
+                                     EFI_VARIABLE_BOOTSERVICE_ACCESS)
+
+typedef struct _NVCACHE_HEADER {
+  UINT32  Magic;
+  UINT16  Version;
+  UINT16  Reserved;
+  UINT32  Size;                     // Of the data following the header
+  UINT32  Checksum;                 // FNV-1a of the data
+  UINT64  Key;
+} NVCACHE_HEADER;
+
+/*******************************************************************************
+ * NvChecksum
+ ******************************************************************************/
+
+static UINT32 NvChecksum(IN const VOID* data, IN const UINTN size)
+{
+  const UINT8* p = (const UINT8*)data;
+  UINT32 h = 0x811c9dc5;
+
+  for (UINTN i = 0; i < size; i++) {
+    h ^= p[i];
+    h *= 0x01000193;
+  }
+
+  return h;
+}
+
+/*******************************************************************************
+ * NvCache_Checksum
+ ******************************************************************************/
+
+UINT32 EFIAPI NvCache_Checksum(IN const VOID* data, IN const UINTN size)
+{
+  return NvChecksum(data, size);
+}
+
+/*******************************************************************************
+ * NvRead
+ * Reads the whole variable into a new pool buffer of exactly 'expected' bytes
+ ******************************************************************************/
+
+static VOID* NvRead(IN CHAR16* name, IN const UINTN expected)
+{
+  UINT32 attr = 0;
+  UINTN varSize = expected;
+
+  VOID* buf = AllocatePool(expected);
+
+  if (!buf) {
+    return NULL;
+  }
+
+  EFI_STATUS status = gRT->GetVariable(name, &gPowerMonkeyVarGuid, &attr, 
+    &varSize, buf);
+
+  if ((EFI_ERROR(status)) || (varSize != expected)) {
+    FreePool(buf);
+    return NULL;
+  }
+
+  return buf;
+}
+
+/*******************************************************************************
+ * NvCache_Load
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI NvCache_Load(
+  IN CHAR16* name,
+  IN const UINT16 version,
+  IN const UINT64 key,
+  OUT VOID* data,
+  IN const UINTN size)
+{
+  if ((!gRT) || (!size) || (size > NVCACHE_MAX_SIZE)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  NVCACHE_HEADER* hdr = (NVCACHE_HEADER*)NvRead(name, 
+    sizeof(NVCACHE_HEADER) + size);
+
+  if (!hdr) {
+    return EFI_NOT_FOUND;
+  }
+
+  EFI_STATUS status = EFI_NOT_FOUND;
+
+  if ((hdr->Magic == NVCACHE_MAGIC) && (hdr->Version == version) &&
+      (hdr->Size == size) && (hdr->Key == key) &&
+      (hdr->Checksum == NvChecksum(hdr + 1, size))) {
+    
+    CopyMem(data, hdr + 1, size);
+    status = EFI_SUCCESS;
+  }
+
+  FreePool(hdr);
+
+  return status;
+}
+
+/*******************************************************************************
+ * NvCache_Store
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI NvCache_Store(
+  IN CHAR16* name,
+  IN const UINT16 version,
+  IN const UINT64 key,
+  IN const VOID* data,
+  IN const UINTN size)
+{
+  if ((!gRT) || (!size) || (size > NVCACHE_MAX_SIZE)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  const UINTN total = sizeof(NVCACHE_HEADER) + size;
+
+  NVCACHE_HEADER* hdr = (NVCACHE_HEADER*)AllocateZeroPool(total);
+
+  if (!hdr) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  hdr->Magic = NVCACHE_MAGIC;
+  hdr->Version = version;
+  hdr->Size = (UINT32)size;
+  hdr->Key = key;
+  hdr->Checksum = NvChecksum(data, size);
+
+  CopyMem(hdr + 1, data, size);
+
+  //
+  // Spare the flash if nothing has changed
+
+  EFI_STATUS status = EFI_SUCCESS;
+  VOID* old = NvRead(name, total);
+
+  if ((!old) || (CompareMem(old, hdr, total) != 0)) {
+    status = gRT->SetVariable(name, &gPowerMonkeyVarGuid, 
+      NVCACHE_ATTRIBUTES, total, hdr);
+  }
+
+  if (old) {
+    FreePool(old);
+  }
+
+  FreePool(hdr);
+
+  return status;
+}
+
+/*******************************************************************************
+ * NvCache_Delete
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI NvCache_Delete(IN CHAR16* name)
+{
+  if (!gRT) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  return gRT->SetVariable(name, &gPowerMonkeyVarGuid, 
+    NVCACHE_ATTRIBUTES, 0, NULL);
+}
@@ -0,0 +1,73 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#pragma once
+
+/*******************************************************************************
+ * NvCache - small blobs persisted across boots in UEFI variables
+ * 
+ * Each blob is stored with a header carrying a layout version, a key (e.g.
+ * CPUID signature) and a checksum. Anything that does not match exactly 
+ * reads as EFI_NOT_FOUND, so a stale or damaged entry is simply rediscovered.
+ * 
+ * Uses runtime services: BSP only, never from a dispatched procedure
+ ******************************************************************************/
+
+/*******************************************************************************
+ * NvCache_Load
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI NvCache_Load(
+  IN CHAR16* name,
+  IN const UINT16 version,
+  IN const UINT64 key,
+  OUT VOID* data,
+  IN const UINTN size);
+
+/*******************************************************************************
+ * NvCache_Store
+ * Does not write (NVRAM) if the stored blob is identical already
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI NvCache_Store(
+  IN CHAR16* name,
+  IN const UINT16 version,
+  IN const UINT64 key,
+  IN const VOID* data,
+  IN const UINTN size);
+
+/*******************************************************************************
+ * NvCache_Delete
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI NvCache_Delete(IN CHAR16* name);
+
+/*******************************************************************************
+ * NvCache_Checksum
+ * FNV-1a, as used for the blobs (also handy for anything else persisted)
+ ******************************************************************************/
+
+UINT32 EFIAPI NvCache_Checksum(IN const VOID* data, IN const UINTN size);
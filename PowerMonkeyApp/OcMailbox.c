@@ -25,9 +25,13 @@
 *******************************************************************************/
 
 #include <Uefi.h>
+#include <Library/BaseMemoryLib.h>
 
 #include "CpuMailboxes.h"
 #include "VFTuning.h"
+#include "LowLevel.h"
+#include "Platform.h"
+#include "PerCpu.h"
 
 /*******************************************************************************
  * Layout of the CPU overclocking mailbox can be found in academic papers:
@@ -68,8 +72,7 @@ EFI_STATUS EFIAPI OcMailbox_InitializeAsMSR(CpuMailbox* b)
 {
   EFI_STATUS state = EFI_SUCCESS;
 
-  b->status = 0;
-  b->b.u64 =  0;
+  SetMem(b, sizeof(CpuMailbox), 0);
   
   b->cfg.type =       MAILBOX_MSR;  
   b->cfg.addr =       MSR_OC_MAILBOX;
@@ -84,6 +87,28 @@ EFI_STATUS EFIAPI OcMailbox_InitializeAsMSR(CpuMailbox* b)
 }
 
 
+/*******************************************************************************
+ * OcMailbox_GetPackageLock
+ ******************************************************************************/
+
+static volatile UINT32* OcMailbox_GetPackageLock(VOID)
+{
+  //
+  // No lock before the platform has been discovered (e.g. in DetectCpu)
+  // as nothing runs concurrently at that point anyway
+
+  if (gNumCores) {
+
+    CPUCORE* core = (CPUCORE*)GetCpuDataBlock();
+
+    if ((core) && (core->parent)) {
+      return &((PACKAGE*)core->parent)->Hot->OcMailboxLock;
+    }
+  }
+
+  return NULL;
+}
+
 /*******************************************************************************
  * OcMailbox_Write
  ******************************************************************************/
@@ -92,10 +117,37 @@ EFI_STATUS EFIAPI OcMailbox_ReadWrite( IN CONST UINT32 cmd,
                                        IN CONST UINT32 data, 
                                        IN OUT CpuMailbox *b )
 {
+  EFI_STATUS status = EFI_SUCCESS;
+
   b->b.box.ifce = cmd;
   b->b.box.data = data;
 
-  return CpuMailbox_ReadWrite(b);
+  //
+  // OC mailbox is shared by all CPUs of the package - when cores are being
+  // programmed concurrently, one transaction (write, busy-wait, read-back)
+  // must complete before another CPU of the same package can start its own
+
+  volatile UINT32* lock = OcMailbox_GetPackageLock();
+
+  if (lock) {
+    pm_spin_lock(lock);
+  }
+
+  status = CpuMailbox_ReadWrite(b);
+
+  if (lock) {
+    pm_spin_unlock(lock);
+  }
+
+  PERCPU_SCRATCH* scratch = PerCpu_Scratch();
+
+  if (scratch) {
+    scratch->MailboxTransactions++;
+    scratch->LastMailboxCmd = cmd;
+    scratch->LastMailboxStatus = b->status;
+  }
+
+  return status;
 }
 
 /*******************************************************************************
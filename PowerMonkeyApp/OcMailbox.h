@@ -28,6 +28,16 @@
 
 #include "CpuMailboxes.h"
 
+/*******************************************************************************
+ * OC mailbox commands used by PowerMonkey
+ ******************************************************************************/
+
+#define OC_CMD_GET_VR_TOPOLOGY          0x04
+#define OC_CMD_READ_VF                  0x10
+#define OC_CMD_WRITE_VF                 0x11
+#define OC_CMD_READ_ICCMAX              0x16
+#define OC_CMD_WRITE_ICCMAX             0x17
+
 /*******************************************************************************
  * InitiazeAsMsrOCMailbox
  ******************************************************************************/
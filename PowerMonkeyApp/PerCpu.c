@@ -0,0 +1,128 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Protocol/MpService.h>
+
+#include "PerCpu.h"
+#include "LowLevel.h"
+#include "SaferAsmHdr.h"
+#include "CoreMap.h"
+
+/*******************************************************************************
+ * Globals
+ ******************************************************************************/
+
+extern EFI_MP_SERVICES_PROTOCOL* gMpServices;
+
+BOOLEAN gPerCpuReady = FALSE;
+
+/*******************************************************************************
+ * PerCpu_Bind
+ ******************************************************************************/
+
+VOID EFIAPI PerCpu_Bind(IN CPUCORE* core)
+{
+  core->Self = core;
+  SetCpuGSBase(core);
+}
+
+/*******************************************************************************
+ * PerCpu_Init
+ ******************************************************************************/
+
+VOID EFIAPI PerCpu_Init(IN PLATFORM* Platform)
+{
+  for (UINTN cidx = 0; cidx < gNumCores; cidx++) {
+
+    CPUCORE* core = (CPUCORE*)gCorePtrs[cidx];
+
+    if (core) {
+      core->Self = core;
+    }
+  }
+
+  //
+  // APs are bound on dispatch, BSP needs to be done here
+
+  CPUCORE* bsp = (CPUCORE*)gCorePtrs[Platform->BootProcessor];
+
+  if (bsp) {
+    PerCpu_Bind(bsp);
+    gPerCpuReady = TRUE;
+  }
+}
+
+/*******************************************************************************
+ * PerCpu_Lookup
+ ******************************************************************************/
+
+CPUCORE* EFIAPI PerCpu_Lookup(VOID)
+{
+  UINTN processorNumber = 0;
+
+  //
+  // APIC ID map first, it is a single hash probe
+
+  CPUCORE* core = CoreMap_ThisCore();
+
+  if (core) {
+    return core;
+  }
+
+  if (!gMpServices) {
+    return NULL;
+  }
+
+  gMpServices->WhoAmI(gMpServices, &processorNumber);
+
+  return (CPUCORE*)gCorePtrs[processorNumber];
+}
+
+/*******************************************************************************
+ * PerCpu_Self
+ ******************************************************************************/
+
+CPUCORE* EFIAPI PerCpu_Self(VOID)
+{
+  if (!gPerCpuReady) {
+    return NULL;
+  }
+
+  return (CPUCORE*)PERCPU_READ64(Self);
+}
+
+/*******************************************************************************
+ * PerCpu_Scratch
+ ******************************************************************************/
+
+PERCPU_SCRATCH* EFIAPI PerCpu_Scratch(VOID)
+{
+  CPUCORE* core = PerCpu_Self();
+
+  return (core) ? &core->Hot->Scratch : NULL;
+}
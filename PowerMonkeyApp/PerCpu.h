@@ -0,0 +1,84 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#pragma once
+
+#include "Platform.h"
+#include "SaferAsmHdr.h"
+
+/*******************************************************************************
+ * Per-CPU storage
+ * 
+ * IA32_GS_BASE of every CPU points to its own CPUCORE block, and the block 
+ * starts with a pointer to itself - so the calling CPU's data can be reached
+ * with a single GS-relative read, instead of asking MP services who we are.
+ * 
+ * GS base of an AP is set when work is dispatched to it (ProcessorIgnite or
+ * the worker pool), BSP's is set once in DiscoverPlatform (PerCpu_Init)
+ ******************************************************************************/
+
+extern BOOLEAN gPerCpuReady;
+
+//
+// Read a CPUCORE field of the calling CPU directly (64-bit fields only)
+
+#define PERCPU_READ64(field) \
+  hlp_gs_read_u64(OFFSET_OF(CPUCORE, field))
+
+/*******************************************************************************
+ * PerCpu_Init
+ * Links all CPU blocks and binds the BSP, call on the BSP once cores are known
+ ******************************************************************************/
+
+VOID EFIAPI PerCpu_Init(IN PLATFORM* Platform);
+
+/*******************************************************************************
+ * PerCpu_Bind
+ * Points GS base of the calling CPU to its block
+ ******************************************************************************/
+
+VOID EFIAPI PerCpu_Bind(IN CPUCORE* core);
+
+/*******************************************************************************
+ * PerCpu_Lookup
+ * Slow path for use before GS base has been set: APIC ID map (CoreMap.h),
+ * MP services WhoAmI if the map is not built yet
+ ******************************************************************************/
+
+CPUCORE* EFIAPI PerCpu_Lookup(VOID);
+
+/*******************************************************************************
+ * PerCpu_Self
+ * Returns NULL until PerCpu_Init has been called
+ ******************************************************************************/
+
+CPUCORE* EFIAPI PerCpu_Self(VOID);
+
+/*******************************************************************************
+ * PerCpu_Scratch
+ ******************************************************************************/
+
+PERCPU_SCRATCH* EFIAPI PerCpu_Scratch(VOID);
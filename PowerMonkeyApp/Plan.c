@@ -0,0 +1,347 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+
+#include "Plan.h"
+#include "VFTuning.h"
+#include "TurboRatioLimits.h"
+#include "CpuData.h"
+#include "Constants.h"
+
+/*******************************************************************************
+ * Globals
+ ******************************************************************************/
+
+extern UINT8 gSkipUnchangedWrites;
+extern UINT8 gPrintProgrammingPlan;
+extern UINT16 vrDomainPrStr[8][12];
+
+/*******************************************************************************
+ * Plan_Get
+ ******************************************************************************/
+
+PKG_PLAN* EFIAPI Plan_Get(IN PACKAGE* pkg)
+{
+  if ((!gSkipUnchangedWrites) || (!pkg->Plan) || (!pkg->Plan->Valid)) {
+    return NULL;
+  }
+
+  return pkg->Plan;
+}
+
+/*******************************************************************************
+ * Plan_Snapshot
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI Plan_Snapshot(IN OUT PLATFORM* sys)
+{
+  if (!gSkipUnchangedWrites) {
+    return EFI_SUCCESS;
+  }
+
+  for (UINTN pidx = 0; pidx < sys->PkgCnt; pidx++) {
+
+    PACKAGE* pk = sys->packages + pidx;
+
+    if (!pk->Plan) {
+      pk->Plan = (PKG_PLAN*)AllocateZeroPool(sizeof(PKG_PLAN));
+
+      //
+      // Without a plan, the package is programmed in full
+
+      if (!pk->Plan) {
+        return EFI_OUT_OF_RESOURCES;
+      }
+    }
+
+    PKG_PLAN* plan = pk->Plan;
+
+    plan->Valid = FALSE;
+
+    CopyMem(plan->Probed, pk->planes, sizeof(plan->Probed));
+    plan->ProbedCtdpLevel = pk->MaxCTDPLevel;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/*******************************************************************************
+ * PlanDomain
+ ******************************************************************************/
+
+static VOID PlanDomain(IN PACKAGE* pk, 
+  IN const UINT8 didx, 
+  IN const DOMAIN* have, 
+  OUT DOMAIN_PLAN* dp)
+{
+  const DOMAIN* want = pk->planes + didx;
+
+  //
+  // IccMax - the unlimited flag cannot be told from a plain read-back on all
+  // parts, so "unlimited" is planned unless the probe saw it set
+
+  if (pk->Program_IccMax[didx]) {
+
+    const UINT16 iccMaxMask = (1 << gActiveCpuData->IccMaxBits) - 1;
+    const UINT16 iccMax = IAPERF_SanitizeIccMax(want->IccMax);
+
+    dp->WriteIccMax = (UINT8)(iccMax != have->IccMax);
+
+    if ((gActiveCpuData->hasUnlimitedIccMaxFlag) && 
+        (iccMax == iccMaxMask) && (!have->UnlimitedIccMax)) {
+      dp->WriteIccMax = 1;
+    }
+  }
+
+  //
+  // Ratio, mode and voltages - compared as mailbox words, as both sides 
+  // went through the same mV <-> fixed point conversions
+
+  dp->WriteVf = 
+    (UINT8)(IAPERF_ComposeDomainVF(want) != IAPERF_ComposeDomainVF(have));
+
+  //
+  // VF points
+
+  if ((pk->Program_VF_Points[didx] == 1) && 
+      (gActiveCpuData->VfPointsExposed == 1)) {
+
+    for (UINT8 vidx = 0; vidx < want->nVfPoints; vidx++) {
+
+      const VF_POINT* wvp = want->vfPoint + vidx;
+      const VF_POINT* hvp = have->vfPoint + vidx;
+
+      if (!wvp->IsValid) {
+        continue;
+      }
+
+      if ((vidx >= have->nVfPoints) || (!hvp->IsValid) ||
+          (IAPERF_ComposeVfPoint(wvp) != IAPERF_ComposeVfPoint(hvp))) {
+        dp->VfPointMask |= (UINT16)(1 << vidx);
+      }
+    }
+  }
+}
+
+/*******************************************************************************
+ * Plan_Build
+ ******************************************************************************/
+
+VOID EFIAPI Plan_Build(IN OUT PLATFORM* sys)
+{
+  if (!gSkipUnchangedWrites) {
+    return;
+  }
+
+  for (UINTN pidx = 0; pidx < sys->PkgCnt; pidx++) {
+
+    PACKAGE* pk = sys->packages + pidx;
+    PKG_PLAN* plan = pk->Plan;
+
+    if (!plan) {
+      continue;
+    }
+
+    ZeroMem(plan->Domain, sizeof(plan->Domain));
+
+    //
+    // OC mailbox
+
+    for (UINT8 didx = 0; didx < MAX_DOMAINS; didx++) {
+      if ((VoltageDomainExists(didx)) && (pk->Program_VF_Overrides[didx])) {
+        PlanDomain(pk, didx, plan->Probed + didx, plan->Domain + didx);
+      }
+    }
+
+    //
+    // Turbo ratio limits
+
+    plan->WriteTrl = 0;
+    plan->WriteTrlECore = 0;
+
+    if (pk->ForcedRatioForPCoreCounts) {
+      plan->TrlValue = ComposeMaxTurboRatios(pk->TurboRatioLimits,
+        pk->ForcedRatioForPCoreCounts);
+
+      plan->WriteTrl = (UINT8)(plan->TrlValue != pk->TurboRatioLimits);
+    }
+
+    if ((pk->CpuInfo.HybridArch) && (pk->ForcedRatioForECoreCounts)) {
+      plan->TrlECoreValue = ComposeMaxTurboRatios(pk->TurboRatioLimitsECore,
+        pk->ForcedRatioForECoreCounts);
+
+      plan->WriteTrlECore = 
+        (UINT8)(plan->TrlECoreValue != pk->TurboRatioLimitsECore);
+    }
+
+    //
+    // cTDP level
+
+    plan->WriteCtdpLevel = 
+      (UINT8)((pk->MaxCTDPLevel & 0x3) != plan->ProbedCtdpLevel);
+
+    plan->Valid = TRUE;
+  }
+}
+
+/*******************************************************************************
+ * CountBits16
+ ******************************************************************************/
+
+static UINT32 CountBits16(IN UINT16 val)
+{
+  UINT32 n = 0;
+
+  for (; val; val &= (UINT16)(val - 1)) {
+    n++;
+  }
+
+  return n;
+}
+
+/*******************************************************************************
+ * Plan_Print
+ ******************************************************************************/
+
+VOID EFIAPI Plan_Print(IN PLATFORM* sys)
+{
+  if ((!gSkipUnchangedWrites) || (!gPrintProgrammingPlan)) {
+    return;
+  }
+
+  for (UINTN pidx = 0; pidx < sys->PkgCnt; pidx++) {
+
+    PACKAGE* pk = sys->packages + pidx;
+    PKG_PLAN* plan = Plan_Get(pk);
+
+    if (!plan) {
+      AsciiPrint("Programming plan, package %u: none, programming all\n", 
+        pidx);
+      continue;
+    }
+
+    UINT32 nPlanned = 0;
+    UINT32 nFull = 0;
+
+    AsciiPrint("Programming plan, package %u:\n", pidx);
+
+    for (UINT8 didx = 0; didx < MAX_DOMAINS; didx++) {
+
+      if ((!VoltageDomainExists(didx)) || (!pk->Program_VF_Overrides[didx])) {
+        continue;
+      }
+
+      DOMAIN_PLAN* dp = plan->Domain + didx;
+      DOMAIN* dom = pk->planes + didx;
+
+      //
+      // What full programming would have cost
+
+      nFull += (pk->Program_IccMax[didx]) ? 1 : 0;
+      nFull += 1;
+
+      if ((pk->Program_VF_Points[didx] == 1) && 
+          (gActiveCpuData->VfPointsExposed == 1)) {
+        for (UINTN vidx = 0; vidx < dom->nVfPoints; vidx++) {
+          nFull += (dom->vfPoint[vidx].IsValid) ? 1 : 0;
+        }
+      }
+
+      nPlanned += (UINT32)dp->WriteIccMax + (UINT32)dp->WriteVf + 
+        CountBits16(dp->VfPointMask);
+
+      AsciiPrint("  %s:", &vrDomainPrStr[didx][0]);
+
+      if ((!dp->WriteIccMax) && (!dp->WriteVf) && (!dp->VfPointMask)) {
+        AsciiPrint(" unchanged\n");
+        continue;
+      }
+
+      if (dp->WriteIccMax) {
+        AsciiPrint(" IccMax %u -> %u,", 
+          plan->Probed[didx].IccMax, 
+          IAPERF_SanitizeIccMax(dom->IccMax));
+      }
+
+      if (dp->WriteVf) {
+        AsciiPrint(" V/F 0x%08x -> 0x%08x,",
+          IAPERF_ComposeDomainVF(plan->Probed + didx),
+          IAPERF_ComposeDomainVF(dom));
+      }
+
+      if (dp->VfPointMask) {
+        AsciiPrint(" VF points:");
+
+        for (UINTN vidx = 0; vidx < MAX_VF_POINTS; vidx++) {
+          if (dp->VfPointMask & (1 << vidx)) {
+            AsciiPrint(" #%u", vidx);
+          }
+        }
+      }
+
+      AsciiPrint("\n");
+    }
+
+    if (plan->WriteTrl) {
+      AsciiPrint("  TRL: 0x%016lx -> 0x%016lx\n",
+        pk->TurboRatioLimits, plan->TrlValue);
+    }
+
+    if (plan->WriteTrlECore) {
+      AsciiPrint("  TRL (E-cores): 0x%016lx -> 0x%016lx\n",
+        pk->TurboRatioLimitsECore, plan->TrlECoreValue);
+    }
+
+    if (plan->WriteCtdpLevel) {
+      AsciiPrint("  cTDP level: %u -> %u\n",
+        plan->ProbedCtdpLevel, pk->MaxCTDPLevel & 0x3);
+    }
+
+    AsciiPrint("  OC mailbox writes: %u (%u skipped)\n\n", 
+      nPlanned, nFull - nPlanned);
+  }
+}
+
+/*******************************************************************************
+ * Plan_Release
+ ******************************************************************************/
+
+VOID EFIAPI Plan_Release(IN OUT PLATFORM* sys)
+{
+  for (UINTN pidx = 0; pidx < sys->PkgCnt; pidx++) {
+
+    PACKAGE* pk = sys->packages + pidx;
+
+    if (pk->Plan) {
+      FreePool(pk->Plan);
+      pk->Plan = NULL;
+    }
+  }
+}
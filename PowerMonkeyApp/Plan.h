@@ -0,0 +1,104 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#pragma once
+
+#include "Platform.h"
+
+/*******************************************************************************
+ * Programming plan
+ * 
+ * ProbePackage stores what the hardware currently holds in the same PACKAGE
+ * and DOMAIN fields that ApplyComputerOwnersPolicy later overwrites with the
+ * requested values. Plan_Snapshot keeps a copy of the probed state before
+ * the policy is applied, Plan_Build compares both and records which writes
+ * are actually needed. Programming procedures then skip everything else, 
+ * so an unchanged profile costs (next to) no mailbox round-trips.
+ * 
+ * Power limit MSR/MMIO fields are not planned here: their encoding depends
+ * on firmware limits read from the same registers, so they are compared 
+ * against the register contents at write time instead (see PowerLimits.c)
+ ******************************************************************************/
+
+typedef struct _DOMAIN_PLAN
+{
+  UINT8   WriteIccMax;                    // IccMax (0x17)
+  UINT8   WriteVf;                        // Ratio/mode/voltages (0x11, pt. 0)
+  UINT16  VfPointMask;                    // Bit N: VF point N (0x11, pt. N+1)
+} DOMAIN_PLAN;
+
+typedef struct _PKG_PLAN
+{
+  BOOLEAN     Valid;                      // Built, use it
+  UINT8       WriteTrl;                   // MSR_TURBO_RATIO_LIMIT
+  UINT8       WriteTrlECore;              // MSR_TURBO_RATIO_LIMIT_ECORE
+  UINT8       WriteCtdpLevel;             // MSR_CONFIG_TDP_CONTROL[1:0]
+
+  DOMAIN_PLAN Domain[MAX_DOMAINS];
+
+  UINT64      TrlValue;                   // Requested values
+  UINT64      TrlECoreValue;
+
+  //
+  // Probed state (before ApplyComputerOwnersPolicy)
+
+  DOMAIN      Probed[MAX_DOMAINS];
+  UINT8       ProbedCtdpLevel;
+} PKG_PLAN;
+
+/*******************************************************************************
+ * Plan_Snapshot
+ * Keeps the probed state, call before ApplyComputerOwnersPolicy
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI Plan_Snapshot(IN OUT PLATFORM* sys);
+
+/*******************************************************************************
+ * Plan_Build
+ * Compares the requested state with the snapshot, call after the policy
+ ******************************************************************************/
+
+VOID EFIAPI Plan_Build(IN OUT PLATFORM* sys);
+
+/*******************************************************************************
+ * Plan_Print
+ ******************************************************************************/
+
+VOID EFIAPI Plan_Print(IN PLATFORM* sys);
+
+/*******************************************************************************
+ * Plan_Release
+ * Frees the plans, programming falls back to writing everything
+ ******************************************************************************/
+
+VOID EFIAPI Plan_Release(IN OUT PLATFORM* sys);
+
+/*******************************************************************************
+ * Plan_Get
+ * Plan of the package, or NULL if there is none (write everything)
+ ******************************************************************************/
+
+PKG_PLAN* EFIAPI Plan_Get(IN PACKAGE* pkg);
@@ -28,6 +28,7 @@
 #include <Uefi.h>
 #include <Library/UefiLib.h>
 #include <Library/MemoryAllocationLib.h>
+#include <Library/BaseMemoryLib.h>
 #include <Protocol/MpService.h>
 
 #include "Platform.h"
@@ -43,6 +44,15 @@
 #include "PrintStats.h"
 #include "CpuData.h"
 #include "LowLevel.h"
+#include "RegScope.h"
+#include "PerCpu.h"
+#include "CoreMap.h"
+#include "Topology.h"
+#include "Profile.h"
+#include "Plan.h"
+#include "ProbeCache.h"
+#include "VrTopology.h"
+#include "VrGroups.h"
 
 /*******************************************************************************
  * Globals
@@ -54,110 +64,9 @@
 extern EFI_MP_SERVICES_PROTOCOL* gMpServices;
 extern UINT8 gPrintPackageConfig;
 extern UINT8 gPostProgrammingOcLock;
+extern UINT8 gConcurrentProgramming;
 extern PLATFORM* gPlatform;
 
-/*******************************************************************************
- * CoreIdxMap
- ******************************************************************************/
-
-UINTN gNumCores = 0;
-VOID* gCorePtrs[MAX_CORES * MAX_PACKAGES] = { 0 };
-UINTN gCoreApicIDs[MAX_CORES * MAX_PACKAGES] = { 0 };
-
-/*******************************************************************************
- * ApicIdToCoreNumber
- ******************************************************************************/
-
-UINTN ApicIdToCoreNumber(const UINTN ApicID)
-{
-  for (UINTN ccount = 0; ccount < gNumCores; ccount++) {
-    if (gCoreApicIDs[ccount] == ApicID) {
-      return ccount;
-    }
-  }
-
-  return 0;
-}
-
-
-/*******************************************************************************
- * DiscoverVRTopology
- ******************************************************************************/
-
-EFI_STATUS DiscoverVRTopology(IN OUT PACKAGE* pkg)
-{
-  EFI_STATUS status = EFI_SUCCESS;
-
-  //
-  // We can use OC Mailbox Function 0x04 only if we:
-  //   a) know how to parse the result
-  // and
-  //   b) CPU actually supports this
-  //
-
-  MiniTraceEx("Detecting VR Topology");
-
-  for (UINTN didx = 0; didx < MAX_DOMAINS; didx++) {
-
-    DOMAIN* dom = &pkg->planes[didx];
-
-    dom->VRaddr = INVALID_VR_ADDR;
-    dom->VRtype = NO_SVID_VR;
-
-    if (gActiveCpuData->vtdt) {
-      
-      VOLTPLANEDESC* vguide = &gActiveCpuData->vtdt->doms[didx];
-
-      //
-      // Domain should exist, check if OC Mailbox can be used to probe it
-
-      if (vguide->DomainExists) {
-
-        if (vguide->DomainSupportedForDiscovery) {
-
-          CpuMailbox box;
-          MailboxBody* b = &box.b;
-
-          //
-          // Use command 0x04 to obtain VR info
-
-          OcMailbox_InitializeAsMSR(&box);
-          UINT32 cmd = OcMailbox_BuildInterface(0x04, 0x0, 0x0);
-          status = OcMailbox_ReadWrite(cmd, 0, &box);
-
-          if (box.status == 0) {
-
-            const UINT32 amask  = vguide->OCMB_VRAddr_DomainBitMask;
-            const UINT32 tmask  = vguide->OCMB_VRsvid_DomainBitMask;
-            const UINT32 ashift = vguide->OCMB_VRAddr_DomainBitShift;
-
-            dom->VRaddr = (UINT8)((b->box.data & amask) >> ashift);
-            dom->VRtype = (UINT8)((b->box.data & tmask) ? NO_SVID_VR : SVID_VR);
-
-          }
-        }
-        else {
-
-          //
-          // Domain cannot be probed by OC Mailbox
-          // This means either incomplete info, 
-          // or BIOS PCODE Mailbox must be used
-
-          MiniTraceEx("Domain 0x%x cannot be probed using OC Mailbox", didx);
-        }
-      }
-      else {
-        MiniTraceEx("Skipping nonexistent voltage domain 0x%x", didx);
-      }
-    }
-    else {
-      MiniTraceEx("CPU information does not contain VR Topology discovery information");
-    }
-  }
-
-  return status;
-}
-
 /*******************************************************************************
  * DomainSupported
  ******************************************************************************/
@@ -198,6 +107,13 @@ EFI_STATUS EFIAPI ProbePackage(IN OUT PACKAGE* pkg)
 {
   EFI_STATUS status = EFI_SUCCESS;
 
+  //
+  // Probed before: only re-read what has been written since
+
+  if (ProbeCache_CanRefresh(pkg)) {
+    return ProbeCache_Refresh(pkg);
+  }
+
   if (pkg->probed != 1) {
 
     ///////////
@@ -224,8 +140,16 @@ EFI_STATUS EFIAPI ProbePackage(IN OUT PACKAGE* pkg)
       if (pkg->probed != 1) {
         dom->parent = (void*)pkg;
       }
+
+      //
+      // VF points known from a previous boot are read without enumeration
+
+      const VF_TOPOLOGY* known = (pkg->ProbeCache.VfTopologyLoaded) ?
+        &pkg->ProbeCache.VfTopology[didx] : NULL;
       
-      IAPERF_ProbeDomainVF(didx, dom);
+      if (!EFI_ERROR(IAPERF_ProbeDomainVF(didx, dom, known))) {
+        ProbeCache_KeepVfTopology(pkg, didx);
+      }
     }
   }
 
@@ -234,6 +158,10 @@ EFI_STATUS EFIAPI ProbePackage(IN OUT PACKAGE* pkg)
 
   pkg->TurboRatioLimits = GetTurboRatioLimits();
 
+  if (pkg->CpuInfo.HybridArch) {
+    pkg->TurboRatioLimitsECore = GetTurboRatioLimits_ECORE();
+  }
+
   //
   // cTDP Levels
 
@@ -258,6 +186,8 @@ EFI_STATUS EFIAPI ProbePackage(IN OUT PACKAGE* pkg)
 
   pkg->probed = 1;
 
+  ProbeCache_Store(pkg);
+
   return status;
 }
 
@@ -265,26 +195,41 @@ EFI_STATUS EFIAPI ProbePackage(IN OUT PACKAGE* pkg)
  * ProgramVFOverridesAndOCRatios
  ******************************************************************************/
 
-EFI_STATUS EFIAPI ProgramVFOverridesAndOCRatios()
+EFI_STATUS EFIAPI ProgramVFOverridesAndOCRatios(IN OUT CORE_RESULT* res, 
+  IN VOID* param OPTIONAL)
 {
+  PMUNUSED(param);
+
   EFI_STATUS status = EFI_SUCCESS;
 
+  PROFILE_BEGIN(tCore);
+
   //
   // We will locate our core and package using 
   // per-CPU Local Storage
 
   CPUCORE* core = (CPUCORE*)GetCpuDataBlock();
   PACKAGE* pkg = (PACKAGE*)core->parent;
+
+  //
+  // Only what differs from the probed state, if planned (see Plan.h)
+
+  const PKG_PLAN* plan = Plan_Get(pkg);
     
   //
   // Forced turbo ratios
 
-  if (pkg->ForcedRatioForPCoreCounts) {
+  if ((pkg->ForcedRatioForPCoreCounts) && ((!plan) || (plan->WriteTrl)) &&
+      (RegScope_ShouldWrite(MSR_TURBO_RATIO_LIMIT, REG_SCOPE_NO_CMD))) {
+    ProbeCache_MarkPackage(pkg, PROBE_PKG_TRL);
     IAPERF_ProgramMaxTurboRatios(pkg->ForcedRatioForPCoreCounts);
   }
 
   if (gCpuInfo.HybridArch) {
-    if (pkg->ForcedRatioForECoreCounts) {
+    if ((pkg->ForcedRatioForECoreCounts) && 
+        ((!plan) || (plan->WriteTrlECore)) &&
+        (RegScope_ShouldWrite(MSR_TURBO_RATIO_LIMIT_ECORE, REG_SCOPE_NO_CMD))) {
+      ProbeCache_MarkPackage(pkg, PROBE_PKG_TRL_ECORE);
       IAPERF_ProgramMaxTurboRatios_ECORE(pkg->ForcedRatioForECoreCounts);
     }
   }
@@ -292,17 +237,43 @@ EFI_STATUS EFIAPI ProgramVFOverridesAndOCRatios()
   //
   // Program V/F overrides
 
-  for (UINT8 didx = 0; didx < MAX_DOMAINS; didx++) {
+  const BOOLEAN writeVf = 
+    RegScope_ShouldWrite(MSR_OC_MAILBOX, OC_CMD_WRITE_VF);
+
+  const BOOLEAN writeIccMax = 
+    RegScope_ShouldWrite(MSR_OC_MAILBOX, OC_CMD_WRITE_ICCMAX);
+
+  //
+  // Domains sharing a VR are programmed back to back (see VrGroups.h)
+
+  UINT8 order[MAX_DOMAINS];
+  VrGroups_ProgramOrder(pkg, order);
+
+  for (UINT8 oidx = 0; (writeVf) && (oidx < MAX_DOMAINS); oidx++) {
+    const UINT8 didx = order[oidx];
+
     if (VoltageDomainExists(didx)) {
       DOMAIN* dom = pkg->planes + didx;
 
       if (pkg->Program_VF_Overrides[didx]) {
-        IAPERF_ProgramDomainVF(didx, dom, pkg->Program_VF_Points[didx],
-          pkg->Program_IccMax[didx]);
+        EFI_STATUS domStatus = IAPERF_ProgramDomainVF(didx, dom, 
+          pkg->Program_VF_Points[didx],
+          (writeIccMax) ? pkg->Program_IccMax[didx] : 0,
+          (plan) ? plan->Domain + didx : NULL,
+          &res->MailboxStatus);
+
+        //
+        // Keep going with other domains, but remember the first failure
+
+        if ((EFI_ERROR(domStatus)) && (!EFI_ERROR(status))) {
+          status = domStatus;
+        }
       }
     }
   }
 
+  PROFILE_END(tCore, "Core: V/F programming");
+
   return status;
 }
 
@@ -325,7 +296,12 @@ EFI_STATUS EFIAPI ProgramPowerLimits()
   // Program Config TDP Params
   // with no lock 
 
-  SetCTDPLevel(pkg->MaxCTDPLevel);
+  const PKG_PLAN* plan = Plan_Get(pkg);
+
+  if ((!plan) || (plan->WriteCtdpLevel)) {
+    ProbeCache_MarkPackage(pkg, PROBE_PKG_CTDP);
+    SetCTDPLevel(pkg->MaxCTDPLevel);
+  }
 
   ///////////////////
   // Power Limits  //
@@ -336,6 +312,8 @@ EFI_STATUS EFIAPI ProgramPowerLimits()
 
   if (pkg->ProgramPL12_MSR) {
 
+    ProbeCache_MarkPackage(pkg, PROBE_PKG_POWER_LIMITS);
+
     SetPkgPowerLimit12(
       IO_MSR,
       pkg->MsrPkgMaxTau,
@@ -394,15 +372,29 @@ EFI_STATUS EFIAPI ProgramPowerLimits()
 
   }
 
-  //
-  // Power Control
+  return status;
+}
 
-  if (pkg->ProgramPowerTweaks) {
+/*******************************************************************************
+ * ProgramCorePowerCtl
+ * MSR_POWER_CTL has core scope - run on a representative of every core
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI ProgramCorePowerCtl(IN OUT CORE_RESULT* res,
+  IN VOID* param OPTIONAL)
+{
+  PMUNUSED(res);
+  PMUNUSED(param);
+
+  CPUCORE* core = (CPUCORE*)GetCpuDataBlock();
+  PACKAGE* pkg = (PACKAGE*)core->parent;
+
+  if ((pkg->ProgramPowerTweaks) &&
+      (RegScope_ShouldWrite(MSR_POWER_CONTROL, REG_SCOPE_NO_CMD))) {
     ProgramPowerCtl(pkg->EnableEETurbo, pkg->EnableRaceToHalt);
   }
 
-
-  return status;
+  return EFI_SUCCESS;
 }
 
 /*******************************************************************************
@@ -490,128 +482,260 @@ EFI_STATUS EFIAPI ProgramPowerLimits_Stage2()
 
 
 /*******************************************************************************
- * DiscoverPackage
+ * FreeDetectedPackages
+ * Undoes the allocations of the first nPackages packages (and the array)
  ******************************************************************************/
 
-EFI_STATUS DetectPackages(IN OUT PLATFORM* psys)
+static VOID FreeDetectedPackages(IN OUT PLATFORM* psys,
+  IN const UINTN nPackages,
+  IN const UINTN* threadsInPkg)
 {
-  EFI_STATUS status = EFI_SUCCESS;
+  for (UINTN pidx = 0; pidx < nPackages; pidx++) {
+
+    PACKAGE* pac = psys->packages + pidx;
 
-  PACKAGE* pac = &psys->packages[0];
-  UINT32 prevPackage = 0xFFFFFFFF;
+    const UINTN hotSize = 
+      sizeof(PACKAGE_HOT) + threadsInPkg[pidx] * sizeof(CPUCORE_HOT);
 
+    if (pac->Core) {
+      FreePool(pac->Core);
+    }
+
+    if (pac->Hot) {
+      FreePages(pac->Hot, EFI_SIZE_TO_PAGES(hotSize));
+    }
+  }
+
+  FreePool(psys->packages);
+  psys->packages = NULL;
+}
+
+/*******************************************************************************
+ * DetectPackagesTwoPass
+ * 
+ * Pass 1 counts packages and threads per package, so that packages and their
+ * core arrays can be allocated to the discovered size; pass 2 populates them
+ ******************************************************************************/
+
+static EFI_STATUS DetectPackagesTwoPass(IN OUT PLATFORM* psys,
+  IN EFI_PROCESSOR_INFORMATION* pis,
+  IN UINT32* pkgIds,
+  IN UINT32* pkgOfThread,
+  IN UINTN* threadsInPkg)
+{
+  const UINTN nThreads = psys->LogicalProcessors;
   UINTN nPackages = 0;
-  UINTN nThreadsTotal = 0;
 
-  UINTN localCoreCount = 0;
+  ///
+  /// Pass 1: which package does each thread belong to
+  ///
+
+  for (UINTN tidx = 0; tidx < nThreads; tidx++) {
+
+    //
+    // Basic topology
+
+    gMpServices->GetProcessorInfo(gMpServices, tidx, pis + tidx);
+
+    const UINT32 pkgId = pis[tidx].Location.Package;
+    UINTN pidx = 0;
+
+    while ((pidx < nPackages) && (pkgIds[pidx] != pkgId)) {
+      pidx++;
+    }
 
-  pac->parent = psys;
+    if (pidx == nPackages) {
+      pkgIds[nPackages++] = pkgId;
+    }
 
-  for (UINTN pidx = 0; pidx < psys->PkgCnt; pidx++) {
-    PACKAGE* p = psys->packages + pidx;
-    p->FirstCoreApicID = 0xFFFFFFFF;
-    p->FirstCoreNumber = 0xFFFFFFFF;
+    pkgOfThread[tidx] = (UINT32)pidx;
+    threadsInPkg[pidx]++;
   }
 
-  for (UINTN tidx = 0; tidx < psys->LogicalProcessors; tidx++) {
+  ///
+  /// Allocate packages and their cores to the discovered size
+  ///
 
-    EFI_PROCESSOR_INFORMATION pi = {0};
+  psys->packages = (PACKAGE*)AllocateZeroPool(nPackages * sizeof(PACKAGE));
 
-#if 0
-    
-    //
-    // Extended topology
-    
-    gMpServices->GetProcessorInfo(gMpServices, tidx | CPU_V2_EXTENDED_TOPOLOGY, &pi);
+  if (!psys->packages) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  for (UINTN pidx = 0; pidx < nPackages; pidx++) {
 
-//    UINT32 *ppi_core =    &pi.ExtendedInformation.Location2.Core;
-    UINT32 *ppi_thread =  &pi.ExtendedInformation.Location2.Thread;
-    UINT32 *ppi_package = &pi.ExtendedInformation.Location2.Package;
+    PACKAGE* pac = psys->packages + pidx;
 
-#else
+    const UINTN hotSize = 
+      sizeof(PACKAGE_HOT) + threadsInPkg[pidx] * sizeof(CPUCORE_HOT);
+
+    pac->Core = (CPUCORE*)AllocateZeroPool(
+      threadsInPkg[pidx] * sizeof(CPUCORE));
 
     //
-    // Basic topology
-    
-    gMpServices->GetProcessorInfo(gMpServices, tidx, &pi);
+    // Pages are cache-line aligned, and so will be every record in them
 
-//    UINT32 *ppi_core =    &pi.Location.Core;
-    UINT32 *ppi_thread =  &pi.Location.Thread;
-    UINT32 *ppi_package = &pi.Location.Package;
+    pac->Hot = (PACKAGE_HOT*)AllocatePages(EFI_SIZE_TO_PAGES(hotSize));
 
-#endif
+    if ((!pac->Core) || (!pac->Hot)) {
+      FreeDetectedPackages(psys, pidx + 1, threadsInPkg);
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    ZeroMem(pac->Hot, hotSize);
+
+    CPUCORE_HOT* coreHot = (CPUCORE_HOT*)(pac->Hot + 1);
+
+    for (UINTN cidx = 0; cidx < threadsInPkg[pidx]; cidx++) {
+      pac->Core[cidx].Hot = coreHot + cidx;
+    }
 
-    if (prevPackage == 0xFFFFFFFF)
-      prevPackage = *ppi_package;
+    pac->parent = (VOID*)psys;
+    pac->idx = (UINT64)pidx;
+    pac->PackageID = pkgIds[pidx];
+    pac->FirstCoreApicID = 0xFFFFFFFF;
+    pac->FirstCoreNumber = 0xFFFFFFFF;
+  }
+
+  ///
+  /// Pass 2: populate
+  ///
+
+  for (UINTN tidx = 0; tidx < nThreads; tidx++) {
+
+    EFI_PROCESSOR_INFORMATION* pi = pis + tidx;
+    PACKAGE* pac = psys->packages + pkgOfThread[tidx];
+
+    const UINTN localCoreCount = pac->LogicalCores;
 
     CPUCORE* core = &pac->Core[localCoreCount];
 
-    core->LocalIdx = (UINT8) localCoreCount;
-    core->ApicID = pi.ProcessorId;
+    core->LocalIdx = (UINT32) localCoreCount;
+    core->ApicID = pi->ProcessorId;
     core->AbsIdx = tidx;
     core->parent = (VOID*) pac;
-    core->PkgIdx = (UINT8) nPackages;
-    pac->idx = (UINT64) nPackages;
+    core->PkgIdx = (UINT8) pkgOfThread[tidx];
 
-    gCorePtrs[tidx] = (VOID*)&pac->Core[localCoreCount];
-    gCoreApicIDs[tidx] = pac->Core[localCoreCount].ApicID;
+    gCorePtrs[tidx] = (VOID*)core;
+    gCoreApicIDs[tidx] = core->ApicID;
 
     //
     // ALDER LAKE HACK!
     // some systems will keep returning pi.location.core as 0, and keep 
     // increasing thread idx instead
     // because of these systems, we need to go back to old ugly hack
+    //
+    // NOTE: only a first guess, replaced by CPUID-based topology in 
+    // Topology_Finalize (if the CPU supports leaf 0xB / 0x1F)
+
+    //const BOOLEAN physCore = (pi->Location.Thread == 0) ? 1 : 0;
 
-    //const BOOLEAN physCore = (*ppi_thread == 0) ? 1 : 0;
+    const UINT32 thread = pi->Location.Thread;
 
-    const BOOLEAN physCore = (((*ppi_thread == 0)||((*ppi_thread > 0) &&
-                             (*ppi_thread % 2 == 0)))) ? 1 : 0;             // will not work for N>2-way SMT
+    const BOOLEAN physCore = (((thread == 0)||((thread > 0) &&
+                             (thread % 2 == 0)))) ? 1 : 0;                  // will not work for N>2-way SMT
         
     pac->LogicalCores += 1;
     pac->PhysicalCores += (physCore) ? 1 : 0;
 
-    pac->Core[localCoreCount].IsPhysical = physCore;
+    core->IsPhysical = physCore;
 
     if (pac->FirstCoreApicID == 0xFFFFFFFF) {
-      pac->FirstCoreApicID = pi.ProcessorId;
+      pac->FirstCoreApicID = pi->ProcessorId;
     }
 
     if (pac->FirstCoreNumber == 0xFFFFFFFF) {
       pac->FirstCoreNumber = tidx;
     }      
-    
-    nThreadsTotal++;
-    localCoreCount++;
 
 #if 0
 
     AsciiPrint("[Tidx %lu] pi.loc.core: %u, pi.loc.package: %u, pi.loc.thread: %u, physical: %u, abs idx: %lu, pkg idx: %u\n", 
       tidx, 
-      *ppi_core,
-      *ppi_package,
-      *ppi_thread,
+      pi->Location.Core,
+      pi->Location.Package,
+      pi->Location.Thread,
       (UINT32) core->IsPhysical,
       (UINT32) core->AbsIdx,
       (UINT32) core->PkgIdx);
 
 #endif
+  }
 
-    if (*ppi_package != prevPackage)
-    {
-      //
-      // New package detected
+  psys->LogicalProcessors = gNumCores = nThreads;
+  psys->PkgCnt = nPackages;
 
-      pac->parent = (VOID*)psys;
+  return EFI_SUCCESS;
+}
 
-      nPackages++;
-      prevPackage = *ppi_package;
-      localCoreCount = 0;
-      pac++;
-    }
+/*******************************************************************************
+ * DiscoverPackage
+ ******************************************************************************/
+
+EFI_STATUS DetectPackages(IN OUT PLATFORM* psys)
+{
+  EFI_STATUS status = EFI_SUCCESS;
+
+  const UINTN nThreads = psys->LogicalProcessors;
+
+  //
+  // Index maps sized to what MP services reported
+
+  status = CoreMap_Allocate(nThreads);
+
+  if (EFI_ERROR(status)) {
+    return status;
   }
 
-  psys->LogicalProcessors = gNumCores = nThreadsTotal;
-  psys->PkgCnt = nPackages + 1;
+  //
+  // Scratch for the first pass (package IDs are at most one per thread)
+
+  EFI_PROCESSOR_INFORMATION* pis = (EFI_PROCESSOR_INFORMATION*)
+    AllocateZeroPool(nThreads * sizeof(EFI_PROCESSOR_INFORMATION));
+
+  UINT32* pkgIds = (UINT32*)AllocateZeroPool(nThreads * sizeof(UINT32));
+  UINT32* pkgOfThread = (UINT32*)AllocateZeroPool(nThreads * sizeof(UINT32));
+  UINTN* threadsInPkg = (UINTN*)AllocateZeroPool(nThreads * sizeof(UINTN));
+
+  if ((pis) && (pkgIds) && (pkgOfThread) && (threadsInPkg)) {
+    status = DetectPackagesTwoPass(psys, pis, pkgIds, pkgOfThread, 
+      threadsInPkg);
+  }
+  else {
+    status = EFI_OUT_OF_RESOURCES;
+  }
+
+  if (pis) FreePool(pis);
+  if (pkgIds) FreePool(pkgIds);
+  if (pkgOfThread) FreePool(pkgOfThread);
+  if (threadsInPkg) FreePool(threadsInPkg);
+
+  //
+  // APIC ID -> CPU index lookups
+
+  if (!EFI_ERROR(status)) {
+    CoreMap_Build();
+  }
+
+  return status;
+}
+
+/*******************************************************************************
+* ProbePackageOnThisCpu
+******************************************************************************/
+
+EFI_STATUS EFIAPI ProbePackageOnThisCpu(IN OUT CORE_RESULT* res,
+  IN VOID* param OPTIONAL)
+{
+  PMUNUSED(res);
+  PMUNUSED(param);
+
+  PROFILE_BEGIN(tCore);
+
+  CPUCORE* core = (CPUCORE*)GetCpuDataBlock();
+  EFI_STATUS status = ProbePackage((PACKAGE*)core->parent);
+
+  PROFILE_END(tCore, "Core: package probe");
 
   return status;
 }
@@ -624,27 +748,40 @@ EFI_STATUS EFIAPI ProbePackages(IN OUT PLATFORM* ppd)
 {
   EFI_STATUS status = EFI_SUCCESS;
 
+  CORE_RESULT* results = (CORE_RESULT*)AllocateZeroPool(
+    ppd->LogicalProcessors * sizeof(CORE_RESULT));
+
+  if (!results) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
   //
-  // For each package
+  // All packages at once (unless disabled in the configuration), each on 
+  // its 1st core
 
-  for (UINTN pidx = 0; pidx < ppd->PkgCnt; pidx++)
-  {
-    PACKAGE* pac = ppd->packages + pidx;
+  for (UINTN pidx = 0; pidx < ppd->PkgCnt; pidx++) {
+    results[ppd->packages[pidx].FirstCoreNumber].Selected = 1;
+  }
 
-    //
-    // Run on 1st core
+  RunOnSelectedCores(ppd, ProbePackageOnThisCpu, 
+    (gConcurrentProgramming) ? TRUE : FALSE, NULL, results);
 
-    status = RunOnPackageOrCore(ppd, pac->FirstCoreNumber, (EFI_AP_PROCEDURE)ProbePackage, pac);
+  for (UINTN pidx = 0; pidx < ppd->PkgCnt; pidx++) {
+
+    PACKAGE* pac = ppd->packages + pidx;
+    CORE_RESULT* res = results + pac->FirstCoreNumber;
 
-    if (EFI_ERROR(status)) {
+    if (EFI_ERROR(res->Status)) {
       Print(L"[ERROR] CPU package %u, status code: 0x%x\n",
         pac->FirstCoreNumber,
-        status);
+        res->Status);
 
-      return status;
+      status = res->Status;
     }
   }
 
+  FreePool(results);
+
   return status;
 }
 
@@ -657,42 +794,42 @@ EFI_STATUS EFIAPI ProbeCores(IN OUT PLATFORM* ppd)
 {
   EFI_STATUS status = EFI_SUCCESS;
 
+  CORE_RESULT* results = (CORE_RESULT*)AllocateZeroPool(
+    ppd->LogicalProcessors * sizeof(CORE_RESULT));
+
+  if (!results) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  //
+  // Note: we use NULL instead of a real callback, because only data
+  // being collected per-core is going to be collected by the MP dispatch
+  // "Ignite" call itself. Once we need more data from each core, there
+  // will be separate callback to do so
   //
-  // Probe each package in its own context
+  // All cores fill their CPUCORE concurrently, in a single fan-out (unless 
+  // disabled in the configuration)
 
-  for (UINTN pidx = 0; pidx < ppd->PkgCnt; pidx++)
-  {
-    PACKAGE* pac = ppd->packages + pidx;
+  for (UINTN cidx = 0; cidx < ppd->LogicalProcessors; cidx++) {
+    results[cidx].Selected = 1;
+  }
 
-    for (UINTN cidx = 0; cidx < pac->LogicalCores; cidx++)
-    {
-      CPUCORE* core = &pac->Core[cidx];
+  RunOnSelectedCores(ppd, NULL, 
+    (gConcurrentProgramming) ? TRUE : FALSE, NULL, results);
 
-      /* if (core->IsPhysical) */ {
+  for (UINTN cidx = 0; cidx < ppd->LogicalProcessors; cidx++) {
 
-        //
-        // Note: we use NULL instead of a real callback, because only data
-        // being collected per-core is going to be collected by the MP dispatch
-        // "Ignite" call itself. Once we need more data from each core, there
-        // will be separate callback to do so
-
-        status = RunOnPackageOrCore(ppd,
-          core->AbsIdx,
-          (EFI_AP_PROCEDURE)NULL,
-          pac
-        );
-
-        if (EFI_ERROR(status)) {
-          Print(L"[ERROR] CPU package %u, status code: 0x%x\n",
-            pac->FirstCoreNumber,
-            status);
-
-          return status;
-        }
-      }
+    if (EFI_ERROR(results[cidx].Status)) {
+      Print(L"[ERROR] CPU %u, status code: 0x%x\n",
+        cidx,
+        results[cidx].Status);
+
+      status = results[cidx].Status;
     }
   }
 
+  FreePool(results);
+
   return status;
 }
 
@@ -749,20 +886,50 @@ EFI_STATUS EFIAPI DiscoverPlatform(IN OUT PLATFORM** ppsys)
   // Identify CPU packages
   // and their respective CPU cores 
 
-  DetectPackages(ppd);
+  PROFILE_BEGIN(tDetect);
+  status = DetectPackages(ppd);
+  PROFILE_END(tDetect, "DetectPackages");
+
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+
+  //
+  // GS-based per-CPU storage (BSP bound here, APs on dispatch)
+
+  PerCpu_Init(ppd);
+  Profile_Init(ppd);
+  CpuMailbox_InitStats(gNumCores);
+  InitTraceRings(gNumCores);
 
   //
   // Collect information specific
   // to each CPU core - currently only hybrid architecture CPUs need this
 
   /*if (gCpuInfo->HybridArch)*/ {   // <-- remove when necessary
+    PROFILE_BEGIN(tCores);
     ProbeCores(ppd);
+    PROFILE_END(tCores, "ProbeCores");
   }
 
+  //
+  // Topology is known now: pick CPUs that will write core-, module- and 
+  // package-scoped registers
+
+  PROFILE_BEGIN(tTopo);
+  Topology_Finalize(ppd);
+  PROFILE_END(tTopo, "Topology_Finalize");
+
   //
   // Probe each detected package and collect info
   
+  PROFILE_BEGIN(tPackages);
+  VrTopology_LoadCached(ppd);
+  ProbeCache_LoadVfTopology(ppd);
   ProbePackages(ppd);
+  VrTopology_StoreCached(ppd);
+  ProbeCache_StoreVfTopology(ppd);
+  PROFILE_END(tPackages, "ProbePackages (discovery)");
   
   return EFI_SUCCESS;
 }
@@ -781,8 +948,14 @@ VOID PrintPlatformInfo(IN PLATFORM* psys)
  * ProgramCoreLocks
  ******************************************************************************/
 
-EFI_STATUS EFIAPI ProgramCoreLocks()
+EFI_STATUS EFIAPI ProgramCoreLocks(IN OUT CORE_RESULT* res,
+  IN VOID* param OPTIONAL)
 {
+  PMUNUSED(res);
+  PMUNUSED(param);
+
+  PROFILE_BEGIN(tCore);
+
   //
   // We will locate our core and package using 
   // per-CPU Local Storage
@@ -794,51 +967,111 @@ EFI_STATUS EFIAPI ProgramCoreLocks()
   //
   // PL1/2 Lock (MSR)
 
-  if (pk->ProgramPL12_MSR) {
+  if ((pk->ProgramPL12_MSR) &&
+      (RegScope_ShouldWrite(MSR_PACKAGE_POWER_LIMIT, REG_SCOPE_NO_CMD))) {
+    ProbeCache_MarkPackage(pk, PROBE_PKG_POWER_LIMITS);
     SetPL12MSRLock(pk->LockMsrPkgPL12);
   }
 
   //
   // PL3 Lock
 
-  if (pk->ProgramPL3) {
+  if ((pk->ProgramPL3) &&
+      (RegScope_ShouldWrite(MSR_PL3_CONTROL, REG_SCOPE_NO_CMD))) {
     SetPL3Lock(pk->LockMsrPkgPL3);
   }
 
   // PL4 Lock
 
-  if (pk->ProgramPL4) {
+  if ((pk->ProgramPL4) &&
+      (RegScope_ShouldWrite(MSR_VR_CURRENT_CONFIG, REG_SCOPE_NO_CMD))) {
     SetPL4Lock(pk->LockMsrPkgPL4);
   }
 
   //
   // PP0 Lock
 
-  if (pk->ProgramPP0) {
+  if ((pk->ProgramPP0) &&
+      (RegScope_ShouldWrite(MSR_PP0_POWER_LIMIT, REG_SCOPE_NO_CMD))) {
     SetPP0Lock(pk->LockMsrPP0);
   }
 
   // PSys Lock
 
-  if (pk->ProgramPL12_PSys) {
+  if ((pk->ProgramPL12_PSys) &&
+      (RegScope_ShouldWrite(MSR_PLATFORM_POWER_LIMIT, REG_SCOPE_NO_CMD))) {
     SetPSysLock(pk->LockPlatformPL);
   }
 
   //
   // cTDP Lock
 
-  SetCTDPLock(pk->TdpControLock);
+  if (RegScope_ShouldWrite(MSR_CONFIG_TDP_CONTROL, REG_SCOPE_NO_CMD)) {
+    ProbeCache_MarkPackage(pk, PROBE_PKG_CTDP);
+    SetCTDPLock(pk->TdpControLock);
+  }
 
   //
   // Overclocking Lock
 
-  if (gPostProgrammingOcLock) {
+  if ((gPostProgrammingOcLock) &&
+      (RegScope_ShouldWrite(MSR_FLEX_RATIO, REG_SCOPE_NO_CMD))) {
     IaCore_OcLock();
   }
 
+  PROFILE_END(tCore, "Core: locks");
+
   return EFI_SUCCESS;
 }
 
+/*******************************************************************************
+ * RunScopedPhase
+ * 
+ * Runs the per-core procedure on representatives of the narrowest scope 
+ * found among ops (see RegScope.h) and reports CPUs that failed
+ ******************************************************************************/
+
+static EFI_STATUS RunScopedPhase(IN PLATFORM* sys,
+  IN const CORE_PROCEDURE proc,
+  IN const REG_OP* ops,
+  IN const UINTN nOps,
+  IN const CHAR16* phaseName)
+{
+  EFI_STATUS status = EFI_SUCCESS;
+
+  CORE_RESULT* results = (CORE_RESULT*)AllocateZeroPool(
+    sys->LogicalProcessors * sizeof(CORE_RESULT));
+
+  if (!results) {
+    Print(L"[ERROR] Out of memory, %s was skipped\n", phaseName);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  RegScope_SelectCores(sys, ops, nOps, results);
+
+  status = RunOnSelectedCores(sys, proc,
+    (gConcurrentProgramming) ? TRUE : FALSE, NULL, results);
+
+  //
+  // Report CPUs that did not take the settings
+
+  for (UINTN cidx = 0; cidx < sys->LogicalProcessors; cidx++) {
+
+    CORE_RESULT* res = results + cidx;
+
+    if ((res->Selected) && (EFI_ERROR(res->Status))) {
+      Print(L"[ERROR] %s failed on CPU #%u, code: 0x%x, mailbox: 0x%x\n",
+        phaseName, cidx, res->Status, res->MailboxStatus);
+
+      status = res->Status;
+    }
+  }
+
+  FreePool(results);
+
+  return status;
+}
+
 
 /*******************************************************************************
  * TBD / TODO: Needs Rewrite
@@ -883,7 +1116,35 @@ EFI_STATUS EFIAPI ApplyPolicy(IN EFI_SYSTEM_TABLE* SystemTable,
   // PROGRAMMING //
   /////////////////
 
+  //
+  // Probed state must be kept before the policy overwrites it
+
+  Plan_Snapshot(sys);
+
+  //
+  // Effective voltage before anything is written (if verification enabled)
+
+  PROFILE_BEGIN(tVrBase);
+  VrGroups_MeasureBaseline(sys);
+  PROFILE_END(tVrBase, "VrGroups_MeasureBaseline");
+
+  PROFILE_BEGIN(tPolicy);
   ApplyComputerOwnersPolicy(sys);
+  PROFILE_END(tPolicy, "ApplyComputerOwnersPolicy");
+
+  //
+  // One set of values per VR - linked domains must not differ
+
+  VrGroups_Coalesce(sys);
+
+  //
+  // Compare requested and probed state, only differing writes are performed
+
+  PROFILE_BEGIN(tPlan);
+  Plan_Build(sys);
+  PROFILE_END(tPlan, "Plan_Build");
+
+  Plan_Print(sys);
 
   ///////////////////
   // VF Overrides  //
@@ -897,23 +1158,34 @@ EFI_STATUS EFIAPI ApplyPolicy(IN EFI_SYSTEM_TABLE* SystemTable,
   // where isolated core would use its own programmed settings (one would need 
   // to power off other cores in package, though)
   //
-  // So we will program every core, for the sake of completeness...
+  // So every core can be programmed (gProgramEveryThread), for the sake of 
+  // completeness. By default, each register is written only once per its 
+  // scope (see RegScope.h), by one representative CPU. Representatives are
+  // programmed concurrently (unless disabled in the configuration), access 
+  // to the OC mailbox is serialized per-package in OcMailbox_ReadWrite
 
-  for (UINTN pidx = 0; pidx < sys->PkgCnt; pidx++) {
+  {
+    static const REG_OP vfOps[] = {
+      { MSR_TURBO_RATIO_LIMIT,        REG_SCOPE_NO_CMD },
+      { MSR_TURBO_RATIO_LIMIT_ECORE,  REG_SCOPE_NO_CMD },
+      { MSR_OC_MAILBOX,               OC_CMD_WRITE_VF },
+      { MSR_OC_MAILBOX,               OC_CMD_WRITE_ICCMAX },
+    };
 
-    PACKAGE* pk = sys->packages + pidx;
+    PROFILE_BEGIN(tVf);
 
-    for (UINTN cidx = 0; cidx < pk->LogicalCores; cidx++)
-    {
-      CPUCORE* core = pk->Core + cidx;
-      RunOnPackageOrCore(sys, core->AbsIdx, (EFI_AP_PROCEDURE)ProgramVFOverridesAndOCRatios, NULL);
-    }
+    RunScopedPhase(sys, ProgramVFOverridesAndOCRatios, vfOps,
+      sizeof(vfOps) / sizeof(vfOps[0]), L"V/F programming");
+
+    PROFILE_END(tVf, "V/F programming");
   }
 
   //////////////////
   // Power Limits //
   //////////////////
 
+  PROFILE_BEGIN(tPl);
+
   for (UINTN pidx = 0; pidx < sys->PkgCnt; pidx++)
   {
     PACKAGE* pk = sys->packages + pidx;
@@ -929,6 +1201,27 @@ EFI_STATUS EFIAPI ApplyPolicy(IN EFI_SYSTEM_TABLE* SystemTable,
     RunOnPackageOrCore(sys, pk->FirstCoreNumber, (EFI_AP_PROCEDURE)ProgramPowerLimits_Stage2, NULL);
   }
 
+  //
+  // Power control (EET, race to halt) is per core, unlike the limits
+
+  BOOLEAN powerTweaks = FALSE;
+
+  for (UINTN pidx = 0; pidx < sys->PkgCnt; pidx++) {
+    powerTweaks |= (sys->packages[pidx].ProgramPowerTweaks) ? TRUE : FALSE;
+  }
+
+  if (powerTweaks) {
+
+    static const REG_OP powerCtlOps[] = {
+      { MSR_POWER_CONTROL,            REG_SCOPE_NO_CMD },
+    };
+
+    RunScopedPhase(sys, ProgramCorePowerCtl, powerCtlOps,
+      sizeof(powerCtlOps) / sizeof(powerCtlOps[0]), L"Power control");
+  }
+
+  PROFILE_END(tPl, "Power limits");
+
 
   /////////////////
   // Apply LOCKS //
@@ -937,27 +1230,63 @@ EFI_STATUS EFIAPI ApplyPolicy(IN EFI_SYSTEM_TABLE* SystemTable,
   //
   // MSR Locks
 
-  RunOnAllProcessors((EFI_AP_PROCEDURE)ProgramCoreLocks, FALSE, (void *)sys);
+  {
+    static const REG_OP lockOps[] = {
+      { MSR_PACKAGE_POWER_LIMIT,      REG_SCOPE_NO_CMD },
+      { MSR_PL3_CONTROL,              REG_SCOPE_NO_CMD },
+      { MSR_VR_CURRENT_CONFIG,        REG_SCOPE_NO_CMD },
+      { MSR_PP0_POWER_LIMIT,          REG_SCOPE_NO_CMD },
+      { MSR_PLATFORM_POWER_LIMIT,     REG_SCOPE_NO_CMD },
+      { MSR_CONFIG_TDP_CONTROL,       REG_SCOPE_NO_CMD },
+      { MSR_FLEX_RATIO,               REG_SCOPE_NO_CMD },
+    };
+
+    PROFILE_BEGIN(tLocks);
+
+    RunScopedPhase(sys, ProgramCoreLocks, lockOps,
+      sizeof(lockOps) / sizeof(lockOps[0]), L"Locking");
+
+    PROFILE_END(tLocks, "MSR locks");
+  }
 
   //
   // MMIO locks
 
+  PROFILE_BEGIN(tMmioLocks);
+
   for (UINTN pidx = 0; pidx < sys->PkgCnt; pidx++)
   {
     PACKAGE* pk = sys->packages + pidx;
     RunOnPackageOrCore(sys, pk->FirstCoreNumber, (EFI_AP_PROCEDURE)ProgramPackageLocks_Stage2, pk);
   }
 
+  PROFILE_END(tMmioLocks, "MMIO locks");
+
+  //
+  // Re-probing below makes the plans stale
+
+  Plan_Release(sys);
+
   ////////////////////
   // PRINT SETTINGS //
   ////////////////////
 
   {
+    PROFILE_BEGIN(tProbe);
     ProbePackages(sys);
+    PROFILE_END(tProbe, "ProbePackages (post-programming)");
 
+    PROFILE_BEGIN(tSettings);
     PrintPlatformSettings(sys);
+    PROFILE_END(tSettings, "PrintPlatformSettings");
 
+    PROFILE_BEGIN(tVfPoints);
     PrintVFPoints(sys);
+    PROFILE_END(tVfPoints, "PrintVFPoints");
+
+    PROFILE_BEGIN(tVrVerify);
+    VrGroups_VerifyEffective(sys);
+    PROFILE_END(tVrVerify, "VrGroups_VerifyEffective");
   }
 
   return status;
@@ -969,8 +1298,12 @@ EFI_STATUS EFIAPI ApplyPolicy(IN EFI_SYSTEM_TABLE* SystemTable,
 
 VOID* GetCpuDataBlock()
 {
-  UINTN processorNumber;
-  gMpServices->WhoAmI(gMpServices, &processorNumber);
-  VOID* coreStructAddr = gCorePtrs[processorNumber];
-  return coreStructAddr;
+  //
+  // Once GS base has been set up, no need to ask MP services who we are
+
+  if (gPerCpuReady) {
+    return PerCpu_Self();
+  }
+
+  return PerCpu_Lookup();
 }
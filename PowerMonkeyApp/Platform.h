@@ -35,23 +35,21 @@
  * Constants
  ******************************************************************************/
 
-#define MAX_PACKAGES    8                        // Maximum Packages
-#define MAX_CORES       128                      // Max cores per package
 #define MAX_DOMAINS     6
 #define MAX_VF_POINTS   15
 
 #define MAX_POWAH       0xFFFFFFFF
 #define MAX_AMPS        0xFFFF
 
+#define CACHE_LINE_SIZE 64
+
 /*******************************************************************************
  * CoreIdxMap
  ******************************************************************************/
 
 extern UINTN gNumCores;
-extern VOID* gCorePtrs[MAX_CORES * MAX_PACKAGES];
-extern UINTN gCoreApicIDs[MAX_CORES * MAX_PACKAGES];
-
-UINTN ApicIdToCoreNumber(const UINTN ApicID);
+extern VOID** gCorePtrs;                         // [gNumCores], see CoreMap.h
+extern UINTN* gCoreApicIDs;                      // [gNumCores]
 
 /*******************************************************************************
  * OC Mailbox - Voltage Domains (NOTE: some might be linked!)
@@ -146,28 +144,181 @@ typedef struct _DOMAIN
 } DOMAIN;
 
 
+/*******************************************************************************
+ * PERCPU_SCRATCH - Per-CPU working area (no locking needed, only the owning
+ * CPU writes to it)
+ ******************************************************************************/
+
+typedef struct _PERCPU_SCRATCH
+{
+  UINT64    MsrReads;                     // pm_rdmsr64 calls
+  UINT64    MsrWrites;                    // pm_wrmsr64 calls
+  UINT64    MailboxTransactions;          // OC mailbox commands issued
+  UINT32    LastMailboxCmd;               // Interface word of the last one
+  UINT32    LastMailboxStatus;            // ... and its completion code
+  UINT64    User[4];                      // Free for use by a running phase
+} PERCPU_SCRATCH;
+
+/*******************************************************************************
+ * CPUCORE_HOT - Fields written by the CPU itself while others may be running
+ * 
+ * Kept apart from read-mostly CPUCORE data, in page-aligned arrays padded to 
+ * whole cache lines, so that APs writing at the same time do not share lines
+ ******************************************************************************/
+
+typedef struct _CPUCORE_HOT
+{
+  PERCPU_SCRATCH  Scratch;
+  EFI_STATUS      LastStatus;             // Of the last dispatched procedure
+  UINT32          ValidateIdx;            // Debug
+
+  UINT8           pad[CACHE_LINE_SIZE - 
+    (sizeof(PERCPU_SCRATCH) + sizeof(EFI_STATUS) + sizeof(UINT32)) % 
+    CACHE_LINE_SIZE];
+} CPUCORE_HOT;
+
+STATIC_ASSERT(sizeof(CPUCORE_HOT) % CACHE_LINE_SIZE == 0,
+  "CPUCORE_HOT must span whole cache lines");
+
+/*******************************************************************************
+ * PACKAGE_HOT - Same as above, for the package
+ ******************************************************************************/
+
+typedef struct _PACKAGE_HOT
+{
+  volatile UINT32 OcMailboxLock;          // Serializes OC mailbox access
+                                          // from CPUs of this package
+  UINT8           pad[CACHE_LINE_SIZE - sizeof(UINT32)];
+} PACKAGE_HOT;
+
+STATIC_ASSERT(sizeof(PACKAGE_HOT) % CACHE_LINE_SIZE == 0,
+  "PACKAGE_HOT must span whole cache lines");
+
+/*******************************************************************************
+ * PROBE_CACHE - Probed package state, and what has been written since
+ * (see ProbeCache.h)
+ ******************************************************************************/
+
+#define PROBE_PKG_TRL                   0       // MSR_TURBO_RATIO_LIMIT
+#define PROBE_PKG_TRL_ECORE             1       // MSR_TURBO_RATIO_LIMIT_ECORE
+#define PROBE_PKG_CTDP                  2       // MSR_CONFIG_TDP_CONTROL
+#define PROBE_PKG_POWER_LIMITS          3       // MSR_PACKAGE_POWER_LIMIT
+#define PROBE_PKG_FIELDS                4
+
+typedef struct _DOMAIN_DIRTY
+{
+  UINT8   IccMax;                         // 0x17 written
+  UINT8   Vf;                             // 0x11, point 0 written
+  UINT8   VfPoint[MAX_VF_POINTS + 1];     // 0x11, point N+1 written
+} DOMAIN_DIRTY;
+
+typedef struct _VF_TOPOLOGY
+{
+  UINT8   Valid;
+  UINT8   nVfPoints;                      // Fused, as enumerated
+  UINT8   FusedRatio[MAX_VF_POINTS];
+} VF_TOPOLOGY;
+
+typedef struct _PROBE_CACHE
+{
+  UINT32        Version;                  // Probes stored, 0 = empty
+  UINT32        Refreshes;                // ... of which were selective
+
+  //
+  // Written since the last probe - one byte per field, so that CPUs 
+  // programming concurrently never share a read-modify-write
+
+  UINT8         DirtyPkg[PROBE_PKG_FIELDS];
+  DOMAIN_DIRTY  Dirty[MAX_DOMAINS];
+
+  //
+  // Probed state
+
+  DOMAIN        Domain[MAX_DOMAINS];
+
+  UINT64        TurboRatioLimits;
+  UINT64        TurboRatioLimitsECore;
+  UINT64        ConfigTdpControl;
+  UINT8         MaxCTDPLevel;
+  UINT8         TdpControLock;
+
+  UINT64        MsrPkgPowerLimits;
+  UINT32        MsrPkgMaxTau;
+  UINT32        MsrPkgMinPL1;
+  UINT32        MsrPkgMaxPL1;
+  UINT32        PkgPowerUnits;
+  UINT32        PkgTimeUnits;
+  UINT32        PkgEnergyUnits;
+
+  //
+  // VF points per domain - persisted across boots, keyed by CPUID 
+  // signature, microcode revision and package index
+
+  UINT64        VfTopologyKey;            // Of this package (see above)
+  UINT8         VfTopologyLoaded;         // From NVRAM, not enumerated
+  VF_TOPOLOGY   VfTopology[MAX_DOMAINS];
+} PROBE_CACHE;
+
+/*******************************************************************************
+ * VR_GROUP - Voltage domains sharing a single VR (see VrGroups.h)
+ ******************************************************************************/
+
+typedef struct _VR_GROUP
+{
+  UINT8   VRaddr;
+  UINT8   Members;                        // Bit (1 << didx)
+  UINT8   Leader;                         // Lowest member, writes IccMax
+  UINT8   Conflict;                       // Not programmed (policy: error)
+} VR_GROUP;
+
+typedef struct _VR_VOLT_SAMPLE
+{
+  UINT8   Valid;
+  UINT8   Ratio;                          // IA32_PERF_STATUS[15:8]
+  UINT16  Millivolts;                     // IA32_PERF_STATUS[47:32], in mV
+  UINT8   VoltMode;                       // IACORE mode when sampled
+  INT16   OffsetMv;                       // Offset expected at this ratio
+  INT16   PointsMv;                       // ... of which from VF points
+  UINT32  nSamples;
+} VR_VOLT_SAMPLE;
+
 /*******************************************************************************
  * CPUCORE - Holds data specific to a single CPU core (logical or physical)
  ******************************************************************************/
 
 typedef struct _CPUCORE
 {
+  struct _CPUCORE* Self;                  // Must stay first: GS:[0] (see
+                                          // PerCpu.h)
+  CPUCORE_HOT*     Hot;
+
   CPUINFO   CpuInfo;
 
   UINTN     ApicID;
   UINTN     AbsIdx;
-  UINT8     LocalIdx;
+  UINT32    LocalIdx;
 
   BOOLEAN   IsPhysical;
   BOOLEAN   IsECore;
 
-  VOID      *parent;
-  UINT8     PkgIdx;
+  UINT8     ScopeLeader;                  // Bit (1 << REG_SCOPE_*) set if 
+                                          // this CPU writes registers of 
+                                          // that scope (see RegScope.h)
 
   //
-  // Debug
+  // Topology (see Topology.h), IDs except PackageId are package-relative
 
-  UINT32    ValidateIdx;
+  BOOLEAN   TopologyValid;
+  UINT8     CoreType;                     // CPUID 0x1A core type
+  UINT32    X2ApicID;
+  UINT32    PackageId;
+  UINT32    DieId;
+  UINT32    ModuleId;                     // E-core cluster, or == CoreId
+  UINT32    CoreId;
+  UINT32    ThreadId;                     // SMT thread within the core
+
+  VOID      *parent;
+  UINT8     PkgIdx;
 } CPUCORE;
 
 
@@ -194,6 +345,7 @@ typedef struct _PACKAGE
   // Turbo Ratio Limits
   
   UINT64  TurboRatioLimits;                    // [READ] MSR_TURBO_RATIO_LIMIT
+  UINT64  TurboRatioLimitsECore;               // [READ] ..._ECORE (hybrids)
     
   UINT8   ForcedRatioForPCoreCounts;           // [WRITE] If != 0, we will 
                                                // program this ratio for all 
@@ -304,7 +456,17 @@ typedef struct _PACKAGE
   // General Package Stuff //
   ///////////////////////////
 
-  CPUCORE Core[MAX_CORES];
+  CPUCORE* Core;                            // [LogicalCores]
+  PACKAGE_HOT* Hot;
+
+  struct _PKG_PLAN* Plan;                   // Writes needed (see Plan.h)
+  PROBE_CACHE ProbeCache;                   // See ProbeCache.h
+  UINT8   VrTopologySource;                 // VR_TOPOLOGY_* (VrTopology.h)
+
+  UINT8   nVrGroups;                        // Linked domains (VrGroups.h)
+  VR_GROUP VrGroup[MAX_DOMAINS];
+  VR_VOLT_SAMPLE VrBaseline;                // Before programming
+  VR_VOLT_SAMPLE VrEffective;               // After programming
 
   UINTN   PackageID;
   UINTN   FirstCoreApicID;
@@ -341,7 +503,7 @@ typedef struct _PLATFORM
   UINTN PhysicalProcessors;
   UINTN EnabledLogicalProcessors;
 
-  PACKAGE packages[MAX_PACKAGES];
+  PACKAGE* packages;                        // [PkgCnt]
 } PLATFORM;
 
 
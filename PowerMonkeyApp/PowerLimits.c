@@ -35,6 +35,31 @@
 #include "Constants.h"
 #include "MiniLog.h"
 
+extern UINT8 gSkipUnchangedWrites;
+
+/*******************************************************************************
+ * WriteIfChanged
+ * Writes val and waits for it to settle, unless the register already holds
+ * it (prev, as read before modifying) and gSkipUnchangedWrites is set
+ ******************************************************************************/
+
+static VOID WriteIfChanged(const UINT8 dst, 
+  const UINT32 addr, 
+  const UINT64 prev, 
+  const UINT64 val,
+  const UINT64 settleUs)
+{
+  if ((gSkipUnchangedWrites) && (prev == val)) {
+    return;
+  }
+
+  pm_xio_write64(dst, addr, val);
+
+  if (settleUs) {
+    MicroStall(settleUs);
+  }
+}
+
 /*******************************************************************************
  * GetPkgPowerUnits
  ******************************************************************************/
@@ -150,9 +175,13 @@ void SetPkgPowerLimit12(
   xform_pl1w = (PkgMaxPL1 > 0) ? MIN(xform_pl1w, PkgMaxPL1) : xform_pl1w;
   xform_tau = (PkgMaxTau > 0) ?  MIN(xform_tau, PkgMaxTau) : xform_tau;
 
-  msr.u64 = pm_xio_read64( dst, (dst==IO_MSR) ? 
+  const UINT32 addr = (dst == IO_MSR) ? 
     MSR_PACKAGE_POWER_LIMIT :
-    MMIO_PACKAGE_POWER_LIMIT );
+    MMIO_PACKAGE_POWER_LIMIT;
+
+  msr.u64 = pm_xio_read64(dst, addr);
+
+  UINT64 prev = msr.u64;
 
   if (!(msr.u32.hi & bit31u32)) {        // do not attempt to write locked MSR
 
@@ -215,19 +244,12 @@ void SetPkgPowerLimit12(
       msr.u32.hi &= 0xff01ffff;
     }
 
-    pm_xio_write64(dst, (dst == IO_MSR) ?
-      MSR_PACKAGE_POWER_LIMIT :
-      MMIO_PACKAGE_POWER_LIMIT,
-      msr.u64);
-
-    MicroStall(3);
+    WriteIfChanged(dst, addr, prev, msr.u64, 3);
 
     //
     // Clamp
 
-    msr.u64 = pm_xio_read64(dst, (dst == IO_MSR) ?
-      MSR_PACKAGE_POWER_LIMIT :
-      MMIO_PACKAGE_POWER_LIMIT);
+    msr.u64 = prev = pm_xio_read64(dst, addr);
 
     msr.u32.lo = (clamp) ?
       msr.u32.lo | bit16u32 :
@@ -237,12 +259,7 @@ void SetPkgPowerLimit12(
       msr.u32.hi | bit16u32 :
       msr.u32.hi & ~bit16u32;
 
-    pm_xio_write64(dst, (dst == IO_MSR) ?
-      MSR_PACKAGE_POWER_LIMIT :
-      MMIO_PACKAGE_POWER_LIMIT,
-      msr.u64 );
-
-    MicroStall(3);
+    WriteIfChanged(dst, addr, prev, msr.u64, 3);
   }
 }
 
@@ -301,6 +318,8 @@ VOID EFIAPI SetPlatformPowerLimit12(
 
   msr.u64 = pm_rdmsr64(MSR_PLATFORM_POWER_LIMIT);
 
+  const UINT64 prev = msr.u64;
+
   /////////
   // PL1 //
   /////////
@@ -348,8 +367,7 @@ VOID EFIAPI SetPlatformPowerLimit12(
     msr.u32.hi &= ~vmask1;
   }
 
-  pm_wrmsr64(MSR_PLATFORM_POWER_LIMIT, msr.u64);
-  MicroStall(3);
+  WriteIfChanged(IO_MSR, MSR_PLATFORM_POWER_LIMIT, prev, msr.u64, 3);
 
   {
     ///////////
@@ -571,6 +589,8 @@ VOID EFIAPI SetPlatformPowerLimit3(
   
   msr.u64 = pm_rdmsr64(MSR_PL3_CONTROL);
 
+  const UINT64 prev = msr.u64;
+
   /////////
   // PL3 //
   /////////
@@ -596,8 +616,7 @@ VOID EFIAPI SetPlatformPowerLimit3(
     }
   }
 
-  pm_wrmsr64(MSR_PL3_CONTROL, msr.u64);
-  MicroStall(3);
+  WriteIfChanged(IO_MSR, MSR_PL3_CONTROL, prev, msr.u64, 3);
 }
 
 
@@ -625,6 +644,8 @@ VOID EFIAPI SetPlatformPowerLimit4(
 
     msr.u64 = pm_rdmsr64(MSR_VR_CURRENT_CONFIG);
 
+    const UINT64 prev = msr.u64;
+
     /////////
     // PL4 //
     /////////
@@ -639,8 +660,7 @@ VOID EFIAPI SetPlatformPowerLimit4(
       msr.u32.lo &= ~vmask1;
     }
 
-    pm_wrmsr64(MSR_VR_CURRENT_CONFIG, msr.u64);
-    MicroStall(3);
+    WriteIfChanged(IO_MSR, MSR_VR_CURRENT_CONFIG, prev, msr.u64, 3);
   }
 }
 
@@ -701,6 +721,8 @@ void SetPP0PowerLimit(
 
   msr.u64 = pm_rdmsr64(MSR_PP0_POWER_LIMIT);
 
+  UINT64 prev = msr.u64;
+
   /////////
   // PP0 //
   /////////
@@ -724,19 +746,18 @@ void SetPP0PowerLimit(
     }
   }
 
-  pm_wrmsr64(MSR_PP0_POWER_LIMIT, msr.u64);
-  MicroStall(3);
+  WriteIfChanged(IO_MSR, MSR_PP0_POWER_LIMIT, prev, msr.u64, 3);
 
   //
   // Clamp
 
-  msr.u64 = pm_rdmsr64(MSR_PP0_POWER_LIMIT);
+  msr.u64 = prev = pm_rdmsr64(MSR_PP0_POWER_LIMIT);
 
   msr.u32.lo = (clamp) ?
     msr.u32.lo | bit16u32 :
     msr.u32.lo & ~bit16u32;
 
-  pm_wrmsr64(MSR_PP0_POWER_LIMIT, msr.u64);
+  WriteIfChanged(IO_MSR, MSR_PP0_POWER_LIMIT, prev, msr.u64, 0);
 }
 
 /*******************************************************************************
@@ -774,10 +795,12 @@ VOID EFIAPI SetCTDPLevel(const UINT8 level)
 
   if (!(msr.u32.lo & bit31u32)) {        // do not attempt to write locked MSR
     
+    const UINT64 prev = msr.u64;
+
     msr.u64 &= 0xfffffffffffffffc;
     msr.u64 |= (UINT64)(level) & 0x03;
 
-    pm_wrmsr64(MSR_CONFIG_TDP_CONTROL, msr.u64);
+    WriteIfChanged(IO_MSR, MSR_CONFIG_TDP_CONTROL, prev, msr.u64, 0);
   }
 }
 
@@ -815,6 +838,8 @@ VOID EFIAPI ProgramPowerCtl(const UINT8 eeTurbo, const UINT8 rtHlt)
 
   msr.u64 = pm_rdmsr64(MSR_POWER_CONTROL);
 
+  const UINT64 prev = msr.u64;
+
   ////////////////////////////
   // Energy Efficient Turbo //
   ////////////////////////////
@@ -848,6 +873,6 @@ VOID EFIAPI ProgramPowerCtl(const UINT8 eeTurbo, const UINT8 rtHlt)
   }
 
   if (wrt) {
-    pm_wrmsr64(MSR_POWER_CONTROL, msr.u64);
+    WriteIfChanged(IO_MSR, MSR_POWER_CONTROL, prev, msr.u64, 0);
   }  
 }
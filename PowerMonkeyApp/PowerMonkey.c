@@ -38,9 +38,13 @@
 #include "DelayX86.h"
 #include "InterruptHook.h"
 #include "SelfTest.h"
+#include "CpuMailboxes.h"
+#include "Profile.h"
+#include "IoBackend.h"
 #include "MiniLog.h"
 #include "CpuInfo.h"
 #include "CpuData.h"
+#include "WorkerPool.h"
 
 /*******************************************************************************
  * Globals
@@ -49,6 +53,7 @@
 extern UINT8 gEnableSaferAsm;
 extern UINT8 gDisableFirwmareWDT;
 extern UINT8 gEmergencyExit;
+extern UINT8 gUseWorkerPool;
 
 extern EFI_BOOT_SERVICES* gBS;
 extern EFI_SYSTEM_TABLE*  gST;
@@ -97,7 +102,9 @@ EFI_STATUS UefiInit(IN EFI_SYSTEM_TABLE* SystemTable)
   // Collect the addresses of the buses/devices/etc...
   // so that we do not need to do it every time we need them
 
+  PROFILE_BEGIN(tMmio);
   InitializeMMIO();
+  PROFILE_END(tMmio, "InitializeMMIO");
 
   //
   // Disable UEFI watchdog timer (if requested)
@@ -302,6 +309,10 @@ EFI_STATUS EFIAPI UefiMain(
   //
   // Gather basic CPU info
 
+  PROFILE_BEGIN(tTotal);
+
+  IoBackend_Init();
+
   gCpuDetected = DetectCpu();
 
   if (!gCpuDetected) {
@@ -320,59 +331,96 @@ EFI_STATUS EFIAPI UefiMain(
   /// Set-up TSC timing
   /// NOTE: not MP-proofed - multiple packages will use the same calibration
 
+  PROFILE_BEGIN(tTsc);
+
   if (EFI_ERROR(InitializeTscVars())) {
     Print(L"[ERROR] Unable to initialize timing using"
       "CPUID leaf 0x15\n");
   }
 
+  PROFILE_END(tTsc, "InitializeTscVars");
+
   ///
   /// Print Banner
   ///
 
+  PROFILE_BEGIN(tBanner);
   PrintBanner();
+  PROFILE_END(tBanner, "PrintBanner");
 
   ///
   /// Emergency Exit
   /// 
   
+  PROFILE_BEGIN(tExit);
+
   if (EmergencyExit()) {
     return EFI_SUCCESS;
   }
 
+  PROFILE_END(tExit, "EmergencyExit");
+
   ///
   /// Init
   ///
 
+  PROFILE_BEGIN(tInit);
   UefiInit(SystemTable);
+  PROFILE_END(tInit, "UefiInit");
 
   ///
   /// Discover platform
   ///
 
+  PROFILE_BEGIN(tDiscover);
   StartupPlatformInit(SystemTable, &gPlatform);
+  PROFILE_END(tDiscover, "StartupPlatformInit");
+
+  ///
+  /// Park APs (all further dispatching goes through the pool)
+  ///
+
+  if ((gUseWorkerPool) && (gPlatform)) {
+    PROFILE_BEGIN(tPool);
+    WorkerPool_Start(gPlatform);
+    PROFILE_END(tPool, "WorkerPool_Start");
+  }
 
   ///
   /// Program
   ///
 
+  PROFILE_BEGIN(tApply);
   ApplyPolicy(SystemTable, gPlatform);
+  PROFILE_END(tApply, "ApplyPolicy");
 
   ///
   /// Self test
   ///
 
   if (gSelfTestMaxRuns) {
+    PROFILE_BEGIN(tSelfTest);
     PM_SelfTest();
+    PROFILE_END(tSelfTest, "PM_SelfTest");
   }
 
   ///
   /// Teardown
   /// 
 
+  WorkerPool_Stop();
+
   if (gEnableSaferAsm) {
     RemoveAllInterruptOverrides();
   }
 
+  PROFILE_END(tTotal, "Total");
+
+  CpuMailbox_PrintStats();
+  Profile_PrintReport();
+  FlushTrace();
+  IoBackend_Finish();
+
   AsciiPrint("Finished.\n");
 
  return EFI_SUCCESS;
@@ -95,7 +95,7 @@ VOID PrintCoreInfo()
       core->CpuInfo.HybridArch,
       core->IsECore,
       core->PkgIdx,
-      core->ValidateIdx
+      core->Hot->ValidateIdx
     );
   }
 
@@ -0,0 +1,400 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Protocol/MpService.h>
+
+#include "ProbeCache.h"
+#include "VFTuning.h"
+#include "TurboRatioLimits.h"
+#include "PowerLimits.h"
+#include "MiniLog.h"
+#include "NvCache.h"
+#include "CpuData.h"
+#include "CpuInfo.h"
+#include "SaferAsmHdr.h"
+#include "MpDispatcher.h"
+
+/*******************************************************************************
+ * Globals
+ ******************************************************************************/
+
+extern UINT8 gUseProbeCache;
+extern UINT8 gCacheVfTopology;
+
+#define VF_TOPOLOGY_VAR_PREFIX        L"PowerMonkeyVfTopo"
+#define VF_TOPOLOGY_VERSION           1
+#define VF_TOPOLOGY_VAR_NAME_LEN      32
+
+/*******************************************************************************
+ * VfTopologyVarName
+ * One variable per package: prefix + package index
+ ******************************************************************************/
+
+static VOID VfTopologyVarName(OUT CHAR16* name, IN const UINTN pidx)
+{
+  const CHAR16* prefix = VF_TOPOLOGY_VAR_PREFIX;
+  UINTN len = 0;
+
+  while (prefix[len]) {
+    name[len] = prefix[len];
+    len++;
+  }
+
+  name[len++] = (CHAR16)(L'0' + (pidx / 10) % 10);
+  name[len++] = (CHAR16)(L'0' + pidx % 10);
+  name[len] = 0;
+}
+
+/*******************************************************************************
+ * VfTopologyKeyOnThisCpu
+ * Packages can differ in stepping and microcode, so each one is keyed from 
+ * one of its own CPUs
+ ******************************************************************************/
+
+static VOID EFIAPI VfTopologyKeyOnThisCpu(IN OUT VOID* param)
+{
+  UINT32 regs[4] = { 0 };
+
+  _pm_cpuid(0x01, regs);
+
+  *(UINT64*)param = ((UINT64)GetMicrocodeRevision() << 32) | regs[0];
+}
+
+/*******************************************************************************
+ * DomainDirty
+ * Marks of the domain, NULL if it does not belong to a package (yet)
+ ******************************************************************************/
+
+static DOMAIN_DIRTY* DomainDirty(IN const DOMAIN* dom)
+{
+  PACKAGE* pkg = (PACKAGE*)dom->parent;
+
+  if (!pkg) {
+    return NULL;
+  }
+
+  const UINTN didx = (UINTN)(dom - pkg->planes);
+
+  return (didx < MAX_DOMAINS) ? &pkg->ProbeCache.Dirty[didx] : NULL;
+}
+
+/*******************************************************************************
+ * ProbeCache_MarkPackage
+ ******************************************************************************/
+
+VOID EFIAPI ProbeCache_MarkPackage(IN OUT PACKAGE* pkg, IN const UINT8 field)
+{
+  if (field < PROBE_PKG_FIELDS) {
+    pkg->ProbeCache.DirtyPkg[field] = 1;
+  }
+}
+
+/*******************************************************************************
+ * ProbeCache_MarkIccMax
+ ******************************************************************************/
+
+VOID EFIAPI ProbeCache_MarkIccMax(IN const DOMAIN* dom)
+{
+  DOMAIN_DIRTY* dirty = DomainDirty(dom);
+
+  if (dirty) {
+    dirty->IccMax = 1;
+  }
+}
+
+/*******************************************************************************
+ * ProbeCache_MarkVf
+ ******************************************************************************/
+
+VOID EFIAPI ProbeCache_MarkVf(IN const DOMAIN* dom)
+{
+  DOMAIN_DIRTY* dirty = DomainDirty(dom);
+
+  if (dirty) {
+    dirty->Vf = 1;
+  }
+}
+
+/*******************************************************************************
+ * ProbeCache_MarkVfPoint
+ ******************************************************************************/
+
+VOID EFIAPI ProbeCache_MarkVfPoint(IN const DOMAIN* dom, IN const UINT8 vidx)
+{
+  DOMAIN_DIRTY* dirty = DomainDirty(dom);
+
+  if ((dirty) && (vidx <= MAX_VF_POINTS)) {
+    dirty->VfPoint[vidx] = 1;
+  }
+}
+
+/*******************************************************************************
+ * ProbeCache_Store
+ ******************************************************************************/
+
+VOID EFIAPI ProbeCache_Store(IN OUT PACKAGE* pkg)
+{
+  PROBE_CACHE* pc = &pkg->ProbeCache;
+
+  CopyMem(pc->Domain, pkg->planes, sizeof(pc->Domain));
+
+  pc->TurboRatioLimits = pkg->TurboRatioLimits;
+  pc->TurboRatioLimitsECore = pkg->TurboRatioLimitsECore;
+  pc->ConfigTdpControl = pkg->ConfigTdpControl;
+  pc->MaxCTDPLevel = pkg->MaxCTDPLevel;
+  pc->TdpControLock = pkg->TdpControLock;
+
+  pc->MsrPkgPowerLimits = pkg->MsrPkgPowerLimits;
+  pc->MsrPkgMaxTau = pkg->MsrPkgMaxTau;
+  pc->MsrPkgMinPL1 = pkg->MsrPkgMinPL1;
+  pc->MsrPkgMaxPL1 = pkg->MsrPkgMaxPL1;
+  pc->PkgPowerUnits = pkg->PkgPowerUnits;
+  pc->PkgTimeUnits = pkg->PkgTimeUnits;
+  pc->PkgEnergyUnits = pkg->PkgEnergyUnits;
+
+  SetMem(pc->DirtyPkg, sizeof(pc->DirtyPkg), 0);
+  SetMem(pc->Dirty, sizeof(pc->Dirty), 0);
+
+  pc->Version++;
+}
+
+/*******************************************************************************
+ * ProbeCache_CanRefresh
+ ******************************************************************************/
+
+BOOLEAN EFIAPI ProbeCache_CanRefresh(IN const PACKAGE* pkg)
+{
+  return (BOOLEAN)((gUseProbeCache) && (pkg->probed == 1) && 
+    (pkg->ProbeCache.Version));
+}
+
+/*******************************************************************************
+ * ProbeCache_Invalidate
+ ******************************************************************************/
+
+VOID EFIAPI ProbeCache_Invalidate(IN OUT PACKAGE* pkg)
+{
+  pkg->ProbeCache.Version = 0;
+}
+
+/*******************************************************************************
+ * ProbeCache_Refresh
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI ProbeCache_Refresh(IN OUT PACKAGE* pkg)
+{
+  EFI_STATUS status = EFI_SUCCESS;
+  PROBE_CACHE* pc = &pkg->ProbeCache;
+
+  //
+  // Domains: cached state first (it also undoes what the policy has put 
+  // there), then whatever has been written
+
+  for (UINT8 didx = 0; didx < MAX_DOMAINS; didx++) {
+
+    if (!VoltageDomainExists(didx)) {
+      continue;
+    }
+
+    DOMAIN* dom = pkg->planes + didx;
+    const DOMAIN_DIRTY* dirty = &pc->Dirty[didx];
+
+    CopyMem(dom, &pc->Domain[didx], sizeof(DOMAIN));
+
+    UINT16 vfPointMask = 0;
+
+    for (UINT8 vidx = 0; vidx < dom->nVfPoints; vidx++) {
+      if (dirty->VfPoint[vidx]) {
+        vfPointMask |= (UINT16)(1 << vidx);
+      }
+    }
+
+    if ((dirty->IccMax) || (dirty->Vf) || (vfPointMask)) {
+
+      MiniTraceEx("Dom: 0x%x, refreshing IccMax: %u, V/F: %u, VF Pts: 0x%x",
+        didx,
+        dirty->IccMax,
+        dirty->Vf,
+        vfPointMask);
+
+      if (EFI_ERROR(IAPERF_RefreshDomainVF(didx, dom, dirty->IccMax, 
+                                           dirty->Vf, vfPointMask))) {
+        status = EFI_ABORTED;
+      }
+    }
+  }
+
+  //
+  // Turbo Ratio Limits
+
+  pkg->TurboRatioLimits = (pc->DirtyPkg[PROBE_PKG_TRL]) ?
+    GetTurboRatioLimits() : pc->TurboRatioLimits;
+
+  if (pkg->CpuInfo.HybridArch) {
+    pkg->TurboRatioLimitsECore = (pc->DirtyPkg[PROBE_PKG_TRL_ECORE]) ?
+      GetTurboRatioLimits_ECORE() : pc->TurboRatioLimitsECore;
+  }
+
+  //
+  // cTDP Levels
+
+  if (pc->DirtyPkg[PROBE_PKG_CTDP]) {
+
+    pkg->ConfigTdpControl = GetConfigTdpControl();
+
+    GetCTDPLevel(
+      &pkg->MaxCTDPLevel,
+      &pkg->TdpControLock);
+  }
+  else {
+    pkg->ConfigTdpControl = pc->ConfigTdpControl;
+    pkg->MaxCTDPLevel = pc->MaxCTDPLevel;
+    pkg->TdpControLock = pc->TdpControLock;
+  }
+
+  //
+  // Power Limits (units, Tau and PL1 range are fused)
+
+  pkg->MsrPkgMaxTau = pc->MsrPkgMaxTau;
+  pkg->MsrPkgMinPL1 = pc->MsrPkgMinPL1;
+  pkg->MsrPkgMaxPL1 = pc->MsrPkgMaxPL1;
+  pkg->PkgPowerUnits = pc->PkgPowerUnits;
+  pkg->PkgTimeUnits = pc->PkgTimeUnits;
+  pkg->PkgEnergyUnits = pc->PkgEnergyUnits;
+
+  if (pc->DirtyPkg[PROBE_PKG_POWER_LIMITS]) {
+    pkg->MsrPkgPowerLimits = GetPkgPowerLimits(
+      &pkg->MsrPkgMaxTau,
+      &pkg->MsrPkgMinPL1,
+      &pkg->MsrPkgMaxPL1
+    );
+  }
+  else {
+    pkg->MsrPkgPowerLimits = pc->MsrPkgPowerLimits;
+  }
+
+  //
+  // Only a refresh that went through becomes the new cached state
+
+  if (EFI_ERROR(status)) {
+    ProbeCache_Invalidate(pkg);
+  }
+  else {
+    ProbeCache_Store(pkg);
+    pc->Refreshes++;
+  }
+
+  return status;
+}
+
+/*******************************************************************************
+ * ProbeCache_LoadVfTopology
+ ******************************************************************************/
+
+VOID EFIAPI ProbeCache_LoadVfTopology(IN OUT PLATFORM* sys)
+{
+  CHAR16 name[VF_TOPOLOGY_VAR_NAME_LEN];
+
+  if (!gCacheVfTopology) {
+    return;
+  }
+
+  for (UINTN pidx = 0; pidx < sys->PkgCnt; pidx++) {
+
+    PACKAGE* pkg = sys->packages + pidx;
+    PROBE_CACHE* pc = &pkg->ProbeCache;
+
+    pc->VfTopologyKey = 0;
+
+    if (EFI_ERROR(RunOnPackageOrCore(sys, pkg->FirstCoreNumber, 
+        VfTopologyKeyOnThisCpu, &pc->VfTopologyKey))) {
+      continue;
+    }
+
+    VfTopologyVarName(name, pidx);
+
+    pc->VfTopologyLoaded = (UINT8)(!EFI_ERROR(NvCache_Load(name, 
+      VF_TOPOLOGY_VERSION, pc->VfTopologyKey, pc->VfTopology, 
+      sizeof(pc->VfTopology))));
+  }
+}
+
+/*******************************************************************************
+ * ProbeCache_KeepVfTopology
+ ******************************************************************************/
+
+VOID EFIAPI ProbeCache_KeepVfTopology(IN OUT PACKAGE* pkg, IN const UINT8 didx)
+{
+  VF_TOPOLOGY* vt = &pkg->ProbeCache.VfTopology[didx];
+  const DOMAIN* dom = &pkg->planes[didx];
+
+  SetMem(vt, sizeof(VF_TOPOLOGY), 0);
+
+  vt->Valid = 1;
+  vt->nVfPoints = (UINT8)dom->nVfPoints;
+
+  for (UINTN vidx = 0; vidx < dom->nVfPoints; vidx++) {
+    vt->FusedRatio[vidx] = dom->vfPoint[vidx].FusedRatio;
+  }
+}
+
+/*******************************************************************************
+ * ProbeCache_StoreVfTopology
+ ******************************************************************************/
+
+VOID EFIAPI ProbeCache_StoreVfTopology(IN PLATFORM* sys)
+{
+  CHAR16 name[VF_TOPOLOGY_VAR_NAME_LEN];
+
+  if (!gCacheVfTopology) {
+    return;
+  }
+
+  for (UINTN pidx = 0; pidx < sys->PkgCnt; pidx++) {
+
+    PROBE_CACHE* pc = &sys->packages[pidx].ProbeCache;
+
+    //
+    // No key, no way to tell a stale topology on the next boot
+
+    if (!pc->VfTopologyKey) {
+      continue;
+    }
+
+    //
+    // NvCache does not write if the topology has not changed
+
+    VfTopologyVarName(name, pidx);
+
+    NvCache_Store(name, VF_TOPOLOGY_VERSION, pc->VfTopologyKey, 
+      pc->VfTopology, sizeof(pc->VfTopology));
+
+    pc->VfTopologyLoaded = 0;
+  }
+}
@@ -0,0 +1,114 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#pragma once
+
+#include "Platform.h"
+
+/*******************************************************************************
+ * Probe cache
+ * 
+ * ProbePackage reads the whole package state: every domain's IccMax (0x16)
+ * and V/F word (0x10), every VF point (0x10), TRL, cTDP and power limits.
+ * ProbeCache_Store keeps a copy of it in PACKAGE.ProbeCache.
+ * 
+ * Programming procedures mark what they write (before writing, so a write
+ * that fails half-way is re-read as well). When the package is probed again
+ * after programming, ProbeCache_Refresh serves untouched domains, VF points
+ * and registers - and read-only fused data such as FusedRatio, nVfPoints 
+ * or VRaddr - from the cache, and reads only the marked ones from hardware
+ ******************************************************************************/
+
+/*******************************************************************************
+ * ProbeCache_Store
+ * Call once the package has been probed from hardware, clears the marks
+ ******************************************************************************/
+
+VOID EFIAPI ProbeCache_Store(IN OUT PACKAGE* pkg);
+
+/*******************************************************************************
+ * ProbeCache_CanRefresh
+ ******************************************************************************/
+
+BOOLEAN EFIAPI ProbeCache_CanRefresh(IN const PACKAGE* pkg);
+
+/*******************************************************************************
+ * ProbeCache_Refresh
+ * Restores the cached state, re-reads what has been written since
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI ProbeCache_Refresh(IN OUT PACKAGE* pkg);
+
+/*******************************************************************************
+ * ProbeCache_Invalidate
+ * Next probe of the package reads everything
+ ******************************************************************************/
+
+VOID EFIAPI ProbeCache_Invalidate(IN OUT PACKAGE* pkg);
+
+/*******************************************************************************
+ * VF topology
+ * 
+ * Number of VF points and their fused ratios are fixed for a part, but 
+ * finding them takes a 0x10 read per point plus one that fails past the 
+ * last one, for every domain. ProbeCache_StoreVfTopology keeps them in a 
+ * UEFI variable per package, keyed by CPUID signature and microcode
+ * revision - with a matching key only the known points are read (offsets
+ * change, the fused ratios read along are checked against the cache and
+ * the curve is re-enumerated if they differ). A different key, e.g. after
+ * a CPU or microcode update, simply misses and gets overwritten
+ ******************************************************************************/
+
+/*******************************************************************************
+ * ProbeCache_LoadVfTopology
+ * BSP only, before the packages are probed (the key of each package is read
+ * on its first CPU)
+ ******************************************************************************/
+
+VOID EFIAPI ProbeCache_LoadVfTopology(IN OUT PLATFORM* sys);
+
+/*******************************************************************************
+ * ProbeCache_KeepVfTopology
+ * Called for every domain probed successfully
+ ******************************************************************************/
+
+VOID EFIAPI ProbeCache_KeepVfTopology(IN OUT PACKAGE* pkg, IN const UINT8 didx);
+
+/*******************************************************************************
+ * ProbeCache_StoreVfTopology
+ * BSP only, after the packages have been probed
+ ******************************************************************************/
+
+VOID EFIAPI ProbeCache_StoreVfTopology(IN PLATFORM* sys);
+
+/*******************************************************************************
+ * Marking written state
+ ******************************************************************************/
+
+VOID EFIAPI ProbeCache_MarkPackage(IN OUT PACKAGE* pkg, IN const UINT8 field);
+VOID EFIAPI ProbeCache_MarkIccMax(IN const DOMAIN* dom);
+VOID EFIAPI ProbeCache_MarkVf(IN const DOMAIN* dom);
+VOID EFIAPI ProbeCache_MarkVfPoint(IN const DOMAIN* dom, IN const UINT8 vidx);
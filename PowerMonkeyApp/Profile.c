@@ -0,0 +1,348 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+
+#include "Profile.h"
+#include "PerCpu.h"
+#include "DelayX86.h"
+
+/*******************************************************************************
+ * Globals
+ ******************************************************************************/
+
+extern UINT8 gPrintBootProfile;
+
+//
+// Early boot (BSP, before Profile_Init) 
+
+static PROFILE_CPU gProfileBoot = { 0 };
+
+//
+// Per-CPU tables [gNumCores], indexed by AbsIdx
+
+static PROFILE_CPU* gProfileCpus = NULL;
+static UINTN gProfileNumCpus = 0;
+static UINTN gProfileBootCpu = 0;
+static UINTN gProfilePages = 0;
+
+//
+// Cleared if the per-CPU tables cannot be had: APs would otherwise all 
+// record into the (unsynchronized) boot table
+
+static BOOLEAN gProfileRecording = TRUE;
+
+#define PROFILE_MAX_REPORT        (PROFILE_MAX_SPANS * 2)
+
+typedef struct _PROFILE_TOTAL {
+  const CHAR8*  Name;
+  UINT64        TotalTicks;
+  UINT64        MaxTicks;
+  UINT32        Count;
+  UINT32        NumCpus;
+} PROFILE_TOTAL;
+
+/*******************************************************************************
+ * SameSpanName
+ ******************************************************************************/
+
+static BOOLEAN SameSpanName(IN const CHAR8* a, IN const CHAR8* b)
+{
+  return (BOOLEAN)((a == b) || (AsciiStrCmp(a, b) == 0));
+}
+
+/*******************************************************************************
+ * FindSpan
+ ******************************************************************************/
+
+static PROFILE_SPAN* FindSpan(IN PROFILE_CPU* pc, IN const CHAR8* name)
+{
+  for (UINT32 sidx = 0; sidx < pc->NumSpans; sidx++) {
+    if (SameSpanName(pc->Spans[sidx].Name, name)) {
+      return pc->Spans + sidx;
+    }
+  }
+
+  return NULL;
+}
+
+/*******************************************************************************
+ * GetProfileCpu
+ * CPU table of the caller (GS-relative), or the boot table
+ ******************************************************************************/
+
+static PROFILE_CPU* GetProfileCpu(VOID)
+{
+  if (gProfileCpus) {
+
+    CPUCORE* core = PerCpu_Self();
+
+    if ((core) && (core->AbsIdx < gProfileNumCpus)) {
+      return gProfileCpus + core->AbsIdx;
+    }
+  }
+
+  return &gProfileBoot;
+}
+
+/*******************************************************************************
+ * Profile_Init
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI Profile_Init(IN PLATFORM* Platform)
+{
+  if ((!gPrintBootProfile) || (gProfileCpus)) {
+    return EFI_SUCCESS;
+  }
+
+  //
+  // One shot, the tables live until exit
+
+  gProfilePages = EFI_SIZE_TO_PAGES(gNumCores * sizeof(PROFILE_CPU));
+
+  PROFILE_CPU* cpus = (PROFILE_CPU*)AllocatePages(gProfilePages);
+
+  if (!cpus) {
+    AsciiPrint("[WARNING] Out of memory, boot profile is not recorded\n");
+    gProfileRecording = FALSE;
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  ZeroMem(cpus, gProfilePages * EFI_PAGE_SIZE);
+
+  gProfileBootCpu = Platform->BootProcessor;
+  gProfileNumCpus = gNumCores;
+  gProfileCpus = cpus;
+
+  return EFI_SUCCESS;
+}
+
+/*******************************************************************************
+ * Profile_Begin
+ ******************************************************************************/
+
+UINT64 EFIAPI Profile_Begin(VOID)
+{
+  return ((gPrintBootProfile) && (gProfileRecording)) ? ReadTsc() : 0;
+}
+
+/*******************************************************************************
+ * Profile_End
+ ******************************************************************************/
+
+VOID EFIAPI Profile_End(IN const CHAR8* name, IN const UINT64 startTsc)
+{
+  if ((!gPrintBootProfile) || (!gProfileRecording)) {
+    return;
+  }
+
+  const UINT64 ticks = ReadTsc() - startTsc;
+
+  PROFILE_CPU* pc = GetProfileCpu();
+  PROFILE_SPAN* span = FindSpan(pc, name);
+
+  if (!span) {
+
+    if (pc->NumSpans >= PROFILE_MAX_SPANS) {
+      pc->Dropped++;
+      return;
+    }
+
+    span = pc->Spans + pc->NumSpans;
+    span->Name = name;
+    pc->NumSpans++;
+  }
+
+  span->TotalTicks += ticks;
+  span->Count++;
+
+  if (ticks > span->MaxTicks) {
+    span->MaxTicks = ticks;
+  }
+}
+
+/*******************************************************************************
+ * AccumulateTotals
+ * sameCpu: table already accounted for the same CPU (BSP's boot table)
+ ******************************************************************************/
+
+static UINTN AccumulateTotals(IN PROFILE_CPU* pc, 
+  IN OUT PROFILE_TOTAL* totals, 
+  IN UINTN numTotals,
+  IN PROFILE_CPU* sameCpu OPTIONAL)
+{
+  for (UINT32 sidx = 0; sidx < pc->NumSpans; sidx++) {
+
+    PROFILE_SPAN* span = pc->Spans + sidx;
+    PROFILE_TOTAL* tot = NULL;
+
+    for (UINTN tidx = 0; tidx < numTotals; tidx++) {
+      if (SameSpanName(totals[tidx].Name, span->Name)) {
+        tot = totals + tidx;
+        break;
+      }
+    }
+
+    if (!tot) {
+
+      if (numTotals >= PROFILE_MAX_REPORT) {
+        continue;
+      }
+
+      tot = totals + numTotals;
+      tot->Name = span->Name;
+      numTotals++;
+    }
+
+    tot->TotalTicks += span->TotalTicks;
+    tot->Count += span->Count;
+    if ((!sameCpu) || (!FindSpan(sameCpu, span->Name))) {
+      tot->NumCpus++;
+    }
+
+    if (span->MaxTicks > tot->MaxTicks) {
+      tot->MaxTicks = span->MaxTicks;
+    }
+  }
+
+  return numTotals;
+}
+
+/*******************************************************************************
+ * PrintCpuBreakdown
+ ******************************************************************************/
+
+static VOID PrintCpuBreakdown(IN const CHAR8* name)
+{
+  AsciiPrint("  %a\n", name);
+
+  for (UINTN cidx = 0; cidx < gProfileNumCpus; cidx++) {
+
+    PROFILE_SPAN* span = FindSpan(gProfileCpus + cidx, name);
+
+    if (span) {
+      AsciiPrint("    CPU %-4u %12lu %8u %12lu\n",
+        cidx,
+        TicksToNanoSeconds(span->TotalTicks) / 1000,
+        span->Count,
+        TicksToNanoSeconds(span->MaxTicks) / 1000);
+    }
+  }
+}
+
+/*******************************************************************************
+ * Profile_PrintReport
+ ******************************************************************************/
+
+VOID EFIAPI Profile_PrintReport(VOID)
+{
+  static PROFILE_TOTAL totals[PROFILE_MAX_REPORT];
+  UINTN numTotals = 0;
+  UINT32 dropped = gProfileBoot.Dropped;
+
+  if ((!gPrintBootProfile) || (!gProfileRecording)) {
+    return;
+  }
+
+  ZeroMem(totals, sizeof(totals));
+
+  //
+  // Early boot spans ran on the BSP
+
+  numTotals = AccumulateTotals(&gProfileBoot, totals, numTotals, NULL);
+
+  for (UINTN cidx = 0; cidx < gProfileNumCpus; cidx++) {
+
+    PROFILE_CPU* pc = gProfileCpus + cidx;
+
+    numTotals = AccumulateTotals(pc, totals, numTotals, 
+      (cidx == gProfileBootCpu) ? &gProfileBoot : NULL);
+
+    dropped += pc->Dropped;
+  }
+
+  //
+  // Sort by total time, descending (few entries, selection sort will do)
+
+  for (UINTN i = 0; i + 1 < numTotals; i++) {
+
+    UINTN best = i;
+
+    for (UINTN j = i + 1; j < numTotals; j++) {
+      if (totals[j].TotalTicks > totals[best].TotalTicks) {
+        best = j;
+      }
+    }
+
+    if (best != i) {
+      PROFILE_TOTAL tmp = totals[i];
+      totals[i] = totals[best];
+      totals[best] = tmp;
+    }
+  }
+
+  AsciiPrint("\nBoot profile (times in microseconds):\n\n");
+  AsciiPrint("  %-34a %12a %8a %12a\n", "Span", "Total", "Count", "Max");
+
+  for (UINTN tidx = 0; tidx < numTotals; tidx++) {
+
+    PROFILE_TOTAL* tot = totals + tidx;
+
+    AsciiPrint("  %-34a %12lu %8u %12lu\n",
+      tot->Name,
+      TicksToNanoSeconds(tot->TotalTicks) / 1000,
+      tot->Count,
+      TicksToNanoSeconds(tot->MaxTicks) / 1000);
+  }
+
+  if (dropped) {
+    AsciiPrint("  (%u spans dropped, table full)\n", dropped);
+  }
+
+  //
+  // Dispatched phases: spans recorded on more than one CPU
+
+  BOOLEAN header = FALSE;
+
+  for (UINTN tidx = 0; tidx < numTotals; tidx++) {
+
+    if (totals[tidx].NumCpus > 1) {
+
+      if (!header) {
+        AsciiPrint("\nPer-CPU breakdown (total, count, max):\n\n");
+        header = TRUE;
+      }
+
+      PrintCpuBreakdown(totals[tidx].Name);
+    }
+  }
+
+  AsciiPrint("\n");
+}
@@ -0,0 +1,94 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#pragma once
+
+#include "Platform.h"
+
+/*******************************************************************************
+ * Boot profile
+ * 
+ * Named spans (TSC start/end) are accumulated per CPU into a fixed table: 
+ * total, count and max for each name. Recording never allocates and never
+ * takes a lock - every CPU only touches its own table. Spans recorded before
+ * the per-CPU tables exist (early boot, BSP only) go to a static boot table.
+ * 
+ * Span names are compared by pointer first, so use string literals.
+ ******************************************************************************/
+
+#define PROFILE_MAX_SPANS         32
+
+typedef struct _PROFILE_SPAN {
+  const CHAR8*  Name;
+  UINT64        TotalTicks;
+  UINT64        MaxTicks;
+  UINT32        Count;
+  UINT32        pad;
+} PROFILE_SPAN;
+
+typedef struct _PROFILE_CPU {
+  UINT32        NumSpans;
+  UINT32        Dropped;                  // Table full
+  PROFILE_SPAN  Spans[PROFILE_MAX_SPANS];
+} PROFILE_CPU;
+
+//
+// Usage:
+//
+//   PROFILE_BEGIN(t);
+//   DoSomething();
+//   PROFILE_END(t, "DoSomething");
+
+#define PROFILE_BEGIN(var)      const UINT64 var = Profile_Begin()
+#define PROFILE_END(var, name)  Profile_End(name, var)
+
+/*******************************************************************************
+ * Profile_Init
+ * Allocates per-CPU tables, call on the BSP once cores are known
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI Profile_Init(IN PLATFORM* Platform);
+
+/*******************************************************************************
+ * Profile_Begin
+ * Returns the span start timestamp (0 if profiling is disabled)
+ ******************************************************************************/
+
+UINT64 EFIAPI Profile_Begin(VOID);
+
+/*******************************************************************************
+ * Profile_End
+ * Accounts a span that started at startTsc to the calling CPU
+ ******************************************************************************/
+
+VOID EFIAPI Profile_End(IN const CHAR8* name, IN const UINT64 startTsc);
+
+/*******************************************************************************
+ * Profile_PrintReport
+ * Totals sorted by time, followed by per-CPU breakdowns of dispatched spans
+ ******************************************************************************/
+
+VOID EFIAPI Profile_PrintReport(VOID);
@@ -0,0 +1,152 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Protocol/MpService.h>
+
+#include "RegScope.h"
+#include "VFTuning.h"
+#include "OcMailbox.h"
+#include "Topology.h"
+
+/*******************************************************************************
+ * Globals
+ ******************************************************************************/
+
+extern UINT8 gProgramEveryThread;
+
+/*******************************************************************************
+ * Scope table
+ * 
+ * MSR scopes are the ones Intel documents in the SDM (Vol. 4, "Model-
+ * Specific Registers"). OC mailbox commands are not documented, but V/F and
+ * IccMax settings are applied to the voltage domain (VR) and are thus shared
+ * by the package - as is everything else PowerMonkey sends to the mailbox.
+ * MSR_FLEX_RATIO is not listed for recent cores, its OC lock bit is 
+ * package-wide. Entries not found in the table default to thread scope 
+ * (always written)
+ ******************************************************************************/
+
+static const REG_SCOPE_ENTRY gRegScopeTable[] = {
+
+  //
+  // OC mailbox
+
+  { MSR_OC_MAILBOX,               REG_SCOPE_ANY_CMD,    REG_SCOPE_PACKAGE },
+
+  //
+  // Ratios
+
+  { MSR_TURBO_RATIO_LIMIT,        REG_SCOPE_ANY_CMD,    REG_SCOPE_PACKAGE },
+  { MSR_TURBO_RATIO_LIMIT_ECORE,  REG_SCOPE_ANY_CMD,    REG_SCOPE_PACKAGE },
+  { MSR_FLEX_RATIO,               REG_SCOPE_ANY_CMD,    REG_SCOPE_PACKAGE },
+
+  //
+  // Power - MSR_POWER_CTL is "Core" in the SDM, the rest "Package"
+
+  { MSR_POWER_CONTROL,            REG_SCOPE_ANY_CMD,    REG_SCOPE_CORE },
+  { MSR_VR_CURRENT_CONFIG,        REG_SCOPE_ANY_CMD,    REG_SCOPE_PACKAGE },
+  { MSR_PACKAGE_POWER_LIMIT,      REG_SCOPE_ANY_CMD,    REG_SCOPE_PACKAGE },
+  { MSR_PL3_CONTROL,              REG_SCOPE_ANY_CMD,    REG_SCOPE_PACKAGE },
+  { MSR_PP0_POWER_LIMIT,          REG_SCOPE_ANY_CMD,    REG_SCOPE_PACKAGE },
+  { MSR_PLATFORM_POWER_LIMIT,     REG_SCOPE_ANY_CMD,    REG_SCOPE_PACKAGE },
+  { MSR_CONFIG_TDP_CONTROL,       REG_SCOPE_ANY_CMD,    REG_SCOPE_PACKAGE },
+};
+
+#define REG_SCOPE_TABLE_SIZE  (sizeof(gRegScopeTable) / sizeof(gRegScopeTable[0]))
+
+/*******************************************************************************
+ * RegScope_Lookup
+ ******************************************************************************/
+
+UINT8 EFIAPI RegScope_Lookup(IN const UINT32 msr, IN const UINT8 cmd)
+{
+  //
+  // First match wins, command-specific entries must precede ANY_CMD ones
+
+  for (UINTN eidx = 0; eidx < REG_SCOPE_TABLE_SIZE; eidx++) {
+
+    const REG_SCOPE_ENTRY* e = gRegScopeTable + eidx;
+
+    if ((e->Msr == msr) && 
+        ((e->Cmd == REG_SCOPE_ANY_CMD) || (e->Cmd == cmd))) {
+      return e->Scope;
+    }
+  }
+
+  return REG_SCOPE_THREAD;
+}
+
+/*******************************************************************************
+ * RegScope_ShouldWrite
+ ******************************************************************************/
+
+BOOLEAN EFIAPI RegScope_ShouldWrite(IN const UINT32 msr, IN const UINT8 cmd)
+{
+  //
+  // Isolated-core case: user wants every thread to carry the settings
+
+  if (gProgramEveryThread) {
+    return TRUE;
+  }
+
+  CPUCORE* core = (CPUCORE*)GetCpuDataBlock();
+
+  if (!core) {
+    return TRUE;
+  }
+
+  const UINT8 scope = RegScope_Lookup(msr, cmd);
+
+  return (core->ScopeLeader & (1 << scope)) ? TRUE : FALSE;
+}
+
+/*******************************************************************************
+ * RegScope_SelectCores
+ ******************************************************************************/
+
+VOID EFIAPI RegScope_SelectCores(
+  IN const PLATFORM* Platform,
+  IN const REG_OP* ops,
+  IN const UINTN nOps,
+  IN OUT CORE_RESULT* results)
+{
+  UINT8 narrowest = REG_SCOPE_PACKAGE;
+
+  for (UINTN oidx = 0; oidx < nOps; oidx++) {
+
+    const UINT8 scope = RegScope_Lookup(ops[oidx].Msr, ops[oidx].Cmd);
+
+    narrowest = (scope < narrowest) ? scope : narrowest;
+  }
+
+  if (gProgramEveryThread) {
+    narrowest = REG_SCOPE_THREAD;
+  }
+
+  Topology_Select(Platform, narrowest, results);
+}
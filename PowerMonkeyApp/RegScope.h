@@ -0,0 +1,87 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#pragma once
+
+#include "Platform.h"
+#include "MpDispatcher.h"
+
+/*******************************************************************************
+ * Register scopes
+ * 
+ * Most of the registers PowerMonkey writes are not private to the logical
+ * CPU executing the write - e.g. all threads of a package share the same 
+ * MSR_TURBO_RATIO_LIMIT. Writing them from every thread only adds MSR and
+ * OC mailbox traffic, so each write is done once per scope, by the first
+ * (lowest numbered) CPU of that scope ("representative", see Topology.h)
+ ******************************************************************************/
+
+#define REG_SCOPE_THREAD      0
+#define REG_SCOPE_CORE        1
+#define REG_SCOPE_MODULE      2
+#define REG_SCOPE_PACKAGE     3
+
+#define REG_SCOPE_ANY_CMD     0xFF          // Table entry covers all commands
+#define REG_SCOPE_NO_CMD      0xFF          // Plain MSR, not a mailbox command
+
+typedef struct _REG_SCOPE_ENTRY
+{
+  UINT32  Msr;
+  UINT8   Cmd;                              // OC mailbox command or ANY_CMD
+  UINT8   Scope;                            // REG_SCOPE_*
+} REG_SCOPE_ENTRY;
+
+typedef struct _REG_OP
+{
+  UINT32  Msr;
+  UINT8   Cmd;                              // OC mailbox command or NO_CMD
+} REG_OP;
+
+/*******************************************************************************
+ * RegScope_Lookup
+ ******************************************************************************/
+
+UINT8 EFIAPI RegScope_Lookup(IN const UINT32 msr, IN const UINT8 cmd);
+
+/*******************************************************************************
+ * RegScope_ShouldWrite
+ * TRUE if the calling CPU is the one that should perform the write
+ ******************************************************************************/
+
+BOOLEAN EFIAPI RegScope_ShouldWrite(IN const UINT32 msr, IN const UINT8 cmd);
+
+/*******************************************************************************
+ * RegScope_SelectCores
+ * Marks results[].Selected for CPUs that have at least one of the ops to 
+ * perform, i.e. representatives of the narrowest scope found among ops
+ ******************************************************************************/
+
+VOID EFIAPI RegScope_SelectCores(
+  IN const PLATFORM* Platform,
+  IN const REG_OP* ops,
+  IN const UINTN nOps,
+  IN OUT CORE_RESULT* results
+);
@@ -99,6 +99,18 @@ UINT64 EFIAPI hlp_atomic_decrement_u64(UINT64* val);
 UINT32 EFIAPI hlp_atomic_increment_u32(UINT32* val);
 UINT32 EFIAPI hlp_atomic_decrement_u32(UINT32* val);
 
+UINT32 EFIAPI hlp_atomic_cmpxchg_u32(UINT32* val, UINT32 cmp, UINT32 xchg);
+
+UINT64 EFIAPI hlp_gs_read_u64(UINTN offset);
+
+UINTN EFIAPI hlp_read_cr4(VOID);
+
+VOID EFIAPI hlp_write_cr4(UINTN val);
+
+UINT64 EFIAPI hlp_xgetbv(UINT32 idx);
+
+VOID EFIAPI hlp_xsetbv(UINT32 idx, UINT64 val);
+
 
 /*******************************************************************************
  * ISR entry points in SaferAsm.asm
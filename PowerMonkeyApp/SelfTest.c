@@ -27,10 +27,14 @@
 #include <PiPei.h>
 #include <Uefi.h>
 #include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/MemoryAllocationLib.h>
 #include <Protocol/MpService.h>
 
 #include "Constants.h"
+#include "Platform.h"
 #include "MpDispatcher.h"
+#include "SaferAsmHdr.h"
 #include "./ASMx64/ComboHell_AVX2.h"
 #include "SelfTest.h"
 
@@ -41,6 +45,12 @@
 UINT64 gSelfTestErrorCnt = 0;
 UINT64 gSelfTestStopReq = 0;
 
+extern const CHAR8* gSelfTestKernel;
+extern PLATFORM* gPlatform;
+
+STRESS_RESULT* gStressResults = NULL;
+UINTN gStressResultCnt = 0;
+
 /*******************************************************************************
  * 
  ******************************************************************************/
@@ -101,17 +111,299 @@ ALIGN32 cbhell_ymm_input combo_scratch1 =
 };
 
 /*******************************************************************************
- * PM_ComboHell_Thread
+ * ComboHell_Run
+ * 
+ * Adapter for the registry - ComboHell keeps most parameters in globals 
+ * (same for every CPU, set up in PM_SelfTest) and its own scratch layout,
+ * only errors go to the per-run counter
  ******************************************************************************/
 
-VOID EFIAPI PM_ComboHell_Thread(IN OUT VOID* Buffer)
+static UINT64 ComboHell_Run(STRESS_CTX* ctx)
 {
-  //
-  // Run ASM kernel
+  UINT64 rv = combohell_avx2_kernel( (void*)&combo_scratch1, 
+    (void*)&combo_scratch2, ctx->ErrorCounterPtr );
   
-  combohell_avx2_kernel( (void*)&combo_scratch1, (void*)&combo_scratch2 );
+  ctx->Runs = (rv) ? 0 : ctx->MaxRuns;
+
+  return rv;
+}
+
+/*******************************************************************************
+ * Kernel registry
+ * 
+ * Heaviest (highest current draw) first - the first entry a CPU supports is 
+ * the one it runs. Add new kernels here.
+ ******************************************************************************/
+
+static const STRESS_KERNEL gStressKernels[] = {
+  { 
+    "AVX512_FMA",     STRESS_FEAT_AVX512F,
+    XCR0_X87 | XCR0_SSE | XCR0_AVX | 
+    XCR0_OPMASK | XCR0_ZMM_HI256 | XCR0_HI16_ZMM,
+    0x4000000,        stress_avx512_kernel
+  },
+  {
+    "FMA3_AVX2",      STRESS_FEAT_AVX | STRESS_FEAT_AVX2 | STRESS_FEAT_FMA3,
+    XCR0_X87 | XCR0_SSE | XCR0_AVX,
+    0x8000000,        stress_fma3_kernel
+  },
+  {
+    "ComboHell_AVX2", STRESS_FEAT_AVX | STRESS_FEAT_AVX2,
+    XCR0_X87 | XCR0_SSE | XCR0_AVX,
+    0,                ComboHell_Run
+  },
+  {
+    "SSE2",           STRESS_FEAT_SSE2,
+    0,
+    0x8000000,        stress_sse_kernel
+  },
+  {
+    "INT_BRANCH",     0,
+    0,
+    0x4000000,        stress_int_kernel
+  },
+};
+
+#define STRESS_KERNEL_CNT   (sizeof(gStressKernels) / sizeof(STRESS_KERNEL))
+
+/*******************************************************************************
+ * Stressor input, shared (read-only) by all CPUs
+ ******************************************************************************/
+
+ALIGN64 STRESS_SCRATCH gStressScratch = { 0 };
+
+/*******************************************************************************
+ * InitStressScratch
+ * 
+ * FP32 values are generated as bit patterns: seeds in [1, 2), multiplicands
+ * around 0.01 - so a*b changes the low mantissa bits of the seeds
+ ******************************************************************************/
+
+static VOID InitStressScratch(VOID)
+{
+  UINT64 x = 0x9E3779B97F4A7C15;
+
+  for (UINTN idx = 0; idx < (sizeof(STRESS_SCRATCH) / sizeof(UINT32)); idx++) {
+    
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    UINT32* dw = ((UINT32*)&gStressScratch) + idx;
+
+    if (idx < 256) {
+      *dw = 0x3F800000 | (UINT32)(x & 0x7FFFFF);
+    }
+    else if (idx < 288) {
+      *dw = 0x3C23D70A | (UINT32)(x & 0x3FFFFF);
+    }
+    else {
+      *dw = (UINT32)x;
+    }
+  }
 }
 
+/*******************************************************************************
+ * DetectFeatures
+ * Of the calling CPU, vector ISAs only count if XCR0 can enable their state
+ ******************************************************************************/
+
+static UINT32 DetectFeatures(OUT UINT64* xcr0Supported)
+{
+  UINT32 regs[4] = { 0 };
+  UINT32 leaf1Ecx = 0;
+  UINT32 feat = 0;
+
+  *xcr0Supported = 0;
+
+  _pm_cpuid(0x00, regs);
+  
+  const UINT32 maxLeaf = regs[0];
+
+  _pm_cpuid(0x01, regs);
+
+  leaf1Ecx = regs[2];
+
+  if (regs[3] & bit26u32) {
+    feat |= STRESS_FEAT_SSE2;
+  }
+
+  //
+  // XSAVE: supported state components from leaf 0xD
+
+  if ((leaf1Ecx & bit26u32) && (maxLeaf >= 0x0D)) {
+    _pm_cpuid_ex(0x0D, 0, regs);
+    *xcr0Supported = ((UINT64)regs[3] << 32) | regs[0];
+  }
+
+  if ((leaf1Ecx & bit28u32) && 
+      ((*xcr0Supported & (XCR0_SSE | XCR0_AVX)) == (XCR0_SSE | XCR0_AVX))) {
+    
+    feat |= STRESS_FEAT_AVX;
+    feat |= (leaf1Ecx & bit12u32) ? STRESS_FEAT_FMA3 : 0;
+
+    if (maxLeaf >= 0x07) {
+      _pm_cpuid_ex(0x07, 0, regs);
+
+      feat |= (regs[1] & bit5u32) ? STRESS_FEAT_AVX2 : 0;
+      feat |= (regs[1] & bit16u32) ? STRESS_FEAT_AVX512F : 0;
+    }
+  }
+
+  return feat;
+}
+
+/*******************************************************************************
+ * Stress_SelectKernel
+ ******************************************************************************/
+
+const STRESS_KERNEL* EFIAPI Stress_SelectKernel(VOID)
+{
+  UINT64 xcr0Supported = 0;
+  const UINT32 feat = DetectFeatures(&xcr0Supported);
+  const STRESS_KERNEL* best = NULL;
+
+  for (UINTN kidx = 0; kidx < STRESS_KERNEL_CNT; kidx++) {
+    
+    const STRESS_KERNEL* k = &gStressKernels[kidx];
+
+    if (((feat & k->Features) != k->Features) ||
+        ((k->Xcr0 & ~xcr0Supported) != 0)) {
+      continue;
+    }
+
+    if ((gSelfTestKernel) && (!AsciiStrCmp(gSelfTestKernel, k->Name))) {
+      return k;
+    }
+
+    best = (best) ? best : k;
+  }
+
+  return best;
+}
+
+/*******************************************************************************
+ * EnableXState / RestoreXState
+ ******************************************************************************/
+
+#define CR4_OSXSAVE   bit18u32
+
+static VOID EnableXState(IN const UINT64 need, 
+  OUT UINTN* savedCr4, 
+  OUT UINT64* savedXcr0)
+{
+  *savedCr4 = hlp_read_cr4();
+  *savedXcr0 = 0;
+
+  if (!need) {
+    return;
+  }
+
+  if (!(*savedCr4 & CR4_OSXSAVE)) {
+    hlp_write_cr4(*savedCr4 | CR4_OSXSAVE);
+  }
+
+  *savedXcr0 = hlp_xgetbv(0);
+
+  if ((*savedXcr0 & need) != need) {
+    hlp_xsetbv(0, *savedXcr0 | need);
+  }
+}
+
+static VOID RestoreXState(IN const UINT64 need,
+  IN const UINTN savedCr4,
+  IN const UINT64 savedXcr0)
+{
+  if (!need) {
+    return;
+  }
+
+  if ((savedXcr0 & need) != need) {
+    hlp_xsetbv(0, savedXcr0);
+  }
+
+  if (!(savedCr4 & CR4_OSXSAVE)) {
+    hlp_write_cr4(savedCr4);
+  }
+}
+
+/*******************************************************************************
+ * PM_Stress_Thread
+ ******************************************************************************/
+
+VOID EFIAPI PM_Stress_Thread(IN OUT VOID* Buffer)
+{
+  PMUNUSED(Buffer);
+
+  CPUCORE* core = (CPUCORE*)GetCpuDataBlock();
+  STRESS_RESULT* res = NULL;
+  STRESS_CTX ctx;
+  UINTN savedCr4 = 0;
+  UINT64 savedXcr0 = 0;
+
+  if ((!core) || (core->AbsIdx >= gStressResultCnt)) {
+    return;
+  }
+
+  res = gStressResults + core->AbsIdx;
+  res->IsECore = core->IsECore;
+  res->Kernel = Stress_SelectKernel();
+
+  if (!res->Kernel) {
+    return;
+  }
+
+  ctx.Scratch = &gStressScratch;
+  ctx.StopRequestPtr = &gSelfTestStopReq;
+  ctx.ErrorCounterPtr = &res->Errors;
+  ctx.MaxRuns = gSelfTestMaxRuns;
+  ctx.InnerLoops = res->Kernel->InnerLoops;
+  ctx.TerminateOnError = 0;
+  ctx.Runs = 0;
+
+  EnableXState(res->Kernel->Xcr0, &savedCr4, &savedXcr0);
+
+  res->Kernel->Run(&ctx);
+
+  RestoreXState(res->Kernel->Xcr0, savedCr4, savedXcr0);
+
+  res->Runs = ctx.Runs;
+}
+
+/*******************************************************************************
+ * PrintStressResults
+ ******************************************************************************/
+
+static VOID PrintStressResults(VOID)
+{
+  for (UINTN kidx = 0; kidx < STRESS_KERNEL_CNT; kidx++) {
+    
+    const STRESS_KERNEL* k = &gStressKernels[kidx];
+    UINT32 nCpus = 0;
+    UINT32 nECores = 0;
+    UINT64 runs = 0;
+    UINT64 errors = 0;
+
+    for (UINTN cidx = 0; cidx < gStressResultCnt; cidx++) {
+      
+      const STRESS_RESULT* res = gStressResults + cidx;
+
+      if (res->Kernel == k) {
+        nCpus++;
+        nECores += (res->IsECore) ? 1 : 0;
+        runs += res->Runs;
+        errors += res->Errors;
+      }
+    }
+
+    if (nCpus) {
+      AsciiPrint("[SelfTest] %a: %u CPUs (%u E-cores), %lu runs, %lu errors\n",
+        k->Name, nCpus, nECores, runs, errors);
+    }
+
+    gSelfTestErrorCnt += errors;
+  }
+}
 
 /*******************************************************************************
  * PM_SelfTest
@@ -127,22 +419,37 @@ EFI_STATUS PM_SelfTest(VOID)
   ComboHell_TerminateOnError = 0;
   ComboHell_MaxRuns = gSelfTestMaxRuns;
 
-  ComboHell_ErrorCounterPtr = (void*)&gSelfTestErrorCnt;
   ComboHell_StopRequestPtr =  (void*)&gSelfTestStopReq;
 
   gSelfTestErrorCnt = 0;
   gSelfTestStopReq = 0;
 
+  gStressResultCnt = (gPlatform) ? gPlatform->LogicalProcessors : 0;
+  gStressResults = (gStressResultCnt) ? 
+    AllocateZeroPool(gStressResultCnt * sizeof(STRESS_RESULT)) : NULL;
+
+  if (!gStressResults) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  InitStressScratch();
+
   //
-  // Execute the same stress-kernel on every CPU
+  // Every CPU runs the heaviest kernel it supports
  
-  AsciiPrint("[SelfTest] Running %u Iterations of ComboHell_AVX2 Stressor\n",
+  AsciiPrint("[SelfTest] Running %u Iterations of the stress engine\n",
     gSelfTestMaxRuns);
 
-  RunOnAllProcessors(PM_ComboHell_Thread, TRUE, NULL);
+  RunOnAllProcessors(PM_Stress_Thread, TRUE, NULL);
+
+  PrintStressResults();
 
   AsciiPrint( "Self test completed with %u errors.\n", 
     gSelfTestErrorCnt);
 
+  FreePool(gStressResults);
+  gStressResults = NULL;
+  gStressResultCnt = 0;
+
   return status;
-}
\ No newline at end of file
+}
@@ -26,6 +26,49 @@
 
 #pragma once
 
+#include "ASMx64/StressKernels.h"
+
+/*******************************************************************************
+ * Stress engine
+ * 
+ * Every CPU picks the heaviest kernel of the registry (SelfTest.c) it can 
+ * run - CPUID is checked on the CPU itself, so P-cores and E-cores of hybrid
+ * parts may run different kernels. XSAVE state a kernel needs is enabled in
+ * XCR0 (and CR4.OSXSAVE) on that CPU around the run, UEFI does not do it.
+ ******************************************************************************/
+
+#define STRESS_FEAT_SSE2            bit0u32
+#define STRESS_FEAT_AVX             bit1u32
+#define STRESS_FEAT_AVX2            bit2u32
+#define STRESS_FEAT_FMA3            bit3u32
+#define STRESS_FEAT_AVX512F         bit4u32
+
+#define XCR0_X87                    0x01
+#define XCR0_SSE                    0x02
+#define XCR0_AVX                    0x04
+#define XCR0_OPMASK                 0x20
+#define XCR0_ZMM_HI256              0x40
+#define XCR0_HI16_ZMM               0x80
+
+typedef UINT64 (*STRESS_KERNEL_FN)(STRESS_CTX* ctx);
+
+typedef struct _STRESS_KERNEL
+{
+  const CHAR8*      Name;
+  UINT32            Features;             // STRESS_FEAT_*, all required
+  UINT64            Xcr0;                 // State components to enable
+  UINT64            InnerLoops;           // Iterations between checks
+  STRESS_KERNEL_FN  Run;
+} STRESS_KERNEL;
+
+typedef struct _STRESS_RESULT
+{
+  const STRESS_KERNEL*  Kernel;           // NULL = did not run
+  UINT64                Runs;
+  UINT64                Errors;
+  BOOLEAN               IsECore;
+} STRESS_RESULT;
+
 /*******************************************************************************
  * Globals
  ******************************************************************************/
@@ -33,7 +76,15 @@
 extern UINT64 gSelfTestMaxRuns;
 
 /*******************************************************************************
- *
+ * Stress_SelectKernel
+ * Heaviest kernel the calling CPU supports (or gSelfTestKernel, if set and
+ * supported)
+ ******************************************************************************/
+
+const STRESS_KERNEL* EFIAPI Stress_SelectKernel(VOID);
+
+/*******************************************************************************
+ * PM_SelfTest
  ******************************************************************************/
 
 EFI_STATUS PM_SelfTest(VOID);
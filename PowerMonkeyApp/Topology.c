@@ -0,0 +1,317 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Protocol/MpService.h>
+
+#include "Topology.h"
+#include "CpuInfo.h"
+#include "SaferAsmHdr.h"
+
+/*******************************************************************************
+ * 
+ ******************************************************************************/
+
+#define CPUID_EAX   0
+#define CPUID_EBX   1
+#define CPUID_ECX   2
+#define CPUID_EDX   3
+
+//
+// CPUID 0x1F / 0x0B level types
+
+#define LEVEL_INVALID   0
+#define LEVEL_SMT       1
+#define LEVEL_CORE      2
+#define LEVEL_MODULE    3
+#define LEVEL_TILE      4
+#define LEVEL_DIE       5
+#define LEVEL_MAX       6
+
+/*******************************************************************************
+ * Log2Ceil
+ ******************************************************************************/
+
+static UINT32 Log2Ceil(const UINT32 n)
+{
+  UINT32 bits = 0;
+
+  while (((UINT32)1 << bits) < n) {
+    bits++;
+  }
+
+  return bits;
+}
+
+/*******************************************************************************
+ * GetL2SharingShift
+ * APIC ID bits covered by logical processors sharing this CPU's L2
+ ******************************************************************************/
+
+static UINT32 GetL2SharingShift(const UINT32 maxLeaf)
+{
+  UINT32 regs[4] = { 0 };
+
+  if (maxLeaf < 4) {
+    return 0;
+  }
+
+  for (UINT32 sub = 0; sub < 16; sub++) {
+
+    _pm_cpuid_ex(4, sub, regs);
+
+    const UINT32 cacheType = regs[CPUID_EAX] & 0x1F;
+    const UINT32 cacheLevel = (regs[CPUID_EAX] >> 5) & 0x7;
+
+    if (cacheType == 0) {
+      break;
+    }
+
+    if (cacheLevel == 2) {
+      return Log2Ceil(((regs[CPUID_EAX] >> 14) & 0xFFF) + 1);
+    }
+  }
+
+  return 0;
+}
+
+/*******************************************************************************
+ * Topology_ProbeThisCpu
+ ******************************************************************************/
+
+VOID EFIAPI Topology_ProbeThisCpu(IN OUT CPUCORE* core)
+{
+  UINT32 regs[4] = { 0 };
+  UINT32 levelShift[LEVEL_MAX] = { 0 };
+  BOOLEAN levelPresent[LEVEL_MAX] = { 0 };
+
+  const UINT32 maxLeaf = core->CpuInfo.maxf;
+
+  core->TopologyValid = FALSE;
+
+  //
+  // Core type (hybrid parts only)
+
+  core->CoreType = CORE_TYPE_UNKNOWN;
+
+  if ((core->CpuInfo.HybridArch) && (maxLeaf >= 0x1A)) {
+    _pm_cpuid(0x1A, regs);
+    core->CoreType = (UINT8)((regs[CPUID_EAX] >> 24) & 0xFF);
+  }
+
+  UINT32 leaf = 0;
+
+  if (maxLeaf >= 0x1F) {
+    _pm_cpuid_ex(0x1F, 0, regs);
+    leaf = (regs[CPUID_EBX] & 0xFFFF) ? 0x1F : 0;
+  }
+
+  if ((!leaf) && (maxLeaf >= 0x0B)) {
+    _pm_cpuid_ex(0x0B, 0, regs);
+    leaf = (regs[CPUID_EBX] & 0xFFFF) ? 0x0B : 0;
+  }
+
+  if (!leaf) {
+    return;
+  }
+
+  //
+  // Walk the levels: shift reported at a level = bits to drop to get the ID
+  // of the next level up; the last one gives the package ID
+
+  UINT32 x2apic = 0;
+  UINT32 pkgShift = 0;
+
+  for (UINT32 sub = 0; sub < 8; sub++) {
+
+    _pm_cpuid_ex(leaf, sub, regs);
+
+    const UINT32 levelType = (regs[CPUID_ECX] >> 8) & 0xFF;
+
+    if (levelType == LEVEL_INVALID) {
+      break;
+    }
+
+    x2apic = regs[CPUID_EDX];
+    pkgShift = regs[CPUID_EAX] & 0x1F;
+
+    if (levelType < LEVEL_MAX) {
+      levelShift[levelType] = pkgShift;
+      levelPresent[levelType] = TRUE;
+    }
+  }
+
+  //
+  // Shift below each level (i.e. bits to drop to get its ID)
+
+  const UINT32 smtShift = levelShift[LEVEL_SMT];
+
+  UINT32 coreTop = (levelPresent[LEVEL_CORE]) ? 
+    levelShift[LEVEL_CORE] : smtShift;
+
+  UINT32 moduleShift = smtShift;
+  UINT32 dieShift = pkgShift;
+
+  if (levelPresent[LEVEL_MODULE]) {
+    moduleShift = coreTop;
+  }
+  else {
+
+    //
+    // Cores sharing L2 form a module (E-core clusters), on other 
+    // CPUs L2 is private to the core and module == core
+
+    const UINT32 l2Shift = GetL2SharingShift(maxLeaf);
+
+    moduleShift = (l2Shift > smtShift) ? l2Shift : smtShift;
+    moduleShift = (moduleShift > pkgShift) ? pkgShift : moduleShift;
+  }
+
+  if (levelPresent[LEVEL_DIE]) {
+    dieShift = (levelPresent[LEVEL_TILE]) ? levelShift[LEVEL_TILE] :
+      (levelPresent[LEVEL_MODULE]) ? levelShift[LEVEL_MODULE] : coreTop;
+  }
+
+  const UINT32 pkgMask = ((UINT32)1 << pkgShift) - 1;
+
+  core->X2ApicID = x2apic;
+  core->PackageId = x2apic >> pkgShift;
+  core->DieId = (x2apic & pkgMask) >> dieShift;
+  core->ModuleId = (x2apic & pkgMask) >> moduleShift;
+  core->CoreId = (x2apic & pkgMask) >> smtShift;
+  core->ThreadId = x2apic & (((UINT32)1 << smtShift) - 1);
+
+  core->TopologyValid = TRUE;
+}
+
+/*******************************************************************************
+ * Topology_Finalize
+ ******************************************************************************/
+
+VOID EFIAPI Topology_Finalize(IN OUT PLATFORM* Platform)
+{
+  for (UINTN pidx = 0; pidx < Platform->PkgCnt; pidx++) {
+
+    PACKAGE* pac = Platform->packages + pidx;
+
+    UINTN physicalCores = 0;
+
+    for (UINTN cidx = 0; cidx < pac->LogicalCores; cidx++) {
+
+      CPUCORE* core = pac->Core + cidx;
+
+      BOOLEAN firstOfCore = TRUE;
+      BOOLEAN firstOfModule = TRUE;
+
+      if (core->TopologyValid) {
+
+        //
+        // Leader = lowest numbered CPU with the same ID in the package
+
+        for (UINTN prev = 0; prev < cidx; prev++) {
+
+          CPUCORE* other = pac->Core + prev;
+
+          if (!other->TopologyValid) {
+            continue;
+          }
+
+          if (other->CoreId == core->CoreId) {
+            firstOfCore = FALSE;
+          }
+
+          if (other->ModuleId == core->ModuleId) {
+            firstOfModule = FALSE;
+          }
+        }
+
+        core->IsPhysical = firstOfCore;
+      }
+      else {
+
+        //
+        // No topology leaves: keep DetectPackages' guess, 
+        // modules are unknown so treat each core as a module
+
+        firstOfCore = firstOfModule = core->IsPhysical;
+      }
+
+      physicalCores += (core->IsPhysical) ? 1 : 0;
+
+      core->ScopeLeader = (1 << REG_SCOPE_THREAD);
+      core->ScopeLeader |= (firstOfCore) ? (1 << REG_SCOPE_CORE) : 0;
+      core->ScopeLeader |= (firstOfModule) ? (1 << REG_SCOPE_MODULE) : 0;
+      core->ScopeLeader |= (cidx == 0) ? (1 << REG_SCOPE_PACKAGE) : 0;
+    }
+
+    pac->PhysicalCores = physicalCores;
+  }
+}
+
+/*******************************************************************************
+ * Topology_NextCpu
+ ******************************************************************************/
+
+CPUCORE* EFIAPI Topology_NextCpu(
+  IN const PLATFORM* Platform,
+  IN const UINT8 selection,
+  IN OUT UINTN* cursor)
+{
+  while (*cursor < Platform->LogicalProcessors) {
+
+    CPUCORE* core = (CPUCORE*)gCorePtrs[*cursor];
+
+    (*cursor)++;
+
+    if ((core) && (core->ScopeLeader & (1 << selection))) {
+      return core;
+    }
+  }
+
+  return NULL;
+}
+
+/*******************************************************************************
+ * Topology_Select
+ ******************************************************************************/
+
+VOID EFIAPI Topology_Select(
+  IN const PLATFORM* Platform,
+  IN const UINT8 selection,
+  IN OUT CORE_RESULT* results)
+{
+  UINTN cursor = 0;
+  CPUCORE* core = NULL;
+
+  for (UINTN cidx = 0; cidx < Platform->LogicalProcessors; cidx++) {
+    results[cidx].Selected = 0;
+  }
+
+  while ((core = Topology_NextCpu(Platform, selection, &cursor)) != NULL) {
+    results[core->AbsIdx].Selected = 1;
+  }
+}
@@ -0,0 +1,94 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#pragma once
+
+#include "Platform.h"
+#include "RegScope.h"
+
+/*******************************************************************************
+ * CPU topology
+ * 
+ * Every CPU decomposes its own x2APIC ID using the level shifts reported by 
+ * CPUID leaf 0x1F (or 0x0B), so no guessing from MP services thread indices
+ * is needed. Modules not enumerated by 0x1F (e.g. Alder Lake E-core clusters)
+ * are derived from L2 sharing (CPUID leaf 4). Core type comes from leaf 0x1A
+ ******************************************************************************/
+
+#define CORE_TYPE_UNKNOWN     0x00
+#define CORE_TYPE_ATOM        0x20            // E-core
+#define CORE_TYPE_CORE        0x40            // P-core
+
+//
+// Iterator selections (leaders of a scope, see RegScope.h)
+
+#define TOPO_EVERY_THREAD     REG_SCOPE_THREAD
+#define TOPO_ONE_PER_CORE     REG_SCOPE_CORE
+#define TOPO_ONE_PER_MODULE   REG_SCOPE_MODULE
+#define TOPO_ONE_PER_PACKAGE  REG_SCOPE_PACKAGE
+
+/*******************************************************************************
+ * Topology_ProbeThisCpu
+ * Runs on the CPU being probed (ProcessorIgnite / worker pool)
+ ******************************************************************************/
+
+VOID EFIAPI Topology_ProbeThisCpu(IN OUT CPUCORE* core);
+
+/*******************************************************************************
+ * Topology_Finalize
+ * Runs on the BSP after all CPUs have been probed: physical core counts and
+ * scope leaders (CPUCORE::ScopeLeader)
+ ******************************************************************************/
+
+VOID EFIAPI Topology_Finalize(IN OUT PLATFORM* Platform);
+
+/*******************************************************************************
+ * Topology_NextCpu
+ * 
+ * Iterates over CPUs matching the selection (TOPO_*), e.g.:
+ * 
+ *   UINTN cursor = 0;
+ *   CPUCORE* core;
+ * 
+ *   while ((core = Topology_NextCpu(sys, TOPO_ONE_PER_CORE, &cursor))) {...}
+ ******************************************************************************/
+
+CPUCORE* EFIAPI Topology_NextCpu(
+  IN const PLATFORM* Platform,
+  IN const UINT8 selection,
+  IN OUT UINTN* cursor
+);
+
+/*******************************************************************************
+ * Topology_Select
+ * Marks results[].Selected for CPUs matching the selection (for dispatch)
+ ******************************************************************************/
+
+VOID EFIAPI Topology_Select(
+  IN const PLATFORM* Platform,
+  IN const UINT8 selection,
+  IN OUT CORE_RESULT* results
+);
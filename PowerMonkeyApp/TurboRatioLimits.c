@@ -68,6 +68,8 @@
  * start and replace this with a gigantic lookup table keyed by CPUID
  ******************************************************************************/
 
+extern UINT8 gSkipUnchangedWrites;
+
 /*******************************************************************************
  * GetTurboRatioLimits
  ******************************************************************************/
@@ -127,23 +129,41 @@ EFI_STATUS SetTurboRatioLimits_ECORE(const UINT64 val)
 
 
 /*******************************************************************************
- * ProgramMaxTurboRatios
+ * ComposeMaxTurboRatios
+ * TRL MSR value with every seemingly valid block set to maxRatio
  ******************************************************************************/
 
-EFI_STATUS IAPERF_ProgramMaxTurboRatios(const UINT8 maxRatio)
+UINT64 ComposeMaxTurboRatios(const UINT64 current, const UINT8 maxRatio)
 {
-  UINT64 msr = GetTurboRatioLimits();
+  UINT64 msr = current;
   UINT8* msr8 = (UINT8*)&msr;
 
-  //
-  // Adjust max ratios for seemingly valid blocks
-
   for (UINT8 blkidx = 0; blkidx < 8; blkidx++) {
     if ((msr8[blkidx]) && (msr8[blkidx] != 0xFF)) {
       msr8[blkidx] = maxRatio;
     }
   }
 
+  return msr;
+}
+
+/*******************************************************************************
+ * ProgramMaxTurboRatios
+ ******************************************************************************/
+
+EFI_STATUS IAPERF_ProgramMaxTurboRatios(const UINT8 maxRatio)
+{
+  const UINT64 cur = GetTurboRatioLimits();
+
+  //
+  // Adjust max ratios for seemingly valid blocks
+
+  UINT64 msr = ComposeMaxTurboRatios(cur, maxRatio);
+
+  if ((gSkipUnchangedWrites) && (msr == cur)) {
+    return EFI_SUCCESS;
+  }
+
   //
   // Program the new values
 
@@ -159,16 +179,15 @@ EFI_STATUS IAPERF_ProgramMaxTurboRatios(const UINT8 maxRatio)
 
 EFI_STATUS IAPERF_ProgramMaxTurboRatios_ECORE(const UINT8 maxRatio)
 {
-  UINT64 msr = GetTurboRatioLimits_ECORE();
-  UINT8* msr8 = (UINT8*)&msr;
+  const UINT64 cur = GetTurboRatioLimits_ECORE();
 
   //
   // Adjust max ratios for seemingly valid blocks
 
-  for (UINT8 blkidx = 0; blkidx < 8; blkidx++) {
-    if ((msr8[blkidx]) && (msr8[blkidx] != 0xFF)) {
-      msr8[blkidx] = maxRatio;
-    }
+  UINT64 msr = ComposeMaxTurboRatios(cur, maxRatio);
+
+  if ((gSkipUnchangedWrites) && (msr == cur)) {
+    return EFI_SUCCESS;
   }
 
   //
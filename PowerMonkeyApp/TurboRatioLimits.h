@@ -40,6 +40,12 @@ UINT64 GetTurboRatioLimits_ECORE(VOID);
 EFI_STATUS SetTurboRatioLimits(const UINT64 val);
 EFI_STATUS SetTurboRatioLimits_ECORE(const UINT64 val);
 
+/*******************************************************************************
+ * ComposeMaxTurboRatios
+ ******************************************************************************/
+
+UINT64 ComposeMaxTurboRatios(const UINT64 current, const UINT8 maxRatio);
+
 /*******************************************************************************
  * ProgramMaxTurboRatios
  ******************************************************************************/
@@ -27,6 +27,7 @@
 #include <PiPei.h>
 #include <Uefi.h>
 #include <Library/UefiLib.h>
+#include <Library/BaseMemoryLib.h>
 
 #include "VFTuning.h"
 #include "LowLevel.h"
@@ -35,6 +36,7 @@
 #include "FixedPoint.h"
 #include "MiniLog.h"
 #include "CpuData.h"
+#include "ProbeCache.h"
 
 /*******************************************************************************
  * Layout of the CPU Overclocking mailbox can be found in academic papers:
@@ -53,54 +55,43 @@
  ******************************************************************************/
 
 /*******************************************************************************
- * IAPERF_ProbeDomainVF
+ * ReadDomainIccMax
  ******************************************************************************/
 
-EFI_STATUS EFIAPI IAPERF_ProbeDomainVF(IN const UINT8 domIdx, OUT DOMAIN* dom)
+static VOID ReadDomainIccMax( IN const UINT8 domIdx, 
+                              IN OUT DOMAIN* dom, 
+                              IN OUT CpuMailbox* box )
 {
-  CpuMailbox box;
-  MailboxBody* b = &box.b;
-  EFI_STATUS status = EFI_SUCCESS;
-  UINT32 cmd = 0;
-
-  //
-  // Alderlake: if we are running on E-Core, skip other domains
-  
-//  CPUCORE *core = (CPUCORE *)GetCpuDataBlock();
-
-// 
-//   if (core->IsECore) {
-//     if (domIdx != ECORE) {
-//       return EFI_SUCCESS;
-//     }
-//   }
-
-  OcMailbox_InitializeAsMSR(&box);
-
-  /////////////////////////////////
-  // Read IccMax for this domain //
-  /////////////////////////////////
+  MailboxBody* b = &box->b;
 
   MiniTraceEx("Dom: 0x%x, Reading IccMax", domIdx);
 
   const UINT16 iccMaxMask = (1 << gActiveCpuData->IccMaxBits) - 1;
 
-  cmd = OcMailbox_BuildInterface(0x16, dom->VRaddr, 0);
+  const UINT32 cmd = OcMailbox_BuildInterface(0x16, dom->VRaddr, 0);
 
-  if (!EFI_ERROR(OcMailbox_ReadWrite(cmd, 0, &box))) {
+  if (!EFI_ERROR(OcMailbox_ReadWrite(cmd, 0, box))) {
     dom->IccMax = b->box.data & iccMaxMask;
+    dom->UnlimitedIccMax = (UINT8)((b->box.data & bit31u32) != 0);
   }
+}
+
+/*******************************************************************************
+ * ReadDomainVF
+ ******************************************************************************/
+
+static EFI_STATUS ReadDomainVF( IN const UINT8 domIdx, 
+                                IN OUT DOMAIN* dom, 
+                                IN OUT CpuMailbox* box )
+{
+  MailboxBody* b = &box->b;
 
-  ///////////////////
-  // Read V/F Info //
-  ///////////////////
-  
   //
   // cmd: Read, Domain#, 0
 
-  cmd = OcMailbox_BuildInterface(0x10, domIdx, 0x0);
+  const UINT32 cmd = OcMailbox_BuildInterface(0x10, domIdx, 0x0);
 
-  if (EFI_ERROR(OcMailbox_ReadWrite(cmd, 0, &box))) {
+  if (EFI_ERROR(OcMailbox_ReadWrite(cmd, 0, box))) {
     return EFI_ABORTED;
   }
 
@@ -123,6 +114,118 @@ EFI_STATUS EFIAPI IAPERF_ProbeDomainVF(IN const UINT8 domIdx, OUT DOMAIN* dom)
     dom->OffsetVolts,
     dom->TargetVolts);
 
+  return EFI_SUCCESS;
+}
+
+/*******************************************************************************
+ * ReadVfPoint
+ * vidx is our index, OC mailbox indices are vidx+1 (VFPT[0] is unused).
+ * Leaves vp untouched if the point does not exist (box->status != 0)
+ ******************************************************************************/
+
+static EFI_STATUS ReadVfPoint( IN const UINT8 domIdx, 
+                               IN const UINT8 vidx, 
+                               OUT VF_POINT* vp,
+                               IN OUT CpuMailbox* box )
+{
+  MailboxBody* b = &box->b;
+
+  const UINT32 cmd = OcMailbox_BuildInterface(0x10, domIdx, vidx + 1);
+
+  if (EFI_ERROR(OcMailbox_ReadWrite(cmd, 0, box))) {
+    return EFI_ABORTED;
+  }
+
+  if (box->status == 0) {
+
+    INT16 voltOffsetFx = (INT16)((b->box.data >> 21) & 0x7ff);
+
+    vp->FusedRatio = (UINT8)(b->box.data & 0xff);
+    vp->VOffset = cvrt_offsetvolts_fxto_i16(voltOffsetFx);
+    vp->IsValid = 1;
+
+    MiniTraceEx("VF Pt. found, #%u, mult: %ux, voffset: %d mV, dom: 0x%x",
+      vidx,
+      vp->FusedRatio,
+      vp->VOffset,
+      domIdx);
+  }
+
+  return EFI_SUCCESS;
+}
+
+/*******************************************************************************
+ * ReadKnownVfPoints
+ * Reads exactly the known number of VF points, FALSE if the fused ratios 
+ * read do not match the known ones (different part, stale cache)
+ ******************************************************************************/
+
+static BOOLEAN ReadKnownVfPoints( IN const UINT8 domIdx, 
+                                  IN OUT DOMAIN* dom, 
+                                  IN const VF_TOPOLOGY* known,
+                                  IN OUT CpuMailbox* box )
+{
+  if (known->nVfPoints > MAX_VF_POINTS) {
+    return FALSE;
+  }
+
+  for (UINT8 vidx = 0; vidx < known->nVfPoints; vidx++) {
+
+    VF_POINT* vp = &dom->vfPoint[vidx];
+
+    if ((EFI_ERROR(ReadVfPoint(domIdx, vidx, vp, box))) || 
+        (box->status != 0) ||
+        (vp->FusedRatio != known->FusedRatio[vidx])) {
+      return FALSE;
+    }
+  }
+
+  dom->nVfPoints = known->nVfPoints;
+
+  return TRUE;
+}
+
+/*******************************************************************************
+ * IAPERF_ProbeDomainVF
+ * known: VF points enumerated before (see ProbeCache.h), if supplied only 
+ * those are read - no probing for the end of the curve
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI IAPERF_ProbeDomainVF( IN const UINT8 domIdx, 
+                                        OUT DOMAIN* dom,
+                                        IN const VF_TOPOLOGY* known OPTIONAL )
+{
+  CpuMailbox box;
+  EFI_STATUS status = EFI_SUCCESS;
+
+  //
+  // Alderlake: if we are running on E-Core, skip other domains
+  
+//  CPUCORE *core = (CPUCORE *)GetCpuDataBlock();
+
+// 
+//   if (core->IsECore) {
+//     if (domIdx != ECORE) {
+//       return EFI_SUCCESS;
+//     }
+//   }
+
+  OcMailbox_InitializeAsMSR(&box);
+
+  /////////////////////////////////
+  // Read IccMax for this domain //
+  /////////////////////////////////
+
+  ReadDomainIccMax(domIdx, dom, &box);
+
+  ///////////////////
+  // Read V/F Info //
+  ///////////////////
+
+  if (EFI_ERROR(ReadDomainVF(domIdx, dom, &box))) {
+    return EFI_ABORTED;
+  }
+
   //
   // Discover V/F Points 
   // (CML and above only!!!)
@@ -132,63 +235,158 @@ EFI_STATUS EFIAPI IAPERF_ProbeDomainVF(IN const UINT8 domIdx, OUT DOMAIN* dom)
   if (  (gActiveCpuData->VfPointsExposed) && 
         ((domIdx==IACORE)||(domIdx==RING)||(domIdx==ECORE))) {
 
-    UINT8 pidx = 0;
+    if ((known) && (known->Valid)) {
 
-    MiniTraceEx("Discovering VF Pts. for domain: 0x%x", domIdx);
+      if (ReadKnownVfPoints(domIdx, dom, known, &box)) {
+        MiniTraceEx("Dom: 0x%x, %u known VF Pts. read", domIdx, dom->nVfPoints);
+        return status;
+      }
 
-    do {
+      MiniTraceEx("Dom: 0x%x, VF Pts. differ from the known ones", domIdx);
 
       //
-      // cmd2: Read, Domain#, VfPt#
-      // NOTE: OC Mailbox Indices are OUR_IDX+1, 
-      // as OC uBOx VFPT[0] is unused!
+      // Enumerate from scratch, nothing read above is to be trusted
+
+      SetMem(dom->vfPoint, sizeof(dom->vfPoint), 0);
+      dom->nVfPoints = 0;
+    }
+
+    MiniTraceEx("Discovering VF Pts. for domain: 0x%x", domIdx);
 
-      const UINT32 cmd2 = OcMailbox_BuildInterface(0x10, domIdx, pidx+1);
+    //
+    // Stop at the first point that does not read back without error:
+    // either V/F points are not supported or we reached the top V/F point
+
+    do {
 
-      if (EFI_ERROR(OcMailbox_ReadWrite(cmd2, 0, &box))) {
+      if (EFI_ERROR(ReadVfPoint(domIdx, (UINT8)dom->nVfPoints, 
+                                &dom->vfPoint[dom->nVfPoints], &box))) {
         return EFI_ABORTED;
       }
 
-      //
-      // Check if the readout was with no error - if not, stop probing 
-      // Either V/F points are not supported or we reached the top V/F point
-
       if (box.status == 0) {
+        dom->nVfPoints++;
+      }
 
-        VF_POINT* vp = &dom->vfPoint[dom->nVfPoints];
+    } while ((box.status == 0) && (dom->nVfPoints < MAX_VF_POINTS));
+  }
 
-        INT16 voltOffsetFx = (INT16)((b->box.data >> 21) & 0x7ff);
+  MiniTraceEx("Dom: 0x%x, V/F discovery done", domIdx);
 
-        vp->FusedRatio = (UINT8)(b->box.data & 0xff);;
-        vp->VOffset = cvrt_offsetvolts_fxto_i16(voltOffsetFx);
-        vp->IsValid = 1;
+  return status;
+}
 
-        MiniTraceEx("VF Pt. found, #%u, mult: %ux, voffset: %d mV, dom: 0x%x",
-          dom->nVfPoints,
-          vp->FusedRatio,
-          vp->VOffset,
-          domIdx);
+/*******************************************************************************
+ * IAPERF_RefreshDomainVF
+ ******************************************************************************/
 
-        dom->nVfPoints++;
+EFI_STATUS EFIAPI IAPERF_RefreshDomainVF( IN const UINT8 domIdx, 
+                                          IN OUT DOMAIN* dom,
+                                          IN const BOOLEAN iccMax,
+                                          IN const BOOLEAN vf,
+                                          IN const UINT16 vfPointMask )
+{
+  CpuMailbox box;
+
+  OcMailbox_InitializeAsMSR(&box);
+
+  if (iccMax) {
+    ReadDomainIccMax(domIdx, dom, &box);
+  }
+
+  if (vf) {
+    if (EFI_ERROR(ReadDomainVF(domIdx, dom, &box))) {
+      return EFI_ABORTED;
+    }
+  }
+
+  for (UINT8 vidx = 0; vidx < dom->nVfPoints; vidx++) {
+    if (vfPointMask & (1 << vidx)) {
+      if (EFI_ERROR(ReadVfPoint(domIdx, vidx, &dom->vfPoint[vidx], &box))) {
+        return EFI_ABORTED;
       }
+    }
+  }
 
-      pidx++;
+  return EFI_SUCCESS;
+}
 
-    } while ((box.status == 0) && (pidx < MAX_VF_POINTS));
+/*******************************************************************************
+* TrackMailboxStatus
+* Remembers the last non-zero completion code for reporting to the dispatcher
+******************************************************************************/
+
+static VOID TrackMailboxStatus(IN const CpuMailbox* box, 
+  OUT UINT32* mboxStatus OPTIONAL)
+{
+  if ((mboxStatus) && (box->status)) {
+    *mboxStatus = box->status;
   }
+}
 
-  MiniTraceEx("Dom: 0x%x, V/F discovery done", domIdx);
+/*******************************************************************************
+* IAPERF_SanitizeIccMax
+******************************************************************************/
 
-  return status;
+UINT16 EFIAPI IAPERF_SanitizeIccMax(IN const UINT16 iccMax)
+{
+  const UINT16 iccMaxMask = (1 << gActiveCpuData->IccMaxBits) - 1;
+
+  UINT16 val = (iccMax > iccMaxMask) ? iccMaxMask : iccMax;
+  
+  return (val < 0x4) ? 0x4 : val;
+}
+
+/*******************************************************************************
+* IAPERF_ComposeDomainVF
+******************************************************************************/
+
+UINT32 EFIAPI IAPERF_ComposeDomainVF(IN const DOMAIN* dom)
+{
+  //
+  // Convert the desired voltages in OC Mailbox format
+
+  UINT32 targetVoltsFx =
+    (UINT32)cvrt_ovrdvolts_i16_tofix(dom->TargetVolts) & 0xfff;
+
+  UINT32 offsetVoltsFx =
+    (UINT32)cvrt_offsetvolts_i16_tofix(dom->OffsetVolts) & 0x7ff;
+
+  //
+  // Compose the command for the OC mailbox
+
+  UINT32 data = dom->MaxRatio;
+  data |= (offsetVoltsFx) << 21;
+  data |= ((UINT32)(dom->VoltMode & bit1u8)) << 20;
+  data |= ((UINT32)(targetVoltsFx)) << 8;
+
+  return data;
+}
+
+/*******************************************************************************
+* IAPERF_ComposeVfPoint
+******************************************************************************/
+
+UINT32 EFIAPI IAPERF_ComposeVfPoint(IN const VF_POINT* vp)
+{
+  //
+  // Convert voltage offset to mbox format:
+
+  UINT32 offsetVoltsFx = (UINT32)cvrt_offsetvolts_i16_tofix(
+    vp->VOffset) & 0x7ff;
+
+  return (offsetVoltsFx) << 21;
 }
 
 /*******************************************************************************
 * IAPERF_ProgramDomainVF
+* plan: if supplied, only writes it lists are performed (see Plan.h)
 ******************************************************************************/
 
 EFI_STATUS EFIAPI IAPERF_ProgramDomainVF( IN const UINT8 domIdx, 
   IN OUT DOMAIN *dom, IN const UINT8 programVfPoints, 
-  IN const UINT8 programIccMax)
+  IN const UINT8 programIccMax, IN const DOMAIN_PLAN* plan OPTIONAL,
+  OUT UINT32* mboxStatus OPTIONAL)
 {
   CpuMailbox box;  
   OcMailbox_InitializeAsMSR(&box);
@@ -214,24 +412,27 @@ EFI_STATUS EFIAPI IAPERF_ProgramDomainVF( IN const UINT8 domIdx,
   // IccMax //
   ////////////
   
-  if (programIccMax) {
+  if ((programIccMax) && ((!plan) || (plan->WriteIccMax))) {
     
     //
     // Sanity
 
     const UINT16 iccMaxMask = (1 << gActiveCpuData->IccMaxBits) - 1;
         
-    dom->IccMax = (dom->IccMax > iccMaxMask) ? iccMaxMask : dom->IccMax;
-    dom->IccMax = (dom->IccMax < 0x4) ? 0x4 : dom->IccMax;
+    dom->IccMax = IAPERF_SanitizeIccMax(dom->IccMax);
     
     data = dom->IccMax;
 
-    MiniTraceEx("Dom: 0x%x, programming IccMax of %u A: %u",
+    MiniTraceEx("Dom: 0x%x, programming IccMax of %u A: 0x%x",
       domIdx,
-      data>>2);
+      data>>2,
+      data);
+
+    ProbeCache_MarkIccMax(dom);
 
     cmd = OcMailbox_BuildInterface(0x17, dom->VRaddr, 0);
     OcMailbox_ReadWrite(cmd, data, &box);
+    TrackMailboxStatus(&box, mboxStatus);
 
     //
     // RKL/ICL/TGL/ADL require extra step for truly unlocked IccMax
@@ -245,6 +446,7 @@ EFI_STATUS EFIAPI IAPERF_ProgramDomainVF( IN const UINT8 domIdx,
 
         cmd = OcMailbox_BuildInterface(0x17, dom->VRaddr, 0);
         OcMailbox_ReadWrite(cmd, data, &box);
+        TrackMailboxStatus(&box, mboxStatus);
       }
     }
 
@@ -260,24 +462,9 @@ EFI_STATUS EFIAPI IAPERF_ProgramDomainVF( IN const UINT8 domIdx,
   // if user has chosen to program individual VF points
 
   //if ((programVfPoints == 0) || (!gActiveCpuData->VfPointsExposed)) 
+  if ((!plan) || (plan->WriteVf))
   {
-
-    //
-    // Convert the desired voltages in OC Mailbox format
-
-    UINT32 targetVoltsFx =
-      (UINT32)cvrt_ovrdvolts_i16_tofix(dom->TargetVolts) & 0xfff;
-
-    UINT32 offsetVoltsFx =
-      (UINT32)cvrt_offsetvolts_i16_tofix(dom->OffsetVolts) & 0x7ff;
-
-    //
-    // Compose the command for the OC mailbox
-
-    data = dom->MaxRatio;
-    data |= (offsetVoltsFx) << 21;
-    data |= ((UINT32)(dom->VoltMode & bit1u8)) << 20;
-    data |= ((UINT32)(targetVoltsFx)) << 8;
+    data = IAPERF_ComposeDomainVF(dom);
     
     cmd = OcMailbox_BuildInterface(0x11, domIdx, 0x0);
 
@@ -288,14 +475,19 @@ EFI_STATUS EFIAPI IAPERF_ProgramDomainVF( IN const UINT8 domIdx,
       dom->OffsetVolts,
       dom->TargetVolts);
 
+    ProbeCache_MarkVf(dom);
+
     if (EFI_ERROR(OcMailbox_ReadWrite(cmd, data, &box))) {
 
       //
       // If we failed here, it is beyond hope
       // (retries already done, etc.) so fail hard
 
+      TrackMailboxStatus(&box, mboxStatus);
       return EFI_ABORTED;
     }
+
+    TrackMailboxStatus(&box, mboxStatus);
   }    
 
   ///////////////
@@ -306,18 +498,13 @@ EFI_STATUS EFIAPI IAPERF_ProgramDomainVF( IN const UINT8 domIdx,
     for (UINT8 vidx = 0; vidx < dom->nVfPoints; vidx++) {
       VF_POINT *vp = dom->vfPoint + vidx;
 
-      if (vp->IsValid) {
-        
-        //
-        // Convert voltage offset to mbox format:
-
-        UINT32 offsetVoltsFx = (UINT32)cvrt_offsetvolts_i16_tofix(
-          vp->VOffset) & 0x7ff;
+      if ((plan) && (!(plan->VfPointMask & (1 << vidx)))) {
+        continue;
+      }
 
-        //
-        // Compose the command for the OC mailbox
+      if (vp->IsValid) {
 
-        data = (offsetVoltsFx) << 21;
+        data = IAPERF_ComposeVfPoint(vp);
 
         MiniTraceEx("Dom: 0x%x, VF Pt. #%u programming: voffset: %d mV",
           domIdx,
@@ -326,6 +513,8 @@ EFI_STATUS EFIAPI IAPERF_ProgramDomainVF( IN const UINT8 domIdx,
 
         cmd = OcMailbox_BuildInterface(0x11, domIdx, vidx + 1);
 
+        ProbeCache_MarkVfPoint(dom, vidx);
+
         if (EFI_ERROR(OcMailbox_ReadWrite(cmd, data, &box))) {
 
           MiniTraceEx("Dom: 0x%x, aborting programming at vfp #%u, err: 0x%x",
@@ -333,8 +522,11 @@ EFI_STATUS EFIAPI IAPERF_ProgramDomainVF( IN const UINT8 domIdx,
             vidx + 1,
             box.status);
 
+          TrackMailboxStatus(&box, mboxStatus);
           return EFI_ABORTED;
         }
+
+        TrackMailboxStatus(&box, mboxStatus);
       }
     }
   }
@@ -27,6 +27,7 @@
 #pragma once
 
 #include "Platform.h"
+#include "Plan.h"
 
 /*******************************************************************************
  * MSRs
@@ -58,7 +59,21 @@
  ******************************************************************************/
 
 EFI_STATUS EFIAPI IAPERF_ProbeDomainVF(
-  IN const UINT8 domain, OUT DOMAIN *desc );
+  IN const UINT8 domain, OUT DOMAIN *desc, 
+  IN const VF_TOPOLOGY* known OPTIONAL );
+
+/*******************************************************************************
+ * IAPERF_RefreshDomainVF
+ * Re-reads only the selected parts of a domain probed before: IccMax, the
+ * domain V/F word and VF points (bit N: vfPoint[N]). Fused data and the 
+ * number of VF points are kept
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI IAPERF_RefreshDomainVF(IN const UINT8 domIdx,
+  IN OUT DOMAIN* dom,
+  IN const BOOLEAN iccMax,
+  IN const BOOLEAN vf,
+  IN const UINT16 vfPointMask);
 
 /*******************************************************************************
  *
@@ -67,7 +82,18 @@ EFI_STATUS EFIAPI IAPERF_ProbeDomainVF(
 EFI_STATUS EFIAPI IAPERF_ProgramDomainVF(IN const UINT8 domIdx,
   IN OUT DOMAIN* dom, 
   IN const UINT8 programVfPoints,
-  IN const UINT8 programIccMax);
+  IN const UINT8 programIccMax,
+  IN const DOMAIN_PLAN* plan OPTIONAL,
+  OUT UINT32* mboxStatus OPTIONAL);
+
+/*******************************************************************************
+ * OC mailbox data words, as written by IAPERF_ProgramDomainVF
+ * (used to compare requested and probed state, see Plan.h)
+ ******************************************************************************/
+
+UINT16 EFIAPI IAPERF_SanitizeIccMax(IN const UINT16 iccMax);
+UINT32 EFIAPI IAPERF_ComposeDomainVF(IN const DOMAIN* dom);
+UINT32 EFIAPI IAPERF_ComposeVfPoint(IN const VF_POINT* vp);
 
 /*******************************************************************************
  *
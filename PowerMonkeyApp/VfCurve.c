@@ -0,0 +1,284 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+
+#include "VfCurve.h"
+#include "CpuData.h"
+#include "MiniLog.h"
+
+/*******************************************************************************
+ * Fixed point
+ * 
+ * Spline math is done in 16.16 fixed point, no FPU state is set up here
+ ******************************************************************************/
+
+#define VFC_ONE                     ((INT64)1 << 16)
+
+static INT64 VfcDivRound(IN const INT64 num, IN const INT64 den)
+{
+  //
+  // den is always positive here
+
+  return (num >= 0) ? ((num + den / 2) / den) : -((-num + den / 2) / den);
+}
+
+/*******************************************************************************
+ * ResolveKnots
+ * 
+ * Replaces VFCURVE_RATIO_MAX with the real ratio and drops knots that do not
+ * move right (e.g. "35x" followed by "max ratio" on a SKU that tops at 30x)
+ ******************************************************************************/
+
+static UINT8 ResolveKnots(
+  IN const VFCURVE* curve,
+  IN const UINT8 maxRatio,
+  OUT INT64* x,
+  OUT INT64* y)
+{
+  UINT8 n = 0;
+  UINT8 nKnots = (curve->nKnots > VFCURVE_MAX_KNOTS) ? 
+    VFCURVE_MAX_KNOTS : curve->nKnots;
+
+  for (UINT8 kidx = 0; kidx < nKnots; kidx++) {
+    
+    const VFCURVE_KNOT* knot = &curve->Knots[kidx];
+
+    INT64 ratio = (knot->Ratio == VFCURVE_RATIO_MAX) ? maxRatio : knot->Ratio;
+
+    if ((n > 0) && (ratio <= x[n - 1])) {
+      continue;
+    }
+
+    x[n] = ratio;
+    y[n] = knot->OffsetMv;
+    n++;
+  }
+
+  return n;
+}
+
+/*******************************************************************************
+ * SplineTangents
+ * 
+ * Fritsch-Carlson: tangents start as the mean of the neighbouring secants
+ * and are limited to 3x the secant, so the curve never overshoots the knots
+ * (an undervolt curve must not get deeper between two points than at them)
+ ******************************************************************************/
+
+static VOID SplineTangents(
+  IN const INT64* x,
+  IN const INT64* y,
+  IN const UINT8 n,
+  OUT INT64* m)
+{
+  INT64 d[VFCURVE_MAX_KNOTS];
+
+  for (UINT8 kidx = 0; kidx + 1 < n; kidx++) {
+    d[kidx] = VfcDivRound((y[kidx + 1] - y[kidx]) * VFC_ONE, 
+      x[kidx + 1] - x[kidx]);
+  }
+
+  m[0] = d[0];
+  m[n - 1] = d[n - 2];
+
+  for (UINT8 kidx = 1; kidx + 1 < n; kidx++) {
+    if ((d[kidx - 1] == 0) || (d[kidx] == 0) ||
+        ((d[kidx - 1] < 0) != (d[kidx] < 0))) {
+      m[kidx] = 0;
+    }
+    else {
+      m[kidx] = (d[kidx - 1] + d[kidx]) / 2;
+    }
+  }
+
+  for (UINT8 kidx = 0; kidx + 1 < n; kidx++) {
+    
+    if (d[kidx] == 0) {
+      m[kidx] = m[kidx + 1] = 0;
+      continue;
+    }
+
+    for (UINT8 eidx = kidx; eidx <= kidx + 1; eidx++) {
+      if (d[kidx] > 0) {
+        m[eidx] = (m[eidx] > 3 * d[kidx]) ? 3 * d[kidx] : m[eidx];
+      }
+      else {
+        m[eidx] = (m[eidx] < 3 * d[kidx]) ? 3 * d[kidx] : m[eidx];
+      }
+    }
+  }
+}
+
+/*******************************************************************************
+ * VfCurve_Evaluate
+ ******************************************************************************/
+
+INT16 EFIAPI VfCurve_Evaluate(
+  IN const VFCURVE* curve,
+  IN const UINT8 ratio,
+  IN const UINT8 maxRatio)
+{
+  INT64 x[VFCURVE_MAX_KNOTS];
+  INT64 y[VFCURVE_MAX_KNOTS];
+  INT64 m[VFCURVE_MAX_KNOTS];
+  UINT8 kidx = 0;
+
+  const UINT8 n = ResolveKnots(curve, maxRatio, x, y);
+
+  if (n == 0) {
+    return 0;
+  }
+
+  //
+  // Held flat outside of the knots
+
+  if (ratio <= x[0]) {
+    return (INT16)y[0];
+  }
+
+  if (ratio >= x[n - 1]) {
+    return (INT16)y[n - 1];
+  }
+
+  while (ratio > x[kidx + 1]) {
+    kidx++;
+  }
+
+  const INT64 h = x[kidx + 1] - x[kidx];
+  const INT64 dx = ratio - x[kidx];
+
+  if ((curve->Interpolation != VFCURVE_SPLINE) || (n < 3)) {
+    return (INT16)(y[kidx] + VfcDivRound((y[kidx + 1] - y[kidx]) * dx, h));
+  }
+
+  //
+  // Cubic Hermite on [x(k), x(k+1)]
+
+  SplineTangents(x, y, n, m);
+
+  const INT64 t = VfcDivRound(dx * VFC_ONE, h);
+  const INT64 t2 = (t * t) / VFC_ONE;
+  const INT64 t3 = (t2 * t) / VFC_ONE;
+
+  const INT64 h00 = 2 * t3 - 3 * t2 + VFC_ONE;
+  const INT64 h10 = t3 - 2 * t2 + t;
+  const INT64 h01 = 3 * t2 - 2 * t3;
+  const INT64 h11 = t3 - t2;
+
+  const INT64 acc = h00 * y[kidx] + h01 * y[kidx + 1] +
+    (h10 * h * m[kidx]) / VFC_ONE + (h11 * h * m[kidx + 1]) / VFC_ONE;
+
+  return (INT16)VfcDivRound(acc, VFC_ONE);
+}
+
+/*******************************************************************************
+ * ClampOffset
+ ******************************************************************************/
+
+static INT16 ClampOffset(IN const INT16 mv)
+{
+  if (mv > VFCURVE_OFFSET_LIMIT) {
+    return VFCURVE_OFFSET_LIMIT;
+  }
+
+  if (mv < -VFCURVE_OFFSET_LIMIT) {
+    return -VFCURVE_OFFSET_LIMIT;
+  }
+
+  return mv;
+}
+
+/*******************************************************************************
+ * DomainMaxRatio
+ ******************************************************************************/
+
+static UINT8 DomainMaxRatio(IN const DOMAIN* dom)
+{
+  UINT8 maxRatio = 0;
+
+  for (UINTN vidx = 0; vidx < dom->nVfPoints; vidx++) {
+    const VF_POINT* vp = &dom->vfPoint[vidx];
+
+    if ((vp->IsValid) && (vp->FusedRatio > maxRatio)) {
+      maxRatio = vp->FusedRatio;
+    }
+  }
+
+  return maxRatio;
+}
+
+/*******************************************************************************
+ * VfCurve_ApplyToDomain
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI VfCurve_ApplyToDomain(
+  IN const VFCURVE* curve,
+  IN OUT DOMAIN* dom)
+{
+  if ((dom->nVfPoints == 0) || (dom->nVfPoints > MAX_VF_POINTS)) {
+    return EFI_NOT_READY;
+  }
+
+  const UINT8 maxRatio = DomainMaxRatio(dom);
+
+  for (UINTN vidx = 0; vidx < dom->nVfPoints; vidx++) {
+
+    VF_POINT* vp = &dom->vfPoint[vidx];
+
+    if (vp->IsValid) {
+      vp->VOffset = ClampOffset(
+        VfCurve_Evaluate(curve, vp->FusedRatio, maxRatio));
+    }
+  }
+
+  return EFI_SUCCESS;
+}
+
+/*******************************************************************************
+ * VfCurve_Apply
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI VfCurve_Apply(
+  IN OUT PACKAGE* pk,
+  IN const UINT8 didx,
+  IN const VFCURVE* curve)
+{
+  DOMAIN* dom = &pk->planes[didx];
+
+  EFI_STATUS status = VfCurve_ApplyToDomain(curve, dom);
+
+  if (EFI_ERROR(status)) {
+    MiniTraceEx("Dom: 0x%x, no VF points to fit the curve to", didx);
+    return status;
+  }
+
+  pk->Program_VF_Overrides[didx] = 1;
+  pk->Program_VF_Points[didx] = 1;
+
+  return EFI_SUCCESS;
+}
@@ -0,0 +1,99 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#pragma once
+
+#include "Platform.h"
+
+/*******************************************************************************
+ * VF curve
+ * 
+ * Describes the wanted voltage offset as a function of the ratio instead of
+ * per VF point - the number of points and their fused ratios differ by SKU,
+ * so a curve can be shared by every machine while the point offsets are 
+ * computed against whatever ratios the probe has found.
+ * 
+ * Knots must be sorted by ratio. Left of the first knot and right of the 
+ * last knot the offset is held flat, so "-80 mV at <=35x, tapering to
+ * -40 mV at max ratio" is written as:
+ * 
+ *   { VFCURVE_LINEAR, 2, { { 35, -80 }, { VFCURVE_RATIO_MAX, -40 } } }
+ ******************************************************************************/
+
+#define VFCURVE_MAX_KNOTS           8
+
+#define VFCURVE_LINEAR              0x00    // Straight lines between knots
+#define VFCURVE_SPLINE              0x01    // Monotone cubic through knots
+
+#define VFCURVE_RATIO_MAX           0xFF    // Highest fused ratio of the dom.
+
+#define VFCURVE_OFFSET_LIMIT        250     // mV, see VoltTables.c
+
+typedef struct _VFCURVE_KNOT
+{
+  UINT8   Ratio;                          // Multiplier or VFCURVE_RATIO_MAX
+  INT16   OffsetMv;                       // in mV (negative = undervolt)
+} VFCURVE_KNOT;
+
+typedef struct _VFCURVE
+{
+  UINT8         Interpolation;            // VFCURVE_LINEAR / VFCURVE_SPLINE
+  UINT8         nKnots;
+  VFCURVE_KNOT  Knots[VFCURVE_MAX_KNOTS];
+} VFCURVE;
+
+/*******************************************************************************
+ * VfCurve_Evaluate
+ * Offset (in mV, not clamped) at the given ratio, maxRatio resolves 
+ * VFCURVE_RATIO_MAX knots
+ ******************************************************************************/
+
+INT16 EFIAPI VfCurve_Evaluate(
+  IN const VFCURVE* curve,
+  IN const UINT8 ratio,
+  IN const UINT8 maxRatio);
+
+/*******************************************************************************
+ * VfCurve_ApplyToDomain
+ * Sets VOffset of every valid VF point of the domain, clamped to +/- 
+ * VFCURVE_OFFSET_LIMIT. Needs a probed domain.
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI VfCurve_ApplyToDomain(
+  IN const VFCURVE* curve,
+  IN OUT DOMAIN* dom);
+
+/*******************************************************************************
+ * VfCurve_Apply
+ * Applies the curve to a domain of the package and enables VF point
+ * programming for it. Domains sharing its VR are brought in line later, by
+ * VrGroups_Coalesce (see VrGroups.h).
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI VfCurve_Apply(
+  IN OUT PACKAGE* pk,
+  IN const UINT8 didx,
+  IN const VFCURVE* curve);
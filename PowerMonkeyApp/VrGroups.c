@@ -0,0 +1,603 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#include <PiPei.h>
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Protocol/MpService.h>
+
+#include "VrGroups.h"
+#include "VFTuning.h"
+#include "CpuData.h"
+#include "LowLevel.h"
+#include "DelayX86.h"
+#include "MpDispatcher.h"
+#include "MiniLog.h"
+
+/*******************************************************************************
+ * Globals
+ ******************************************************************************/
+
+extern UINT8 gVrCoalescePolicy;
+extern UINT8 gVerifyEffectiveVoltage;
+extern UINT16 vrDomainPrStr[8][12];
+
+volatile UINT64 gVrLoadSink = 0;
+
+static const CHAR8* const VrPolicyStr[] = { "off", "min", "max", "error" };
+
+/*******************************************************************************
+ * VrGroups_Build
+ ******************************************************************************/
+
+VOID EFIAPI VrGroups_Build(IN OUT PACKAGE* pk)
+{
+  pk->nVrGroups = 0;
+
+  for (UINT8 didx = 0; didx < MAX_DOMAINS; didx++) {
+    
+    const UINT8 addr = pk->planes[didx].VRaddr;
+    
+    if ((!VoltageDomainExists(didx)) || (addr == INVALID_VR_ADDR)) {
+      continue;
+    }
+
+    VR_GROUP* grp = NULL;
+
+    for (UINT8 gidx = 0; gidx < pk->nVrGroups; gidx++) {
+      if (pk->VrGroup[gidx].VRaddr == addr) {
+        grp = &pk->VrGroup[gidx];
+        break;
+      }
+    }
+
+    if (!grp) {
+      grp = &pk->VrGroup[pk->nVrGroups++];
+      grp->VRaddr = addr;
+      grp->Members = 0;
+      grp->Leader = didx;
+      grp->Conflict = 0;
+    }
+
+    grp->Members |= (UINT8)(1 << didx);
+  }
+}
+
+/*******************************************************************************
+ * Pick
+ ******************************************************************************/
+
+static INT32 Pick(IN const INT32 a, IN const INT32 b, IN OUT BOOLEAN* differs)
+{
+  if (a == b) {
+    return a;
+  }
+
+  *differs = TRUE;
+
+  if (gVrCoalescePolicy == VR_COALESCE_MIN) {
+    return (a < b) ? a : b;
+  }
+
+  return (a > b) ? a : b;
+}
+
+/*******************************************************************************
+ * CoalesceGroup
+ ******************************************************************************/
+
+static VOID CoalesceGroup(IN OUT PACKAGE* pk, IN OUT VR_GROUP* grp)
+{
+  BOOLEAN differs = FALSE;
+  BOOLEAN conflict = FALSE;
+  BOOLEAN seeded = FALSE;
+  BOOLEAN withPoints = FALSE;
+  BOOLEAN withIccMax = FALSE;
+
+  UINT8   voltMode = V_IPOLATIVE;
+  INT32   offsetVolts = 0;
+  INT32   targetVolts = 0;
+  INT32   iccMax = 0;
+  INT32   vfOffset[MAX_VF_POINTS] = { 0 };
+  UINT16  vfMask = 0;
+
+  //
+  // Nothing to do for a group nobody asked to program
+
+  UINT8 requested = 0;
+
+  for (UINT8 didx = 0; didx < MAX_DOMAINS; didx++) {
+    if ((grp->Members & (1 << didx)) && (pk->Program_VF_Overrides[didx])) {
+      requested |= (UINT8)(1 << didx);
+    }
+  }
+
+  if (!requested) {
+    return;
+  }
+
+  for (UINT8 didx = 0; didx < MAX_DOMAINS; didx++) {
+    
+    const DOMAIN* dom = &pk->planes[didx];
+
+    if (!(requested & (1 << didx))) {
+      continue;
+    }
+
+    //
+    // Legacy (whole curve) - override and offset cannot be compared
+
+    if (!seeded) {
+      voltMode = dom->VoltMode;
+      offsetVolts = dom->OffsetVolts;
+      targetVolts = dom->TargetVolts;
+      seeded = TRUE;
+    }
+    else if (dom->VoltMode != voltMode) {
+      conflict = TRUE;
+    }
+    else {
+      offsetVolts = Pick(offsetVolts, dom->OffsetVolts, &differs);
+      targetVolts = Pick(targetVolts, dom->TargetVolts, &differs);
+    }
+
+    //
+    // VF points, matched by index
+
+    if ((pk->Program_VF_Points[didx] == 1) && 
+        (gActiveCpuData->VfPointsExposed == 1)) {
+      
+      withPoints = TRUE;
+
+      for (UINT8 vidx = 0; vidx < dom->nVfPoints; vidx++) {
+
+        if (!dom->vfPoint[vidx].IsValid) {
+          continue;
+        }
+
+        if (vfMask & (1 << vidx)) {
+          vfOffset[vidx] = 
+            Pick(vfOffset[vidx], dom->vfPoint[vidx].VOffset, &differs);
+        }
+        else {
+          vfOffset[vidx] = dom->vfPoint[vidx].VOffset;
+          vfMask |= (UINT16)(1 << vidx);
+        }
+      }
+    }
+
+    //
+    // IccMax
+
+    if (pk->Program_IccMax[didx]) {
+      iccMax = (withIccMax) ? Pick(iccMax, dom->IccMax, &differs) : 
+        dom->IccMax;
+      withIccMax = TRUE;
+    }
+  }
+
+  //
+  // Requests that cannot (or must not) be merged: leave the VR alone
+
+  if ((conflict) || ((differs) && (gVrCoalescePolicy == VR_COALESCE_ERROR))) {
+    
+    AsciiPrint("[ERROR] VR 0x%x: linked domains requested %a settings, "
+      "not programming any of them\n", 
+      grp->VRaddr,
+      (conflict) ? "different voltage modes for" : "different");
+
+    for (UINT8 didx = 0; didx < MAX_DOMAINS; didx++) {
+      if (grp->Members & (1 << didx)) {
+        pk->Program_VF_Overrides[didx] = 0;
+        pk->Program_IccMax[didx] = 0;
+      }
+    }
+
+    grp->Conflict = 1;
+    return;
+  }
+
+  if (differs) {
+    AsciiPrint("[WARNING] VR 0x%x: linked domains requested different "
+      "settings, using %a\n", grp->VRaddr, VrPolicyStr[gVrCoalescePolicy]);
+  }
+
+  //
+  // Same values for every member
+
+  for (UINT8 didx = 0; didx < MAX_DOMAINS; didx++) {
+    
+    DOMAIN* dom = &pk->planes[didx];
+
+    if (!(grp->Members & (1 << didx))) {
+      continue;
+    }
+
+    if (!(requested & (1 << didx))) {
+      MiniTraceEx("Dom: 0x%x, programmed with its VR group 0x%x", 
+        didx, grp->VRaddr);
+    }
+
+    pk->Program_VF_Overrides[didx] = 1;
+
+    dom->VoltMode = voltMode;
+    dom->OffsetVolts = (INT16)offsetVolts;
+    dom->TargetVolts = (UINT16)targetVolts;
+
+    if ((withPoints) && (dom->nVfPoints > 0)) {
+
+      pk->Program_VF_Points[didx] = 1;
+
+      for (UINT8 vidx = 0; vidx < dom->nVfPoints; vidx++) {
+        if (vfMask & (1 << vidx)) {
+          dom->vfPoint[vidx].VOffset = (INT16)vfOffset[vidx];
+        }
+      }
+    }
+
+    //
+    // One IccMax write per VR
+
+    if (didx == grp->Leader) {
+      pk->Program_IccMax[didx] = (UINT8)withIccMax;
+      dom->IccMax = (withIccMax) ? (UINT16)iccMax : dom->IccMax;
+    }
+    else {
+      pk->Program_IccMax[didx] = 0;
+    }
+  }
+}
+
+/*******************************************************************************
+ * VrGroups_Coalesce
+ ******************************************************************************/
+
+VOID EFIAPI VrGroups_Coalesce(IN OUT PLATFORM* sys)
+{
+  if ((gVrCoalescePolicy == VR_COALESCE_OFF) || 
+      (gVrCoalescePolicy > VR_COALESCE_ERROR)) {
+    return;
+  }
+
+  for (UINTN pidx = 0; pidx < sys->PkgCnt; pidx++) {
+
+    PACKAGE* pk = sys->packages + pidx;
+
+    VrGroups_Build(pk);
+
+    for (UINT8 gidx = 0; gidx < pk->nVrGroups; gidx++) {
+
+      VR_GROUP* grp = &pk->VrGroup[gidx];
+
+      //
+      // Single member: nothing to coalesce
+
+      if ((grp->Members & (grp->Members - 1)) == 0) {
+        continue;
+      }
+
+      CoalesceGroup(pk, grp);
+    }
+  }
+}
+
+/*******************************************************************************
+ * VrGroups_ProgramOrder
+ ******************************************************************************/
+
+VOID EFIAPI VrGroups_ProgramOrder(
+  IN const PACKAGE* pk, 
+  OUT UINT8* order)
+{
+  UINT8 done = 0;
+  UINT8 n = 0;
+
+  for (UINT8 didx = 0; didx < MAX_DOMAINS; didx++) {
+
+    if (done & (1 << didx)) {
+      continue;
+    }
+
+    UINT8 members = (UINT8)(1 << didx);
+
+    for (UINT8 gidx = 0; gidx < pk->nVrGroups; gidx++) {
+      if (pk->VrGroup[gidx].Members & (1 << didx)) {
+        members = pk->VrGroup[gidx].Members;
+        break;
+      }
+    }
+
+    for (UINT8 midx = didx; midx < MAX_DOMAINS; midx++) {
+      if (members & (1 << midx)) {
+        order[n++] = midx;
+        done |= (UINT8)(1 << midx);
+      }
+    }
+  }
+}
+
+/*******************************************************************************
+ * PointOffsetAt
+ * Offset of the VF curve at the given ratio, interpolated between points
+ ******************************************************************************/
+
+static INT32 PointOffsetAt(IN const DOMAIN* dom, IN const UINT8 ratio)
+{
+  const VF_POINT* lo = NULL;
+  const VF_POINT* hi = NULL;
+
+  for (UINTN vidx = 0; vidx < dom->nVfPoints; vidx++) {
+    
+    const VF_POINT* vp = &dom->vfPoint[vidx];
+
+    if (!vp->IsValid) {
+      continue;
+    }
+
+    if (vp->FusedRatio <= ratio) {
+      lo = vp;
+    }
+    else if (!hi) {
+      hi = vp;
+    }
+  }
+
+  if ((!lo) && (!hi)) {
+    return 0;
+  }
+
+  if ((!lo) || (!hi) || (hi->FusedRatio == lo->FusedRatio)) {
+    return (lo) ? lo->VOffset : hi->VOffset;
+  }
+
+  return lo->VOffset + ((INT32)(hi->VOffset - lo->VOffset) * 
+    (ratio - lo->FusedRatio)) / (hi->FusedRatio - lo->FusedRatio);
+}
+
+/*******************************************************************************
+ * ExpectedOffset
+ * Legacy offset and VF point offset of IA cores at the given ratio
+ * 
+ * Assumes pcode stacks the two: the legacy offset shifts the whole curve and
+ * VF point offsets are applied on top of it. Nothing in the mailbox confirms
+ * that, so VrGroups_VerifyEffective checks the measured change against each
+ * part alone too (pointsMv receives the VF point part).
+ ******************************************************************************/
+
+static INT16 ExpectedOffset( IN const PACKAGE* pk, 
+                             IN const UINT8 ratio,
+                             OUT INT16* pointsMv )
+{
+  const DOMAIN* dom = &pk->planes[IACORE];
+
+  INT32 offset = (dom->VoltMode == V_IPOLATIVE) ? dom->OffsetVolts : 0;
+  INT32 points = 0;
+
+  if (gActiveCpuData->VfPointsExposed == 1) {
+    points = PointOffsetAt(dom, ratio);
+  }
+
+  *pointsMv = (INT16)points;
+
+  return (INT16)(offset + points);
+}
+
+/*******************************************************************************
+ * ReportOffsetsNotStacked
+ * Out of tolerance with both offsets changed: does the measurement follow 
+ * one of them alone? Then the assumption of ExpectedOffset does not hold
+ ******************************************************************************/
+
+static VOID ReportOffsetsNotStacked( IN const UINTN pidx,
+                                     IN const VR_VOLT_SAMPLE* base,
+                                     IN const VR_VOLT_SAMPLE* eff,
+                                     IN const INT32 measured )
+{
+  const INT32 points = (INT32)eff->PointsMv - (INT32)base->PointsMv;
+  const INT32 legacy = 
+    ((INT32)eff->OffsetMv - (INT32)base->OffsetMv) - points;
+
+  if ((points == 0) || (legacy == 0)) {
+    return;
+  }
+
+  const INT32 devLegacy = measured - legacy;
+  const INT32 devPoints = measured - points;
+
+  if ((devLegacy <= VR_VERIFY_TOLERANCE_MV) && 
+      (devLegacy >= -VR_VERIFY_TOLERANCE_MV)) {
+    AsciiPrint("[VR] Package %u: change follows the legacy offset (%d mV) "
+      "alone, VF point offsets (%d mV) did not add to it\n", 
+      pidx, legacy, points);
+  }
+  else if ((devPoints <= VR_VERIFY_TOLERANCE_MV) && 
+           (devPoints >= -VR_VERIFY_TOLERANCE_MV)) {
+    AsciiPrint("[VR] Package %u: change follows the VF point offsets "
+      "(%d mV) alone, the legacy offset (%d mV) did not add to them\n",
+      pidx, points, legacy);
+  }
+}
+
+/*******************************************************************************
+ * MeasureUnderLoad
+ * 
+ * Integer load on the calling CPU while IA32_PERF_STATUS is sampled. Only
+ * samples taken at the highest ratio seen are kept, so the voltage is the 
+ * one requested for the loaded state.
+ ******************************************************************************/
+
+static VOID EFIAPI MeasureUnderLoad(IN OUT VOID* Buffer)
+{
+  VR_VOLT_SAMPLE* vs = (VR_VOLT_SAMPLE*)Buffer;
+
+  UINT64 mvSum = 0;
+  UINT32 nSamples = 0;
+  UINT8 topRatio = 0;
+  UINT64 x = ReadTsc() | 1;
+
+  const UINT64 end = ReadTsc() + MicroSecondsToTicks(VR_VERIFY_LOAD_US);
+
+  while (ReadTsc() < end) {
+    
+    for (UINT32 iter = 0; iter < 4096; iter++) {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      x *= 0x2545F4914F6CDD1DULL;
+    }
+
+    const UINT64 perfStatus = pm_rdmsr64(MSR_IA32_PERF_STATUS);
+    const UINT8 ratio = (UINT8)((perfStatus >> 8) & 0xFF);
+    
+    //
+    // Voltage is in 1/8192 V units
+
+    const UINT32 mv = (UINT32)((((perfStatus >> 32) & 0xFFFF) * 1000) >> 13);
+
+    if (ratio > topRatio) {
+      topRatio = ratio;
+      mvSum = 0;
+      nSamples = 0;
+    }
+
+    if (ratio == topRatio) {
+      mvSum += mv;
+      nSamples++;
+    }
+  }
+
+  gVrLoadSink ^= x;
+
+  vs->Ratio = topRatio;
+  vs->nSamples = nSamples;
+  vs->Millivolts = (nSamples) ? (UINT16)(mvSum / nSamples) : 0;
+  vs->Valid = (UINT8)((nSamples > 0) && (vs->Millivolts > 0));
+}
+
+/*******************************************************************************
+ * Measure
+ ******************************************************************************/
+
+static VOID Measure(IN PLATFORM* sys, IN PACKAGE* pk, OUT VR_VOLT_SAMPLE* vs)
+{
+  vs->Valid = 0;
+
+  RunOnPackageOrCore(sys, pk->FirstCoreNumber, MeasureUnderLoad, vs);
+
+  vs->VoltMode = pk->planes[IACORE].VoltMode;
+  vs->OffsetMv = ExpectedOffset(pk, vs->Ratio, &vs->PointsMv);
+}
+
+/*******************************************************************************
+ * VrGroups_MeasureBaseline
+ ******************************************************************************/
+
+VOID EFIAPI VrGroups_MeasureBaseline(IN OUT PLATFORM* sys)
+{
+  if (!gVerifyEffectiveVoltage) {
+    return;
+  }
+
+  for (UINTN pidx = 0; pidx < sys->PkgCnt; pidx++) {
+    PACKAGE* pk = sys->packages + pidx;
+    Measure(sys, pk, &pk->VrBaseline);
+  }
+}
+
+/*******************************************************************************
+ * VrGroups_VerifyEffective
+ ******************************************************************************/
+
+VOID EFIAPI VrGroups_VerifyEffective(IN OUT PLATFORM* sys)
+{
+  if (!gVerifyEffectiveVoltage) {
+    return;
+  }
+
+  for (UINTN pidx = 0; pidx < sys->PkgCnt; pidx++) {
+
+    PACKAGE* pk = sys->packages + pidx;
+    const VR_VOLT_SAMPLE* base = &pk->VrBaseline;
+    VR_VOLT_SAMPLE* eff = &pk->VrEffective;
+
+    Measure(sys, pk, eff);
+
+    if ((!base->Valid) || (!eff->Valid)) {
+      AsciiPrint("[VR] Package %u: voltage read-back not available\n", pidx);
+      continue;
+    }
+
+    AsciiPrint("[VR] Package %u: %ux under load, %u mV -> %u mV\n",
+      pidx, eff->Ratio, base->Millivolts, eff->Millivolts);
+
+    //
+    // Override mode: absolute target
+
+    if (eff->VoltMode == V_OVERRIDE) {
+      
+      const INT32 dev = 
+        (INT32)eff->Millivolts - (INT32)pk->planes[IACORE].TargetVolts;
+
+      if ((dev > VR_VERIFY_TOLERANCE_MV) || (dev < -VR_VERIFY_TOLERANCE_MV)) {
+        AsciiPrint("[WARNING] Package %u: target %u mV, effective %u mV\n",
+          pidx, pk->planes[IACORE].TargetVolts, eff->Millivolts);
+      }
+
+      continue;
+    }
+
+    //
+    // Offsets: compare the change, the fused voltage is not known
+
+    if ((base->Ratio != eff->Ratio) || (base->VoltMode != V_IPOLATIVE)) {
+      AsciiPrint("[VR] Package %u: inconclusive (ratio %ux before, %ux "
+        "after)\n", pidx, base->Ratio, eff->Ratio);
+      continue;
+    }
+
+    const INT32 expected = (INT32)eff->OffsetMv - (INT32)base->OffsetMv;
+    const INT32 measured = (INT32)eff->Millivolts - (INT32)base->Millivolts;
+    const INT32 dev = measured - expected;
+
+    if ((dev <= VR_VERIFY_TOLERANCE_MV) && (dev >= -VR_VERIFY_TOLERANCE_MV)) {
+      AsciiPrint("[VR] Package %u: change of %d mV in effect (expected %d mV)"
+        "\n", pidx, measured, expected);
+    }
+    else if ((expected < 0) && (dev > 0)) {
+      AsciiPrint("[WARNING] Package %u: phantom undervolt - programmed %d mV, "
+        "effective change %d mV. Check domains sharing the VR!\n",
+        pidx, expected, measured);
+    }
+    else {
+      AsciiPrint("[WARNING] Package %u: programmed %d mV, effective change "
+        "%d mV\n", pidx, expected, measured);
+    }
+
+    if ((dev > VR_VERIFY_TOLERANCE_MV) || (dev < -VR_VERIFY_TOLERANCE_MV)) {
+      ReportOffsetsNotStacked(pidx, base, eff, measured);
+    }
+  }
+}
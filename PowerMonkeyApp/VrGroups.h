@@ -0,0 +1,93 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#pragma once
+
+#include "Platform.h"
+
+/*******************************************************************************
+ * VR groups
+ * 
+ * Domains reporting the same VR address (see VrTopology.h) share one voltage
+ * regulator - e.g. IACORE and RING on SKL to RKL. If they are programmed
+ * differently, pcode applies the higher voltage to both while the mailbox 
+ * read-back still shows the requested values.
+ * 
+ * VrGroups_Coalesce gives every group a single set of values, chosen by
+ * gVrCoalescePolicy, and propagates it to all members. IccMax is a property
+ * of the VR, so it is written by the group leader only. Members of a group
+ * are programmed back to back (VrGroups_ProgramOrder).
+ * 
+ * With gVerifyEffectiveVoltage, IA32_PERF_STATUS voltage is sampled under 
+ * load before and after programming, a change that does not follow the 
+ * programmed offset (a "phantom undervolt") is reported. The expected change
+ * assumes the legacy offset and VF point offsets add up; if the measurement
+ * follows only one of them, that is reported as well.
+ ******************************************************************************/
+
+#define VR_COALESCE_OFF             0x00    // Program domains as requested
+#define VR_COALESCE_MIN             0x01    // Lowest voltage of the group
+#define VR_COALESCE_MAX             0x02    // Highest (what pcode would use)
+#define VR_COALESCE_ERROR           0x03    // Do not program a group that
+                                            // got different requests
+
+#define MSR_IA32_PERF_STATUS        0x198
+
+#define VR_VERIFY_LOAD_US           200000  // Sampling time (per package)
+#define VR_VERIFY_TOLERANCE_MV      15      // Allowed deviation from offset
+
+/*******************************************************************************
+ * VrGroups_Build
+ * Groups existing domains by VR address, domains without one stay unlinked
+ ******************************************************************************/
+
+VOID EFIAPI VrGroups_Build(IN OUT PACKAGE* pk);
+
+/*******************************************************************************
+ * VrGroups_Coalesce
+ * After ApplyComputerOwnersPolicy, before Plan_Build
+ ******************************************************************************/
+
+VOID EFIAPI VrGroups_Coalesce(IN OUT PLATFORM* sys);
+
+/*******************************************************************************
+ * VrGroups_ProgramOrder
+ * Domain indices in programming order, members of a group adjacent
+ ******************************************************************************/
+
+VOID EFIAPI VrGroups_ProgramOrder(
+  IN const PACKAGE* pk, 
+  OUT UINT8* order);
+
+/*******************************************************************************
+ * VrGroups_MeasureBaseline / VrGroups_VerifyEffective
+ * Before the policy is applied / after re-probing the programmed state.
+ * Both do nothing unless gVerifyEffectiveVoltage is set.
+ ******************************************************************************/
+
+VOID EFIAPI VrGroups_MeasureBaseline(IN OUT PLATFORM* sys);
+
+VOID EFIAPI VrGroups_VerifyEffective(IN OUT PLATFORM* sys);
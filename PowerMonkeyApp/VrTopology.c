@@ -0,0 +1,212 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "VrTopology.h"
+#include "OcMailbox.h"
+#include "CpuData.h"
+#include "NvCache.h"
+#include "MiniLog.h"
+
+/*******************************************************************************
+ * Globals
+ ******************************************************************************/
+
+extern UINT8 gCacheVrTopology;
+
+#define VR_MAP_VAR_NAME             L"PowerMonkeyVrMap"
+#define VR_MAP_VERSION              1
+
+typedef struct _VR_MAP {
+  UINT8   VRaddr[MAX_DOMAINS];
+  UINT8   VRtype[MAX_DOMAINS];
+} VR_MAP;
+
+/*******************************************************************************
+ * DiscoverVRTopology
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI DiscoverVRTopology(IN OUT PACKAGE* pkg)
+{
+  EFI_STATUS status = EFI_SUCCESS;
+
+  if (pkg->VrTopologySource == VR_TOPOLOGY_CACHED) {
+    return EFI_SUCCESS;
+  }
+
+  //
+  // We can use OC Mailbox Function 0x04 only if we:
+  //   a) know how to parse the result
+  // and
+  //   b) CPU actually supports this
+  //
+
+  MiniTraceEx("Detecting VR Topology");
+
+  pkg->VrTopologySource = VR_TOPOLOGY_NONE;
+
+  BOOLEAN anyProbed = FALSE;
+
+  for (UINTN didx = 0; didx < MAX_DOMAINS; didx++) {
+
+    DOMAIN* dom = &pkg->planes[didx];
+
+    dom->VRaddr = INVALID_VR_ADDR;
+    dom->VRtype = NO_SVID_VR;
+
+    if (gActiveCpuData->vtdt) {
+
+      const VOLTPLANEDESC* vguide = &gActiveCpuData->vtdt->doms[didx];
+
+      if (!vguide->DomainExists) {
+        MiniTraceEx("Skipping nonexistent voltage domain 0x%x", didx);
+      }
+      else if (!vguide->DomainSupportedForDiscovery) {
+
+        //
+        // Domain cannot be probed by OC Mailbox
+        // This means either incomplete info, 
+        // or BIOS PCODE Mailbox must be used
+
+        MiniTraceEx("Domain 0x%x cannot be probed using OC Mailbox", didx);
+      }
+      else {
+        anyProbed = TRUE;
+      }
+    }
+  }
+
+  if (!gActiveCpuData->vtdt) {
+    MiniTraceEx("CPU information does not contain VR Topology discovery information");
+    return EFI_SUCCESS;
+  }
+
+  if (!anyProbed) {
+    return EFI_SUCCESS;
+  }
+
+  //
+  // Use command 0x04 to obtain VR info - one word describes all domains
+
+  CpuMailbox box;
+
+  OcMailbox_InitializeAsMSR(&box);
+  UINT32 cmd = OcMailbox_BuildInterface(OC_CMD_GET_VR_TOPOLOGY, 0x0, 0x0);
+  status = OcMailbox_ReadWrite(cmd, 0, &box);
+
+  if ((EFI_ERROR(status)) || (box.status != 0)) {
+    return status;
+  }
+
+  const UINT32 data = box.b.box.data;
+
+  for (UINTN didx = 0; didx < MAX_DOMAINS; didx++) {
+
+    const VOLTPLANEDESC* vguide = &gActiveCpuData->vtdt->doms[didx];
+
+    if ((vguide->DomainExists) && (vguide->DomainSupportedForDiscovery)) {
+
+      DOMAIN* dom = &pkg->planes[didx];
+
+      const UINT32 amask  = vguide->OCMB_VRAddr_DomainBitMask;
+      const UINT32 tmask  = vguide->OCMB_VRsvid_DomainBitMask;
+      const UINT32 ashift = vguide->OCMB_VRAddr_DomainBitShift;
+
+      dom->VRaddr = (UINT8)((data & amask) >> ashift);
+      dom->VRtype = (UINT8)((data & tmask) ? NO_SVID_VR : SVID_VR);
+    }
+  }
+
+  pkg->VrTopologySource = VR_TOPOLOGY_DISCOVERED;
+
+  return status;
+}
+
+/*******************************************************************************
+ * VrTopology_LoadCached
+ ******************************************************************************/
+
+VOID EFIAPI VrTopology_LoadCached(IN OUT PLATFORM* sys)
+{
+  VR_MAP map;
+
+  if ((!gCacheVrTopology) || (!gActiveCpuData->vtdt)) {
+    return;
+  }
+
+  if (EFI_ERROR(NvCache_Load(VR_MAP_VAR_NAME, VR_MAP_VERSION, gCpuInfo.f1,
+                             &map, sizeof(VR_MAP)))) {
+    return;
+  }
+
+  for (UINTN pidx = 0; pidx < sys->PkgCnt; pidx++) {
+
+    PACKAGE* pkg = sys->packages + pidx;
+
+    for (UINTN didx = 0; didx < MAX_DOMAINS; didx++) {
+      pkg->planes[didx].VRaddr = map.VRaddr[didx];
+      pkg->planes[didx].VRtype = map.VRtype[didx];
+    }
+
+    pkg->VrTopologySource = VR_TOPOLOGY_CACHED;
+  }
+}
+
+/*******************************************************************************
+ * VrTopology_StoreCached
+ ******************************************************************************/
+
+VOID EFIAPI VrTopology_StoreCached(IN PLATFORM* sys)
+{
+  VR_MAP map;
+
+  if ((!gCacheVrTopology) || (!sys->PkgCnt)) {
+    return;
+  }
+
+  //
+  // Only a map actually read from the mailbox is worth keeping 
+  // (all packages are the same model)
+
+  const PACKAGE* pkg = sys->packages;
+
+  if (pkg->VrTopologySource != VR_TOPOLOGY_DISCOVERED) {
+    return;
+  }
+
+  SetMem(&map, sizeof(VR_MAP), 0);
+
+  for (UINTN didx = 0; didx < MAX_DOMAINS; didx++) {
+    map.VRaddr[didx] = pkg->planes[didx].VRaddr;
+    map.VRtype[didx] = pkg->planes[didx].VRtype;
+  }
+
+  NvCache_Store(VR_MAP_VAR_NAME, VR_MAP_VERSION, gCpuInfo.f1, 
+    &map, sizeof(VR_MAP));
+}
@@ -0,0 +1,66 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#pragma once
+
+#include "Platform.h"
+
+/*******************************************************************************
+ * VR topology
+ * 
+ * OC mailbox command 0x04 returns the VR address and SVID capability of all
+ * voltage domains in a single data word, DiscoverVRTopology reads it once 
+ * per package and decodes every domain from it (see VOLTCFGTEMPLATE).
+ * 
+ * The decoded map depends on the CPU model only, so it is kept in a UEFI
+ * variable keyed by the CPUID signature - later boots take it from there 
+ * and skip the discovery altogether
+ ******************************************************************************/
+
+#define VR_TOPOLOGY_NONE            0x00    // Unknown, domains left invalid
+#define VR_TOPOLOGY_DISCOVERED      0x01    // Read from the OC mailbox
+#define VR_TOPOLOGY_CACHED          0x02    // Restored from NVRAM
+
+/*******************************************************************************
+ * DiscoverVRTopology
+ * Does nothing if the package has got its map from the cache
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI DiscoverVRTopology(IN OUT PACKAGE* pkg);
+
+/*******************************************************************************
+ * VrTopology_LoadCached
+ * BSP only, before the packages are probed
+ ******************************************************************************/
+
+VOID EFIAPI VrTopology_LoadCached(IN OUT PLATFORM* sys);
+
+/*******************************************************************************
+ * VrTopology_StoreCached
+ * BSP only, after the packages have been probed
+ ******************************************************************************/
+
+VOID EFIAPI VrTopology_StoreCached(IN PLATFORM* sys);
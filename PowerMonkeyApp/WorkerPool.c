@@ -0,0 +1,522 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#include <PiPei.h>
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+
+//
+// Protocols
+
+#include <Protocol/MpService.h>
+
+#if defined(__clang__)
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+#include <x86intrin.h>
+#else
+#pragma intrinsic(_mm_pause)
+#endif
+
+//
+// PowerMonkey
+
+#include "WorkerPool.h"
+#include "LowLevel.h"
+#include "DelayX86.h"
+#include "PerCpu.h"
+#include "Topology.h"
+#include "Profile.h"
+#include "MiniLog.h"
+
+//
+// Initialized at startup
+
+extern EFI_MP_SERVICES_PROTOCOL* gMpServices;
+extern EFI_BOOT_SERVICES* gBS;
+
+/*******************************************************************************
+ * Internal state
+ ******************************************************************************/
+
+#define WP_CACHE_LINE         64
+#define WP_STARTUP_TIMEOUT_US 1000000
+#define WP_STOP_TIMEOUT_US    1000000
+
+typedef struct _WORKER_POOL
+{
+  BOOLEAN       Active;
+  UINTN         NumSlots;
+  UINTN         BootProcessor;
+  WORKER_SLOT*  Slots;                      // Cache-line aligned
+  VOID*         RawAlloc;                   // As returned by AllocatePool
+  EFI_EVENT     Event;                      // Signaled when all APs returned
+} WORKER_POOL;
+
+static WORKER_POOL gPool = { 0 };
+
+/*******************************************************************************
+ * WorkerPool_ApMain
+ * 
+ * Runs on every AP for the lifetime of the pool
+ ******************************************************************************/
+
+VOID EFIAPI WorkerPool_ApMain(VOID* params)
+{
+  PMUNUSED(params);
+
+  UINTN processorNumber = 0;
+
+  gMpServices->WhoAmI(gMpServices, &processorNumber);
+
+  if (processorNumber >= gPool.NumSlots) {
+    return;
+  }
+
+  WORKER_SLOT* slot = gPool.Slots + processorNumber;
+
+  //
+  // One-time setup (what ProcessorIgnite does on every call)
+
+  CPUCORE* core = (CPUCORE*)gCorePtrs[processorNumber];
+
+  if (core) {
+    PerCpu_Bind(core);
+
+    PROFILE_BEGIN(tProbe);
+    GetCpuInfo(&core->CpuInfo);
+    core->IsECore = core->CpuInfo.ECore;
+    Topology_ProbeThisCpu(core);
+    PROFILE_END(tProbe, "Core: CPU info probe");
+    core->Hot->ValidateIdx = (UINT32)processorNumber;
+  }
+
+  slot->State = WP_STATE_READY;
+
+  //
+  // Park
+
+  for (;;) {
+
+    UINT32 cmd = slot->Command;
+
+    if (cmd == WP_CMD_IDLE) {
+      _mm_pause();
+      continue;
+    }
+
+    if (cmd == WP_CMD_EXIT) {
+      break;
+    }
+
+    if (slot->CoreProc) {
+      const EFI_STATUS status = slot->CoreProc(slot->Result, slot->Param);
+
+      if (core) {
+        core->Hot->LastStatus = status;
+      }
+
+      //
+      // The BSP may have given up on this job (and released the results)
+
+      CORE_RESULT* result = slot->Result;
+
+      if (result) {
+        result->Status = status;
+        result->Completed = 1;
+      }
+    }
+    else if (slot->Proc) {
+      slot->Proc(slot->Param);
+    }
+
+    //
+    // Make results visible before reporting completion
+
+    MemoryFence();
+    slot->Command = WP_CMD_IDLE;
+  }
+
+  slot->State = WP_STATE_OFFLINE;
+  MemoryFence();
+  slot->Command = WP_CMD_IDLE;
+}
+
+/*******************************************************************************
+ * WorkerPool_IsActive
+ ******************************************************************************/
+
+BOOLEAN EFIAPI WorkerPool_IsActive(VOID)
+{
+  return gPool.Active;
+}
+
+/*******************************************************************************
+ * WorkerPool_Post
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI WorkerPool_Post(
+  IN const UINTN CpuNumber,
+  IN const EFI_AP_PROCEDURE proc OPTIONAL,
+  IN const CORE_PROCEDURE coreProc OPTIONAL,
+  IN VOID* param OPTIONAL,
+  IN OUT CORE_RESULT* result OPTIONAL)
+{
+  if ((!gPool.Active) || (CpuNumber >= gPool.NumSlots) ||
+      (CpuNumber == gPool.BootProcessor)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if ((coreProc) && (!result)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  WORKER_SLOT* slot = gPool.Slots + CpuNumber;
+
+  if (slot->State != WP_STATE_READY) {
+    return EFI_NOT_READY;
+  }
+
+  //
+  // Previous job must be finished before the slot can be reused
+
+  EFI_STATUS status = WorkerPool_Wait(CpuNumber, WP_JOB_TIMEOUT_US);
+
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+
+  slot->Proc = proc;
+  slot->CoreProc = coreProc;
+  slot->Param = param;
+  slot->Result = result;
+
+  MemoryFence();
+  slot->Command = WP_CMD_RUN;
+
+  return EFI_SUCCESS;
+}
+
+/*******************************************************************************
+ * WorkerPool_Wait
+ ******************************************************************************/
+
+/*******************************************************************************
+ * WaitSlot
+ * deadline: TSC value, 0 for no limit
+ ******************************************************************************/
+
+static EFI_STATUS WaitSlot(IN const UINTN CpuNumber, IN const UINT64 deadline)
+{
+  if ((!gPool.Slots) || (CpuNumber >= gPool.NumSlots)) {
+    return EFI_SUCCESS;
+  }
+
+  WORKER_SLOT* slot = gPool.Slots + CpuNumber;
+
+  //
+  // Timed out before: do not wait for it again
+
+  if ((slot->State == WP_STATE_HUNG) && (slot->Command != WP_CMD_IDLE)) {
+    return EFI_TIMEOUT;
+  }
+
+  //
+  // BSP is idle here anyway - use it to render what the APs traced
+
+  while (slot->Command != WP_CMD_IDLE) {
+
+    DrainTrace();
+    _mm_pause();
+
+    if ((deadline) && (ReadTsc() > deadline) && 
+        (slot->Command != WP_CMD_IDLE)) {
+
+      CORE_RESULT* result = slot->Result;
+
+      slot->Result = NULL;
+      slot->State = WP_STATE_HUNG;
+
+      if ((result) && (!result->Completed)) {
+        result->Status = EFI_TIMEOUT;
+      }
+
+      MiniTraceEx("CPU %u: job timed out, AP no longer used", CpuNumber);
+      Print(L"[ERROR] CPU %u did not complete its job in time\n", CpuNumber);
+
+      return EFI_TIMEOUT;
+    }
+  }
+
+  MemoryFence();
+
+  return EFI_SUCCESS;
+}
+
+/*******************************************************************************
+ * WorkerPool_Wait
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI WorkerPool_Wait(
+  IN const UINTN CpuNumber, 
+  IN const UINT64 TimeoutUs)
+{
+  const UINT64 deadline = 
+    (TimeoutUs) ? ReadTsc() + MicroSecondsToTicks(TimeoutUs) : 0;
+
+  return WaitSlot(CpuNumber, deadline);
+}
+
+/*******************************************************************************
+ * WorkerPool_PostAll
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI WorkerPool_PostAll(
+  IN const EFI_AP_PROCEDURE proc,
+  IN VOID* param OPTIONAL)
+{
+  EFI_STATUS status = EFI_SUCCESS;
+
+  if (!gPool.Active) {
+    return EFI_NOT_READY;
+  }
+
+  for (UINTN cidx = 0; cidx < gPool.NumSlots; cidx++) {
+
+    if ((cidx == gPool.BootProcessor) || 
+        (gPool.Slots[cidx].State != WP_STATE_READY)) {
+      continue;
+    }
+
+    EFI_STATUS apStatus = WorkerPool_Post(cidx, proc, NULL, param, NULL);
+
+    if (EFI_ERROR(apStatus)) {
+      status = apStatus;
+    }
+  }
+
+  return status;
+}
+
+/*******************************************************************************
+ * WorkerPool_WaitAll
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI WorkerPool_WaitAll(IN const UINT64 TimeoutUs)
+{
+  EFI_STATUS status = EFI_SUCCESS;
+
+  //
+  // Jobs were posted together, so they share one deadline
+
+  const UINT64 deadline = 
+    (TimeoutUs) ? ReadTsc() + MicroSecondsToTicks(TimeoutUs) : 0;
+
+  for (UINTN cidx = 0; cidx < gPool.NumSlots; cidx++) {
+
+    EFI_STATUS apStatus = WaitSlot(cidx, deadline);
+
+    if (EFI_ERROR(apStatus)) {
+      status = apStatus;
+    }
+  }
+
+  //
+  // Render the tail traced after the last slot went idle
+
+  DrainTrace();
+
+  return status;
+}
+
+/*******************************************************************************
+ * WorkerPool_Start
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI WorkerPool_Start(IN PLATFORM* Platform)
+{
+  EFI_STATUS status = EFI_SUCCESS;
+
+  if ((!gMpServices) || (gPool.Active)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  if (Platform->EnabledLogicalProcessors < 2) {
+    return EFI_UNSUPPORTED;
+  }
+
+  //
+  // One cache line per CPU, so that APs spinning on their own slot 
+  // do not disturb each other (or the BSP writing to another slot)
+
+  gPool.NumSlots = Platform->LogicalProcessors;
+  gPool.BootProcessor = Platform->BootProcessor;
+  gPool.RawAlloc = AllocateZeroPool(
+    gPool.NumSlots * sizeof(WORKER_SLOT) + WP_CACHE_LINE);
+
+  if (!gPool.RawAlloc) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  gPool.Slots = (WORKER_SLOT*)(((UINTN)gPool.RawAlloc + WP_CACHE_LINE - 1) & 
+    ~((UINTN)WP_CACHE_LINE - 1));
+
+  //
+  // NOTE: WaitForEvent() refuses EVT_NOTIFY_SIGNAL events, 
+  // so this has to be a plain (type 0) event
+
+  status = gBS->CreateEvent(0, TPL_NOTIFY, NULL, NULL, &gPool.Event);
+
+  if (!EFI_ERROR(status)) {
+    status = gMpServices->StartupAllAPs(
+      gMpServices,
+      WorkerPool_ApMain,
+      FALSE,
+      gPool.Event,
+      0,
+      NULL,
+      NULL
+    );
+
+    if (EFI_ERROR(status)) {
+      gBS->CloseEvent(gPool.Event);
+    }
+  }
+
+  if (EFI_ERROR(status)) {
+    FreePool(gPool.RawAlloc);
+    ZeroMem(&gPool, sizeof(gPool));
+    return status;
+  }
+
+  gPool.Active = TRUE;
+
+  //
+  // Wait for all enabled APs to park
+
+  UINTN expected = Platform->EnabledLogicalProcessors - 1;
+  UINTN ready = 0;
+
+  for (UINTN us = 0; us < WP_STARTUP_TIMEOUT_US; us++) {
+
+    ready = 0;
+
+    for (UINTN cidx = 0; cidx < gPool.NumSlots; cidx++) {
+      if (gPool.Slots[cidx].State == WP_STATE_READY) {
+        ready++;
+      }
+    }
+
+    if (ready >= expected) {
+      break;
+    }
+
+    MicroStall(1);
+  }
+
+  if (ready < expected) {
+
+    //
+    // Missing APs cannot be reached through the pool - rather than
+    // silently skipping them later, give up and let the dispatcher
+    // use MP services as before
+
+    Print(L"[ERROR] Worker pool: only %u of %u APs responded\n", 
+      ready, expected);
+
+    WorkerPool_Stop();
+
+    return EFI_TIMEOUT;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/*******************************************************************************
+ * WorkerPool_Stop
+ ******************************************************************************/
+
+VOID EFIAPI WorkerPool_Stop(VOID)
+{
+  if (!gPool.Active) {
+    return;
+  }
+
+  gPool.Active = FALSE;
+
+  //
+  // Keep telling parked APs to leave until all of them have returned from
+  // WorkerPool_ApMain (event signaled) - this also catches late starters
+  // that parked after WorkerPool_Start() gave up waiting for them
+
+  BOOLEAN stopped = FALSE;
+
+  for (UINTN us = 0; us < WP_STOP_TIMEOUT_US; us++) {
+
+    for (UINTN cidx = 0; cidx < gPool.NumSlots; cidx++) {
+
+      WORKER_SLOT* slot = gPool.Slots + cidx;
+
+      //
+      // Hung APs too, once (if ever) they are done with their job
+
+      if ((slot->State != WP_STATE_OFFLINE) && 
+          (slot->Command == WP_CMD_IDLE)) {
+        slot->Command = WP_CMD_EXIT;
+      }
+    }
+
+    if (gBS->CheckEvent(gPool.Event) != EFI_NOT_READY) {
+      stopped = TRUE;
+      break;
+    }
+
+    MicroStall(1);
+  }
+
+  //
+  // An AP stuck in a procedure may still touch its slot, and MP services 
+  // will signal the event once it returns: keep both, just stop using them
+
+  if (!stopped) {
+    Print(L"[ERROR] Worker pool: APs did not return, MP services stay "
+      "busy\n");
+    return;
+  }
+
+  //
+  // MP services are usable again
+
+  gBS->CloseEvent(gPool.Event);
+
+  FreePool(gPool.RawAlloc);
+  ZeroMem(&gPool, sizeof(gPool));
+}
@@ -0,0 +1,126 @@
+/*******************************************************************************
+*  ______                            ______                 _
+* (_____ \                          |  ___ \               | |
+*  _____) )___   _ _ _   ____   ___ | | _ | |  ___   ____  | |  _  ____  _   _
+* |  ____// _ \ | | | | / _  ) / __)| || || | / _ \ |  _ \ | | / )/ _  )| | | |
+* | |    | |_| || | | |( (/ / | |   | || || || |_| || | | || |< (( (/ / | |_| |
+* |_|     \___/  \____| \____)|_|   |_||_||_| \___/ |_| |_||_| \_)\____) \__  |
+*                                                                       (____/
+* Copyright (C) 2021-2022 Ivan Dimkovic. All rights reserved.
+*
+* All trademarks, logos and brand names are the property of their respective
+* owners. All company, product and service names used are for identification
+* purposes only. Use of these names, trademarks and brands does not imply
+* endorsement.
+*
+* SPDX-License-Identifier: Apache-2.0
+* Full text of the license is available in project root directory (LICENSE)
+*
+* WARNING: This code is a proof of concept for educative purposes. It can
+* modify internal computer configuration parameters and cause malfunctions or
+* even permanent damage. It has been tested on a limited range of target CPUs
+* and has minimal built-in failsafe mechanisms, thus making it unsuitable for
+* recommended use by users not skilled in the art. Use it at your own risk.
+*
+*******************************************************************************/
+
+#pragma once
+
+#include "Platform.h"
+#include "MpDispatcher.h"
+
+/*******************************************************************************
+ * Worker pool
+ * 
+ * APs are started once (non-blocking StartupAllAPs), set up their GS base and
+ * CPUINFO a single time and then spin on their own command slot. Dispatching 
+ * work to a parked AP is a single store, completion is signaled by the AP 
+ * clearing the slot. While the pool is active, MP protocol cannot be used for
+ * anything else, so MpDispatcher routes all its calls through the pool.
+ ******************************************************************************/
+
+#define WP_CMD_IDLE         0
+#define WP_CMD_RUN          1
+#define WP_CMD_EXIT         2
+
+#define WP_STATE_OFFLINE    0
+#define WP_STATE_READY      1
+#define WP_STATE_HUNG       2               // Job timed out, set by the BSP,
+                                            // never posted to again
+
+//
+// Budget of a single dispatched job (same as StartupThisAP calls used), 0 is
+// no limit (as StartupAllAPs calls used)
+
+#define WP_JOB_TIMEOUT_US   1000000
+
+typedef struct _WORKER_SLOT
+{
+  volatile UINT32   Command;                // WP_CMD_*, written by the BSP,
+                                            // cleared by the AP when done
+  volatile UINT32   State;                  // WP_STATE_*, written by the AP
+  EFI_AP_PROCEDURE  Proc;
+  CORE_PROCEDURE    CoreProc;
+  VOID*             Param;
+  CORE_RESULT* volatile Result;             // Detached (NULL) on timeout
+  UINT8             pad[24];                // One slot per cache line
+} WORKER_SLOT;
+
+/*******************************************************************************
+ * WorkerPool_Start
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI WorkerPool_Start(IN PLATFORM* Platform);
+
+/*******************************************************************************
+ * WorkerPool_Stop
+ * Releases the parked APs, gives up after a second if some do not return 
+ * (the pool is then inactive, but MP services stay busy)
+ ******************************************************************************/
+
+VOID EFIAPI WorkerPool_Stop(VOID);
+
+/*******************************************************************************
+ * WorkerPool_IsActive
+ ******************************************************************************/
+
+BOOLEAN EFIAPI WorkerPool_IsActive(VOID);
+
+/*******************************************************************************
+ * WorkerPool_Post
+ * Hands a job to the parked AP, returns without waiting for it to complete.
+ * Exactly one of proc or coreProc is used (coreProc if supplied, with result)
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI WorkerPool_Post(
+  IN const UINTN CpuNumber,
+  IN const EFI_AP_PROCEDURE proc OPTIONAL,
+  IN const CORE_PROCEDURE coreProc OPTIONAL,
+  IN VOID* param OPTIONAL,
+  IN OUT CORE_RESULT* result OPTIONAL
+);
+
+/*******************************************************************************
+ * WorkerPool_Wait
+ * Waits until the AP has finished its current job, at most TimeoutUs (0: no
+ * limit). On timeout the slot is marked WP_STATE_HUNG, EFI_TIMEOUT goes to 
+ * its CORE_RESULT (if any) and is returned, the AP keeps running whatever it
+ * got stuck in
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI WorkerPool_Wait(
+  IN const UINTN CpuNumber, 
+  IN const UINT64 TimeoutUs
+);
+
+/*******************************************************************************
+ * WorkerPool_PostAll / WorkerPool_WaitAll
+ * Same as above, for all parked APs
+ ******************************************************************************/
+
+EFI_STATUS EFIAPI WorkerPool_PostAll(
+  IN const EFI_AP_PROCEDURE proc,
+  IN VOID* param OPTIONAL
+);
+
+EFI_STATUS EFIAPI WorkerPool_WaitAll(IN const UINT64 TimeoutUs);